@@ -0,0 +1,271 @@
+/* codec.c - BookSeats parsing and number formatting benchmark
+	ITA: confronta il percorso precedente (ricerca di "\r\n", strtok,
+		strtoull, array dei posti allungato con una realloc per posto,
+		itos con una divisione per cifra) con reqparse e numfmt, su
+		prenotazioni di gruppo da 10k posti. La richiesta è copiata
+		prima di ogni iterazione in entrambi i casi, strtok la modifica.
+		reqparse è misurato sia con la richiesta intera sia a blocchi
+		da 4096 bytes, come la riceve il server.
+
+	usage: bench/codec [seats [iterations]]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "../server/malloc_utils.h"
+#include "../server/reqparse.h"
+#include "../server/numfmt.h"
+
+#define BENCH_ROWS 1000
+#define BENCH_POLS 1000
+#define BENCH_CHUNK 4096
+
+typedef unsigned long long ulong64;
+
+/* NOT exposed */
+static double __bench_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* --- previous implementation --- */
+
+static int __legacy_dgt(unsigned j) {
+	int i = 0;
+
+	while (j) {
+		j /= 10;
+		i++;
+	}
+
+	return i;
+}
+
+static int __legacy_itos(unsigned n, char* out) {
+	int slen = __legacy_dgt(n);
+	for (int i = slen - 1; n; --i) {
+		out[i] = (n % 10) + 48;
+		n /= 10;
+	}
+
+	return slen;
+}
+
+static int __legacy_stoull(const char* s, ulong64* res) {
+	char* end = NULL;
+	errno = 0;
+	*res = strtoull(s, &end, 10);
+	return *end != 0 || errno;
+}
+
+/* returns the number of seats, 0 on any error */
+static unsigned __legacy_parse(char* req, unsigned len, unsigned** out) {
+	long termpos = -1;
+	for(unsigned i = 0; i < len - 1; ++i) {
+		if(req[i] == '\r' && req[i + 1] == '\n') {
+			termpos = i + 1;
+			break;
+		}
+	}
+
+	if(termpos < 0 || strncmp(req, "BookSeats", 9) != 0)
+		return 0;
+
+	char* endat = req + termpos;
+	*(endat - 1) = 0;
+
+	unsigned n_bookings = 0;
+	unsigned* to_book = (unsigned*) malloc(sizeof(unsigned));
+	malloc_check_exit_on_error(to_book);
+
+	char* tok = strtok(req + 9, ",");
+	while(tok && tok < endat) {
+		char* prevtok = tok;
+		tok = strtok(NULL, ",");
+
+		ulong64 x;
+		ulong64 y;
+		if(tok == NULL || __legacy_stoull(prevtok, &x) || __legacy_stoull(tok, &y) ||
+				x == 0 || y == 0 || x > BENCH_ROWS || y > BENCH_POLS) {
+			free(to_book);
+			return 0;
+		}
+
+		to_book[n_bookings++] = (unsigned) (x - 1) * BENCH_POLS + (unsigned) (y - 1);
+		to_book = (unsigned*) realloc(to_book, sizeof(unsigned) * (n_bookings + 1));
+		malloc_check_exit_on_error(to_book);
+
+		tok = strtok(NULL, ",");
+	}
+
+	*out = to_book;
+	return n_bookings;
+}
+
+/* --- reqparse --- */
+
+/* same validation as op_book_seats, ids into a preallocated list */
+static unsigned __fast_parse(reqparse* rp, const char* req, unsigned len, unsigned chunk, unsigned* to_book) {
+	unsigned pos = 0;
+	int rv = REQPARSE_NEED_MORE;
+
+	while(pos < len && rv == REQPARSE_NEED_MORE) {
+		unsigned n = len - pos < chunk ? len - pos : chunk;
+		unsigned consumed = 0;
+		rv = reqparse_feed(rp, req + pos, n, &consumed);
+		pos += consumed;
+	}
+
+	unsigned n_bookings = rp->n_values >> 1;
+	if(rv != REQPARSE_DONE || rp->error != REQPARSE_ERR_NONE || (rp->n_values & 1))
+		n_bookings = 0;
+
+	for(unsigned i = 0; i < n_bookings; ++i) {
+		unsigned x = rp->values[i << 1];
+		unsigned y = rp->values[(i << 1) + 1];
+
+		if(x == 0 || y == 0 || x > BENCH_ROWS || y > BENCH_POLS) {
+			n_bookings = 0;
+			break;
+		}
+
+		to_book[i] = (x - 1) * BENCH_POLS + (y - 1);
+	}
+
+	reqparse_next(rp);
+	return n_bookings;
+}
+
+static char* __bench_request(unsigned seats, unsigned* out_len) {
+	char* req = (char*) malloc(9 + (unsigned long) seats * 2 * (NUMFMT_UINT_MAX_DIGITS + 1) + 2);
+	malloc_check_exit_on_error(req);
+
+	unsigned len = 9;
+	memcpy(req, "BookSeats", 9);
+
+	//spread over the hall, both coordinates up to 4 digits
+	for(unsigned i = 0; i < seats; ++i) {
+		unsigned id = (unsigned) (((unsigned long) i * 7919) % (BENCH_ROWS * BENCH_POLS));
+		len += numfmt_utoa(id / BENCH_POLS + 1, req + len);
+		req[len++] = ',';
+		len += numfmt_utoa(id % BENCH_POLS + 1, req + len);
+		req[len++] = ',';
+	}
+
+	req[len - 1] = '\r';
+	req[len++] = '\n';
+
+	*out_len = len;
+	return req;
+}
+
+static void __bench_report(const char* name, double secs, unsigned iters, unsigned seats, unsigned len) {
+	printf("%-28s %10.1f us/request %8.2f ns/seat %8.1f MB/s\n", name,
+			secs / iters * 1e6, secs / iters / seats * 1e9, (double) len * iters / secs / 1e6);
+}
+
+int main(int argc, char** argv) {
+	unsigned seats = argc > 1 ? (unsigned) strtoul(argv[1], NULL, 10) : 10000;
+	unsigned iters = argc > 2 ? (unsigned) strtoul(argv[2], NULL, 10) : 500;
+
+	if(seats == 0 || iters == 0 || seats > BENCH_ROWS * BENCH_POLS) {
+		fprintf(stderr, "usage: %s [seats [iterations]]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	unsigned len;
+	char* req = __bench_request(seats, &len);
+	char* work = (char*) malloc(len);
+	malloc_check_exit_on_error(work);
+
+	unsigned* to_book = (unsigned*) malloc(sizeof(unsigned) * seats);
+	malloc_check_exit_on_error(to_book);
+
+	reqparse rp;
+	reqparse_init(&rp, (seats + 1) << 1, len);
+
+	printf("BookSeats with %u seats, %u bytes, %u iterations, reqparse: %s\n", 
+			seats, len, iters, reqparse_simd_name());
+
+	//results must agree before anything is timed
+	unsigned* legacy_ids = NULL;
+	memcpy(work, req, len);
+	unsigned n_legacy = __legacy_parse(work, len, &legacy_ids);
+	unsigned n_fast = __fast_parse(&rp, req, len, BENCH_CHUNK, to_book);
+	if(n_legacy != seats || n_fast != seats || memcmp(legacy_ids, to_book, sizeof(unsigned) * seats)) {
+		fprintf(stderr, "parsers disagree: %u %u\n", n_legacy, n_fast);
+		return EXIT_FAILURE;
+	}
+	free(legacy_ids);
+
+	double t0 = __bench_now();
+	for(unsigned i = 0; i < iters; ++i) {
+		memcpy(work, req, len);
+		unsigned* ids = NULL;
+		if(__legacy_parse(work, len, &ids) != seats)
+			return EXIT_FAILURE;
+		free(ids);
+	}
+	__bench_report("strtok + strtoull + realloc", __bench_now() - t0, iters, seats, len);
+
+	t0 = __bench_now();
+	for(unsigned i = 0; i < iters; ++i) {
+		memcpy(work, req, len);
+		if(__fast_parse(&rp, work, len, len, to_book) != seats)
+			return EXIT_FAILURE;
+	}
+	__bench_report("reqparse, whole request", __bench_now() - t0, iters, seats, len);
+
+	t0 = __bench_now();
+	for(unsigned i = 0; i < iters; ++i) {
+		memcpy(work, req, len);
+		if(__fast_parse(&rp, work, len, BENCH_CHUNK, to_book) != seats)
+			return EXIT_FAILURE;
+	}
+	__bench_report("reqparse, 4096B chunks", __bench_now() - t0, iters, seats, len);
+
+	//the seat list back to text, as GetAvailableSeats does
+	volatile unsigned sink = 0;
+
+	t0 = __bench_now();
+	for(unsigned i = 0; i < iters; ++i) {
+		unsigned out = 0;
+		for(unsigned j = 0; j < seats; ++j) {
+			out += __legacy_itos(to_book[j] / BENCH_POLS + 1, work + out);
+			work[out++] = ',';
+			out += __legacy_itos(to_book[j] % BENCH_POLS + 1, work + out);
+			work[out++] = ',';
+		}
+		sink += out;
+	}
+	__bench_report("itos", __bench_now() - t0, iters, seats, len);
+
+	t0 = __bench_now();
+	for(unsigned i = 0; i < iters; ++i) {
+		unsigned out = 0;
+		for(unsigned j = 0; j < seats; ++j) {
+			out += numfmt_utoa(to_book[j] / BENCH_POLS + 1, work + out);
+			work[out++] = ',';
+			out += numfmt_utoa(to_book[j] % BENCH_POLS + 1, work + out);
+			work[out++] = ',';
+		}
+		sink += out;
+	}
+	__bench_report("numfmt_utoa", __bench_now() - t0, iters, seats, len);
+
+	if(memcmp(work, req + 9, len - 11) != 0) {
+		fprintf(stderr, "numfmt_utoa output differs from the request\n");
+		return EXIT_FAILURE;
+	}
+
+	reqparse_finish(&rp);
+	free(to_book);
+	free(work);
+	free(req);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,532 @@
+/* handlers.c - request parser and handler microbenchmark
+	ITA: misura in un solo processo, senza socket, il parser (reqparse,
+		che riconosce anche la fine della richiesta) e i comandi
+		GetAvailableSeats, BookSeats e RevokeBooking di ops.c, su sale
+		da 100, 10k e 1M posti occupate allo 0, 50, 90 e 99% (posti
+		scelti a caso, prenotati a gruppi di 16 prima di misurare).
+
+		GetAvailableSeats è misurata con la risposta già pronta e con
+		una riga da serializzare di nuovo a ogni richiesta, come dopo
+		una prenotazione. BookSeats prenota gruppi disgiunti di posti
+		liberi, RevokeBooking revoca poi le stesse prenotazioni: la sala
+		torna com'era a ogni giro. Il tempo di BookSeats include la
+		lettura del codice dalla risposta. BookBatch prenota gli stessi
+		gruppi a 16 per richiesta, il tempo è per prenotazione.
+		BookBest prenota dalla riga centrale finché trova posti (al più
+		1024 prenotazioni), a parte il tempo di una richiesta che non li
+		trova più dopo aver provato tutte le righe.
+
+		Per ogni caso: ns per richiesta, allocazioni per richiesta
+		(alloccount, compilato con -DCOUNT_ALLOCS) e cache miss per
+		richiesta se perf_event_open lo permette. Ogni caso è ripetuto
+		per almeno ms millisecondi.
+
+	usage: bench/handlers [ms]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "../server/malloc_utils.h"
+#include "../server/ops.h"
+#include "../server/stats.h"
+#include "../server/numfmt.h"
+#include "../server/alloccount.h"
+
+#define BENCH_FILL_GROUP 16
+#define BENCH_MAX_BOOKINGS 1024 //per round of BookSeats
+#define BENCH_BATCH 16 //bookings per BookBatch
+#define BENCH_KEEP_ARENA (1 << 20)
+
+typedef unsigned long long ulong64;
+
+typedef struct {
+	double secs;
+	unsigned long ops;
+	unsigned long allocs;
+	ulong64 misses;
+} __bench_acc;
+
+/* NOT exposed */
+static int __bench_perf_fd = -1;
+static double __bench_t0;
+static unsigned long __bench_allocs0;
+static double __bench_min_secs = 0.1;
+
+static const unsigned __bench_halls[][2] = { { 10, 10 }, { 100, 100 }, { 1000, 1000 } };
+static const unsigned __bench_occupancy[] = { 0, 50, 90, 99 };
+static const unsigned __bench_booking_sizes[] = { 1, 10, 100 };
+static const unsigned __bench_parse_sizes[] = { 1, 10, 100, 1000 };
+
+static double __bench_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static ulong64 __bench_next_random(ulong64* s) {
+	*s ^= *s >> 12;
+	*s ^= *s << 25;
+	*s ^= *s >> 27;
+	return *s * 2685821657736338717ULL;
+}
+
+/* user space cache misses of this thread, unavailable in most containers */
+static void __bench_perf_open() {
+	struct perf_event_attr pe;
+	memset(&pe, 0, sizeof(struct perf_event_attr));
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.size = sizeof(struct perf_event_attr);
+	pe.config = PERF_COUNT_HW_CACHE_MISSES;
+	pe.disabled = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+
+	__bench_perf_fd = (int) syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+	if(__bench_perf_fd < 0)
+		printf("cache misses not available: perf_event_open: %s\n", strerror(errno));
+}
+
+static void __bench_start() {
+	if(__bench_perf_fd >= 0) {
+		ioctl(__bench_perf_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(__bench_perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	__bench_allocs0 = alloccount_get();
+	__bench_t0 = __bench_now();
+}
+
+static void __bench_stop(__bench_acc* acc, unsigned long ops) {
+	acc->secs += __bench_now() - __bench_t0;
+	acc->allocs += alloccount_get() - __bench_allocs0;
+	acc->ops += ops;
+
+	if(__bench_perf_fd >= 0) {
+		ioctl(__bench_perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+
+		ulong64 misses = 0;
+		if(read(__bench_perf_fd, &misses, sizeof(ulong64)) == sizeof(ulong64))
+			acc->misses += misses;
+	}
+}
+
+static void __bench_print(const char* name, const __bench_acc* acc) {
+	printf("  %-44s %12.1f ns/op %8.2f allocs/op", name,
+			acc->secs / acc->ops * 1e9, (double) acc->allocs / acc->ops);
+
+	if(__bench_perf_fd >= 0)
+		printf(" %10.1f misses/op", (double) acc->misses / acc->ops);
+
+	printf("\n");
+}
+
+/* --- reqparse --- */
+
+static char* __bench_book_request(unsigned seats, unsigned* out_len) {
+	char* req = (char*) malloc(9 + (unsigned long) seats * 2 * (NUMFMT_UINT_MAX_DIGITS + 1) + 2);
+	malloc_check_exit_on_error(req);
+
+	unsigned len = 9;
+	memcpy(req, "BookSeats", 9);
+
+	for(unsigned i = 0; i < seats; ++i) {
+		len += numfmt_utoa(i / 1000 + 1, req + len);
+		req[len++] = ',';
+		len += numfmt_utoa(i % 1000 + 1, req + len);
+		req[len++] = ',';
+	}
+
+	req[len - 1] = '\r';
+	req[len++] = '\n';
+
+	*out_len = len;
+	return req;
+}
+
+/* the request in n_chunks recv()s, the terminator is found in the last one */
+static void __bench_parse(const char* name, const char* req, unsigned len, unsigned n_chunks) {
+	reqparse rp;
+	reqparse_init(&rp, 2 * 1000 + 2, len);
+
+	unsigned chunk = (len + n_chunks - 1) / n_chunks;
+	__bench_acc acc = { 0, 0, 0, 0 };
+
+	while(acc.secs < __bench_min_secs) {
+		__bench_start();
+		for(unsigned i = 0; i < 1000; ++i) {
+			unsigned pos = 0;
+			int rv = REQPARSE_NEED_MORE;
+
+			while(rv == REQPARSE_NEED_MORE) {
+				unsigned consumed;
+				unsigned n = len - pos < chunk ? len - pos : chunk;
+				rv = reqparse_feed(&rp, req + pos, n, &consumed);
+				pos += consumed;
+			}
+
+			if(rp.error != REQPARSE_ERR_NONE)
+				exit(EXIT_FAILURE);
+
+			reqparse_next(&rp);
+		}
+		__bench_stop(&acc, 1000);
+	}
+
+	__bench_print(name, &acc);
+	reqparse_finish(&rp);
+}
+
+static void __bench_parser() {
+	printf("reqparse_feed (%s), whole request unless noted\n", reqparse_simd_name());
+
+	__bench_parse("GetAvailableSeats", "GetAvailableSeats\r\n", 19, 1);
+	__bench_parse("RevokeBooking", "RevokeBooking1234567890\r\n", 25, 1);
+
+	for(unsigned i = 0; i < sizeof(__bench_parse_sizes) / sizeof(unsigned); ++i) {
+		unsigned len;
+		char* req = __bench_book_request(__bench_parse_sizes[i], &len);
+		char name[64];
+
+		snprintf(name, 64, "BookSeats, %u seat(s)", __bench_parse_sizes[i]);
+		__bench_parse(name, req, len, 1);
+
+		snprintf(name, 64, "BookSeats, %u seat(s), 2 recv", __bench_parse_sizes[i]);
+		__bench_parse(name, req, len, 2);
+
+		free(req);
+	}
+}
+
+/* --- handlers --- */
+
+/* the first occupancy% of ids booked, ids shuffled */
+static void __bench_fill(show* sh, unsigned* ids, unsigned occupancy, ulong64* rng) {
+	for(unsigned i = sh->n_total_seats - 1; i > 0; --i) {
+		unsigned j = (unsigned) (__bench_next_random(rng) % (i + 1));
+		unsigned t = ids[i];
+		ids[i] = ids[j];
+		ids[j] = t;
+	}
+
+	unsigned n_booked = (unsigned) ((unsigned long) sh->n_total_seats * occupancy / 100);
+	for(unsigned i = 0; i < n_booked; i += BENCH_FILL_GROUP) {
+		unsigned n = n_booked - i < BENCH_FILL_GROUP ? n_booked - i : BENCH_FILL_GROUP;
+		unsigned code;
+		if(booking_book(&sh->engine, ids + i, n, &code) != BOOKING_OK)
+			exit(EXIT_FAILURE);
+	}
+}
+
+static void __bench_get(show* sh, arena* scratch, reqparse* rp, int dirty) {
+	__bench_acc acc = { 0, 0, 0, 0 };
+	unsigned reply_len = 0;
+
+	while(acc.secs < __bench_min_secs) {
+		__bench_start();
+		for(unsigned i = 0; i < 16; ++i) {
+			//as a booking in that row would
+			if(dirty)
+				availcache_mark_dirty(&sh->engine.ac, i % sh->rows);
+
+			arena_reset(scratch);
+			op_get_available_seats(sh, scratch, rp, &reply_len);
+		}
+		__bench_stop(&acc, 16);
+	}
+
+	char name[64];
+	snprintf(name, 64, "GetAvailableSeats, %s (%uB)", dirty ? "1 dirty row" : "cached", reply_len);
+	__bench_print(name, &acc);
+}
+
+/* book n_bookings groups of k free seats (ids), then revoke them */
+static void __bench_book_revoke(show* sh, arena* scratch, const unsigned* free_ids, unsigned n_free, unsigned k) {
+	unsigned n_bookings = n_free / k < BENCH_MAX_BOOKINGS ? n_free / k : BENCH_MAX_BOOKINGS;
+	if(n_bookings == 0)
+		return;
+
+	//x,y,x,y,... of every booking, handed to the handler as the parser would
+	unsigned* coords = (unsigned*) malloc(sizeof(unsigned) * 2 * k * n_bookings);
+	unsigned* codes = (unsigned*) malloc(sizeof(unsigned) * n_bookings);
+	malloc_check_exit_on_error(coords);
+	malloc_check_exit_on_error(codes);
+
+	for(unsigned i = 0; i < k * n_bookings; ++i) {
+		coords[i << 1] = free_ids[i] / sh->pols + 1;
+		coords[(i << 1) + 1] = free_ids[i] % sh->pols + 1;
+	}
+
+	reqparse rp;
+	reqparse_init(&rp, 2, 0);
+	unsigned* own_values = rp.values;
+
+	__bench_acc book = { 0, 0, 0, 0 };
+	__bench_acc revoke = { 0, 0, 0, 0 };
+
+	while(book.secs + revoke.secs < 2 * __bench_min_secs) {
+		unsigned len;
+
+		rp.n_values = 2 * k;
+		__bench_start();
+		for(unsigned i = 0; i < n_bookings; ++i) {
+			arena_reset(scratch);
+			rp.values = coords + 2 * k * i;
+
+			const char* res = op_book_seats(sh, scratch, &rp, &len);
+			if(strncmp(res, "Success:", 8) != 0)
+				exit(EXIT_FAILURE);
+
+			codes[i] = (unsigned) strtoul(res + 8, NULL, 10);
+		}
+		__bench_stop(&book, n_bookings);
+
+		rp.n_values = 1;
+		__bench_start();
+		for(unsigned i = 0; i < n_bookings; ++i) {
+			rp.values = codes + i;
+			if(op_revoke_booking(sh, scratch, &rp, &len)[0] != 'S')
+				exit(EXIT_FAILURE);
+		}
+		__bench_stop(&revoke, n_bookings);
+	}
+
+	rp.values = own_values;
+	reqparse_finish(&rp);
+	ops_result_take();
+
+	char name[64];
+	snprintf(name, 64, "BookSeats, %u seat(s)", k);
+	__bench_print(name, &book);
+	snprintf(name, 64, "RevokeBooking, %u seat(s)", k);
+	__bench_print(name, &revoke);
+
+	free(codes);
+	free(coords);
+}
+
+/* as __bench_book_revoke, BENCH_BATCH bookings per BookBatch, ns per booking */
+static void __bench_book_batch(show* sh, arena* scratch, const unsigned* free_ids, unsigned n_free, unsigned k) {
+	unsigned n_batches = n_free / (k * BENCH_BATCH) < BENCH_MAX_BOOKINGS / BENCH_BATCH ?
+		n_free / (k * BENCH_BATCH) : BENCH_MAX_BOOKINGS / BENCH_BATCH;
+	if(n_batches == 0)
+		return;
+
+	//n,x,y,...,n,x,y,... as the parser leaves BookBatch
+	unsigned batch_values = BENCH_BATCH * (2 * k + 1);
+	unsigned* values = (unsigned*) malloc(sizeof(unsigned) * batch_values * n_batches);
+	unsigned* codes = (unsigned*) malloc(sizeof(unsigned) * BENCH_BATCH * n_batches);
+	malloc_check_exit_on_error(values);
+	malloc_check_exit_on_error(codes);
+
+	unsigned* v = values;
+	for(unsigned b = 0; b < BENCH_BATCH * n_batches; ++b) {
+		*v++ = 2 * k;
+		for(unsigned i = 0; i < k; ++i) {
+			unsigned id = free_ids[b * k + i];
+			*v++ = id / sh->pols + 1;
+			*v++ = id % sh->pols + 1;
+		}
+	}
+
+	reqparse rp;
+	reqparse_init(&rp, batch_values, 0);
+	unsigned* own_values = rp.values;
+
+	__bench_acc book = { 0, 0, 0, 0 };
+
+	while(book.secs < __bench_min_secs) {
+		unsigned len;
+
+		rp.n_values = batch_values;
+		__bench_start();
+		for(unsigned i = 0; i < n_batches; ++i) {
+			arena_reset(scratch);
+			rp.values = values + batch_values * i;
+
+			const char* res = op_book_batch(sh, scratch, &rp, &len);
+			for(unsigned b = 0; b < BENCH_BATCH; ++b) {
+				if(strncmp(res, "Success:", 8) != 0)
+					exit(EXIT_FAILURE);
+
+				char* end;
+				codes[i * BENCH_BATCH + b] = (unsigned) strtoul(res + 8, &end, 10);
+				res = end + 1;
+			}
+		}
+		__bench_stop(&book, n_batches * BENCH_BATCH);
+
+		for(unsigned i = 0; i < n_batches * BENCH_BATCH; ++i)
+			booking_revoke(&sh->engine, codes[i]);
+	}
+
+	rp.values = own_values;
+	reqparse_finish(&rp);
+	ops_result_take();
+
+	char name[64];
+	snprintf(name, 64, "BookBatch, %u x %u seat(s), per booking", BENCH_BATCH, k);
+	__bench_print(name, &book);
+
+	free(codes);
+	free(values);
+}
+
+static unsigned __bench_best_round(show* sh, arena* scratch, reqparse* rp, unsigned max, unsigned* codes) {
+	unsigned n = 0;
+	unsigned len;
+
+	for(; n < max; ++n) {
+		arena_reset(scratch);
+
+		const char* res = op_book_best(sh, scratch, rp, &len);
+		if(strncmp(res, "Success:", 8) != 0)
+			break;
+
+		codes[n] = (unsigned) strtoul(res + 8, NULL, 10);
+	}
+
+	return n;
+}
+
+/* BookBest k until no row has k free seats in a row (or BENCH_MAX_BOOKINGS), then revoke */
+static void __bench_book_best(show* sh, arena* scratch, unsigned k) {
+	if(k > sh->pols)
+		return;
+
+	unsigned* codes = (unsigned*) malloc(sizeof(unsigned) * BENCH_MAX_BOOKINGS);
+	malloc_check_exit_on_error(codes);
+
+	reqparse rp;
+	reqparse_init(&rp, 2, 0);
+	rp.values[0] = k;
+	rp.n_values = 1;
+
+	//same hall, same choices: timed rounds book exactly n_ok seats, the miss is timed apart
+	unsigned n_ok = __bench_best_round(sh, scratch, &rp, BENCH_MAX_BOOKINGS, codes);
+	for(unsigned i = 0; i < n_ok; ++i)
+		booking_revoke(&sh->engine, codes[i]);
+
+	__bench_acc book = { 0, 0, 0, 0 };
+	__bench_acc miss = { 0, 0, 0, 0 };
+
+	while(book.secs + miss.secs < __bench_min_secs) {
+		__bench_start();
+		if(__bench_best_round(sh, scratch, &rp, n_ok, codes) != n_ok)
+			exit(EXIT_FAILURE);
+		__bench_stop(&book, n_ok);
+
+		//every row is tried before giving up
+		if(n_ok < BENCH_MAX_BOOKINGS) {
+			__bench_start();
+			for(unsigned i = 0; i < BENCH_BATCH; ++i)
+				if(__bench_best_round(sh, scratch, &rp, 1, codes + n_ok) != 0)
+					exit(EXIT_FAILURE);
+			__bench_stop(&miss, BENCH_BATCH);
+		}
+
+		for(unsigned i = 0; i < n_ok; ++i)
+			booking_revoke(&sh->engine, codes[i]);
+	}
+
+	reqparse_finish(&rp);
+	ops_result_take();
+
+	char name[64];
+	if(book.ops) {
+		snprintf(name, 64, "BookBest, %u seat(s), %u booking(s)", k, n_ok);
+		__bench_print(name, &book);
+	}
+
+	if(miss.ops) {
+		snprintf(name, 64, "BookBest, %u seat(s), none left", k);
+		__bench_print(name, &miss);
+	}
+
+	free(codes);
+}
+
+static void __bench_hall(unsigned rows, unsigned pols, unsigned occupancy, arena* scratch) {
+	show_table st;
+	int res = shows_single(&st, 1, rows, pols, BENCH_MAX_BOOKINGS);
+	if(res != SHOWS_OK) {
+		char buf[256];
+		shows_strerror(res, buf, 256);
+		fprintf(stderr, "%s\n", buf);
+		exit(EXIT_FAILURE);
+	}
+
+	show* sh = st.default_show;
+	unsigned* ids = (unsigned*) malloc(sizeof(unsigned) * sh->n_total_seats);
+	malloc_check_exit_on_error(ids);
+
+	for(unsigned i = 0; i < sh->n_total_seats; ++i)
+		ids[i] = i;
+
+	ulong64 rng = 0x9E3779B97F4A7C15ULL;
+	__bench_fill(sh, ids, occupancy, &rng);
+
+	unsigned n_booked = (unsigned) ((unsigned long) sh->n_total_seats * occupancy / 100);
+	printf("\n%u x %u seats, %u%% booked\n", rows, pols, occupancy);
+
+	reqparse rp;
+	reqparse_init(&rp, 2, 0);
+
+	__bench_get(sh, scratch, &rp, 0);
+	__bench_get(sh, scratch, &rp, 1);
+
+	for(unsigned i = 0; i < sizeof(__bench_booking_sizes) / sizeof(unsigned); ++i) {
+		__bench_book_revoke(sh, scratch, ids + n_booked, sh->n_total_seats - n_booked, __bench_booking_sizes[i]);
+		__bench_book_batch(sh, scratch, ids + n_booked, sh->n_total_seats - n_booked, __bench_booking_sizes[i]);
+		__bench_book_best(sh, scratch, __bench_booking_sizes[i]);
+	}
+
+	reqparse_finish(&rp);
+	free(ids);
+	shows_finish(&st);
+}
+
+int main(int argc, char** argv) {
+	if(argc > 1) {
+		unsigned long ms = strtoul(argv[1], NULL, 10);
+		if(ms == 0) {
+			fprintf(stderr, "usage: %s [ms]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		__bench_min_secs = ms / 1e3;
+	}
+
+	__bench_perf_open();
+
+	//op_stats and the results of failed requests
+	const char* const op_names[] = { "Invalid" };
+	stats_init(op_names, 1, NULL);
+
+	if(alloccount_get() == 0)
+		printf("allocations not counted: build with -DCOUNT_ALLOCS\n");
+
+	__bench_parser();
+
+	arena scratch;
+	arena_init(&scratch, BENCH_KEEP_ARENA);
+
+	for(unsigned h = 0; h < sizeof(__bench_halls) / sizeof(__bench_halls[0]); ++h) {
+		for(unsigned o = 0; o < sizeof(__bench_occupancy) / sizeof(unsigned); ++o)
+			__bench_hall(__bench_halls[h][0], __bench_halls[h][1], __bench_occupancy[o], &scratch);
+	}
+
+	arena_finish(&scratch);
+
+	if(__bench_perf_fd >= 0)
+		close(__bench_perf_fd);
+
+	return EXIT_SUCCESS;
+}
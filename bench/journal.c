@@ -0,0 +1,141 @@
+/* journal.c - durable booking throughput benchmark
+	ITA: threads thread prenotano posti singoli distinti della stessa
+		sala (ognuno le proprie righe), prima solo in memoria, poi con
+		il giornale in ciascuna modalità. Riporta prenotazioni al
+		secondo e quante fdatasync sono servite: con più thread una
+		fdatasync conferma più prenotazioni (group commit).
+		Il file del giornale è ricreato per ogni modalità e rimosso alla
+		fine, va messo sul disco da misurare.
+
+	usage: bench/journal [file [threads [bookings per thread [window us]]]]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../server/malloc_utils.h"
+#include "../server/booking.h"
+#include "../server/journal.h"
+
+#define BENCH_POLS 1000
+
+typedef struct {
+	booking_engine* be;
+	unsigned first_row;
+	unsigned n;
+} __bench_worker;
+
+/* NOT exposed */
+static double __bench_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int __bench_no_replay(void* ctx, const journal_record* rec) {
+	(void) ctx;
+	(void) rec;
+	return 1;
+}
+
+static void* __bench_book(void* arg) {
+	__bench_worker* w = (__bench_worker*) arg;
+
+	for(unsigned i = 0; i < w->n; ++i) {
+		unsigned seat = w->first_row * BENCH_POLS + i;
+		unsigned code;
+		if(booking_book(w->be, &seat, 1, &code) != BOOKING_OK)
+			exit(EXIT_FAILURE);
+	}
+
+	return NULL;
+}
+
+static void __bench_run(const char* name, const char* path, int mode, unsigned window,
+		unsigned threads, unsigned per_thread) {
+	unsigned rows_per_thread = (per_thread + BENCH_POLS - 1) / BENCH_POLS;
+	booking_engine be;
+	journal jr;
+
+	if(booking_init(&be, rows_per_thread * threads, BENCH_POLS, threads * per_thread) != BOOKING_OK) {
+		perror("booking_init");
+		exit(EXIT_FAILURE);
+	}
+
+	if(path) {
+		unlink(path);
+		int res = journal_open(&jr, path, 0, mode, window, __bench_no_replay, NULL);
+		if(res != JOURNAL_OK) {
+			char buf[256];
+			journal_strerror(res, buf, 256);
+			fprintf(stderr, "%s\n", buf);
+			exit(EXIT_FAILURE);
+		}
+
+		booking_attach_journal(&be, &jr, 0);
+	}
+
+	pthread_t* tids = (pthread_t*) malloc(sizeof(pthread_t) * threads);
+	__bench_worker* ws = (__bench_worker*) malloc(sizeof(__bench_worker) * threads);
+	malloc_check_exit_on_error(tids);
+	malloc_check_exit_on_error(ws);
+
+	double t0 = __bench_now();
+	for(unsigned i = 0; i < threads; ++i) {
+		ws[i].be = &be;
+		ws[i].first_row = i * rows_per_thread;
+		ws[i].n = per_thread;
+		if(pthread_create(&tids[i], NULL, __bench_book, &ws[i]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for(unsigned i = 0; i < threads; ++i)
+		pthread_join(tids[i], NULL);
+
+	//async: bookings count once they are on disk too
+	if(path)
+		journal_sync(&jr);
+
+	double secs = __bench_now() - t0;
+	double total = (double) threads * per_thread;
+
+	printf("%-24s %12.0f bookings/s %10.2f us/booking", name, total / secs, secs / total * 1e6);
+	if(path) {
+		printf(" %8lu fdatasync %8.1f bookings/fdatasync", jr.fsyncs, jr.fsyncs ? total / jr.fsyncs : 0.0);
+		journal_close(&jr);
+		unlink(path);
+	}
+	printf("\n");
+
+	free(ws);
+	free(tids);
+	booking_finish(&be);
+}
+
+int main(int argc, char** argv) {
+	const char* path = argc > 1 ? argv[1] : "journal.bench";
+	unsigned threads = argc > 2 ? (unsigned) strtoul(argv[2], NULL, 10) : 16;
+	unsigned per_thread = argc > 3 ? (unsigned) strtoul(argv[3], NULL, 10) : 2000;
+	unsigned window = argc > 4 ? (unsigned) strtoul(argv[4], NULL, 10) : 1000;
+
+	if(threads == 0 || per_thread == 0) {
+		fprintf(stderr, "usage: %s [file [threads [bookings per thread [window us]]]]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("%u threads, %u single seat bookings each, window %u us, journal %s\n",
+			threads, per_thread, window, path);
+
+	__bench_run("memory", NULL, 0, 0, threads, per_thread);
+	__bench_run("journal, request", path, JOURNAL_SYNC_REQUEST, window, threads, per_thread);
+	__bench_run("journal, batch", path, JOURNAL_SYNC_BATCH, window, threads, per_thread);
+	__bench_run("journal, async", path, JOURNAL_SYNC_ASYNC, window, threads, per_thread);
+
+	return EXIT_SUCCESS;
+}
@@ -7,6 +7,8 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 
+#include "clientproto.h"
+
 #ifndef DEFAULT_PORT
 #define DEFAULT_PORT 8123
 #endif
@@ -45,7 +47,7 @@ typedef unsigned long long ulong64;
 typedef unsigned short ushort16;
 
 void print_usage_exit(const char* fa) {
-	printf("usage: %s [ --host ht | -h ht ] [ --port pt | -p pt ] [ --unique ue | -u ue ]\n", fa);
+	printf("usage: %s [ --host ht | -h ht ] [ --port pt | -p pt ] [ --unique ue | -u ue ] [ --show id | -s id ]\n", fa);
 	exit(EXIT_FAILURE);
 }
 
@@ -75,37 +77,6 @@ int stoull(const char* s, ulong64* res) {
 	return *end != 0;
 }
 
-struct sockaddr_in host_lookup(const char* hostname, ushort16 port) {// 1) lookup
-	struct sockaddr_in addr;
-	addr.sin_family = 0;
-
-	struct hostent* host_entity = gethostbyname(hostname);
-	if(host_entity == NULL)
-		return addr;
-
-	addr.sin_family = AF_INET;
-	addr.sin_addr = *(struct in_addr*) host_entity->h_addr;
-	addr.sin_port = htons(port);
-
-	return addr;
-}
-
-#define SOCKET_ERROR -1
-#define CONNECT_ERROR -2
-
-int get_connected_socket(struct sockaddr_in* addr) {
-	int sd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if(sd < 0)
-		return SOCKET_ERROR;
-
-	if(connect(sd, (struct sockaddr*) addr, sizeof(struct sockaddr_in)) < 0) {
-		close(sd);
-		return CONNECT_ERROR;
-	}
-
-	return sd;
-}
-
 #define attempt_connection(newsckfd, hstaddr) \
 	int newsckfd = get_connected_socket(hstaddr); \
 	if(newsckfd == SOCKET_ERROR) { \
@@ -119,10 +90,13 @@ int get_connected_socket(struct sockaddr_in* addr) {
 void print_available_seats(struct sockaddr_in* addr) {
 	attempt_connection(sd, addr);
 
+	int req_len;
+	char* req = make_request("GetAvailableSeats", "", 0, &req_len);
+
 	int err;
 
 intr_write_retry:
-	if((err = write(sd, "GetAvailableSeats\r\n", sizeof("GetAvailableSeats\r\n"))) < 0) {
+	if((err = write(sd, req, req_len)) < 0) {
 		if(errno == EINTR)
 			goto intr_write_retry;
 		else {
@@ -136,6 +110,10 @@ intr_write_retry:
 	char buf[1025] = { 0 };
 intr_recv_retry:
 	while((err = recv(sd, buf, 1024, MSG_NOSIGNAL)) > 0) {
+		//replies end with '\0', the server may keep the connection open
+		int last = memchr(buf, 0, err) != NULL;
+		buf[err] = 0;
+
 		int i = 0;
 		char* tok = strtok(buf, ",");
 		while(tok) {
@@ -147,6 +125,9 @@ intr_recv_retry:
 			++i;
 			tok = strtok(NULL, ",");
 		}
+
+		if(last)
+			break;
 	}
 
 	if(err < 0) {
@@ -161,6 +142,102 @@ intr_recv_retry:
 finish:
 	puts("\n\n=======================\n");
 	close(sd);
+	free(req);
+}
+
+/* ITA: risposta di GetAvailableRanges, "r:a-b,c,d-e;r:...;"
+ *  stampa una riga per ogni fila, una colonna isolata non ha il '-'
+ */
+void print_ranges(char* reply) {
+	char* row_save = NULL;
+	char* row = strtok_r(reply, ";", &row_save);
+	while(row) {
+		char* cols = strchr(row, ':');
+		if(cols == NULL) {
+			printf("\nmalformed row: %s", row);
+			break;
+		}
+
+		*cols++ = 0;
+		printf("\nrow %s: ", row);
+
+		char* range_save = NULL;
+		char* range = strtok_r(cols, ",", &range_save);
+		while(range) {
+			char* dash = strchr(range, '-');
+			if(dash) {
+				*dash = 0;
+				printf("pols %s to %s", range, dash + 1);
+			} else
+				printf("pol %s", range);
+
+			range = strtok_r(NULL, ",", &range_save);
+			if(range)
+				printf(", ");
+		}
+
+		row = strtok_r(NULL, ";", &row_save);
+	}
+}
+
+void print_available_ranges(struct sockaddr_in* addr) {
+	attempt_connection(sd, addr);
+
+	int req_len;
+	char* req = make_request("GetAvailableRanges", "", 0, &req_len);
+
+	int err;
+
+intr_write_retry:
+	if((err = write(sd, req, req_len)) < 0) {
+		if(errno == EINTR)
+			goto intr_write_retry;
+		else {
+			perror("write");
+			goto finish;
+		}
+	}
+
+	printf("Available seat ranges\n"
+		   "=====================\n");
+
+	//the whole reply is needed, a range may span two recv(s)
+	uint32 cap = 1024;
+	uint32 len = 0;
+	char* reply = (char*) malloc(cap);
+	if(reply == NULL)
+		exit(EXIT_FAILURE);
+
+	int last = 0;
+	while(!last) {
+		if(len + 1025 > cap) {
+			cap <<= 1;
+			if((reply = (char*) realloc(reply, cap)) == NULL)
+				exit(EXIT_FAILURE);
+		}
+
+		err = recv(sd, reply + len, 1024, MSG_NOSIGNAL);
+		if(err < 0) {
+			if(errno == EINTR)
+				continue;
+
+			perror("read");
+			break;
+		} else if(err == 0)
+			break;
+
+		last = memchr(reply + len, 0, err) != NULL;
+		len += err;
+	}
+
+	reply[len] = 0;
+	print_ranges(reply);
+	free(reply);
+
+finish:
+	puts("\n\n=====================\n");
+	close(sd);
+	free(req);
 }
 
 void book_seats(struct sockaddr_in* addr, char* seats_coords) {
@@ -169,15 +246,8 @@ void book_seats(struct sockaddr_in* addr, char* seats_coords) {
 	remove_char(seats_coords, '(');
 	remove_char(seats_coords, ')');
 
-	int seats_coords_len = strlen(seats_coords);
-	int len = seats_coords_len + 11;
-	char* req = (char*) calloc(len, sizeof(char));
-	if(req == NULL)
-		exit(EXIT_FAILURE);
-
-	memcpy(req, "BookSeats", 9);
-	memcpy(req + 9, seats_coords, seats_coords_len);
-	memcpy(req + 9 + seats_coords_len, "\r\n", 2);
+	int len;
+	char* req = make_request("BookSeats", seats_coords, strlen(seats_coords), &len);
 
 	int err;
 
@@ -227,19 +297,95 @@ finish:
 	free(req);
 }
 
-void revoke_booking(struct sockaddr_in* addr, const char* unique_code) {
+/* ITA: "n" o "n riga", il server sceglie i posti e li restituisce
+ *  con il codice: "Success:code:x,y,x,y,..."
+ */
+void book_best(struct sockaddr_in* addr, char* args) {
 	attempt_connection(sd, addr);
+	replace_char(args, ' ', ',');
 
-	int unique_code_len = strlen(unique_code);
-	int req_len = 15 + unique_code_len;
-	
-	char* req = (char*) calloc(req_len, sizeof(char));
-	if(req == NULL)
+	int len;
+	char* req = make_request("BookBest", args, strlen(args), &len);
+
+	int err;
+
+intr_write_retry:
+	if((err = write(sd, req, len)) < 0) {
+		if(errno == EINTR)
+			goto intr_write_retry;
+		else {
+			perror("write");
+			goto finish;
+		}
+	}
+
+	//a whole row of coordinates may not fit in one recv
+	uint32 cap = 1024;
+	uint32 got = 0;
+	char* reply = (char*) malloc(cap);
+	if(reply == NULL)
 		exit(EXIT_FAILURE);
 
-	memcpy(req, "RevokeBooking", 13);
-	memcpy(req + 13, unique_code, unique_code_len);
-	memcpy(req + 13 + unique_code_len, "\r\n", 2);
+	int last = 0;
+	while(!last) {
+		if(got + 1025 > cap) {
+			cap <<= 1;
+			if((reply = (char*) realloc(reply, cap)) == NULL)
+				exit(EXIT_FAILURE);
+		}
+
+		err = recv(sd, reply + got, 1024, MSG_NOSIGNAL);
+		if(err < 0) {
+			if(errno == EINTR)
+				continue;
+
+			perror("read");
+			break;
+		} else if(err == 0)
+			break;
+
+		last = memchr(reply + got, 0, err) != NULL;
+		got += err;
+	}
+
+	reply[got] = 0;
+
+	puts("Best available seats\n"
+		 "====================\n");
+
+	char* ans = strtok(reply, ":");
+	if(ans && strcmp(ans, "Success") == 0) {
+		printf("You did it! Here's your code: %s\n", strtok(NULL, ":"));
+
+		char* coords = strtok(NULL, ":");
+		printf("Your seats:");
+		for(char* x = strtok(coords, ","); x; x = strtok(NULL, ","))
+			printf(" (%s,%s)", x, strtok(NULL, ","));
+		printf("\n");
+	} else {
+		char* error_string = ans ? strtok(NULL, ":") : NULL;
+		if(error_string && strcmp(error_string, "notavail") == 0)
+			printf("No row has that many free seats next to each other\n");
+		else if(error_string && strcmp(error_string, "toomuch") == 0)
+			printf("More seats than a row has\n");
+		else if(error_string && strcmp(error_string, "exceed") == 0)
+			printf("No such row\n");
+		else
+			printf("Malformed input\n");
+	}
+
+	free(reply);
+	puts("\n====================\n");
+finish:
+	close(sd);
+	free(req);
+}
+
+void revoke_booking(struct sockaddr_in* addr, const char* unique_code) {
+	attempt_connection(sd, addr);
+
+	int req_len;
+	char* req = make_request("RevokeBooking", unique_code, strlen(unique_code), &req_len);
 
 	int err;
 
@@ -286,6 +432,51 @@ finish:
 	free(req);
 }
 
+/* ITA: report di Stats, una riga per op, stampato così com'è */
+void print_stats(struct sockaddr_in* addr) {
+	attempt_connection(sd, addr);
+
+	int req_len;
+	char* req = make_request("Stats", "", 0, &req_len);
+
+	int err;
+
+intr_write_retry:
+	if((err = write(sd, req, req_len)) < 0) {
+		if(errno == EINTR)
+			goto intr_write_retry;
+		else {
+			perror("write");
+			goto finish;
+		}
+	}
+
+	printf("Server statistics\n"
+		   "=================\n");
+	char buf[1025] = { 0 };
+intr_recv_retry:
+	while((err = recv(sd, buf, 1024, MSG_NOSIGNAL)) > 0) {
+		int last = memchr(buf, 0, err) != NULL;
+		buf[err] = 0;
+		printf("%s", buf);
+
+		if(last)
+			break;
+	}
+
+	if(err < 0) {
+		if(errno == EINTR)
+			goto intr_recv_retry;
+		else
+			perror("read");
+	}
+
+finish:
+	puts("\n\n=================\n");
+	close(sd);
+	free(req);
+}
+
 #define MAX_LINE 1024
 
 #define read_stdin(bufname) \
@@ -311,6 +502,11 @@ int main(int argc, char** argv) {
 			get_ullong_value_for_option(argv, &r, i);
 			port = (ushort16) r;
 			
+		} else if(arg(argv[i], "--show", "-s")) {
+			ulong64 r;
+			get_ullong_value_for_option(argv, &r, i);
+			select_show((uint32) r);
+
 		}  else {
 			if(i > 0)
 				printf("ignoring unrecognized option: %s\n", argv[i]);
@@ -329,34 +525,49 @@ int main(int argc, char** argv) {
 		int opt;
 		printf("--- options:\n"
 				"\t1) Get list of available seats\n"
-				"\t2) Book one or more seats\n"
-				"\t3) Revoke a previous booking (unique code needed)\n"
-				"\t4) Exit\n\nchoice: ");
+				"\t2) Get available seats as ranges\n"
+				"\t3) Book one or more seats\n"
+				"\t4) Revoke a previous booking (unique code needed)\n"
+				"\t5) Server statistics\n"
+				"\t6) Book best available adjacent seats\n"
+				"\t7) Exit\n\nchoice: ");
 		fflush(stdout);
 
 		read_stdin(bufopt);
 		puts("***");
 
 		if(stoull(bufopt, (ulong64*) &opt) == 0) {
-			if(opt < 1 || opt > 4)
+			if(opt < 1 || opt > 7)
 				printf("unrecognized option: %d\n", opt);
 
 			else if(opt == 1)
 				print_available_seats(&host_address);
 
-			else if(opt == 2) {
+			else if(opt == 2)
+				print_available_ranges(&host_address);
+
+			else if(opt == 3) {
 				printf("seat coordinates (x1,y1) (x2,y2) ... : ");
 				fflush(stdout);
 				read_stdin(bufcoords);
 				book_seats(&host_address, bufcoords);
 
-			} else if(opt == 3) {
+			} else if(opt == 4) {
 				printf("unique code: ");
 				fflush(stdout);
 				read_stdin(bufunique);
 				revoke_booking(&host_address, bufunique);
 
-			} else if(opt == 4)
+			} else if(opt == 5)
+				print_stats(&host_address);
+
+			else if(opt == 6) {
+				printf("number of seats [preferred row] : ");
+				fflush(stdout);
+				read_stdin(bufbest);
+				book_best(&host_address, bufbest);
+
+			} else if(opt == 7)
 				exit(EXIT_SUCCESS);
 		} else {
 			printf("invalid character for base 10\n");
@@ -0,0 +1,92 @@
+/* clientproto.c - text protocol helpers shared by tktcli and tktbench */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "clientproto.h"
+
+#define RECV_REPLY_CHUNK 1024
+
+//"@id:" if a show was chosen, empty otherwise
+static char show_prefix[16] = { 0 };
+static int show_prefix_len = 0;
+
+struct sockaddr_in host_lookup(const char* hostname, unsigned short port) {
+	struct sockaddr_in addr;
+	addr.sin_family = 0;
+
+	struct hostent* host_entity = gethostbyname(hostname);
+	if(host_entity == NULL)
+		return addr;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr = *(struct in_addr*) host_entity->h_addr;
+	addr.sin_port = htons(port);
+
+	return addr;
+}
+
+void select_show(unsigned id) {
+	show_prefix_len = snprintf(show_prefix, sizeof(show_prefix), "@%u:", id);
+}
+
+char* make_request(const char* op, const char* arg, int arg_len, int* out_len) {
+	int op_len = strlen(op);
+	int len = show_prefix_len + op_len + arg_len + 2;
+	char* req = (char*) calloc(len, sizeof(char));
+	if(req == NULL)
+		exit(EXIT_FAILURE);
+
+	memcpy(req, show_prefix, show_prefix_len);
+	memcpy(req + show_prefix_len, op, op_len);
+	memcpy(req + show_prefix_len + op_len, arg, arg_len);
+	memcpy(req + show_prefix_len + op_len + arg_len, "\r\n", 2);
+
+	*out_len = len;
+	return req;
+}
+
+int get_connected_socket(struct sockaddr_in* addr) {
+	int sd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(sd < 0)
+		return SOCKET_ERROR;
+
+	if(connect(sd, (struct sockaddr*) addr, sizeof(struct sockaddr_in)) < 0) {
+		close(sd);
+		return CONNECT_ERROR;
+	}
+
+	return sd;
+}
+
+int recv_reply(int sd, char** buf, unsigned* cap) {
+	unsigned len = 0;
+
+	for(;;) {
+		if(len + RECV_REPLY_CHUNK > *cap) {
+			*cap = *cap ? *cap << 1 : RECV_REPLY_CHUNK << 2;
+			if((*buf = (char*) realloc(*buf, *cap)) == NULL)
+				exit(EXIT_FAILURE);
+		}
+
+		int err = recv(sd, *buf + len, *cap - len, 0);
+		if(err < 0) {
+			if(errno == EINTR)
+				continue;
+
+			return RECV_REPLY_ERROR;
+		} else if(err == 0)
+			return RECV_REPLY_CLOSED;
+
+		//one request at a time: the terminator is the last byte received
+		len += err;
+		if((*buf)[len - 1] == 0)
+			return (int) len;
+	}
+}
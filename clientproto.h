@@ -0,0 +1,55 @@
+#ifndef CLIENTPROTO_H
+#define CLIENTPROTO_H
+
+#include <netinet/in.h>
+
+#define SOCKET_ERROR -1
+#define CONNECT_ERROR -2
+
+#define RECV_REPLY_ERROR -1 //recv fallita, errno impostato
+#define RECV_REPLY_CLOSED -2 //connessione chiusa prima della fine della risposta
+
+/*
+ * parti del protocollo testuale comuni a tktcli e tktbench
+ */
+
+/*
+ * host_lookup
+ *		indirizzo di hostname:port, sin_family == 0 se non risolvibile.
+ *		Non thread safe (gethostbyname)
+ */
+struct sockaddr_in host_lookup(const char* hostname, unsigned short port);
+
+/*
+ * select_show
+ *		le richieste successive sono per lo spettacolo id ("@id:")
+ */
+void select_show(unsigned id);
+
+/*
+ * make_request
+ *		richiesta completa: [@id:]op[arg]\r\n, allocata con malloc
+ */
+char* make_request(const char* op, const char* arg, int arg_len, int* out_len);
+
+/*
+ * get_connected_socket
+ *		socket connesso ad addr, SOCKET_ERROR o CONNECT_ERROR altrimenti
+ */
+int get_connected_socket(struct sockaddr_in* addr);
+
+/*
+ * recv_reply
+ *
+ * DESCRIZIONE:
+ *		riceve da sd una risposta testuale intera (fino al '\0' che la
+ *		termina) in *buf, allungato se serve (*cap bytes, può essere
+ *		NULL e 0 la prima volta)
+ *
+ * RITORNA:
+ *		* la lunghezza della risposta, terminatore incluso
+ *		* RECV_REPLY_ERROR o RECV_REPLY_CLOSED altrimenti
+ */
+int recv_reply(int sd, char** buf, unsigned* cap);
+
+#endif
@@ -0,0 +1,51 @@
+/* alloccount.c - allocation counter
+	ITA: con -DCOUNT_ALLOCS malloc, calloc e realloc sono sostituite da
+		funzioni che contano le chiamate e passano alle implementazioni
+		della libc: il numero di allocazioni per richiesta si misura 
+		confrontando il contatore prima e dopo un gruppo di richieste.
+
+		make COMMON_DEFINES="-DPOSIX_VERSION -DCOUNT_ALLOCS"
+*/
+
+#include <stddef.h>
+
+#include "alloccount.h"
+
+#ifdef COUNT_ALLOCS
+
+extern void* __libc_malloc(size_t);
+extern void* __libc_calloc(size_t, size_t);
+extern void* __libc_realloc(void*, size_t);
+
+/* NOT exposed */
+static unsigned long __alloccount_calls;
+
+#define __alloccount_inc() (__atomic_add_fetch(&__alloccount_calls, 1, __ATOMIC_RELAXED))
+
+void* malloc(size_t n) {
+	__alloccount_inc();
+	return __libc_malloc(n);
+}
+
+void* calloc(size_t n, size_t size) {
+	__alloccount_inc();
+	return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t n) {
+	__alloccount_inc();
+	return __libc_realloc(p, n);
+}
+
+/* exposed */
+unsigned long alloccount_get() {
+	return __atomic_load_n(&__alloccount_calls, __ATOMIC_RELAXED);
+}
+
+#else
+
+unsigned long alloccount_get() {
+	return 0;
+}
+
+#endif
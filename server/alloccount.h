@@ -0,0 +1,12 @@
+#ifndef ALLOCCOUNT_H
+#define ALLOCCOUNT_H
+
+/*
+ * alloccount_get
+ *		chiamate a malloc, calloc e realloc dall'avvio del processo,
+ *		tutti i thread inclusi. Contate solo se compilato con 
+ *		-DCOUNT_ALLOCS, altrimenti ritorna sempre 0
+ */
+unsigned long alloccount_get();
+
+#endif
@@ -0,0 +1,116 @@
+/* arena.c - bump allocator for per-request memory
+	ITA: la memoria di una richiesta (argomenti decodificati, risposta)
+		vive solo fino alla risposta successiva dello stesso worker:
+		ogni allocazione è un incremento di un offset, il reset azzera
+		l'offset. Se un blocco non basta se ne aggiunge uno più grande,
+		al reset i blocchi vengono fusi in uno solo della dimensione
+		totale, così la richiesta successiva non ne ha più bisogno.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "malloc_utils.h"
+#include "arena.h"
+
+#define ARENA_HEADER ((sizeof(arena_block) + ARENA_ALIGN - 1) & ~((unsigned long) ARENA_ALIGN - 1))
+
+#define __arena_round(n) (((n) + ARENA_ALIGN - 1) & ~((unsigned long) ARENA_ALIGN - 1))
+
+/* NOT exposed */
+static char* __arena_data(arena_block* b) {
+	return (char*) b + ARENA_HEADER;
+}
+
+static arena_block* __arena_new_block(arena_block* prev, unsigned long cap) {
+	arena_block* b = (arena_block*) malloc(ARENA_HEADER + cap);
+	malloc_check_exit_on_error(b);
+
+	b->prev = prev;
+	b->cap = cap;
+	b->used = 0;
+	return b;
+}
+
+static void __arena_free_blocks(arena_block* b) {
+	while(b) {
+		arena_block* prev = b->prev;
+		free(b);
+		b = prev;
+	}
+}
+
+/* exposed */
+void arena_init(arena* a, unsigned long keep_max) {
+	a->head = NULL;
+	a->last = NULL;
+	a->keep_max = keep_max;
+}
+
+void arena_finish(arena* a) {
+	__arena_free_blocks(a->head);
+	a->head = NULL;
+	a->last = NULL;
+}
+
+void* arena_alloc(arena* a, unsigned long n) {
+	n = __arena_round(n ? n : 1);
+
+	arena_block* b = a->head;
+	if(b == NULL || b->cap - b->used < n) {
+		unsigned long cap = b ? b->cap << 1 : ARENA_MIN_BLOCK;
+		while(cap < n)
+			cap <<= 1;
+
+		b = a->head = __arena_new_block(b, cap);
+	}
+
+	void* p = __arena_data(b) + b->used;
+	b->used += n;
+	a->last = p;
+	return p;
+}
+
+void* arena_grow(arena* a, void* p, unsigned long old_n, unsigned long new_n) {
+	if(new_n <= old_n)
+		return p;
+
+	arena_block* b = a->head;
+	if(p != NULL && p == a->last) {
+		unsigned long offset = (unsigned long) ((char*) p - __arena_data(b));
+		unsigned long need = __arena_round(new_n);
+
+		if(b->cap - offset >= need) {
+			b->used = offset + need;
+			return p;
+		}
+	}
+
+	void* np = arena_alloc(a, new_n);
+	if(old_n)
+		memcpy(np, p, old_n);
+
+	return np;
+}
+
+void arena_reset(arena* a) {
+	arena_block* b = a->head;
+	a->last = NULL;
+
+	if(b == NULL)
+		return;
+
+	if(b->prev == NULL && b->cap <= a->keep_max) {
+		b->used = 0;
+		return;
+	}
+
+	//more than one block: replace them with one as large as all of them
+	unsigned long total = 0;
+	for(arena_block* i = b; i; i = i->prev)
+		total += i->cap;
+
+	__arena_free_blocks(b);
+	a->head = total <= a->keep_max ? __arena_new_block(NULL, total) : NULL;
+}
@@ -0,0 +1,68 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#define ARENA_ALIGN 16
+#define ARENA_MIN_BLOCK 4096
+
+/*
+ * blocco di memoria, i dati seguono l'intestazione
+ */
+typedef struct __arena_block {
+	struct __arena_block* prev;
+	unsigned long cap;
+	unsigned long used;
+} arena_block;
+
+/*
+ * allocatore a incremento per la memoria temporanea di una richiesta:
+ * nessuna free per singola allocazione, arena_reset libera tutto
+ * insieme. Dopo un reset la memoria resta all'arena (un solo blocco,
+ * grande quanto tutti quelli usati), a regime quindi nessuna malloc.
+ * Non thread safe, ogni worker ha la propria.
+ */
+typedef struct {
+	arena_block* head;
+	void* last; //ultima allocazione, l'unica che arena_grow può estendere
+	unsigned long keep_max; //oltre questa dimensione il blocco è liberato al reset
+} arena;
+
+/*
+ * arena_init
+ *		arena vuota, nessuna allocazione fino alla prima arena_alloc.
+ *		keep_max limita la memoria trattenuta tra un reset e l'altro
+ */
+void arena_init(arena* a, unsigned long keep_max);
+
+/*
+ * arena_finish
+ *		libera tutti i blocchi
+ */
+void arena_finish(arena* a);
+
+/*
+ * arena_alloc
+ *		n bytes allineati ad ARENA_ALIGN, validi fino al prossimo
+ *		arena_reset. Termina il processo se la memoria è esaurita
+ */
+void* arena_alloc(arena* a, unsigned long n);
+
+/*
+ * arena_grow
+ *
+ * DESCRIZIONE:
+ *		porta l'allocazione p da old_n a new_n bytes, sul posto se p è
+ *		l'ultima allocazione e il blocco ha spazio, altrimenti copiandola
+ *
+ * RITORNA:
+ *		il nuovo indirizzo di p
+ */
+void* arena_grow(arena* a, void* p, unsigned long old_n, unsigned long new_n);
+
+/*
+ * arena_reset
+ *		rende riutilizzabile tutta la memoria dell'arena, le allocazioni
+ *		precedenti non sono più valide
+ */
+void arena_reset(arena* a);
+
+#endif
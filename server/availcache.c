@@ -0,0 +1,225 @@
+/* availcache.c - pre-serialized GetAvailableSeats reply
+	ITA: ogni riga ha il proprio frammento di testo, segnato come sporco
+		da chi prenota o revoca. Alla richiesta successiva vengono
+		serializzate solo le righe sporche e i frammenti sono concatenati
+		in una risposta completa, che viene poi solo copiata finché la
+		sala non cambia.
+
+	Ordinamento: chi scrive modifica la bitmap, poi imposta row.dirty e
+	infine stale (release). Chi ricostruisce azzera stale prima di
+	azzerare i dirty (acquire): una modifica che arriva durante la
+	ricostruzione lascia stale a 1 e sarà raccolta dalla richiesta
+	successiva.
+
+	La ricostruzione è una lettura seqlock della seatmap: se una scrittura
+	la attraversa, le righe appena serializzate tornano sporche e si
+	ripete. La risposta corrisponde quindi sempre a una sola versione
+	della sala, mai a metà di una prenotazione su più righe.
+*/
+
+#define _GNU_SOURCE //pthread_rwlockattr_setkind_np
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "malloc_utils.h"
+#include "numfmt.h"
+#include "availcache.h"
+
+/* NOT exposed */
+static void __availcache_serialize_row(availcache* ac, unsigned r) {
+	availcache_row* row = &ac->rows[r];
+	unsigned n_free = seatmap_row_free_list(ac->sm, r, ac->cols);
+
+	char prefix[NUMFMT_UINT_MAX_DIGITS + 1];
+	unsigned prefix_len = numfmt_utoa(r + 1, prefix);
+	prefix[prefix_len++] = ',';
+
+	unsigned len = 0;
+	for(unsigned j = 0; j < n_free; ++j) {
+		memcpy(row->text + len, prefix, prefix_len);
+		len += prefix_len;
+		len += numfmt_utoa(ac->cols[j] + 1, row->text + len);
+		row->text[len++] = ',';
+	}
+
+	row->len = len;
+}
+
+static void __availcache_gather(availcache* ac) {
+	unsigned len = 0;
+
+	for(unsigned r = 0; r < ac->sm->rows; ++r) {
+		memcpy(ac->reply + len, ac->rows[r].text, ac->rows[r].len);
+		len += ac->rows[r].len;
+	}
+
+	//last ',' becomes the terminator
+	if(len > 0)
+		--len;
+
+	ac->reply[len] = 0;
+	ac->reply_len = len + 1;
+}
+
+static void __availcache_rebuild(availcache* ac) {
+	if(!__atomic_exchange_n(&ac->stale, 0, __ATOMIC_ACQUIRE))
+		return;
+
+	unsigned long version;
+	for(;;) {
+		unsigned n_touched = 0;
+		version = seatmap_read_begin(ac->sm);
+
+		for(unsigned r = 0; r < ac->sm->rows; ++r) {
+			if(__atomic_exchange_n(&ac->rows[r].dirty, 0, __ATOMIC_ACQUIRE)) {
+				__availcache_serialize_row(ac, r);
+				ac->touched[n_touched++] = r;
+			}
+		}
+
+		if(!seatmap_read_retry(ac->sm, version))
+			break;
+
+		//a write overlapped, what was serialized may be torn
+		for(unsigned i = 0; i < n_touched; ++i)
+			__atomic_store_n(&ac->rows[ac->touched[i]].dirty, 1, __ATOMIC_RELAXED);
+	}
+
+	__availcache_gather(ac);
+	ac->version = version;
+}
+
+static char* __availcache_copy(const availcache* ac, int with_version, arena* a, unsigned* out_len) {
+	char prefix[NUMFMT_ULONG_MAX_DIGITS + 1];
+	unsigned prefix_len = 0;
+
+	if(with_version) {
+		prefix_len = numfmt_ultoa(ac->version, prefix);
+		prefix[prefix_len++] = ':';
+	}
+
+	char* res = (char*) arena_alloc(a, prefix_len + ac->reply_len);
+	memcpy(res, prefix, prefix_len);
+	memcpy(res + prefix_len, ac->reply, ac->reply_len);
+	*out_len = prefix_len + ac->reply_len;
+	return res;
+}
+
+/* exposed */
+int availcache_init(availcache* ac, const seatmap* sm) {
+	if(sm == NULL || sm->rows == 0 || sm->pols == 0)
+		return AVAILCACHE_INIT_INVAL;
+
+	memset(ac, 0, sizeof(availcache));
+	ac->sm = sm;
+
+	if((ac->rows = (availcache_row*) calloc(sm->rows, sizeof(availcache_row))) == NULL)
+		goto malloc_failure;
+
+	if((ac->cols = (unsigned*) malloc(sizeof(unsigned) * sm->pols)) == NULL)
+		goto malloc_failure;
+
+	if((ac->touched = (unsigned*) malloc(sizeof(unsigned) * sm->rows)) == NULL)
+		goto malloc_failure;
+
+	unsigned long total = 1;
+	unsigned pols_digits = numfmt_digits(sm->pols);
+
+	for(unsigned r = 0; r < sm->rows; ++r) {
+		//worst case, every seat of the row is free
+		unsigned long cap = (unsigned long) sm->pols * (numfmt_digits(r + 1) + pols_digits + 2);
+		if((ac->rows[r].text = (char*) malloc(cap)) == NULL)
+			goto malloc_failure;
+
+		ac->rows[r].dirty = 1;
+		total += cap;
+	}
+
+	if((ac->reply = (char*) malloc(total)) == NULL)
+		goto malloc_failure;
+
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	//readers are the vast majority, a booking must not wait behind all of them
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	int err = pthread_rwlock_init(&ac->lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+
+	if(err) {
+		errno = err;
+		malloc_free(ac->reply);
+		availcache_finish(ac);
+		return AVAILCACHE_INIT_RWLOCK_FAILURE;
+	}
+
+	//the hall may still be replaced (snapshot, replay), the first request serializes it
+	ac->stale = 1;
+
+	return AVAILCACHE_OK;
+
+malloc_failure:
+	availcache_finish(ac);
+	return AVAILCACHE_INIT_MALLOC_FAILURE;
+}
+
+void availcache_finish(availcache* ac) {
+	if(ac->rows) {
+		for(unsigned r = 0; r < ac->sm->rows; ++r)
+			malloc_free(ac->rows[r].text);
+	}
+
+	if(ac->reply)
+		pthread_rwlock_destroy(&ac->lock);
+
+	malloc_free(ac->rows);
+	malloc_free(ac->cols);
+	malloc_free(ac->touched);
+	malloc_free(ac->reply);
+}
+
+void availcache_mark_dirty(availcache* ac, unsigned r) {
+	__atomic_store_n(&ac->rows[r].dirty, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ac->stale, 1, __ATOMIC_RELEASE);
+}
+
+char* availcache_reply(availcache* ac, int with_version, arena* a, unsigned* out_len) {
+	char* res;
+
+	pthread_rwlock_rdlock(&ac->lock);
+	if(!__atomic_load_n(&ac->stale, __ATOMIC_ACQUIRE)) {
+		res = __availcache_copy(ac, with_version, a, out_len);
+		pthread_rwlock_unlock(&ac->lock);
+		return res;
+	}
+	pthread_rwlock_unlock(&ac->lock);
+
+	pthread_rwlock_wrlock(&ac->lock);
+	__availcache_rebuild(ac);
+	res = __availcache_copy(ac, with_version, a, out_len);
+	pthread_rwlock_unlock(&ac->lock);
+
+	return res;
+}
+
+void availcache_strerror(int error, char* dst, int dst_max_size) {
+	int current_errno = errno;
+	memset(dst, 0, dst_max_size);
+	switch(error) {
+		case AVAILCACHE_INIT_INVAL:
+			memcpy(dst, "availcache_init: Invalid argument", sizeof("availcache_init: Invalid argument"));
+			break;
+		case AVAILCACHE_INIT_MALLOC_FAILURE:
+			snprintf(dst, dst_max_size, "availcache_init:malloc: %s", strerror(current_errno));
+			break;
+		case AVAILCACHE_INIT_RWLOCK_FAILURE:
+			snprintf(dst, dst_max_size, "availcache_init:pthread_rwlock_init: %s", strerror(current_errno));
+			break;
+
+		default:
+			snprintf(dst, dst_max_size, "availcache: Success");
+	}
+}
@@ -0,0 +1,87 @@
+#ifndef AVAILCACHE_H
+#define AVAILCACHE_H
+
+#include <pthread.h>
+
+#include "seatmap.h"
+#include "arena.h"
+
+#define AVAILCACHE_OK 0
+
+#define AVAILCACHE_INIT_INVAL 4
+#define AVAILCACHE_INIT_MALLOC_FAILURE 5
+#define AVAILCACHE_INIT_RWLOCK_FAILURE 6
+
+/*
+ * frammento serializzato di una riga: "r,c,r,c,...,r,c," (ogni posto
+ * libero seguito da una virgola), dirty != 0 se la riga è cambiata
+ * dall'ultima serializzazione
+ */
+typedef struct {
+	char* text;
+	unsigned len;
+	int dirty;
+} availcache_row;
+
+/*
+ * risposta GetAvailableSeats mantenuta in forma serializzata: un frammento
+ * per riga e la loro concatenazione, ricostruita solo se qualche riga è
+ * cambiata
+ */
+typedef struct {
+	const seatmap* sm;
+	availcache_row* rows;
+	unsigned* cols; //scratch per seatmap_row_free_list
+	unsigned* touched; //righe serializzate durante una ricostruzione
+	char* reply;
+	unsigned reply_len; //incluso il terminatore
+	unsigned long version; //versione della seatmap a cui corrisponde reply
+	int stale;
+	pthread_rwlock_t lock;
+} availcache;
+
+/*
+ * availcache_init
+ *
+ * DESCRIZIONE:
+ *		alloca i frammenti di tutte le righe di sm (dimensionati per il caso
+ *		peggiore, riga interamente libera), tutte sporche: la prima
+ *		richiesta serializza lo stato di quel momento
+ *
+ * RITORNA:
+ *		* AVAILCACHE_OK se tutto è andato a buon fine
+ *		* uno degli errori della classe AVAILCACHE_INIT_* altrimenti
+ */
+int availcache_init(availcache* ac, const seatmap* sm);
+
+/*
+ * availcache_finish
+ *		libera le risorse
+ */
+void availcache_finish(availcache* ac);
+
+/*
+ * availcache_mark_dirty
+ *		da chiamare dopo aver modificato la riga r della seatmap,
+ *		la riga sarà serializzata di nuovo alla prossima richiesta
+ */
+void availcache_mark_dirty(availcache* ac, unsigned r);
+
+/*
+ * availcache_reply
+ *
+ * DESCRIZIONE:
+ *		copia della risposta ("r,c,...,r,c\0"), allocata nell'arena a, 
+ *		preceduta da "versione:" se with_version != 0.
+ *		Se nessuna riga è cambiata è una sola memcpy, altrimenti solo
+ *		le righe cambiate vengono serializzate di nuovo. Corrisponde sempre 
+ *		a un'unica versione della seatmap.
+ *
+ * RITORNA:
+ *		la risposta, in *out_len la sua lunghezza (terminatore incluso)
+ */
+char* availcache_reply(availcache* ac, int with_version, arena* a, unsigned* out_len);
+
+void availcache_strerror(int error, char* dst, int dst_size);
+
+#endif
@@ -0,0 +1,277 @@
+/* bookidx.c - booking code generator and code -> seats index
+	ITA: RevokeBooking trova i posti di una prenotazione con una sola
+		ricerca nella tabella, senza scandire la sala.
+		I codici sono un contatore cifrato con una permutazione a chiave:
+		distinti per costruzione (una permutazione è biiettiva) e non
+		consecutivi, un client non può indovinare i codici altrui
+		partendo dal proprio.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include "malloc_utils.h"
+#include "bookidx.h"
+
+#define BOOKIDX_ROUNDS 4
+
+/* NOT exposed */
+static unsigned __bookidx_round(unsigned half, unsigned key) {
+	unsigned f = half * 0x9E3779B1u + key;
+	f ^= f >> 15;
+	f *= 0x85EBCA77u;
+	f ^= f >> 13;
+	return f & 0xffff;
+}
+
+static unsigned __bookidx_permute(const unsigned* key, unsigned x) {
+	unsigned l = x >> 16;
+	unsigned r = x & 0xffff;
+
+	for(int i = 0; i < BOOKIDX_ROUNDS; ++i) {
+		unsigned t = r;
+		r = l ^ __bookidx_round(r, key[i]);
+		l = t;
+	}
+
+	return (l << 16) | r;
+}
+
+static unsigned __bookidx_unpermute(const unsigned* key, unsigned x) {
+	unsigned l = x >> 16;
+	unsigned r = x & 0xffff;
+
+	for(int i = BOOKIDX_ROUNDS; i > 0; --i) {
+		unsigned t = l;
+		l = r ^ __bookidx_round(l, key[i - 1]);
+		r = t;
+	}
+
+	return (l << 16) | r;
+}
+
+static unsigned __bookidx_home(const bookidx* bi, unsigned code) {
+	return (code * 0x9E3779B1u) & (bi->capacity - 1);
+}
+
+static bookidx_entry* __bookidx_find(const bookidx* bi, unsigned code) {
+	unsigned mask = bi->capacity - 1;
+
+	for(unsigned i = __bookidx_home(bi, code); ; i = (i + 1) & mask) {
+		if(bi->slots[i].code == code)
+			return &bi->slots[i];
+
+		if(bi->slots[i].code == 0)
+			return NULL;
+	}
+}
+
+static void __bookidx_place(bookidx* bi, const bookidx_entry* e) {
+	unsigned mask = bi->capacity - 1;
+	unsigned i = __bookidx_home(bi, e->code);
+
+	while(bi->slots[i].code != 0)
+		i = (i + 1) & mask;
+
+	bi->slots[i] = *e;
+}
+
+/* smallest c with 2^c >= n_seats, n_seats > BOOKIDX_INLINE_SEATS */
+static unsigned __bookidx_size_class(unsigned n_seats) {
+	return 32 - (unsigned) __builtin_clz(n_seats - 1);
+}
+
+/* a block of the class of n_seats, a released one if any: its first word links the list */
+static unsigned* __bookidx_block_alloc(bookidx* bi, unsigned n_seats) {
+	unsigned c = __bookidx_size_class(n_seats);
+
+	void* block = bi->free_blocks[c];
+	if(block) {
+		bi->free_blocks[c] = *(void**) block;
+		return (unsigned*) block;
+	}
+
+	unsigned* seats = (unsigned*) malloc(sizeof(unsigned) << c);
+	malloc_check_exit_on_error(seats);
+	return seats;
+}
+
+static void __bookidx_block_free(bookidx* bi, unsigned* seats, unsigned n_seats) {
+	unsigned c = __bookidx_size_class(n_seats);
+
+	*(void**) seats = bi->free_blocks[c];
+	bi->free_blocks[c] = seats;
+}
+
+static void __bookidx_grow(bookidx* bi) {
+	bookidx_entry* old = bi->slots;
+	unsigned old_capacity = bi->capacity;
+
+	bi->capacity <<= 1;
+	bi->slots = (bookidx_entry*) calloc(bi->capacity, sizeof(bookidx_entry));
+	malloc_check_exit_on_error(bi->slots);
+
+	for(unsigned i = 0; i < old_capacity; ++i)
+		if(old[i].code != 0)
+			__bookidx_place(bi, &old[i]);
+
+	free(old);
+}
+
+/* exposed */
+int bookidx_init(bookidx* bi, unsigned capacity) {
+	if(capacity == 0 || capacity > (1U << 31))
+		return BOOKIDX_INIT_INVAL;
+
+	unsigned cap = 1;
+	while(cap < capacity)
+		cap <<= 1;
+
+	memset(bi, 0, sizeof(bookidx));
+	bi->capacity = cap;
+
+	if((bi->slots = (bookidx_entry*) calloc(cap, sizeof(bookidx_entry))) == NULL)
+		return BOOKIDX_INIT_MALLOC_FAILURE;
+
+	if(getrandom(bi->key, sizeof(bi->key), 0) != sizeof(bi->key)) {
+		//weaker, codes are still unique
+		unsigned seed = (unsigned) time(NULL) ^ ((unsigned) getpid() << 16);
+		for(int i = 0; i < BOOKIDX_ROUNDS; ++i)
+			bi->key[i] = seed = seed * 1103515245u + 12345u;
+	}
+
+	return BOOKIDX_OK;
+}
+
+void bookidx_finish(bookidx* bi) {
+	if(bi->slots) {
+		for(unsigned i = 0; i < bi->capacity; ++i)
+			if(bi->slots[i].code != 0 && bi->slots[i].n_seats > BOOKIDX_INLINE_SEATS)
+				malloc_free(bi->slots[i].seats);
+	}
+
+	malloc_free(bi->slots);
+
+	for(unsigned c = 0; c < BOOKIDX_SIZE_CLASSES; ++c) {
+		while(bi->free_blocks[c]) {
+			void* next = *(void**) bi->free_blocks[c];
+			free(bi->free_blocks[c]);
+			bi->free_blocks[c] = next;
+		}
+	}
+}
+
+unsigned bookidx_next_code(bookidx* bi) {
+	unsigned code;
+
+	do {
+		unsigned n = __atomic_add_fetch(&bi->counter, 1, __ATOMIC_RELAXED);
+		code = __bookidx_permute(bi->key, n);
+	} while(code == 0);
+
+	return code;
+}
+
+void bookidx_set_key(bookidx* bi, const unsigned* key) {
+	memcpy(bi->key, key, sizeof(bi->key));
+}
+
+void bookidx_set_counter(bookidx* bi, unsigned counter) {
+	bi->counter = counter;
+}
+
+unsigned bookidx_get_counter(const bookidx* bi) {
+	return __atomic_load_n(&bi->counter, __ATOMIC_RELAXED);
+}
+
+void bookidx_advance(bookidx* bi, unsigned code) {
+	unsigned n = __bookidx_unpermute(bi->key, code);
+	if(n > bi->counter)
+		bi->counter = n;
+}
+
+void bookidx_insert(bookidx* bi, unsigned code, const unsigned* seats, unsigned n_seats) {
+	if((bi->size + 1) * 10 > bi->capacity * 7)
+		__bookidx_grow(bi);
+
+	bookidx_entry e;
+	e.code = code;
+	e.n_seats = n_seats;
+
+	if(n_seats <= BOOKIDX_INLINE_SEATS)
+		memcpy(e.inline_seats, seats, sizeof(unsigned) * n_seats);
+	else {
+		e.seats = __bookidx_block_alloc(bi, n_seats);
+		memcpy(e.seats, seats, sizeof(unsigned) * n_seats);
+	}
+
+	__bookidx_place(bi, &e);
+	++bi->size;
+}
+
+unsigned bookidx_remove(bookidx* bi, unsigned code, bookidx_entry* out) {
+	if(code == 0)
+		return 0;
+
+	bookidx_entry* e = __bookidx_find(bi, code);
+	if(e == NULL)
+		return 0;
+
+	unsigned n_seats = e->n_seats;
+	*out = *e;
+	--bi->size;
+
+	//backward shift: pull back every entry of the cluster that may use the hole
+	unsigned mask = bi->capacity - 1;
+	unsigned hole = (unsigned) (e - bi->slots);
+	unsigned j = hole;
+
+	for(;;) {
+		j = (j + 1) & mask;
+		if(bi->slots[j].code == 0)
+			break;
+
+		unsigned home = __bookidx_home(bi, bi->slots[j].code);
+		int stays = hole <= j ? (home > hole && home <= j) : (home > hole || home <= j);
+		if(!stays) {
+			bi->slots[hole] = bi->slots[j];
+			hole = j;
+		}
+	}
+
+	bi->slots[hole].code = 0;
+	bi->slots[hole].n_seats = 0;
+	return n_seats;
+}
+
+const unsigned* bookidx_entry_seats(const bookidx_entry* e) {
+	return e->n_seats <= BOOKIDX_INLINE_SEATS ? e->inline_seats : e->seats;
+}
+
+void bookidx_entry_release(bookidx* bi, bookidx_entry* e) {
+	if(e->n_seats > BOOKIDX_INLINE_SEATS)
+		__bookidx_block_free(bi, e->seats, e->n_seats);
+
+	e->n_seats = 0;
+}
+
+void bookidx_strerror(int error, char* dst, int dst_max_size) {
+	int current_errno = errno;
+	memset(dst, 0, dst_max_size);
+	switch(error) {
+		case BOOKIDX_INIT_INVAL:
+			memcpy(dst, "bookidx_init: Invalid argument", sizeof("bookidx_init: Invalid argument"));
+			break;
+		case BOOKIDX_INIT_MALLOC_FAILURE:
+			snprintf(dst, dst_max_size, "bookidx_init:malloc: %s", strerror(current_errno));
+			break;
+
+		default:
+			snprintf(dst, dst_max_size, "bookidx: Success");
+	}
+}
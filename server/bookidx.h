@@ -0,0 +1,141 @@
+#ifndef BOOKIDX_H
+#define BOOKIDX_H
+
+#define BOOKIDX_OK 0
+
+#define BOOKIDX_INIT_INVAL 4
+#define BOOKIDX_INIT_MALLOC_FAILURE 5
+
+#define BOOKIDX_INLINE_SEATS 4 //prenotazioni fino a 4 posti non allocano memoria
+#define BOOKIDX_SIZE_CLASSES 33 //blocchi di posti da 2^c elementi, c <= 32
+#define BOOKIDX_KEY_WORDS 4
+
+/*
+ * una prenotazione: il codice e i posti (indici lineari, riga * pols + colonna)
+ * code == 0 indica uno slot libero della tabella.
+ * Fino a BOOKIDX_INLINE_SEATS posti sono nello slot stesso, oltre sono
+ * in un blocco a parte: usare bookidx_entry_seats per leggerli
+ */
+typedef struct {
+	unsigned code;
+	unsigned n_seats;
+	union {
+		unsigned inline_seats[BOOKIDX_INLINE_SEATS];
+		unsigned* seats;
+	};
+} bookidx_entry;
+
+/*
+ * indice codice -> posti prenotati: tabella hash ad indirizzamento aperto
+ * (linear probing, capacità potenza di 2, cancellazione per spostamento
+ * all'indietro, nessuna tombstone) e generatore di codici.
+ * I blocchi dei posti di prenotazioni revocate restano in una lista per
+ * classe di dimensione (potenze di 2) e sono riusati dagli inserimenti
+ * successivi: a regime prenotare e revocare non alloca memoria, quella
+ * trattenuta non supera quella del picco di prenotazioni grandi
+ */
+typedef struct {
+	bookidx_entry* slots;
+	unsigned capacity;
+	unsigned size;
+	unsigned counter;
+	unsigned key[BOOKIDX_KEY_WORDS];
+	void* free_blocks[BOOKIDX_SIZE_CLASSES];
+} bookidx;
+
+/*
+ * bookidx_init
+ *
+ * DESCRIZIONE:
+ *		alloca la tabella (capacity arrotondata alla potenza di 2 successiva)
+ *		e sceglie una chiave casuale per il generatore di codici
+ *
+ * NOTA BENE:
+ *		capacity > 0
+ *
+ * RITORNA:
+ *		* BOOKIDX_OK se tutto è andato a buon fine
+ *		* uno degli errori della classe BOOKIDX_INIT_* altrimenti
+ */
+int bookidx_init(bookidx* bi, unsigned capacity);
+
+/*
+ * bookidx_finish
+ *		libera la tabella, i posti di tutte le prenotazioni e i blocchi
+ *		in attesa di essere riusati
+ */
+void bookidx_finish(bookidx* bi);
+
+/*
+ * bookidx_next_code
+ *		nuovo codice di prenotazione, mai 0: un contatore passato per una
+ *		permutazione a chiave (Feistel a 4 round su 32 bit), quindi codici
+ *		distinti per 2^32 - 1 prenotazioni e non prevedibili dal client.
+ *		Thread safe.
+ */
+unsigned bookidx_next_code(bookidx* bi);
+
+/*
+ * bookidx_set_key
+ *		sostituisce la chiave del generatore (BOOKIDX_KEY_WORDS parole),
+ *		per ritrovare i codici di un'esecuzione precedente.
+ *		Non thread safe
+ */
+void bookidx_set_key(bookidx* bi, const unsigned* key);
+
+/*
+ * bookidx_set_counter
+ *		riprende il contatore del generatore da counter (snapshot).
+ *		Non thread safe
+ */
+void bookidx_set_counter(bookidx* bi, unsigned counter);
+
+/*
+ * bookidx_get_counter
+ *		valore attuale del contatore, ogni codice già generato viene da
+ *		un valore minore o uguale. Thread safe
+ */
+unsigned bookidx_get_counter(const bookidx* bi);
+
+/*
+ * bookidx_advance
+ *		porta il contatore oltre quello che ha generato code: i codici
+ *		successivi non ripetono code. Non thread safe
+ */
+void bookidx_advance(bookidx* bi, unsigned code);
+
+/*
+ * bookidx_insert
+ *		associa a code una copia di seats (n_seats elementi), in un
+ *		blocco riusato se possibile; la tabella cresce oltre il 70% di
+ *		occupazione.
+ *		Non thread safe, code non deve essere già presente
+ */
+void bookidx_insert(bookidx* bi, unsigned code, const unsigned* seats, unsigned n_seats);
+
+/*
+ * bookidx_remove
+ *		rimuove code, in *out la sua prenotazione (da rilasciare con
+ *		bookidx_entry_release), ritorna il numero dei posti, 0 se code 
+ *		non è presente.
+ *		Non thread safe
+ */
+unsigned bookidx_remove(bookidx* bi, unsigned code, bookidx_entry* out);
+
+/*
+ * bookidx_entry_seats
+ *		i posti della prenotazione e
+ */
+const unsigned* bookidx_entry_seats(const bookidx_entry* e);
+
+/*
+ * bookidx_entry_release
+ *		restituisce all'indice il blocco dei posti di una prenotazione
+ *		rimossa, se oltre BOOKIDX_INLINE_SEATS.
+ *		Non thread safe, come bookidx_insert
+ */
+void bookidx_entry_release(bookidx* bi, bookidx_entry* e);
+
+void bookidx_strerror(int error, char* dst, int dst_size);
+
+#endif
@@ -0,0 +1,552 @@
+/* booking.c - booking engine with per-row locks
+	ITA: prenotazioni su righe diverse procedono in parallelo. Ogni
+		richiesta blocca le righe che tocca, ordinate e senza duplicati,
+		verifica che tutti i posti siano liberi e li prenota; solo
+		l'inserimento nell'indice dei codici è serializzato.
+		La revoca rimuove il codice dall'indice (una sola revoca può
+		ottenerne i posti) e poi blocca le righe come una prenotazione.
+		Un gruppo di prenotazioni (BookBatch) blocca una volta sola le
+		righe di tutte e l'indice una volta sola per tutti i codici.
+		BookBest blocca una riga alla volta, nell'ordine di preferenza,
+		e prenota nella prima in cui trova abbastanza posti consecutivi:
+		un solo lock tenuto, nessun ordine da rispettare.
+
+	Le modifiche ai posti e le righe segnate nella cache stanno nella
+	stessa sezione seatmap_write_begin/end: chi legge una versione
+	valida vede tutte le righe cambiate fino a quella versione.
+
+	Il record del giornale è accodato con le righe ancora bloccate,
+	l'attesa del disco avviene dopo averle sbloccate: altre richieste
+	sulle stesse righe entrano nello stesso fdatasync.
+
+	Un lock già occupato (trylock fallito) è contato e cronometrato nei
+	contatori del thread, l'acquisizione libera non legge l'orologio.
+
+	Le righe di una richiesta con più di BOOKING_STACK_ROWS posti stanno
+	in un buffer del thread, riusato dalle richieste successive.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "malloc_utils.h"
+#include "booking.h"
+
+#define BOOKING_STACK_ROWS 64
+#define BOOKING_RADIX_BUCKETS 65536
+
+/* NOT exposed */
+static __thread unsigned long __booking_lock_waits = 0;
+static __thread unsigned long __booking_lock_wait_ns = 0;
+
+//rows of requests beyond BOOKING_STACK_ROWS seats, kept by the thread until it exits
+static __thread unsigned* __booking_rows_buf = NULL;
+static __thread unsigned __booking_rows_cap = 0;
+static pthread_key_t __booking_rows_key;
+static pthread_once_t __booking_rows_once = PTHREAD_ONCE_INIT;
+
+static void __booking_lock(pthread_mutex_t* mtx) {
+	if(pthread_mutex_trylock(mtx) == 0)
+		return;
+
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pthread_mutex_lock(mtx);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	++__booking_lock_waits;
+	__booking_lock_wait_ns += (t1.tv_sec - t0.tv_sec) * 1000000000UL + t1.tv_nsec - t0.tv_nsec;
+}
+
+static int __booking_cmp_rows(const void* a, const void* b) {
+	unsigned x = *(const unsigned*) a;
+	unsigned y = *(const unsigned*) b;
+	return (x > y) - (x < y);
+}
+
+/* groups pairs by their high 32 bits: two 16 bit LSD radix passes, tmp as large as pairs */
+static void __booking_sort_pairs(unsigned long long* pairs, unsigned long long* tmp, unsigned long n) {
+	unsigned long* counts = (unsigned long*) malloc(sizeof(unsigned long) * BOOKING_RADIX_BUCKETS);
+	malloc_check_exit_on_error(counts);
+
+	for(int shift = 32; shift < 64; shift += 16) {
+		memset(counts, 0, sizeof(unsigned long) * BOOKING_RADIX_BUCKETS);
+		for(unsigned long i = 0; i < n; ++i)
+			++counts[(pairs[i] >> shift) & (BOOKING_RADIX_BUCKETS - 1)];
+
+		unsigned long sum = 0;
+		for(unsigned b = 0; b < BOOKING_RADIX_BUCKETS; ++b) {
+			unsigned long c = counts[b];
+			counts[b] = sum;
+			sum += c;
+		}
+
+		for(unsigned long i = 0; i < n; ++i)
+			tmp[counts[(pairs[i] >> shift) & (BOOKING_RADIX_BUCKETS - 1)]++] = pairs[i];
+
+		memcpy(pairs, tmp, sizeof(unsigned long long) * n);
+	}
+
+	free(counts);
+}
+
+/* rows (n_seats elements) <- sorted, distinct rows of seats, returns how many */
+static unsigned __booking_rows(const booking_engine* be, const unsigned* seats, unsigned n_seats,
+		unsigned* rows) {
+	for(unsigned i = 0; i < n_seats; ++i)
+		rows[i] = seats[i] / be->sm.pols;
+
+	qsort(rows, n_seats, sizeof(unsigned), __booking_cmp_rows);
+
+	unsigned n = 0;
+	for(unsigned i = 0; i < n_seats; ++i)
+		if(n == 0 || rows[n - 1] != rows[i])
+			rows[n++] = rows[i];
+
+	return n;
+}
+
+/* 1 if every seat is free, the rows locked */
+static int __booking_all_free(const booking_engine* be, const unsigned* seats, unsigned n_seats) {
+	for(unsigned i = 0; i < n_seats; ++i)
+		if(!seatmap_is_free(&be->sm, seats[i] / be->sm.pols, seats[i] % be->sm.pols))
+			return 0;
+
+	return 1;
+}
+
+static void __booking_lock_rows(booking_engine* be, const unsigned* rows, unsigned n_rows) {
+	for(unsigned i = 0; i < n_rows; ++i)
+		__booking_lock(&be->row_locks[rows[i]].mtx);
+}
+
+static void __booking_unlock_rows(booking_engine* be, const unsigned* rows, unsigned n_rows) {
+	for(unsigned i = n_rows; i > 0; --i)
+		pthread_mutex_unlock(&be->row_locks[rows[i - 1]].mtx);
+}
+
+static void __booking_rows_key_create() {
+	int err = pthread_key_create(&__booking_rows_key, free);
+	if(err != 0) {
+		errno = err;
+		perror("pthread_key_create");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* never nested: one request of the thread uses it at a time */
+static unsigned* __booking_rows_scratch(unsigned n_seats, unsigned* stack_rows) {
+	if(n_seats <= BOOKING_STACK_ROWS)
+		return stack_rows;
+
+	if(n_seats > __booking_rows_cap) {
+		unsigned cap = __booking_rows_cap ? __booking_rows_cap : BOOKING_STACK_ROWS;
+		while(cap < n_seats && cap < (1U << 31))
+			cap <<= 1;
+		if(cap < n_seats)
+			cap = n_seats;
+
+		__booking_rows_buf = (unsigned*) realloc(__booking_rows_buf, sizeof(unsigned) * (unsigned long) cap);
+		malloc_check_exit_on_error(__booking_rows_buf);
+		__booking_rows_cap = cap;
+
+		//freed by the key destructor when the thread exits
+		pthread_once(&__booking_rows_once, __booking_rows_key_create);
+		pthread_setspecific(__booking_rows_key, __booking_rows_buf);
+	}
+
+	return __booking_rows_buf;
+}
+
+/* books seats, all free and their rows locked; returns the journal lsn to wait for, in *out_code the code */
+static unsigned long __booking_commit(booking_engine* be, const unsigned* seats, unsigned n_seats,
+		const unsigned* rows, unsigned n_rows, unsigned* out_code) {
+	unsigned code = bookidx_next_code(&be->bi);
+
+	seatmap_write_begin(&be->sm);
+
+	for(unsigned i = 0; i < n_seats; ++i)
+		seatmap_book(&be->sm, seats[i] / be->sm.pols, seats[i] % be->sm.pols, code);
+
+	for(unsigned i = 0; i < n_rows; ++i)
+		availcache_mark_dirty(&be->ac, rows[i]);
+
+	seatmap_write_end(&be->sm);
+
+	__booking_lock(&be->idx_mtx);
+	bookidx_insert(&be->bi, code, seats, n_seats);
+	pthread_mutex_unlock(&be->idx_mtx);
+
+	*out_code = code;
+	return be->jr ? journal_append(be->jr, JOURNAL_REC_BOOK, be->jr_show_id, code, seats, n_seats) : 0;
+}
+
+/* exposed */
+int booking_init(booking_engine* be, unsigned rows, unsigned pols, unsigned bookings) {
+	if(rows == 0 || pols == 0 || bookings == 0)
+		return BOOKING_INIT_INVAL;
+
+	memset(be, 0, sizeof(booking_engine));
+
+	if(seatmap_init(&be->sm, rows, pols) != SEATMAP_OK)
+		goto malloc_failure;
+
+	int err = availcache_init(&be->ac, &be->sm);
+	if(err == AVAILCACHE_INIT_RWLOCK_FAILURE)
+		goto mutex_failure;
+	else if(err != AVAILCACHE_OK)
+		goto malloc_failure;
+
+	if(bookidx_init(&be->bi, bookings) != BOOKIDX_OK)
+		goto malloc_failure;
+
+	if(posix_memalign((void**) &be->row_locks, BOOKING_CACHE_LINE, sizeof(booking_row_lock) * rows) != 0) {
+		be->row_locks = NULL;
+		goto malloc_failure;
+	}
+
+	for(unsigned r = 0; r < rows; ++r) {
+		if((err = pthread_mutex_init(&be->row_locks[r].mtx, NULL)) != 0) {
+			errno = err;
+			goto mutex_failure;
+		}
+	}
+
+	if((err = pthread_mutex_init(&be->idx_mtx, NULL)) != 0) {
+		errno = err;
+		goto mutex_failure;
+	}
+
+	return BOOKING_OK;
+
+malloc_failure:
+	booking_finish(be);
+	return BOOKING_INIT_MALLOC_FAILURE;
+
+mutex_failure:
+	booking_finish(be);
+	return BOOKING_INIT_MUTEX_FAILURE;
+}
+
+void booking_finish(booking_engine* be) {
+	//mutexes are never held here, destroying them frees nothing on Linux
+	malloc_free(be->row_locks);
+	bookidx_finish(&be->bi);
+	availcache_finish(&be->ac);
+	seatmap_finish(&be->sm);
+}
+
+int booking_book(booking_engine* be, const unsigned* seats, unsigned n_seats, unsigned* out_code) {
+	unsigned stack_rows[BOOKING_STACK_ROWS];
+	unsigned* rows = __booking_rows_scratch(n_seats, stack_rows);
+	unsigned n_rows = __booking_rows(be, seats, n_seats, rows);
+
+	__booking_lock_rows(be, rows, n_rows);
+
+	for(unsigned i = 0; i < n_seats; ++i) {
+		if(!seatmap_is_free(&be->sm, seats[i] / be->sm.pols, seats[i] % be->sm.pols)) {
+			__booking_unlock_rows(be, rows, n_rows);
+			return BOOKING_NOTAVAIL;
+		}
+	}
+
+	unsigned long lsn = __booking_commit(be, seats, n_seats, rows, n_rows, out_code);
+
+	__booking_unlock_rows(be, rows, n_rows);
+
+	if(be->jr)
+		journal_wait(be->jr, lsn);
+
+	return BOOKING_OK;
+}
+
+int booking_book_best(booking_engine* be, unsigned n_seats, unsigned pref_row, unsigned* out_seats, 
+		unsigned* out_code) {
+	unsigned rows = be->sm.rows;
+	unsigned pols = be->sm.pols;
+	unsigned target = (pols - n_seats) >> 1;
+
+	//pref_row, pref_row + 1, pref_row - 1, pref_row + 2, ...
+	for(unsigned d = 0; d <= pref_row || pref_row + d < rows; ++d) {
+		for(int side = 0; side < 2; ++side) {
+			if((side == 0 && pref_row + d >= rows) || (side == 1 && (d == 0 || d > pref_row)))
+				continue;
+
+			unsigned r = side == 0 ? pref_row + d : pref_row - d;
+
+			__booking_lock(&be->row_locks[r].mtx);
+
+			unsigned c = seatmap_row_best_run(&be->sm, r, n_seats, target);
+			if(c == SEATMAP_NO_RUN) {
+				pthread_mutex_unlock(&be->row_locks[r].mtx);
+				continue;
+			}
+
+			for(unsigned i = 0; i < n_seats; ++i)
+				out_seats[i] = (unsigned) seatmap_index(&be->sm, r, c + i);
+
+			unsigned long lsn = __booking_commit(be, out_seats, n_seats, &r, 1, out_code);
+			pthread_mutex_unlock(&be->row_locks[r].mtx);
+
+			if(be->jr)
+				journal_wait(be->jr, lsn);
+
+			return BOOKING_OK;
+		}
+	}
+
+	return BOOKING_NOTAVAIL;
+}
+
+unsigned booking_book_batch(booking_engine* be, const unsigned* seats, const unsigned* n_seats,
+		unsigned n_bookings, unsigned* out_codes) {
+	unsigned long n_total = 0;
+	for(unsigned b = 0; b < n_bookings; ++b)
+		n_total += n_seats[b];
+
+	//every row of every booking, locked once for the whole batch
+	unsigned stack_rows[BOOKING_STACK_ROWS];
+	unsigned* rows = __booking_rows_scratch((unsigned) n_total, stack_rows);
+	unsigned n_rows = __booking_rows(be, seats, (unsigned) n_total, rows);
+
+	__booking_lock_rows(be, rows, n_rows);
+
+	/* the rows are locked, checking needs no write section: until the
+	 * first booking that fits nothing changes, if none fits readers and
+	 * the cache are left alone, as by a failed booking_book
+	 */
+	unsigned first = 0;
+	const unsigned* cur = seats;
+	for(; first < n_bookings; cur += n_seats[first++]) {
+		out_codes[first] = 0;
+		if(__booking_all_free(be, cur, n_seats[first]))
+			break;
+	}
+
+	//in order: a booking sees the seats taken by the previous ones
+	unsigned n_booked = 0;
+	if(first < n_bookings) {
+		seatmap_write_begin(&be->sm);
+
+		for(unsigned b = first; b < n_bookings; cur += n_seats[b++]) {
+			out_codes[b] = 0;
+			if(b > first && !__booking_all_free(be, cur, n_seats[b]))
+				continue;
+
+			out_codes[b] = bookidx_next_code(&be->bi);
+
+			unsigned last_row = be->sm.rows;
+			for(unsigned i = 0; i < n_seats[b]; ++i) {
+				unsigned r = cur[i] / be->sm.pols;
+				seatmap_book(&be->sm, r, cur[i] % be->sm.pols, out_codes[b]);
+
+				//only rows really changed get serialized again
+				if(r != last_row)
+					availcache_mark_dirty(&be->ac, last_row = r);
+			}
+
+			++n_booked;
+		}
+
+		seatmap_write_end(&be->sm);
+	}
+
+	unsigned long lsn = 0;
+	if(n_booked) {
+		__booking_lock(&be->idx_mtx);
+		cur = seats;
+		for(unsigned b = 0; b < n_bookings; cur += n_seats[b++])
+			if(out_codes[b])
+				bookidx_insert(&be->bi, out_codes[b], cur, n_seats[b]);
+		pthread_mutex_unlock(&be->idx_mtx);
+
+		//one record per booking, all covered by the wait for the last one
+		cur = seats;
+		for(unsigned b = 0; be->jr && b < n_bookings; cur += n_seats[b++])
+			if(out_codes[b])
+				lsn = journal_append(be->jr, JOURNAL_REC_BOOK, be->jr_show_id, out_codes[b], cur, n_seats[b]);
+	}
+
+	__booking_unlock_rows(be, rows, n_rows);
+
+	if(be->jr && n_booked)
+		journal_wait(be->jr, lsn);
+
+	return n_booked;
+}
+
+unsigned booking_revoke(booking_engine* be, unsigned code) {
+	bookidx_entry removed;
+
+	__booking_lock(&be->idx_mtx);
+	unsigned n_seats = bookidx_remove(&be->bi, code, &removed);
+	pthread_mutex_unlock(&be->idx_mtx);
+
+	if(n_seats == 0)
+		return 0;
+
+	const unsigned* seats = bookidx_entry_seats(&removed);
+
+	unsigned stack_rows[BOOKING_STACK_ROWS];
+	unsigned* rows = __booking_rows_scratch(n_seats, stack_rows);
+	unsigned n_rows = __booking_rows(be, seats, n_seats, rows);
+
+	__booking_lock_rows(be, rows, n_rows);
+	seatmap_write_begin(&be->sm);
+
+	for(unsigned i = 0; i < n_seats; ++i)
+		seatmap_release(&be->sm, seats[i] / be->sm.pols, seats[i] % be->sm.pols);
+
+	for(unsigned i = 0; i < n_rows; ++i)
+		availcache_mark_dirty(&be->ac, rows[i]);
+
+	seatmap_write_end(&be->sm);
+
+	unsigned long lsn = be->jr ? 
+		journal_append(be->jr, JOURNAL_REC_REVOKE, be->jr_show_id, code, seats, n_seats) : 0;
+
+	__booking_unlock_rows(be, rows, n_rows);
+
+	//the block goes back to the index, reused by the next large booking
+	if(n_seats > BOOKIDX_INLINE_SEATS) {
+		__booking_lock(&be->idx_mtx);
+		bookidx_entry_release(&be->bi, &removed);
+		pthread_mutex_unlock(&be->idx_mtx);
+	}
+
+	if(be->jr)
+		journal_wait(be->jr, lsn);
+
+	return n_seats;
+}
+
+void booking_attach_journal(booking_engine* be, journal* jr, unsigned show_id) {
+	be->jr = jr;
+	be->jr_show_id = show_id;
+}
+
+int booking_redo(booking_engine* be, unsigned code, const unsigned* seats, unsigned n_seats, int book) {
+	unsigned n_total = be->sm.rows * be->sm.pols;
+
+	if(code == 0)
+		return BOOKING_NOTAVAIL;
+
+	for(unsigned i = 0; i < n_seats; ++i)
+		if(seats[i] >= n_total)
+			return BOOKING_NOTAVAIL;
+
+	seatmap_write_begin(&be->sm);
+
+	for(unsigned i = 0; i < n_seats; ++i) {
+		unsigned r = seats[i] / be->sm.pols;
+		unsigned c = seats[i] % be->sm.pols;
+
+		if(book) {
+			seatmap_book(&be->sm, r, c, code);
+		} else {
+			seatmap_release(&be->sm, r, c);
+		}
+
+		availcache_mark_dirty(&be->ac, r);
+	}
+
+	seatmap_write_end(&be->sm);
+
+	bookidx_advance(&be->bi, code);
+	return BOOKING_OK;
+}
+
+void booking_rebuild_index(booking_engine* be) {
+	unsigned long n_total = (unsigned long) be->sm.rows * be->sm.pols;
+	unsigned long n_booked = n_total - seatmap_count_free(&be->sm);
+	if(n_booked == 0)
+		return;
+
+	//code in the high half: sorting groups the seats of each booking
+	unsigned long long* pairs = (unsigned long long*) malloc(sizeof(unsigned long long) * n_booked);
+	unsigned long long* tmp = (unsigned long long*) malloc(sizeof(unsigned long long) * n_booked);
+	unsigned* cols = (unsigned*) malloc(sizeof(unsigned) * be->sm.pols);
+	unsigned* seats = (unsigned*) malloc(sizeof(unsigned) * n_booked);
+	malloc_check_exit_on_error(pairs);
+	malloc_check_exit_on_error(tmp);
+	malloc_check_exit_on_error(cols);
+	malloc_check_exit_on_error(seats);
+
+	unsigned long n = 0;
+	for(unsigned r = 0; r < be->sm.rows; ++r) {
+		unsigned k = seatmap_row_booked_list(&be->sm, r, cols);
+
+		for(unsigned i = 0; i < k; ++i) {
+			unsigned long id = seatmap_index(&be->sm, r, cols[i]);
+			pairs[n++] = ((unsigned long long) be->sm.seats[id].unique_code << 32) | id;
+		}
+	}
+
+	__booking_sort_pairs(pairs, tmp, n);
+	free(tmp);
+
+	for(unsigned long i = 0; i < n; ) {
+		unsigned code = (unsigned) (pairs[i] >> 32);
+		unsigned k = 0;
+
+		for(; i < n && (unsigned) (pairs[i] >> 32) == code; ++i)
+			seats[k++] = (unsigned) pairs[i];
+
+		bookidx_insert(&be->bi, code, seats, k);
+		bookidx_advance(&be->bi, code);
+	}
+
+	free(seats);
+	free(cols);
+	free(pairs);
+}
+
+void booking_adopt(booking_engine* be, seat* seats, unsigned long long* free_bits) {
+	seatmap_write_begin(&be->sm);
+	seatmap_adopt(&be->sm, seats, free_bits);
+
+	for(unsigned r = 0; r < be->sm.rows; ++r)
+		availcache_mark_dirty(&be->ac, r);
+
+	seatmap_write_end(&be->sm);
+}
+
+void booking_copy(booking_engine* be, seat* seats_dst, unsigned long long* bits_dst) {
+	unsigned long seats_row = sizeof(seat) * be->sm.pols;
+	unsigned long bits_row = sizeof(unsigned long long) * be->sm.words_per_row;
+
+	for(unsigned r = 0; r < be->sm.rows; ++r) {
+		pthread_mutex_lock(&be->row_locks[r].mtx);
+		memcpy(seats_dst + seatmap_index(&be->sm, r, 0), seatmap_seat(&be->sm, r, 0), seats_row);
+		memcpy(bits_dst + (unsigned long) r * be->sm.words_per_row, seatmap_word(&be->sm, r, 0), bits_row);
+		pthread_mutex_unlock(&be->row_locks[r].mtx);
+	}
+}
+
+void booking_lock_waits(unsigned long* waits, unsigned long* wait_ns) {
+	*waits = __booking_lock_waits;
+	*wait_ns = __booking_lock_wait_ns;
+}
+
+void booking_strerror(int error, char* dst, int dst_max_size) {
+	int current_errno = errno;
+	memset(dst, 0, dst_max_size);
+	switch(error) {
+		case BOOKING_INIT_INVAL:
+			memcpy(dst, "booking_init: Invalid argument", sizeof("booking_init: Invalid argument"));
+			break;
+		case BOOKING_INIT_MALLOC_FAILURE:
+			snprintf(dst, dst_max_size, "booking_init:malloc: %s", strerror(current_errno));
+			break;
+		case BOOKING_INIT_MUTEX_FAILURE:
+			snprintf(dst, dst_max_size, "booking_init:pthread_mutex_init: %s", strerror(current_errno));
+			break;
+
+		default:
+			snprintf(dst, dst_max_size, "booking: Success");
+	}
+}
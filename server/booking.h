@@ -0,0 +1,181 @@
+#ifndef BOOKING_H
+#define BOOKING_H
+
+#include <pthread.h>
+
+#include "seatmap.h"
+#include "availcache.h"
+#include "bookidx.h"
+#include "journal.h"
+
+#define BOOKING_OK 0
+#define BOOKING_NOTAVAIL 1
+
+#define BOOKING_INIT_INVAL 4
+#define BOOKING_INIT_MALLOC_FAILURE 5
+#define BOOKING_INIT_MUTEX_FAILURE 6
+
+#define BOOKING_CACHE_LINE 64
+
+/*
+ * lock di una riga, uno per linea di cache: righe vicine prenotate
+ * da thread diversi non si contendono la stessa linea
+ */
+typedef struct {
+	pthread_mutex_t mtx;
+} __attribute__((aligned(BOOKING_CACHE_LINE))) booking_row_lock;
+
+/*
+ * stato di una sala: posti, risposta GetAvailableSeats serializzata,
+ * indice delle prenotazioni e i lock.
+ * Una prenotazione blocca solo le righe che tocca, in ordine crescente
+ * (nessun deadlock tra prenotazioni che condividono righe), idx_mtx
+ * protegge solo l'indice ed è tenuto per un inserimento o una rimozione.
+ * Con un giornale ogni modifica vi è accodata prima di sbloccare le righe
+ * (l'ordine dei record per un posto è quello delle modifiche) e la
+ * funzione ritorna solo quando è durevole, secondo la modalità del giornale.
+ */
+typedef struct {
+	seatmap sm;
+	availcache ac;
+	bookidx bi;
+	booking_row_lock* row_locks;
+	pthread_mutex_t idx_mtx;
+	journal* jr; //NULL: solo in memoria
+	unsigned jr_show_id;
+} booking_engine;
+
+/*
+ * booking_init
+ *
+ * DESCRIZIONE:
+ *		inizializza una sala rows * pols con tutti i posti liberi,
+ *		l'indice delle prenotazioni parte da bookings elementi
+ *
+ * RITORNA:
+ *		* BOOKING_OK se tutto è andato a buon fine
+ *		* uno degli errori della classe BOOKING_INIT_* altrimenti
+ */
+int booking_init(booking_engine* be, unsigned rows, unsigned pols, unsigned bookings);
+
+/*
+ * booking_finish
+ *		libera le risorse
+ */
+void booking_finish(booking_engine* be);
+
+/*
+ * booking_book
+ *
+ * DESCRIZIONE:
+ *		prenota tutti i posti di seats (indici lineari, riga * pols + colonna,
+ *		già validati) o nessuno. Thread safe.
+ *
+ * RITORNA:
+ *		* BOOKING_OK, in *out_code il codice della prenotazione
+ *		* BOOKING_NOTAVAIL se almeno un posto è già prenotato
+ */
+int booking_book(booking_engine* be, const unsigned* seats, unsigned n_seats, unsigned* out_code);
+
+/*
+ * booking_book_batch
+ *
+ * DESCRIZIONE:
+ *		n_bookings prenotazioni indipendenti, la b-esima di n_seats[b]
+ *		posti, uno dopo l'altro in seats (già validati): ognuna come
+ *		booking_book, in ordine, con un solo lock per riga per tutto il
+ *		gruppo. Una prenotazione non disponibile non blocca le altre.
+ *		Con un giornale si attende il disco una volta sola. Thread safe.
+ *
+ * RITORNA:
+ *		quante prenotazioni sono riuscite, in out_codes[b] il codice della
+ *		b-esima o 0 se almeno un suo posto era già prenotato
+ */
+unsigned booking_book_batch(booking_engine* be, const unsigned* seats, const unsigned* n_seats,
+		unsigned n_bookings, unsigned* out_codes);
+
+/*
+ * booking_book_best
+ *
+ * DESCRIZIONE:
+ *		prenota n_seats (> 0, <= pols) posti liberi consecutivi in una
+ *		stessa riga: le righe sono provate a partire da pref_row (< rows)
+ *		allontanandosi, prima dietro poi davanti (pref_row, pref_row + 1,
+ *		pref_row - 1, ...), nella riga la sequenza più vicina al centro.
+ *		Cercare e prenotare avvengono sotto lo stesso lock di riga: i
+ *		posti trovati non possono essere presi da altri. Thread safe.
+ *
+ * RITORNA:
+ *		* BOOKING_OK, in *out_code il codice e in out_seats (n_seats
+ *		  elementi) i posti prenotati, in ordine di colonna
+ *		* BOOKING_NOTAVAIL se nessuna riga ha n_seats posti liberi consecutivi
+ */
+int booking_book_best(booking_engine* be, unsigned n_seats, unsigned pref_row, unsigned* out_seats,
+		unsigned* out_code);
+
+/*
+ * booking_revoke
+ *		annulla la prenotazione code, ritorna il numero di posti liberati
+ *		(0 se code non esiste). Thread safe.
+ */
+unsigned booking_revoke(booking_engine* be, unsigned code);
+
+/*
+ * booking_attach_journal
+ *		da qui in poi prenotazioni e revoche sono scritte su jr come
+ *		modifiche dello spettacolo show_id. Prima di servire richieste
+ */
+void booking_attach_journal(booking_engine* be, journal* jr, unsigned show_id);
+
+/*
+ * booking_redo
+ *
+ * DESCRIZIONE:
+ *		replay del giornale: segna i posti seats prenotati con code 
+ *		(book != 0) o liberi, qualunque sia il loro stato attuale. 
+ *		Riapplicare un record già presente nello stato non cambia nulla:
+ *		lo stato di partenza può contenere modifiche successive allo
+ *		snapshot. Il generatore non produrrà più code.
+ *		Non thread safe, nulla è scritto sul giornale, l'indice dei
+ *		codici va ricostruito alla fine con booking_rebuild_index
+ *
+ * RITORNA:
+ *		* BOOKING_OK se tutto è andato a buon fine
+ *		* BOOKING_NOTAVAIL se un posto è fuori dalla sala
+ */
+int booking_redo(booking_engine* be, unsigned code, const unsigned* seats, unsigned n_seats, int book);
+
+/*
+ * booking_rebuild_index
+ *		ricostruisce l'indice dei codici dai posti prenotati, dopo
+ *		snapshot e replay. Non thread safe
+ */
+void booking_rebuild_index(booking_engine* be);
+
+/*
+ * booking_adopt
+ *		la sala usa posti e bitmap di un'altra area (vedi seatmap_adopt),
+ *		tutte le righe della cache sono da ricostruire. Non thread safe
+ */
+void booking_adopt(booking_engine* be, seat* seats, unsigned long long* free_bits);
+
+/*
+ * booking_copy
+ *		copia posti e bitmap in seats_dst e bits_dst una riga alla volta,
+ *		ogni riga con il suo lock: ogni riga copiata è coerente e ogni
+ *		modifica che vi compare è già nel giornale. Righe diverse possono
+ *		essere di momenti diversi. Thread safe
+ */
+void booking_copy(booking_engine* be, seat* seats_dst, unsigned long long* bits_dst);
+
+/*
+ * booking_lock_waits
+ *		quante volte il thread chiamante ha trovato occupato un lock di
+ *		riga o dell'indice in booking_book/booking_revoke, e il tempo
+ *		totale di attesa in nanosecondi (qualunque sala)
+ */
+void booking_lock_waits(unsigned long* waits, unsigned long* wait_ns);
+
+void booking_strerror(int error, char* dst, int dst_size);
+
+#endif
@@ -0,0 +1,466 @@
+/* evloop.c - epoll event loop
+	ITA: n thread, ognuno con la propria istanza epoll, accettano
+		connessioni da uno dei socket in ascolto (con più socket SO_REUSEPORT
+		il kernel distribuisce le connessioni, i loop che condividono un
+		socket usano EPOLLEXCLUSIVE, evita il thundering herd) e gestiscono ogni connessione come una macchina a stati
+		lettura -> scrittura con socket non bloccanti. Durante la scrittura
+		la lettura è sospesa, le richieste in pipeline attendono nel buffer.
+
+	Ogni loop ha una timerwheel con un timer per connessione, la sua
+	scadenza dipende dalla fase: lettura di una richiesta, attesa della
+	successiva, invio delle risposte. La scadenza è fissata all'inizio
+	della fase, i bytes che arrivano (o partono) un po' alla volta non
+	la spostano: un client che invia un byte ogni tanto è chiuso come
+	uno che non invia nulla. Programmare, cancellare e far scadere un
+	timer costa O(1), senza scansioni.
+*/
+
+#define _GNU_SOURCE //accept4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "malloc_utils.h"
+#include "timerwheel.h"
+#include "evloop.h"
+
+#define EVLOOP_MAX_EVENTS 256
+#define EVLOOP_INITIAL_BUFFER 512
+#define EVLOOP_TICK_MS 250 //timeouts resolution
+
+#define EVLOOP_PHASE_READ 0 //read_timeout
+#define EVLOOP_PHASE_IDLE 1 //idle_timeout
+#define EVLOOP_PHASE_WRITE 2 //write_timeout
+
+typedef struct __evloop_conn {
+	int sd;
+	int writing;
+	int closing;
+	int phase;
+	unsigned phase_served; //served all'inizio della fase
+	int pending; //richiesta incompleta consumata dall'handler
+	unsigned served;
+	char* in;
+	unsigned in_len;
+	unsigned in_cap;
+	char* out;
+	unsigned out_len;
+	unsigned out_cap;
+	unsigned out_off;
+	timerwheel_timer timer;
+	struct __evloop_conn* prev;
+	struct __evloop_conn* next;
+	//params.state_size bytes of handler state follow
+} __evloop_conn;
+
+typedef struct {
+	pthread_t thread;
+	int epfd;
+	int listen_fd;
+	__evloop_conn* conns; //all of them, to close them at exit
+	timerwheel tw;
+} __evloop_loop;
+
+/* NOT exposed */
+static __evloop_loop* loops;
+static unsigned n_running_loops;
+static int stop_fd = -1;
+static evloop_params params;
+
+static char listen_marker;
+
+static void* __evloop_state(__evloop_conn* c) {
+	return (char*) c + sizeof(__evloop_conn);
+}
+
+static void __evloop_conns_unlink(__evloop_loop* loop, __evloop_conn* c) {
+	if(c->prev)
+		c->prev->next = c->next;
+	else
+		loop->conns = c->next;
+
+	if(c->next)
+		c->next->prev = c->prev;
+
+	c->prev = c->next = NULL;
+}
+
+static void __evloop_conns_push(__evloop_loop* loop, __evloop_conn* c) {
+	c->prev = NULL;
+	c->next = loop->conns;
+
+	if(loop->conns)
+		loop->conns->prev = c;
+
+	loop->conns = c;
+}
+
+static void __evloop_schedule(__evloop_loop* loop, __evloop_conn* c, int phase) {
+	unsigned timeout = phase == EVLOOP_PHASE_READ ? params.read_timeout :
+		(phase == EVLOOP_PHASE_IDLE ? params.idle_timeout : params.write_timeout);
+
+	c->phase = phase;
+	c->phase_served = c->served;
+	timerwheel_schedule(&loop->tw, &c->timer, timerwheel_clock_ms() + timeout * 1000ULL);
+}
+
+/* a new deadline only when a phase or a request begins */
+static void __evloop_touch(__evloop_loop* loop, __evloop_conn* c) {
+	int phase = c->writing ? EVLOOP_PHASE_WRITE :
+		((c->served > 0 && c->in_len == 0 && !c->pending) ? EVLOOP_PHASE_IDLE : EVLOOP_PHASE_READ);
+
+	if(phase != c->phase || c->served != c->phase_served)
+		__evloop_schedule(loop, c, phase);
+}
+
+static void __evloop_conn_close(__evloop_loop* loop, __evloop_conn* c) {
+	timerwheel_cancel(&c->timer);
+	__evloop_conns_unlink(loop, c);
+	close(c->sd); //also removes it from the epoll set
+	if(params.state_finish)
+		params.state_finish(__evloop_state(c));
+	malloc_free(c->in);
+	malloc_free(c->out);
+	free(c);
+}
+
+static void __evloop_accept(__evloop_loop* loop) {
+	int sd;
+	while((sd = accept4(loop->listen_fd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+		__evloop_conn* c = (__evloop_conn*) calloc(1, sizeof(__evloop_conn) + params.state_size);
+		if(c == NULL) {
+			close(sd);
+			continue;
+		}
+
+		c->sd = sd;
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.ptr = c;
+		if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, sd, &ev) < 0) {
+			close(sd);
+			free(c);
+			continue;
+		}
+
+		if(params.state_init)
+			params.state_init(__evloop_state(c));
+
+		__evloop_conns_push(loop, c);
+		__evloop_schedule(loop, c, EVLOOP_PHASE_READ);
+	}
+}
+
+/* returns 0 on allocation failure */
+static int __evloop_queue_reply(__evloop_conn* c, const char* ans, unsigned ans_len) {
+	if(c->out_len + ans_len > c->out_cap) {
+		unsigned cap = c->out_cap ? c->out_cap : EVLOOP_INITIAL_BUFFER;
+		while(cap < c->out_len + ans_len)
+			cap <<= 1;
+
+		char* out = (char*) realloc(c->out, cap);
+		if(out == NULL)
+			return 0;
+
+		c->out = out;
+		c->out_cap = cap;
+	}
+
+	memcpy(c->out + c->out_len, ans, ans_len);
+	c->out_len += ans_len;
+	return 1;
+}
+
+static int __evloop_set_events(__evloop_loop* loop, __evloop_conn* c, unsigned events) {
+	struct epoll_event ev;
+	ev.events = events | EPOLLRDHUP;
+	ev.data.ptr = c;
+	return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, c->sd, &ev);
+}
+
+/* returns 0 if the connection must be closed */
+static int __evloop_flush(__evloop_loop* loop, __evloop_conn* c) {
+	while(c->out_off < c->out_len) {
+		ssize_t n = send(c->sd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			else if(errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			return 0;
+		}
+
+		c->out_off += n;
+	}
+
+	if(c->out_off < c->out_len) {
+		if(!c->writing) {
+			//stop reading until the pending replies are gone
+			if(__evloop_set_events(loop, c, EPOLLOUT) < 0)
+				return 0;
+
+			c->writing = 1;
+		}
+
+		return 1;
+	}
+
+	c->out_off = c->out_len = 0;
+
+	if(c->closing)
+		return 0;
+
+	if(c->writing) {
+		if(__evloop_set_events(loop, c, EPOLLIN) < 0)
+			return 0;
+
+		c->writing = 0;
+	}
+
+	return 1;
+}
+
+/* runs every complete request in the input buffer, returns 0 on failure */
+static int __evloop_process(__evloop_conn* c) {
+	unsigned pos = 0;
+
+	while(pos < c->in_len && !c->closing) {
+		const char* ans = NULL;
+		unsigned ans_len = 0;
+		unsigned consumed = 0;
+
+		int rv = params.handler(__evloop_state(c), c->in + pos, c->in_len - pos, &ans, &ans_len, &consumed);
+		pos += consumed;
+
+		if(rv == EVLOOP_REQUEST_NEED_MORE) {
+			if(consumed > 0)
+				c->pending = 1;
+			break;
+		}
+
+		c->pending = 0;
+
+		if(!__evloop_queue_reply(c, ans, ans_len))
+			return 0;
+
+		++c->served;
+		if(rv == EVLOOP_REQUEST_CLOSE || c->served == params.max_requests)
+			c->closing = 1;
+	}
+
+	if(c->closing)
+		c->in_len = 0; //anything else is discarded
+	else if(pos > 0) {
+		memmove(c->in, c->in + pos, c->in_len - pos);
+		c->in_len -= pos;
+	}
+
+	return 1;
+}
+
+/* returns 0 if the connection must be closed */
+static int __evloop_read(__evloop_loop* loop, __evloop_conn* c) {
+	for(;;) {
+		if(c->in_len == c->in_cap) {
+			unsigned cap = c->in_cap ? c->in_cap << 1 : EVLOOP_INITIAL_BUFFER;
+			if(cap > params.max_input)
+				cap = params.max_input;
+
+			if(cap == c->in_cap)
+				return 0; //full and not consumed by the handler
+
+			char* in = (char*) realloc(c->in, cap);
+			if(in == NULL)
+				return 0;
+
+			c->in = in;
+			c->in_cap = cap;
+		}
+
+		ssize_t n = recv(c->sd, c->in + c->in_len, c->in_cap - c->in_len, 0);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		} else if(n == 0)
+			return 0;
+
+		c->in_len += n;
+
+		if(!__evloop_process(c))
+			return 0;
+
+		if(c->out_len > 0)
+			return __evloop_flush(loop, c);
+	}
+}
+
+static void __evloop_expired(timerwheel_timer* t, void* _loop) {
+	__evloop_conn* c = (__evloop_conn*) ((char*) t - offsetof(__evloop_conn, timer));
+	__evloop_conn_close((__evloop_loop*) _loop, c);
+}
+
+static void* __evloop_routine(void* _loop) {
+	__evloop_loop* loop = (__evloop_loop*) _loop;
+	struct epoll_event events[EVLOOP_MAX_EVENTS];
+
+	for(;;) {
+		int n = epoll_wait(loop->epfd, events, EVLOOP_MAX_EVENTS, EVLOOP_TICK_MS);
+		if(n < 0 && errno != EINTR)
+			break;
+
+		for(int i = 0; i < n; ++i) {
+			void* ptr = events[i].data.ptr;
+
+			if(ptr == NULL)
+				goto loop_finish; //stop requested
+			else if(ptr == &listen_marker) {
+				__evloop_accept(loop);
+				continue;
+			}
+
+			__evloop_conn* c = (__evloop_conn*) ptr;
+			int keep;
+
+			if(events[i].events & (EPOLLERR | EPOLLHUP))
+				keep = 0;
+			else if(c->writing)
+				keep = __evloop_flush(loop, c);
+			else
+				keep = __evloop_read(loop, c);
+
+			if(keep)
+				__evloop_touch(loop, c);
+			else
+				__evloop_conn_close(loop, c);
+		}
+
+		timerwheel_advance(&loop->tw, timerwheel_clock_ms(), __evloop_expired, loop);
+	}
+
+loop_finish:
+	while(loop->conns)
+		__evloop_conn_close(loop, loop->conns);
+
+	return NULL;
+}
+
+/* exposed */
+int evloop_init(const int* listen_sds, unsigned n_listen, unsigned n_loops, const evloop_params* p) {
+	if(n_loops == 0 || n_listen == 0 || n_listen > n_loops || p->max_input == 0 || 
+			p->read_timeout == 0 || p->idle_timeout == 0 || p->write_timeout == 0 || p->handler == NULL)
+		return EVLOOP_INIT_INVAL;
+
+	for(unsigned i = 0; i < n_listen; ++i) {
+		int flags = fcntl(listen_sds[i], F_GETFL, 0);
+		if(flags < 0 || fcntl(listen_sds[i], F_SETFL, flags | O_NONBLOCK) < 0)
+			return EVLOOP_INIT_NONBLOCK_FAILURE;
+	}
+
+	params = *p;
+
+	if((loops = (__evloop_loop*) calloc(n_loops, sizeof(__evloop_loop))) == NULL)
+		return EVLOOP_INIT_MALLOC_FAILURE;
+
+	if((stop_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+		malloc_free(loops);
+		return EVLOOP_INIT_EVENTFD_FAILURE;
+	}
+
+	for(n_running_loops = 0; n_running_loops < n_loops; ++n_running_loops) {
+		__evloop_loop* loop = &loops[n_running_loops];
+		loop->listen_fd = listen_sds[n_running_loops % n_listen];
+		timerwheel_init(&loop->tw, EVLOOP_TICK_MS, timerwheel_clock_ms());
+
+		if((loop->epfd = epoll_create1(0)) < 0) {
+			evloop_finish();
+			return EVLOOP_INIT_EPOLL_FAILURE;
+		}
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+		ev.data.ptr = &listen_marker;
+		int r1 = epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->listen_fd, &ev);
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		int r2 = epoll_ctl(loop->epfd, EPOLL_CTL_ADD, stop_fd, &ev);
+
+		if(r1 < 0 || r2 < 0) {
+			close(loop->epfd);
+			evloop_finish();
+			return EVLOOP_INIT_EPOLL_FAILURE;
+		}
+
+		if(pthread_create(&loop->thread, NULL, __evloop_routine, (void*) loop) != 0) {
+			close(loop->epfd);
+			evloop_finish();
+			return EVLOOP_INIT_CREATE_FAILURE;
+		}
+	}
+
+	return EVLOOP_OK;
+}
+
+//errors ignored
+void evloop_finish() {
+	if(stop_fd >= 0) {
+		unsigned long long one = 1;
+		ssize_t r = write(stop_fd, &one, sizeof(one));
+		((void)r);
+	}
+
+	for(unsigned i = 0; i < n_running_loops; ++i) {
+		pthread_join(loops[i].thread, NULL);
+		close(loops[i].epfd);
+	}
+
+	n_running_loops = 0;
+
+	if(stop_fd >= 0) {
+		close(stop_fd);
+		stop_fd = -1;
+	}
+
+	malloc_free(loops);
+}
+
+void evloop_strerror(int error, char* dst, int dst_max_size) {
+	int current_errno = errno;
+	memset(dst, 0, dst_max_size);
+	switch(error) {
+		case EVLOOP_INIT_INVAL:
+			memcpy(dst, "evloop_init: Invalid argument", sizeof("evloop_init: Invalid argument"));
+			break;
+		case EVLOOP_INIT_MALLOC_FAILURE:
+			snprintf(dst, dst_max_size, "evloop_init:malloc: %s", strerror(current_errno));
+			break;
+		case EVLOOP_INIT_EPOLL_FAILURE:
+			snprintf(dst, dst_max_size, "evloop_init:epoll: %s", strerror(current_errno));
+			break;
+		case EVLOOP_INIT_EVENTFD_FAILURE:
+			snprintf(dst, dst_max_size, "evloop_init:eventfd: %s", strerror(current_errno));
+			break;
+		case EVLOOP_INIT_CREATE_FAILURE:
+			snprintf(dst, dst_max_size, "evloop_init:pthread_create: %s", strerror(current_errno));
+			break;
+		case EVLOOP_INIT_NONBLOCK_FAILURE:
+			snprintf(dst, dst_max_size, "evloop_init:fcntl: %s", strerror(current_errno));
+			break;
+
+		default:
+			snprintf(dst, dst_max_size, "evloop: Success");
+	}
+}
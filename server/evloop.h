@@ -0,0 +1,78 @@
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#define EVLOOP_OK 0
+
+#define EVLOOP_INIT_INVAL 4
+#define EVLOOP_INIT_MALLOC_FAILURE 5
+#define EVLOOP_INIT_EPOLL_FAILURE 6
+#define EVLOOP_INIT_EVENTFD_FAILURE 7
+#define EVLOOP_INIT_CREATE_FAILURE 8
+#define EVLOOP_INIT_NONBLOCK_FAILURE 9
+
+#define EVLOOP_REQUEST_NEED_MORE 0
+#define EVLOOP_REQUEST_REPLY 1
+#define EVLOOP_REQUEST_CLOSE 2
+
+/*
+ * evloop_request_fpt
+ *		invocata ogni volta che arrivano nuovi dati su una connessione,
+ *		state è lo stato della connessione (params.state_size bytes),
+ *		req contiene i dati ricevuti e non ancora consumati (len bytes).
+ *		Esegue al più una richiesta, in *consumed i bytes da scartare:
+ *		un handler che tiene traccia delle richieste incomplete in state
+ *		può consumarli tutti anche prima che la richiesta sia completa.
+ *		Ritorna:
+ *		  * EVLOOP_REQUEST_NEED_MORE per attendere altri dati
+ *		  * EVLOOP_REQUEST_REPLY impostando *out e *out_len, *out appartiene
+ *		    all'handler e resta valida solo fino alla sua prossima chiamata
+ *		    nello stesso thread: il modulo la copia nel buffer di uscita
+ *		    della connessione, riutilizzato tra una risposta e l'altra
+ *		  * EVLOOP_REQUEST_CLOSE come sopra, ma la connessione va chiusa dopo
+ *		    la risposta
+ */
+typedef int (*evloop_request_fpt)(void* state, char* req, unsigned len,
+		const char** out, unsigned* out_len, unsigned* consumed);
+
+typedef struct {
+	unsigned max_input;    //dati non consumati, oltre la connessione è chiusa
+	unsigned read_timeout; //secondi, dall'inizio di una richiesta alla sua fine
+	unsigned idle_timeout; //secondi, in attesa di una nuova richiesta
+	unsigned write_timeout; //secondi, dall'inizio dell'invio di una risposta alla sua fine
+	unsigned max_requests; //richieste per connessione, 0 = illimitate
+	evloop_request_fpt handler;
+	unsigned state_size; //bytes di stato per connessione, anche 0
+	void (*state_init)(void*); //alla connessione, può essere NULL
+	void (*state_finish)(void*); //alla chiusura, può essere NULL
+} evloop_params;
+
+/*
+ * evloop_init
+ *
+ * DESCRIZIONE:
+ *		avvia n_loops thread, ognuno con la propria istanza epoll, che accettano
+ *		connessioni da uno degli n_listen socket in listen_sds (resi non 
+ *		bloccanti, il loop i usa listen_sds[i % n_listen]) e le servono con 
+ *		socket non bloccanti. Nessun thread rimane bloccato su un client lento.
+ *		Una connessione può trasportare più richieste, anche in pipeline: 
+ *		le risposte sono inviate nello stesso ordine.
+ *
+ * NOTA BENE:
+ *		0 < n_listen <= n_loops, params->max_input > 0, timeout > 0
+ *
+ * RITORNA:
+ *		* EVLOOP_OK se tutto è andato a buon fine
+ *		* uno degli errori della classe EVLOOP_INIT_* altrimenti
+ */
+int evloop_init(const int* listen_sds, unsigned n_listen, unsigned n_loops, const evloop_params* params);
+
+/*
+ * evloop_finish
+ *		ferma tutti i loop, chiude le connessioni aperte e libera le risorse,
+ *		ogni errore è ignorato
+ */
+void evloop_finish();
+
+void evloop_strerror(int error, char* dst, int dst_size);
+
+#endif
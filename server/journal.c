@@ -0,0 +1,550 @@
+/* journal.c - write-ahead booking journal with group commit
+	ITA: il file inizia con JOURNAL_MAGIC, la versione e l'LSN del primo
+		record (64 bit), poi i record uno dopo l'altro:
+
+			lunghezza del corpo | crc32c del corpo | corpo
+			corpo: tipo | show_id | code | n_values | values...
+
+		tutti interi a 32 bit nell'ordine della macchina. Un crash può
+		lasciare in coda un record scritto a metà: all'apertura il primo
+		record incompleto o con crc errato chiude il giornale e viene
+		troncato, i record precedenti sono stati confermati ai client
+		solo dopo il loro fdatasync.
+
+	Il thread di scrittura prende tutto il buffer accumulato, lo scrive
+	con un solo write e un solo fdatasync: le richieste arrivate durante
+	un fdatasync vengono confermate insieme dal successivo.
+	Dopo uno snapshot i record che contiene non servono più: la coda
+	del giornale è copiata in un nuovo file, che sostituisce il vecchio
+	con rename (un crash durante la copia lascia il giornale intero).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "malloc_utils.h"
+#include "journal.h"
+
+#define JOURNAL_MAGIC "TKTJ"
+#define JOURNAL_VERSION 2
+#define JOURNAL_FILE_HEADER 16
+#define JOURNAL_RECORD_HEADER 8
+#define JOURNAL_BODY_FIXED 16
+#define JOURNAL_MIN_BUFFER 65536
+#define JOURNAL_COPY_CHUNK 65536
+
+#define JOURNAL_CRC32C_POLY 0x82F63B78u
+
+/* NOT exposed */
+static unsigned __journal_crc_table[256];
+static unsigned long __journal_error_offset;
+
+static void __journal_crc_init() {
+	for(unsigned i = 0; i < 256; ++i) {
+		unsigned c = i;
+		for(int k = 0; k < 8; ++k)
+			c = (c >> 1) ^ (JOURNAL_CRC32C_POLY & (0u - (c & 1)));
+
+		__journal_crc_table[i] = c;
+	}
+}
+
+static unsigned __journal_crc(const char* data, unsigned long len) {
+	unsigned c = 0xffffffffu;
+	for(unsigned long i = 0; i < len; ++i)
+		c = __journal_crc_table[(c ^ (unsigned char) data[i]) & 0xff] ^ (c >> 8);
+
+	return ~c;
+}
+
+/* returns 0 on success */
+static int __journal_write_all(int fd, const char* data, unsigned long len) {
+	while(len > 0) {
+		ssize_t w = write(fd, data, len);
+		if(w < 0) {
+			if(errno == EINTR)
+				continue;
+
+			return 1;
+		}
+
+		data += w;
+		len -= (unsigned long) w;
+	}
+
+	return 0;
+}
+
+/* a new file is durable only once its directory entry is */
+static void __journal_sync_dir(const char* path) {
+	char* copy = strdup(path);
+	if(copy == NULL)
+		return;
+
+	int dfd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+	if(dfd >= 0) {
+		fsync(dfd);
+		close(dfd);
+	}
+
+	free(copy);
+}
+
+/* returns 0 on success */
+static int __journal_write_header(int fd, unsigned long base_lsn) {
+	char header[JOURNAL_FILE_HEADER];
+	unsigned version = JOURNAL_VERSION;
+	unsigned long long base = base_lsn;
+
+	memcpy(header, JOURNAL_MAGIC, 4);
+	memcpy(header + 4, &version, 4);
+	memcpy(header + 8, &base, 8);
+
+	return __journal_write_all(fd, header, JOURNAL_FILE_HEADER) || fdatasync(fd) < 0;
+}
+
+/* offset of the end of the last valid record, records before from_lsn are skipped */
+static unsigned long __journal_replay(journal* jr, const char* data, unsigned long size,
+		unsigned long from_lsn, journal_replay_fpt replay, void* ctx, int* failed) {
+	unsigned long off = JOURNAL_FILE_HEADER;
+	*failed = 0;
+
+	while(size - off >= JOURNAL_RECORD_HEADER + JOURNAL_BODY_FIXED) {
+		unsigned hdr[2];
+		memcpy(hdr, data + off, sizeof(hdr));
+
+		unsigned long body_len = hdr[0];
+		if(body_len < JOURNAL_BODY_FIXED || body_len > size - off - JOURNAL_RECORD_HEADER)
+			break;
+
+		const char* body = data + off + JOURNAL_RECORD_HEADER;
+		unsigned fixed[4];
+		memcpy(fixed, body, sizeof(fixed));
+
+		if(fixed[3] > JOURNAL_MAX_VALUES || body_len != JOURNAL_BODY_FIXED + ((unsigned long) fixed[3] << 2) ||
+				__journal_crc(body, body_len) != hdr[1])
+			break;
+
+		journal_record rec;
+		rec.type = fixed[0];
+		rec.show_id = fixed[1];
+		rec.code = fixed[2];
+		rec.n_values = fixed[3];
+		rec.values = (const unsigned*) (body + JOURNAL_BODY_FIXED);
+
+		if(jr->base_lsn + off - JOURNAL_FILE_HEADER < from_lsn) {
+			off += JOURNAL_RECORD_HEADER + body_len;
+			continue;
+		}
+
+		if(replay(ctx, &rec)) {
+			__journal_error_offset = off;
+			*failed = 1;
+			break;
+		}
+
+		++jr->replayed;
+		off += JOURNAL_RECORD_HEADER + body_len;
+	}
+
+	return off;
+}
+
+static void __journal_sleep_us(unsigned us) {
+	struct timespec ts;
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (long) (us % 1000000) * 1000;
+
+	while(nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+static void* __journal_flusher(void* arg) {
+	journal* jr = (journal*) arg;
+
+	pthread_mutex_lock(&jr->mtx);
+
+	for(;;) {
+		while(jr->len == 0 && jr->running)
+			pthread_cond_wait(&jr->flush_cv, &jr->mtx);
+
+		if(jr->len == 0)
+			break;
+
+		//more requests join this flush while we wait
+		if(jr->mode != JOURNAL_SYNC_REQUEST && jr->running) {
+			pthread_mutex_unlock(&jr->mtx);
+			__journal_sleep_us(jr->window_us);
+			pthread_mutex_lock(&jr->mtx);
+		}
+
+		char* out = jr->buf;
+		unsigned long out_len = jr->len;
+		unsigned long target = jr->appended_lsn;
+
+		jr->buf = jr->wbuf;
+		jr->wbuf = out;
+		unsigned long cap = jr->cap;
+		jr->cap = jr->wcap;
+		jr->wcap = cap;
+		jr->len = 0;
+
+		pthread_mutex_unlock(&jr->mtx);
+
+		pthread_mutex_lock(&jr->file_mtx);
+		if(__journal_write_all(jr->fd, out, out_len) || fdatasync(jr->fd) < 0) {
+			perror("journal");
+			exit(EXIT_FAILURE);
+		}
+		jr->written_lsn = target;
+		pthread_mutex_unlock(&jr->file_mtx);
+
+		pthread_mutex_lock(&jr->mtx);
+		jr->durable_lsn = target;
+		++jr->fsyncs;
+		pthread_cond_broadcast(&jr->durable_cv);
+	}
+
+	pthread_mutex_unlock(&jr->mtx);
+	return NULL;
+}
+
+static void __journal_wait_lsn(journal* jr, unsigned long lsn) {
+	pthread_mutex_lock(&jr->mtx);
+	while(jr->durable_lsn < lsn)
+		pthread_cond_wait(&jr->durable_cv, &jr->mtx);
+	pthread_mutex_unlock(&jr->mtx);
+}
+
+/* exposed */
+int journal_open(journal* jr, const char* path, unsigned long from_lsn, int mode, unsigned window_us,
+		journal_replay_fpt replay, void* ctx) {
+	memset(jr, 0, sizeof(journal));
+	jr->fd = -1;
+	__journal_error_offset = 0;
+
+	if(path == NULL || replay == NULL || mode < JOURNAL_SYNC_REQUEST || mode > JOURNAL_SYNC_ASYNC)
+		return JOURNAL_OPEN_INVAL;
+
+	__journal_crc_init();
+
+	jr->mode = mode;
+	jr->window_us = window_us;
+
+	if((jr->path = strdup(path)) == NULL)
+		return JOURNAL_OPEN_MALLOC_FAILURE;
+
+	if((jr->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+		malloc_free(jr->path);
+		return JOURNAL_OPEN_FAILURE;
+	}
+
+	int err;
+	struct stat st;
+	if(fstat(jr->fd, &st) < 0)
+		goto open_failure;
+
+	unsigned long size = (unsigned long) st.st_size;
+	unsigned long valid_end = JOURNAL_FILE_HEADER;
+
+	if(size == 0) {
+		jr->base_lsn = from_lsn;
+		if(__journal_write_header(jr->fd, from_lsn))
+			goto open_failure;
+
+		__journal_sync_dir(path);
+		size = JOURNAL_FILE_HEADER;
+	} else {
+		if(size < JOURNAL_FILE_HEADER) {
+			err = JOURNAL_OPEN_FORMAT;
+			goto close_failure;
+		}
+
+		char* data = (char*) mmap(NULL, size, PROT_READ, MAP_PRIVATE, jr->fd, 0);
+		if(data == MAP_FAILED)
+			goto open_failure;
+
+		unsigned version;
+		unsigned long long base;
+		memcpy(&version, data + 4, 4);
+		memcpy(&base, data + 8, 8);
+		jr->base_lsn = (unsigned long) base;
+
+		if(memcmp(data, JOURNAL_MAGIC, 4) != 0 || version != JOURNAL_VERSION) {
+			munmap(data, size);
+			err = JOURNAL_OPEN_FORMAT;
+			goto close_failure;
+		}
+
+		//records between the snapshot and this file would be missing
+		if(jr->base_lsn > from_lsn) {
+			munmap(data, size);
+			err = JOURNAL_OPEN_SEQUENCE;
+			goto close_failure;
+		}
+
+		int failed;
+		valid_end = __journal_replay(jr, data, size, from_lsn, replay, ctx, &failed);
+		munmap(data, size);
+
+		if(failed) {
+			err = JOURNAL_OPEN_REPLAY_FAILURE;
+			goto close_failure;
+		}
+
+		//the snapshot contains records this file lost
+		if(jr->base_lsn + valid_end - JOURNAL_FILE_HEADER < from_lsn) {
+			err = JOURNAL_OPEN_SEQUENCE;
+			goto close_failure;
+		}
+	}
+
+	if(valid_end < size) {
+		jr->truncated = size - valid_end;
+		if(ftruncate(jr->fd, (off_t) valid_end) < 0 || fdatasync(jr->fd) < 0)
+			goto open_failure;
+	}
+
+	if(lseek(jr->fd, (off_t) valid_end, SEEK_SET) < 0)
+		goto open_failure;
+
+	jr->appended_lsn = jr->durable_lsn = jr->written_lsn = jr->base_lsn + valid_end - JOURNAL_FILE_HEADER;
+
+	jr->cap = jr->wcap = JOURNAL_MIN_BUFFER;
+	jr->buf = (char*) malloc(jr->cap);
+	jr->wbuf = (char*) malloc(jr->wcap);
+	if(jr->buf == NULL || jr->wbuf == NULL) {
+		err = JOURNAL_OPEN_MALLOC_FAILURE;
+		goto close_failure;
+	}
+
+	int perr;
+	if((perr = pthread_mutex_init(&jr->mtx, NULL)) != 0 ||
+			(perr = pthread_mutex_init(&jr->file_mtx, NULL)) != 0 ||
+			(perr = pthread_cond_init(&jr->flush_cv, NULL)) != 0 ||
+			(perr = pthread_cond_init(&jr->durable_cv, NULL)) != 0)
+		goto thread_failure;
+
+	jr->running = 1;
+	if((perr = pthread_create(&jr->flusher, NULL, __journal_flusher, jr)) != 0) {
+		jr->running = 0;
+		goto thread_failure;
+	}
+
+	return JOURNAL_OK;
+
+thread_failure:
+	errno = perr;
+	err = JOURNAL_OPEN_THREAD_FAILURE;
+	goto close_failure;
+
+open_failure:
+	err = JOURNAL_OPEN_FAILURE;
+
+close_failure:
+	perr = errno;
+	close(jr->fd);
+	malloc_free(jr->buf);
+	malloc_free(jr->wbuf);
+	malloc_free(jr->path);
+	errno = perr;
+	return err;
+}
+
+void journal_close(journal* jr) {
+	if(!jr->running)
+		return;
+
+	pthread_mutex_lock(&jr->mtx);
+	jr->running = 0;
+	pthread_cond_signal(&jr->flush_cv);
+	pthread_mutex_unlock(&jr->mtx);
+
+	pthread_join(jr->flusher, NULL);
+
+	close(jr->fd);
+	malloc_free(jr->buf);
+	malloc_free(jr->wbuf);
+	malloc_free(jr->path);
+}
+
+unsigned long journal_append(journal* jr, unsigned type, unsigned show_id, unsigned code,
+		const unsigned* values, unsigned n_values) {
+	unsigned long body_len = JOURNAL_BODY_FIXED + ((unsigned long) n_values << 2);
+	unsigned long total = JOURNAL_RECORD_HEADER + body_len;
+	unsigned fixed[4] = { type, show_id, code, n_values };
+
+	pthread_mutex_lock(&jr->mtx);
+
+	if(jr->len + total > jr->cap) {
+		while(jr->len + total > jr->cap)
+			jr->cap <<= 1;
+
+		jr->buf = (char*) realloc(jr->buf, jr->cap);
+		malloc_check_exit_on_error(jr->buf);
+	}
+
+	char* rec = jr->buf + jr->len;
+	char* body = rec + JOURNAL_RECORD_HEADER;
+	memcpy(body, fixed, sizeof(fixed));
+	if(n_values)
+		memcpy(body + JOURNAL_BODY_FIXED, values, (unsigned long) n_values << 2);
+
+	unsigned hdr[2] = { (unsigned) body_len, __journal_crc(body, body_len) };
+	memcpy(rec, hdr, sizeof(hdr));
+
+	if(jr->len == 0)
+		pthread_cond_signal(&jr->flush_cv);
+
+	jr->len += total;
+	unsigned long lsn = jr->appended_lsn += total;
+
+	pthread_mutex_unlock(&jr->mtx);
+	return lsn;
+}
+
+void journal_wait(journal* jr, unsigned long lsn) {
+	if(jr->mode != JOURNAL_SYNC_ASYNC)
+		__journal_wait_lsn(jr, lsn);
+}
+
+void journal_sync(journal* jr) {
+	pthread_mutex_lock(&jr->mtx);
+	unsigned long lsn = jr->appended_lsn;
+	pthread_mutex_unlock(&jr->mtx);
+
+	__journal_wait_lsn(jr, lsn);
+}
+
+unsigned long journal_position(journal* jr) {
+	pthread_mutex_lock(&jr->mtx);
+	unsigned long lsn = jr->appended_lsn;
+	pthread_mutex_unlock(&jr->mtx);
+
+	return lsn;
+}
+
+int journal_truncate(journal* jr, unsigned long lsn) {
+	pthread_mutex_lock(&jr->file_mtx);
+
+	if(lsn > jr->written_lsn)
+		lsn = jr->written_lsn;
+
+	if(lsn <= jr->base_lsn) {
+		pthread_mutex_unlock(&jr->file_mtx);
+		return JOURNAL_OK;
+	}
+
+	unsigned long path_len = strlen(jr->path);
+	char* tmp = (char*) malloc(path_len + sizeof(".tmp"));
+	char* chunk = (char*) malloc(JOURNAL_COPY_CHUNK);
+	int fd = -1;
+	int err;
+
+	if(tmp == NULL || chunk == NULL)
+		goto failure;
+
+	memcpy(tmp, jr->path, path_len);
+	memcpy(tmp + path_len, ".tmp", sizeof(".tmp"));
+
+	if((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0 || __journal_write_header(fd, lsn))
+		goto failure;
+
+	//records from lsn to the end of the file, lsn is always a record boundary
+	off_t from = (off_t) (JOURNAL_FILE_HEADER + lsn - jr->base_lsn);
+	off_t to = (off_t) (JOURNAL_FILE_HEADER + jr->written_lsn - jr->base_lsn);
+
+	while(from < to) {
+		unsigned long n = (unsigned long) (to - from) < JOURNAL_COPY_CHUNK ? 
+			(unsigned long) (to - from) : JOURNAL_COPY_CHUNK;
+		ssize_t r = pread(jr->fd, chunk, n, from);
+		if(r < 0 && errno == EINTR)
+			continue;
+		if(r <= 0 || __journal_write_all(fd, chunk, (unsigned long) r))
+			goto failure;
+
+		from += r;
+	}
+
+	if(fdatasync(fd) < 0 || rename(tmp, jr->path) < 0)
+		goto failure;
+
+	__journal_sync_dir(jr->path);
+
+	close(jr->fd);
+	jr->fd = fd;
+	jr->base_lsn = lsn;
+
+	free(chunk);
+	free(tmp);
+	pthread_mutex_unlock(&jr->file_mtx);
+	return JOURNAL_OK;
+
+failure:
+	err = errno;
+	if(fd >= 0) {
+		close(fd);
+		unlink(tmp);
+	}
+
+	malloc_free(chunk);
+	malloc_free(tmp);
+	pthread_mutex_unlock(&jr->file_mtx);
+	errno = err;
+	return JOURNAL_TRUNCATE_FAILURE;
+}
+
+int journal_parse_mode(const char* s) {
+	if(strcmp(s, "request") == 0)
+		return JOURNAL_SYNC_REQUEST;
+	else if(strcmp(s, "batch") == 0)
+		return JOURNAL_SYNC_BATCH;
+	else if(strcmp(s, "async") == 0)
+		return JOURNAL_SYNC_ASYNC;
+
+	return -1;
+}
+
+void journal_strerror(int error, char* dst, int dst_max_size) {
+	int current_errno = errno;
+	memset(dst, 0, dst_max_size);
+	switch(error) {
+		case JOURNAL_OPEN_INVAL:
+			memcpy(dst, "journal_open: Invalid argument", sizeof("journal_open: Invalid argument"));
+			break;
+		case JOURNAL_OPEN_FAILURE:
+			snprintf(dst, dst_max_size, "journal_open: %s", strerror(current_errno));
+			break;
+		case JOURNAL_OPEN_FORMAT:
+			memcpy(dst, "journal_open: not a journal file", sizeof("journal_open: not a journal file"));
+			break;
+		case JOURNAL_OPEN_REPLAY_FAILURE:
+			snprintf(dst, dst_max_size, "journal_open: record at offset %lu does not match the shows",
+					__journal_error_offset);
+			break;
+		case JOURNAL_OPEN_MALLOC_FAILURE:
+			snprintf(dst, dst_max_size, "journal_open:malloc: %s", strerror(current_errno));
+			break;
+		case JOURNAL_OPEN_THREAD_FAILURE:
+			snprintf(dst, dst_max_size, "journal_open:pthread: %s", strerror(current_errno));
+			break;
+		case JOURNAL_OPEN_SEQUENCE:
+			memcpy(dst, "journal_open: the journal does not continue the snapshot", 
+					sizeof("journal_open: the journal does not continue the snapshot"));
+			break;
+		case JOURNAL_TRUNCATE_FAILURE:
+			snprintf(dst, dst_max_size, "journal_truncate: %s", strerror(current_errno));
+			break;
+
+		default:
+			snprintf(dst, dst_max_size, "journal: Success");
+	}
+}
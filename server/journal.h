@@ -0,0 +1,159 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <pthread.h>
+
+#define JOURNAL_OK 0
+
+#define JOURNAL_OPEN_INVAL 4
+#define JOURNAL_OPEN_FAILURE 5
+#define JOURNAL_OPEN_FORMAT 6
+#define JOURNAL_OPEN_REPLAY_FAILURE 7
+#define JOURNAL_OPEN_MALLOC_FAILURE 8
+#define JOURNAL_OPEN_THREAD_FAILURE 9
+#define JOURNAL_OPEN_SEQUENCE 10
+
+#define JOURNAL_TRUNCATE_FAILURE 12
+
+//quando una modifica è durevole
+#define JOURNAL_SYNC_REQUEST 0 //prima della risposta, fdatasync appena possibile
+#define JOURNAL_SYNC_BATCH 1 //prima della risposta, fdatasync dopo window_us
+#define JOURNAL_SYNC_ASYNC 2 //dopo la risposta, fdatasync ogni window_us
+
+#define JOURNAL_REC_KEY 1 //chiave del generatore di codici, values: 4 parole
+#define JOURNAL_REC_BOOK 2 //prenotazione code, values: i posti
+#define JOURNAL_REC_REVOKE 3 //revoca di code, values: i posti liberati
+
+#define JOURNAL_MAX_VALUES (1U << 28)
+
+/*
+ * un record del giornale, come passato alla funzione di replay.
+ * values è valido solo durante la chiamata
+ */
+typedef struct {
+	unsigned type;
+	unsigned show_id;
+	unsigned code;
+	unsigned n_values;
+	const unsigned* values;
+} journal_record;
+
+/*
+ * replay: ritorna 0 per proseguire, altro per interrompere l'apertura
+ */
+typedef int(*journal_replay_fpt)(void* ctx, const journal_record* rec);
+
+/*
+ * giornale delle modifiche (write-ahead): ogni prenotazione e revoca
+ * è accodata in memoria mentre la sala è ancora bloccata, un thread
+ * dedicato scrive il buffer e chiama fdatasync per tutti i record
+ * accodati nel frattempo (group commit), chi attende la durabilità
+ * si blocca solo sulla condition variable.
+ * LSN: offset logico della fine di un record, continua tra un'esecuzione
+ * e l'altra (il file ne registra la base) e durable_lsn è l'ultimo già
+ * sul disco. file_mtx serializza l'uso del file: scrittura del flusher
+ * e troncamento dopo uno snapshot.
+ */
+typedef struct {
+	int fd;
+	char* path;
+	int mode;
+	unsigned window_us;
+	pthread_mutex_t mtx;
+	pthread_mutex_t file_mtx;
+	pthread_cond_t flush_cv; //nuovi record o chiusura
+	pthread_cond_t durable_cv; //durable_lsn avanzato
+	char* buf; //record non ancora scritti
+	unsigned long len;
+	unsigned long cap;
+	char* wbuf; //in scrittura dal flusher, scambiato con buf
+	unsigned long wcap;
+	unsigned long appended_lsn;
+	unsigned long durable_lsn;
+	unsigned long base_lsn; //LSN del primo record nel file
+	unsigned long written_lsn; //fine del file, con file_mtx
+	unsigned long replayed; //record applicati all'apertura
+	unsigned long truncated; //bytes di un record incompleto scartati all'apertura
+	unsigned long fsyncs;
+	int running;
+	pthread_t flusher;
+} journal;
+
+/*
+ * journal_open
+ *
+ * DESCRIZIONE:
+ *		apre (o crea) il giornale path, passa a replay in ordine tutti i
+ *		record validi che iniziano da from_lsn in poi (quelli precedenti
+ *		sono già in uno snapshot), tronca un eventuale record incompleto
+ *		in coda (scrittura interrotta da un crash) e avvia il thread di
+ *		scrittura. Un giornale nuovo inizia da from_lsn.
+ *
+ * NOTA BENE:
+ *		il thread eredita la maschera dei segnali del chiamante
+ *
+ * RITORNA:
+ *		* JOURNAL_OK se tutto è andato a buon fine
+ *		* uno degli errori della classe JOURNAL_OPEN_* altrimenti
+ */
+int journal_open(journal* jr, const char* path, unsigned long from_lsn, int mode, unsigned window_us,
+		journal_replay_fpt replay, void* ctx);
+
+/*
+ * journal_close
+ *		scrive e sincronizza i record ancora in memoria, termina il thread
+ */
+void journal_close(journal* jr);
+
+/*
+ * journal_append
+ *		accoda un record (values: n_values elementi), ritorna il suo LSN.
+ *		Thread safe, non attende il disco
+ */
+unsigned long journal_append(journal* jr, unsigned type, unsigned show_id, unsigned code,
+		const unsigned* values, unsigned n_values);
+
+/*
+ * journal_wait
+ *		attende che il record lsn sia durevole, non attende in modalità
+ *		JOURNAL_SYNC_ASYNC. Se la scrittura fallisce il processo termina:
+ *		la modifica è già visibile in memoria e non può essere confermata
+ */
+void journal_wait(journal* jr, unsigned long lsn);
+
+/*
+ * journal_sync
+ *		attende che tutti i record accodati siano durevoli, in ogni modalità
+ */
+void journal_sync(journal* jr);
+
+/*
+ * journal_position
+ *		LSN dell'ultimo record accodato. Thread safe
+ */
+unsigned long journal_position(journal* jr);
+
+/*
+ * journal_truncate
+ *
+ * DESCRIZIONE:
+ *		elimina dal file i record che finiscono entro lsn (già durevoli,
+ *		vedi journal_sync): i restanti sono copiati in un nuovo file che
+ *		sostituisce il precedente con rename. Il flusher attende la fine
+ *		della copia
+ *
+ * RITORNA:
+ *		* JOURNAL_OK se tutto è andato a buon fine
+ *		* JOURNAL_TRUNCATE_FAILURE altrimenti, il giornale resta intatto
+ */
+int journal_truncate(journal* jr, unsigned long lsn);
+
+/*
+ * journal_parse_mode
+ *		"request", "batch" o "async", -1 altrimenti
+ */
+int journal_parse_mode(const char* s);
+
+void journal_strerror(int error, char* dst, int dst_size);
+
+#endif
@@ -0,0 +1,326 @@
+/* logger.c - asynchronous logging, per-thread rings drained by one thread
+	ITA: ogni thread che scrive un messaggio riceve (alla prima chiamata)
+		un buffer circolare di LOGGER_RING_SIZE bytes, un solo produttore
+		(il thread) e un solo consumatore (il thread del logger): head e
+		tail sono contatori che crescono sempre, pubblicati con
+		release/acquire. Un messaggio è un'intestazione (lunghezza,
+		livello, secondo in cui è stato scritto) seguita dal testo,
+		allineato a 8 bytes, e può attraversare la fine del buffer.
+
+		I buffer formano una lista a cui si aggiunge in testa (CAS) e da
+		cui non si toglie mai: quando un thread termina il suo buffer,
+		una volta svuotato, è riutilizzato dal prossimo thread che ne
+		chiede uno. Vengono liberati solo con il processo: un exit() da
+		un altro thread può arrivare mentre i worker scrivono ancora.
+
+		Il thread del logger svuota tutti i buffer, poi se non ha trovato
+		nulla dorme LOGGER_POLL_US: chi scrive non deve svegliarlo.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "logger.h"
+
+#ifndef DATETIME_FORMAT
+#define DATETIME_FORMAT "%Y/%m/%d %H:%M:%S"
+#endif
+
+#ifndef LOGGER_RING_SIZE
+#define LOGGER_RING_SIZE 16384 //power of two, per thread
+#endif
+
+#ifndef LOGGER_POLL_US
+#define LOGGER_POLL_US 10000
+#endif
+
+#define LOGGER_TIMEBUF 64
+#define LOGGER_ALIGN(n) (((n) + 7UL) & ~7UL)
+
+#define LOGGER_RING_ACTIVE 0
+#define LOGGER_RING_DEAD 1 //thread terminated, still to be drained
+#define LOGGER_RING_FREE 2
+
+typedef struct {
+	unsigned len;
+	int level;
+	long sec;
+} __logger_entry;
+
+typedef struct __logger_ring_s {
+	char* data;
+	unsigned long head; //written by the owner
+	unsigned long tail; //written by the logger
+	unsigned long dropped; //written by the owner
+	unsigned long reported; //dropped already written out, logger only
+	int state;
+	struct __logger_ring_s* next;
+} __logger_ring;
+
+/* NOT exposed */
+static __logger_ring* __logger_rings = NULL;
+static __thread __logger_ring* __logger_local = NULL;
+static pthread_key_t __logger_key;
+static pthread_t __logger_thread;
+static int __logger_running = 0;
+static int __logger_level = LOGGER_INFO;
+static int __logger_initialized = 0;
+
+//logger thread only
+static long __logger_cached_sec = -1;
+static char __logger_cached_time[LOGGER_TIMEBUF];
+static char __logger_msg[LOGGER_MAX_MESSAGE];
+
+static void __logger_format_time(long sec, char* dst) {
+	time_t t = (time_t) sec;
+	struct tm tm;
+
+	if(localtime_r(&t, &tm) == NULL)
+		snprintf(dst, LOGGER_TIMEBUF, "localtime: failure");
+	else if(strftime(dst, LOGGER_TIMEBUF, DATETIME_FORMAT, &tm) == 0)
+		snprintf(dst, LOGGER_TIMEBUF, "strftime: failure");
+}
+
+/* one output line per non empty line of msg, like the old strtok() split */
+static void __logger_write(int level, const char* timebuf, const char* msg, unsigned len) {
+	FILE* out = level == LOGGER_ERROR ? stderr : stdout;
+	const char* type = level == LOGGER_ERROR ? "ERROR" : "LOG";
+	const char* end = msg + len;
+
+	while(msg < end) {
+		const char* nl = (const char*) memchr(msg, '\n', end - msg);
+		const char* line_end = nl ? nl : end;
+
+		if(line_end > msg)
+			fprintf(out, "%s [%s]: %.*s\n", type, timebuf, (int)(line_end - msg), msg);
+
+		msg = line_end + 1;
+	}
+}
+
+static void __logger_write_sync(int level, const char* msg, unsigned len) {
+	char timebuf[LOGGER_TIMEBUF];
+	__logger_format_time((long) time(NULL), timebuf);
+	__logger_write(level, timebuf, msg, len);
+}
+
+static void __logger_ring_put(__logger_ring* r, unsigned long pos, const void* src, unsigned long n) {
+	unsigned long off = pos & (LOGGER_RING_SIZE - 1);
+	unsigned long first = LOGGER_RING_SIZE - off < n ? LOGGER_RING_SIZE - off : n;
+
+	memcpy(r->data + off, src, first);
+	memcpy(r->data, (const char*) src + first, n - first);
+}
+
+static void __logger_ring_get(const __logger_ring* r, unsigned long pos, void* dst, unsigned long n) {
+	unsigned long off = pos & (LOGGER_RING_SIZE - 1);
+	unsigned long first = LOGGER_RING_SIZE - off < n ? LOGGER_RING_SIZE - off : n;
+
+	memcpy(dst, r->data + off, first);
+	memcpy((char*) dst + first, r->data, n - first);
+}
+
+static void __logger_ring_release(void* _r) {
+	__logger_ring* r = (__logger_ring*) _r;
+	__atomic_store_n(&r->state, LOGGER_RING_DEAD, __ATOMIC_RELEASE);
+}
+
+/* NULL: no memory, the caller writes the message itself */
+static __logger_ring* __logger_ring_get_local() {
+	if(__logger_local)
+		return __logger_local;
+
+	__logger_ring* r = __atomic_load_n(&__logger_rings, __ATOMIC_ACQUIRE);
+	for(; r; r = r->next) {
+		int expected = LOGGER_RING_FREE;
+		if(__atomic_compare_exchange_n(&r->state, &expected, LOGGER_RING_ACTIVE, 0,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+	}
+
+	if(r == NULL) {
+		r = (__logger_ring*) calloc(1, sizeof(__logger_ring));
+		if(r == NULL)
+			return NULL;
+
+		r->data = (char*) malloc(LOGGER_RING_SIZE);
+		if(r->data == NULL) {
+			free(r);
+			return NULL;
+		}
+
+		r->state = LOGGER_RING_ACTIVE;
+		r->next = __atomic_load_n(&__logger_rings, __ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(&__logger_rings, &r->next, r, 1,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+
+	//marks the ring dead when the thread terminates
+	pthread_setspecific(__logger_key, r);
+	__logger_local = r;
+	return r;
+}
+
+static unsigned long __logger_drain() {
+	unsigned long n = 0;
+
+	for(__logger_ring* r = __atomic_load_n(&__logger_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+		int state = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+		if(state == LOGGER_RING_FREE)
+			continue;
+
+		unsigned long head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		unsigned long tail = r->tail;
+
+		while(tail != head) {
+			__logger_entry e;
+			__logger_ring_get(r, tail, &e, sizeof(__logger_entry));
+			__logger_ring_get(r, tail + sizeof(__logger_entry), __logger_msg, e.len);
+
+			if(e.sec != __logger_cached_sec) {
+				__logger_format_time(e.sec, __logger_cached_time);
+				__logger_cached_sec = e.sec;
+			}
+
+			__logger_write(e.level, __logger_cached_time, __logger_msg, e.len);
+
+			tail += sizeof(__logger_entry) + LOGGER_ALIGN(e.len);
+			__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+			++n;
+		}
+
+		unsigned long dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+		if(dropped != r->reported) {
+			fprintf(stderr, "ERROR [%s]: %lu log message(s) dropped, buffer full\n",
+					__logger_cached_sec >= 0 ? __logger_cached_time : "-", dropped - r->reported);
+			r->reported = dropped;
+			++n;
+		}
+
+		//a dead thread wrote everything before dying
+		if(state == LOGGER_RING_DEAD)
+			__atomic_store_n(&r->state, LOGGER_RING_FREE, __ATOMIC_RELEASE);
+	}
+
+	return n;
+}
+
+static void* __logger_routine(void* arg) {
+	(void) arg;
+	struct timespec pause = { 0, LOGGER_POLL_US * 1000L };
+
+	for(;;) {
+		//read before draining: the last round sees everything appended before logger_finish
+		int running = __atomic_load_n(&__logger_running, __ATOMIC_ACQUIRE);
+
+		if(__logger_drain() > 0)
+			fflush(stdout);
+		else if(running)
+			nanosleep(&pause, NULL);
+
+		if(!running)
+			break;
+	}
+
+	return NULL;
+}
+
+/* exposed */
+int logger_init() {
+	if(pthread_key_create(&__logger_key, __logger_ring_release) != 0)
+		return LOGGER_INIT_KEY_FAILURE;
+
+	__atomic_store_n(&__logger_running, 1, __ATOMIC_RELEASE);
+	if(pthread_create(&__logger_thread, NULL, __logger_routine, NULL) != 0) {
+		__atomic_store_n(&__logger_running, 0, __ATOMIC_RELEASE);
+		pthread_key_delete(__logger_key);
+		return LOGGER_INIT_THREAD_FAILURE;
+	}
+
+	if(!__logger_initialized) {
+		__logger_initialized = 1;
+		atexit(logger_finish);
+	}
+
+	return LOGGER_OK;
+}
+
+void logger_finish() {
+	if(!__atomic_exchange_n(&__logger_running, 0, __ATOMIC_ACQ_REL))
+		return;
+
+	pthread_join(__logger_thread, NULL);
+	fflush(stdout);
+}
+
+void logger_log(int level, const char* msg) {
+	if(level > __logger_level)
+		return;
+
+	unsigned len = (unsigned) strnlen(msg, LOGGER_MAX_MESSAGE);
+
+	__logger_ring* r;
+	if(!__atomic_load_n(&__logger_running, __ATOMIC_ACQUIRE) || (r = __logger_ring_get_local()) == NULL) {
+		__logger_write_sync(level, msg, len);
+		return;
+	}
+
+	unsigned long size = sizeof(__logger_entry) + LOGGER_ALIGN(len);
+	unsigned long head = r->head;
+	if(LOGGER_RING_SIZE - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) < size) {
+		__atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	__logger_entry e = { len, level, (long) time(NULL) };
+	__logger_ring_put(r, head, &e, sizeof(__logger_entry));
+	__logger_ring_put(r, head + sizeof(__logger_entry), msg, len);
+
+	__atomic_store_n(&r->head, head + size, __ATOMIC_RELEASE);
+}
+
+void logger_set_level(int level) {
+	__logger_level = level;
+}
+
+int logger_enabled(int level) {
+	return level <= __logger_level;
+}
+
+unsigned long logger_dropped() {
+	unsigned long n = 0;
+	for(__logger_ring* r = __atomic_load_n(&__logger_rings, __ATOMIC_ACQUIRE); r; r = r->next)
+		n += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+
+	return n;
+}
+
+int logger_parse_level(const char* s) {
+	if(strcmp(s, "error") == 0)
+		return LOGGER_ERROR;
+	else if(strcmp(s, "info") == 0)
+		return LOGGER_INFO;
+	else if(strcmp(s, "verbose") == 0)
+		return LOGGER_VERBOSE;
+
+	return -1;
+}
+
+void logger_strerror(int error, char* dst, int dst_max_size) {
+	memset(dst, 0, dst_max_size);
+	switch(error) {
+		case LOGGER_INIT_KEY_FAILURE:
+			memcpy(dst, "logger_init: pthread_key_create failed", sizeof("logger_init: pthread_key_create failed"));
+			break;
+		case LOGGER_INIT_THREAD_FAILURE:
+			memcpy(dst, "logger_init: pthread_create failed", sizeof("logger_init: pthread_create failed"));
+			break;
+
+		default:
+			snprintf(dst, dst_max_size, "logger: Success");
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#define LOGGER_OK 0
+
+#define LOGGER_INIT_KEY_FAILURE 4
+#define LOGGER_INIT_THREAD_FAILURE 5
+
+//livelli, in ordine di dettaglio crescente
+#define LOGGER_ERROR 0 //stderr
+#define LOGGER_INFO 1 //stdout
+#define LOGGER_VERBOSE 2 //stdout, solo con --verbose
+
+#define LOGGER_MAX_MESSAGE 1024
+
+/*
+ * logger_init
+ *
+ * DESCRIZIONE:
+ *		avvia il thread che scrive i messaggi: da qui in poi ogni thread
+ *		accoda i propri in un buffer circolare privato (senza lock, senza
+ *		chiamate di sistema), il thread li svuota tutti, formatta data e
+ *		ora (ricalcolata solo al cambio di secondo) e scrive su
+ *		stdout/stderr. Prima di logger_init e dopo logger_finish i
+ *		messaggi sono scritti subito dal chiamante
+ *
+ * NOTA BENE:
+ *		il thread eredita la maschera dei segnali del chiamante,
+ *		logger_finish è registrata con atexit
+ *
+ * RITORNA:
+ *		* LOGGER_OK se tutto è andato a buon fine
+ *		* uno degli errori della classe LOGGER_INIT_* altrimenti
+ */
+int logger_init();
+
+/*
+ * logger_finish
+ *		scrive tutti i messaggi accodati e termina il thread
+ */
+void logger_finish();
+
+/*
+ * logger_log
+ *		accoda msg (anche su più righe, troncato a LOGGER_MAX_MESSAGE) se
+ *		level è abilitato. Non si blocca mai: se il buffer del thread è
+ *		pieno il messaggio è scartato e contato
+ */
+void logger_log(int level, const char* msg);
+
+void logger_set_level(int level);
+
+/*
+ * logger_enabled
+ *		!= 0 se i messaggi di livello level vengono scritti
+ */
+int logger_enabled(int level);
+
+/*
+ * logger_dropped
+ *		messaggi scartati finora perché il buffer del thread era pieno
+ */
+unsigned long logger_dropped();
+
+/*
+ * logger_parse_level
+ *		"error", "info" o "verbose", -1 altrimenti
+ */
+int logger_parse_level(const char* s);
+
+void logger_strerror(int error, char* dst, int dst_size);
+
+#endif
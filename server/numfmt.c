@@ -0,0 +1,74 @@
+/* numfmt.c - integer formatting
+	ITA: le risposte sono fatte quasi solo di numeri (coordinate dei
+		posti, codici di prenotazione). La lunghezza si ricava dalla
+		posizione del bit più alto e da un confronto con una potenza
+		di 10, le cifre si scrivono a coppie da una tabella di 200
+		caratteri: una divisione per 100 (moltiplicazione per l'inverso)
+		ogni due cifre invece di una divisione per ogni cifra.
+*/
+
+#include <string.h>
+
+#include "numfmt.h"
+
+/* NOT exposed */
+static const char __numfmt_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const unsigned __numfmt_pow10[NUMFMT_UINT_MAX_DIGITS] = {
+	1U, 10U, 100U, 1000U, 10000U, 100000U, 1000000U, 10000000U, 100000000U, 1000000000U
+};
+
+/* writes the digits of n backwards ending right before end, returns the first one */
+static char* __numfmt_write(unsigned long n, char* end) {
+	while(n >= 100) {
+		unsigned r = (unsigned) (n % 100);
+		n /= 100;
+		end -= 2;
+		memcpy(end, __numfmt_pairs + (r << 1), 2);
+	}
+
+	if(n >= 10) {
+		end -= 2;
+		memcpy(end, __numfmt_pairs + (n << 1), 2);
+	} else
+		*--end = (char) ('0' + n);
+
+	return end;
+}
+
+/* exposed */
+unsigned numfmt_digits(unsigned n) {
+	//floor(log10(2) * bit length) is exact or one short
+	unsigned bits = 32 - (unsigned) __builtin_clz(n | 1);
+	unsigned t = (bits * 1233) >> 12;
+	return t + ((n | 1) >= __numfmt_pow10[t]);
+}
+
+unsigned numfmt_utoa(unsigned n, char* out) {
+	unsigned len = numfmt_digits(n);
+	__numfmt_write(n, out + len);
+	return len;
+}
+
+unsigned numfmt_ultoa(unsigned long n, char* out) {
+	if(n <= 0xffffffffUL)
+		return numfmt_utoa((unsigned) n, out);
+
+	char buf[NUMFMT_ULONG_MAX_DIGITS];
+	char* end = buf + NUMFMT_ULONG_MAX_DIGITS;
+	char* first = __numfmt_write(n, end);
+
+	unsigned len = (unsigned) (end - first);
+	memcpy(out, first, len);
+	return len;
+}
@@ -0,0 +1,32 @@
+#ifndef NUMFMT_H
+#define NUMFMT_H
+
+#define NUMFMT_UINT_MAX_DIGITS 10
+#define NUMFMT_ULONG_MAX_DIGITS 20
+
+/*
+ * numfmt_digits
+ *		cifre decimali di n (1 per n == 0), senza divisioni
+ */
+unsigned numfmt_digits(unsigned n);
+
+/*
+ * numfmt_utoa
+ *
+ * DESCRIZIONE:
+ *		scrive n in base 10 in out, due cifre alla volta da una tabella,
+ *		senza terminatore. out deve avere spazio per 
+ *		NUMFMT_UINT_MAX_DIGITS caratteri
+ *
+ * RITORNA:
+ *		il numero di caratteri scritti
+ */
+unsigned numfmt_utoa(unsigned n, char* out);
+
+/*
+ * numfmt_ultoa
+ *		come numfmt_utoa, per interi a 64 bit (NUMFMT_ULONG_MAX_DIGITS)
+ */
+unsigned numfmt_ultoa(unsigned long n, char* out);
+
+#endif
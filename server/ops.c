@@ -0,0 +1,415 @@
+/* ops.c - request handlers
+	ITA: i comandi testuali e v2 su uno spettacolo, senza socket né
+		stato della connessione: ricevono la richiesta già decodificata
+		dal parser e scrivono la risposta nell'arena del worker. Usati
+		dal server e dai benchmark in bench/.
+*/
+
+#include <string.h>
+#include <endian.h>
+#include <stddef.h>
+
+#include "ops.h"
+#include "stats.h"
+#include "numfmt.h"
+
+typedef unsigned int uint32;
+typedef unsigned short ushort16;
+
+/* NOT exposed */
+static __thread unsigned __ops_result = STATS_RESULT_OK;
+
+/* exposed */
+void ops_set_result(unsigned result) {
+	__ops_result = result;
+}
+
+unsigned ops_result_take() {
+	unsigned result = __ops_result;
+	__ops_result = STATS_RESULT_OK;
+	return result;
+}
+
+const char* op_get_available_seats(show* sh, arena* scratch, const reqparse* __unused__, uint32* out_len) {
+	(void)__unused__;
+
+	return availcache_reply(&sh->engine.ac, 0, scratch, out_len);
+}
+
+/* ITA: come GetAvailableSeats, preceduta dalla versione della sala
+ *  a cui corrisponde la risposta: "v:r,c,...,r,c\0"
+ */
+const char* op_get_versioned_seats(show* sh, arena* scratch, const reqparse* __unused__, uint32* out_len) {
+	(void)__unused__;
+
+	return availcache_reply(&sh->engine.ac, 1, scratch, out_len);
+}
+
+/* ITA: "r:a-b,c,d-e;r:...;\0", solo le righe con posti liberi, 
+ *  una colonna isolata è scritta senza '-'. La dimensione dipende dal 
+ *  numero di sequenze libere, non dal numero di posti.
+ */
+const char* op_get_available_ranges(show* sh, arena* scratch, const reqparse* __unused__, uint32* out_len) {
+	(void)__unused__;
+
+	uint32* ranges = (uint32*) arena_alloc(scratch, sizeof(uint32) * (sh->pols + 1));
+
+	//last allocation of the arena, grows in place
+	uint32 cap = 256;
+	uint32 len = 0;
+	char* res = (char*) arena_alloc(scratch, cap);
+
+	uint32 range_max = (numfmt_digits(sh->pols) << 1) + 2; //"a-b,"
+	unsigned long version;
+
+seqlock_retry:
+	version = seatmap_read_begin(&sh->engine.sm);
+	len = 0;
+
+	for(uint32 i = 0; i < sh->rows; ++i) {
+		uint32 n_ranges = seatmap_row_free_ranges(&sh->engine.sm, i, ranges);
+		if(n_ranges == 0)
+			continue;
+
+		//"r:" + ranges + ';' + '\0'
+		uint32 need = 12 + n_ranges * range_max + 2;
+		if(len + need > cap) {
+			uint32 old_cap = cap;
+			while(len + need > cap)
+				cap <<= 1;
+
+			res = (char*) arena_grow(scratch, res, old_cap, cap);
+		}
+
+		len += numfmt_utoa(i + 1, res + len);
+		res[len++] = ':';
+
+		for(uint32 j = 0; j < n_ranges; ++j) {
+			uint32 first = ranges[j << 1];
+			uint32 last = ranges[(j << 1) + 1];
+
+			len += numfmt_utoa(first + 1, res + len);
+			if(last != first) {
+				res[len++] = '-';
+				len += numfmt_utoa(last + 1, res + len);
+			}
+
+			res[len++] = ',';
+		}
+
+		res[len - 1] = ';';
+	}
+
+	if(seatmap_read_retry(&sh->engine.sm, version))
+		goto seqlock_retry;
+
+	res[len] = 0;
+	*out_len = len + 1;
+	return res;
+}
+
+/* ITA: le coordinate sono già decodificate dal parser, x,y,x,y,...
+ *  (un token non numerico vale 0, quindi Fail:exceed)
+ */
+const char* op_book_seats(show* sh, arena* scratch, const reqparse* rp, uint32* out_len) {
+	uint32 n_bookings = rp->n_values >> 1;
+	uint32 max_bookings = n_bookings < sh->n_total_seats ? n_bookings : sh->n_total_seats;
+	uint32* to_book = (uint32*) arena_alloc(scratch, sizeof(uint32) * max_bookings);
+
+	//pairs past the hall size are only counted: toomuch fires before reaching them
+	for(uint32 i = 0; i < n_bookings; ++i) {
+		uint32 x = rp->values[i << 1];
+		uint32 y = rp->values[(i << 1) + 1];
+
+		if(x == 0 || y == 0 || x > sh->rows || y > sh->pols)
+			return fail_reply("Fail:exceed", STATS_RESULT_EXCEED, out_len);
+
+		if(i + 1 > max_bookings)
+			return fail_reply("Fail:toomuch", STATS_RESULT_TOOMUCH, out_len);
+
+		to_book[i] = (x - 1) * sh->pols + (y - 1);
+	}
+
+	if(rp->n_values & 1)
+		return fail_reply("Fail:noteven", STATS_RESULT_NOTEVEN, out_len);
+
+	if(n_bookings == 0)
+		return fail_reply("Fail:wholeempty", STATS_RESULT_EMPTY, out_len);
+
+	uint32 unique;
+	if(booking_book(&sh->engine, to_book, n_bookings, &unique) != BOOKING_OK)
+		return fail_reply("Fail:notavail", STATS_RESULT_NOTAVAIL, out_len);
+
+	char* res = (char*) arena_alloc(scratch, 8 + NUMFMT_UINT_MAX_DIGITS + 1);
+	memcpy(res, "Success:", 8);
+	uint32 len = 8 + numfmt_utoa(unique, res + 8);
+	res[len] = 0;
+
+	*out_len = len + 1;
+	return res;
+}
+
+/* ITA: prenotazioni indipendenti separate da ';', ciascuna validata
+ *  come BookSeats prima di prendere i lock, poi tutte insieme con
+ *  booking_book_batch. Una risposta per prenotazione, nello stesso
+ *  ordine: "Success:code;Fail:notavail;...\0". Per Stats la richiesta
+ *  riesce se almeno una prenotazione riesce, altrimenti vale l'esito
+ *  della prima
+ */
+const char* op_book_batch(show* sh, arena* scratch, const reqparse* rp, uint32* out_len) {
+	//values past max_values are only counted, the group lengths would be lost
+	if(rp->n_values > rp->max_values)
+		return fail_reply("Fail:toomuch", STATS_RESULT_TOOMUCH, out_len);
+
+	uint32 n_bookings = 0;
+	for(uint32 i = 0; i < rp->n_values; i += rp->values[i] + 1)
+		++n_bookings;
+
+	uint32* seats = (uint32*) arena_alloc(scratch, sizeof(uint32) * ((rp->n_values - n_bookings) >> 1));
+	uint32* n_seats = (uint32*) arena_alloc(scratch, sizeof(uint32) * n_bookings);
+	uint32* codes = (uint32*) arena_alloc(scratch, sizeof(uint32) * n_bookings);
+	const char** fails = (const char**) arena_alloc(scratch, sizeof(const char*) * n_bookings);
+	uint32* results = (uint32*) arena_alloc(scratch, sizeof(uint32) * n_bookings);
+
+	uint32 n_valid = 0;
+	uint32 n_total = 0;
+	const uint32* group = rp->values;
+
+	for(uint32 b = 0; b < n_bookings; group += group[0] + 1, ++b) {
+		uint32 n_values = group[0];
+		uint32 n = n_values >> 1;
+		fails[b] = NULL;
+
+		for(uint32 i = 0; i < n && fails[b] == NULL; ++i) {
+			uint32 x = group[1 + (i << 1)];
+			uint32 y = group[2 + (i << 1)];
+
+			if(x == 0 || y == 0 || x > sh->rows || y > sh->pols) {
+				fails[b] = "Fail:exceed";
+				results[b] = STATS_RESULT_EXCEED;
+			} else
+				seats[n_total + i] = (x - 1) * sh->pols + (y - 1);
+		}
+
+		if(fails[b] == NULL && n > sh->n_total_seats) {
+			fails[b] = "Fail:toomuch";
+			results[b] = STATS_RESULT_TOOMUCH;
+		} else if(fails[b] == NULL && (n_values & 1)) {
+			fails[b] = "Fail:noteven";
+			results[b] = STATS_RESULT_NOTEVEN;
+		} else if(fails[b] == NULL && n == 0) {
+			fails[b] = "Fail:wholeempty";
+			results[b] = STATS_RESULT_EMPTY;
+		}
+
+		if(fails[b] == NULL) {
+			n_seats[n_valid++] = n;
+			n_total += n;
+		}
+	}
+
+	uint32 n_booked = n_valid ? booking_book_batch(&sh->engine, seats, n_seats, n_valid, codes) : 0;
+
+	//"Success:" and 10 digits, or a shorter "Fail:*", and ';' or '\0'
+	char* res = (char*) arena_alloc(scratch, n_bookings * (8 + NUMFMT_UINT_MAX_DIGITS + 1));
+	uint32 len = 0;
+
+	for(uint32 b = 0, v = 0; b < n_bookings; ++b) {
+		const char* fail = fails[b];
+		if(fail == NULL && codes[v] == 0) {
+			fail = "Fail:notavail";
+			results[b] = STATS_RESULT_NOTAVAIL;
+		}
+
+		if(fail) {
+			uint32 n = (uint32) strlen(fail);
+			memcpy(res + len, fail, n);
+			len += n;
+		} else {
+			memcpy(res + len, "Success:", 8);
+			len += 8 + numfmt_utoa(codes[v], res + len + 8);
+		}
+
+		if(fails[b] == NULL)
+			++v;
+
+		res[len++] = ';';
+	}
+
+	res[len - 1] = 0;
+	*out_len = len;
+
+	ops_set_result(n_booked ? STATS_RESULT_OK : results[0]);
+	return res;
+}
+
+/* ITA: "BookBestn" o "BookBestn,r": n posti consecutivi nella stessa
+ *  riga, cercati dalla riga r (di default quella centrale) verso le altre
+ *  con booking_book_best. Nessun conflitto da ritentare: la risposta 
+ *  porta il codice e i posti scelti, "Success:code:x,y,x,y,...\0"
+ */
+const char* op_book_best(show* sh, arena* scratch, const reqparse* rp, uint32* out_len) {
+	if(rp->n_values > 2)
+		return fail_reply(INVALID_REQUEST_REPLY, STATS_RESULT_INVALID, out_len);
+
+	//a non numeric token is 0 as in BookSeats
+	uint32 n = rp->n_values > 0 ? rp->values[0] : 0;
+	uint32 row = rp->n_values > 1 ? rp->values[1] : (sh->rows + 1) >> 1;
+
+	if(n == 0)
+		return fail_reply("Fail:wholeempty", STATS_RESULT_EMPTY, out_len);
+
+	if(n > sh->pols)
+		return fail_reply("Fail:toomuch", STATS_RESULT_TOOMUCH, out_len);
+
+	if(row == 0 || row > sh->rows)
+		return fail_reply("Fail:exceed", STATS_RESULT_EXCEED, out_len);
+
+	uint32* seats = (uint32*) arena_alloc(scratch, sizeof(uint32) * n);
+
+	uint32 unique;
+	if(booking_book_best(&sh->engine, n, row - 1, seats, &unique) != BOOKING_OK)
+		return fail_reply("Fail:notavail", STATS_RESULT_NOTAVAIL, out_len);
+
+	//all in the same row: "x," is written once per seat anyway
+	uint32 pair_max = numfmt_digits(sh->rows) + numfmt_digits(sh->pols) + 2;
+	char* res = (char*) arena_alloc(scratch, 8 + NUMFMT_UINT_MAX_DIGITS + 1 + n * pair_max);
+	memcpy(res, "Success:", 8);
+	uint32 len = 8 + numfmt_utoa(unique, res + 8);
+	res[len++] = ':';
+
+	for(uint32 i = 0; i < n; ++i) {
+		len += numfmt_utoa(seats[i] / sh->pols + 1, res + len);
+		res[len++] = ',';
+		len += numfmt_utoa(seats[i] % sh->pols + 1, res + len);
+		res[len++] = ',';
+	}
+
+	res[len - 1] = 0;
+	*out_len = len;
+	return res;
+}
+
+const char* op_revoke_booking(show* sh, arena* scratch, const reqparse* rp, uint32* out_len) {
+	((void)scratch);
+
+	if(rp->error == REQPARSE_ERR_NUMBER || rp->n_values != 1)
+		return fail_reply("Fail:nan", STATS_RESULT_NAN, out_len);
+
+	if(booking_revoke(&sh->engine, rp->values[0]) == 0)
+		return fail_reply("Fail:nounique", STATS_RESULT_NOUNIQUE, out_len);
+
+	return static_reply("Success:ok", out_len);
+}
+
+/* ITA: report dei contatori (vedi stats_report), una riga per op,
+ *  uguale per ogni spettacolo
+ */
+const char* op_stats(show* __unused_1__, arena* scratch, const reqparse* __unused_2__, uint32* out_len) {
+	((void)__unused_1__);
+	((void)__unused_2__);
+
+	char* res = (char*) arena_alloc(scratch, STATS_REPORT_MAX);
+	*out_len = stats_report(res, STATS_REPORT_MAX) + 1;
+	return res;
+}
+
+/* --- protocol v2 --- */
+
+char* op2_reply(arena* scratch, const proto2_header* req, ushort16 status, uint32 payload_len, uint32* out_len) {
+	char* res = (char*) arena_alloc(scratch, PROTO2_HEADER_SIZE + payload_len);
+
+	//STATS_RESULT_* share the values of the v2 statuses
+	ops_set_result(status);
+
+	proto2_header h;
+	h.magic = PROTO2_MAGIC;
+	h.opcode = req->opcode;
+	h.status = htole16(status);
+	h.show_id = htole32(req->show_id);
+	h.request_id = htole32(req->request_id);
+	h.payload_len = htole32(payload_len);
+	memcpy(res, &h, PROTO2_HEADER_SIZE);
+
+	*out_len = PROTO2_HEADER_SIZE + payload_len;
+	return res;
+}
+
+char* op2_get_available_seats(show* sh, arena* scratch, const proto2_header* req, const uint32* __unused_1__, uint32* out_len) {
+	((void)__unused_1__);
+
+	if(req->payload_len != 0)
+		return op2_reply(scratch, req, PROTO2_STATUS_INVALID, 0, out_len);
+
+	char* res = op2_reply(scratch, req, PROTO2_STATUS_OK, 
+			sizeof(proto2_available_seats) + sizeof(uint32) * sh->n_total_seats, out_len);
+	uint32* ids = (uint32*) (res + PROTO2_HEADER_SIZE + sizeof(proto2_available_seats));
+
+	uint32 count;
+	unsigned long version;
+	do {
+		version = seatmap_read_begin(&sh->engine.sm);
+		count = 0;
+
+		for(uint32 i = 0; i < sh->rows; ++i) {
+			uint32 base = i * sh->pols;
+			uint32 n_free = seatmap_row_free_list(&sh->engine.sm, i, ids + count);
+
+			for(uint32 j = 0; j < n_free; ++j)
+				ids[count + j] = htole32(base + ids[count + j]);
+
+			count += n_free;
+		}
+	} while(seatmap_read_retry(&sh->engine.sm, version));
+
+	proto2_available_seats body;
+	body.pols = htole32(sh->pols);
+	body.count = htole32(count);
+	body.version = htole64(version);
+	memcpy(res + PROTO2_HEADER_SIZE, &body, sizeof(body));
+
+	uint32 payload_len = sizeof(proto2_available_seats) + sizeof(uint32) * count;
+	uint32 le_payload_len = htole32(payload_len);
+	memcpy(res + offsetof(proto2_header, payload_len), &le_payload_len, sizeof(uint32));
+	*out_len = PROTO2_HEADER_SIZE + payload_len;
+
+	return res;
+}
+
+/* ITA: payload già decodificato dal parser, un uint32 per posto */
+char* op2_book_seats(show* sh, arena* scratch, const proto2_header* req, const uint32* payload, uint32* out_len) {
+	uint32 n_bookings = req->payload_len / sizeof(uint32);
+
+	if(req->payload_len % sizeof(uint32))
+		return op2_reply(scratch, req, PROTO2_STATUS_INVALID, 0, out_len);
+	else if(n_bookings == 0)
+		return op2_reply(scratch, req, PROTO2_STATUS_EMPTY, 0, out_len);
+	else if(n_bookings > sh->n_total_seats)
+		return op2_reply(scratch, req, PROTO2_STATUS_TOOMUCH, 0, out_len);
+
+	for(uint32 i = 0; i < n_bookings; ++i) {
+		if(payload[i] >= sh->n_total_seats)
+			return op2_reply(scratch, req, PROTO2_STATUS_EXCEED, 0, out_len);
+	}
+
+	uint32 unique;
+	if(booking_book(&sh->engine, payload, n_bookings, &unique) != BOOKING_OK)
+		return op2_reply(scratch, req, PROTO2_STATUS_NOTAVAIL, 0, out_len);
+
+	char* res = op2_reply(scratch, req, PROTO2_STATUS_OK, sizeof(proto2_booking), out_len);
+	proto2_booking body;
+	body.code = htole32(unique);
+	memcpy(res + PROTO2_HEADER_SIZE, &body, sizeof(body));
+
+	return res;
+}
+
+char* op2_revoke_booking(show* sh, arena* scratch, const proto2_header* req, const uint32* payload, uint32* out_len) {
+	if(req->payload_len != sizeof(uint32))
+		return op2_reply(scratch, req, PROTO2_STATUS_INVALID, 0, out_len);
+
+	if(booking_revoke(&sh->engine, payload[0]) == 0)
+		return op2_reply(scratch, req, PROTO2_STATUS_NOUNIQUE, 0, out_len);
+
+	return op2_reply(scratch, req, PROTO2_STATUS_OK, 0, out_len);
+}
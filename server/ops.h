@@ -0,0 +1,66 @@
+#ifndef OPS_H
+#define OPS_H
+
+#include "shows.h"
+#include "arena.h"
+#include "reqparse.h"
+#include "proto2.h"
+
+#define INVALID_REQUEST_REPLY "Op:invalid\r\n"
+
+//constant replies are never copied nor allocated, sizeof includes the terminator
+#define static_reply(msg, out_len) (*(out_len) = sizeof(msg), msg)
+
+//failed requests are counted by reason in the Stats report
+#define fail_reply(msg, reason, out_len) (ops_set_result(reason), static_reply(msg, out_len))
+
+/*
+ * ops_handler_fpt
+ *		un comando testuale già decodificato (rp) sullo spettacolo sh:
+ *		ritorna la risposta, costante o allocata in scratch, in *out_len
+ *		la sua lunghezza (terminatore incluso)
+ */
+typedef const char* (*ops_handler_fpt)(show* sh, arena* scratch, const reqparse* rp, unsigned* out_len);
+
+/*
+ * ops_set_result
+ *		esito (STATS_RESULT_*) della richiesta che il thread sta eseguendo
+ */
+void ops_set_result(unsigned result);
+
+/*
+ * ops_result_take
+ *		esito dell'ultima richiesta eseguita dal thread, che torna a
+ *		STATS_RESULT_OK per la prossima
+ */
+unsigned ops_result_take();
+
+/*
+ * comandi testuali, indicizzati per REQPARSE_OP_* in server.c.
+ * Nessun socket: il chiamante passa la richiesta già decodificata e
+ * copia la risposta prima del prossimo arena_reset
+ */
+const char* op_get_available_seats(show* sh, arena* scratch, const reqparse* rp, unsigned* out_len);
+const char* op_get_available_ranges(show* sh, arena* scratch, const reqparse* rp, unsigned* out_len);
+const char* op_get_versioned_seats(show* sh, arena* scratch, const reqparse* rp, unsigned* out_len);
+const char* op_book_seats(show* sh, arena* scratch, const reqparse* rp, unsigned* out_len);
+const char* op_book_batch(show* sh, arena* scratch, const reqparse* rp, unsigned* out_len);
+const char* op_book_best(show* sh, arena* scratch, const reqparse* rp, unsigned* out_len);
+const char* op_revoke_booking(show* sh, arena* scratch, const reqparse* rp, unsigned* out_len);
+const char* op_stats(show* sh, arena* scratch, const reqparse* rp, unsigned* out_len);
+
+/*
+ * op2_reply
+ *		header della risposta v2 a req con status e spazio per payload_len
+ *		bytes di payload, allocata in scratch
+ */
+char* op2_reply(arena* scratch, const proto2_header* req, unsigned short status, unsigned payload_len, unsigned* out_len);
+
+/*
+ * comandi v2, payload già decodificato dal parser (un uint32 per valore)
+ */
+char* op2_get_available_seats(show* sh, arena* scratch, const proto2_header* req, const unsigned* payload, unsigned* out_len);
+char* op2_book_seats(show* sh, arena* scratch, const proto2_header* req, const unsigned* payload, unsigned* out_len);
+char* op2_revoke_booking(show* sh, arena* scratch, const proto2_header* req, const unsigned* payload, unsigned* out_len);
+
+#endif
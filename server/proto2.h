@@ -0,0 +1,65 @@
+#ifndef PROTO2_H
+#define PROTO2_H
+
+/* 
+ * protocollo binario v2, servito sulla stessa porta del protocollo testuale:
+ * ogni richiesta v2 inizia con PROTO2_MAGIC, byte che nessun comando 
+ * testuale può avere in testa. Testo e v2 possono alternarsi sulla stessa
+ * connessione, le risposte v2 sono nello stesso formato delle richieste.
+ *
+ * Tutti i campi sono little endian. Un posto è identificato dal suo indice 
+ * lineare (riga * colonne + colonna), righe e colonne partono da 0.
+ *
+ *  richiesta                          payload
+ *  GET_AVAILABLE_SEATS                vuoto
+ *  BOOK_SEATS                         uint32 seat[n]
+ *  REVOKE_BOOKING                     uint32 code
+ *
+ *  risposta (status == OK)            payload
+ *  GET_AVAILABLE_SEATS                proto2_available_seats + uint32 seat[count]
+ *  BOOK_SEATS                         proto2_booking
+ *  REVOKE_BOOKING                     vuoto
+ *
+ * Con status != OK il payload della risposta è sempre vuoto.
+ *
+ * show_id è l'id dello spettacolo (32 bit, come nei comandi testuali),
+ * ripetuto nella risposta; NOSHOW se non esiste. Nelle richieste status
+ * deve essere 0.
+ */
+
+#define PROTO2_MAGIC 0xB2
+#define PROTO2_HEADER_SIZE 16
+
+#define PROTO2_OP_GET_AVAILABLE_SEATS 1
+#define PROTO2_OP_BOOK_SEATS 2
+#define PROTO2_OP_REVOKE_BOOKING 3
+
+#define PROTO2_STATUS_OK 0
+#define PROTO2_STATUS_INVALID 1 //Op:invalid
+#define PROTO2_STATUS_EXCEED 2 //Fail:exceed
+#define PROTO2_STATUS_TOOMUCH 3 //Fail:toomuch
+#define PROTO2_STATUS_EMPTY 4 //Fail:wholeempty
+#define PROTO2_STATUS_NOTAVAIL 5 //Fail:notavail
+#define PROTO2_STATUS_NOUNIQUE 6 //Fail:nounique
+#define PROTO2_STATUS_NOSHOW 7 //Fail:noshow
+
+typedef struct __attribute__((packed)) {
+	unsigned char magic;
+	unsigned char opcode;
+	unsigned short status; //requests: 0
+	unsigned int show_id; //echoed back in the reply
+	unsigned int request_id; //echoed back in the reply
+	unsigned int payload_len;
+} proto2_header;
+
+typedef struct __attribute__((packed)) {
+	unsigned int pols;
+	unsigned int count;
+	unsigned long long version; //versione della sala a cui corrisponde l'elenco
+} proto2_available_seats;
+
+typedef struct __attribute__((packed)) {
+	unsigned int code;
+} proto2_booking;
+
+#endif
@@ -0,0 +1,500 @@
+/* reqparse.c - resumable request parser
+	ITA: il parser è una macchina a stati che riprende da dove si era
+		fermato: una richiesta può arrivare spezzata in un numero
+		qualsiasi di recv, il buffer di ricezione resta di dimensione
+		costante qualunque sia la sala. Le coppie di BookSeats sono
+		decodificate mentre arrivano; i bytes dell'argomento sono
+		classificati a blocchi di 32 (AVX2: maschere di delimitatori e
+		cifre), il terminatore delle parti da saltare è cercato con
+		memchr.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <endian.h>
+#include <immintrin.h>
+
+#include "malloc_utils.h"
+#include "reqparse.h"
+
+#define REQPARSE_BLOCK 32
+
+#define __REQPARSE_STAGE_START 0
+#define __REQPARSE_STAGE_SHOW 1
+#define __REQPARSE_STAGE_NAME 2
+#define __REQPARSE_STAGE_ARG 3
+#define __REQPARSE_STAGE_SKIP 4 //fino a '\r'
+#define __REQPARSE_STAGE_SKIP_CR 5 //dopo '\r', si attende '\n'
+#define __REQPARSE_STAGE_V2_HEADER 6
+#define __REQPARSE_STAGE_V2_WORDS 7
+#define __REQPARSE_STAGE_V2_SKIP 8
+
+#define __REQPARSE_ARG_NONE 0
+#define __REQPARSE_ARG_LIST 1
+#define __REQPARSE_ARG_NUMBER 2
+#define __REQPARSE_ARG_GROUPS 3 //liste separate da ';'
+
+typedef struct {
+	const char* name;
+	unsigned len;
+	unsigned op;
+	unsigned arg_kind;
+} __reqparse_op;
+
+//delimitatori (',' ';' '\r') e cifre di un blocco, un bit per byte
+typedef void (*__reqparse_classify_fpt)(const char*, unsigned*, unsigned*);
+
+/* NOT exposed */
+static const __reqparse_op __reqparse_ops[] = {
+	{ "GetAvailableSeats", 17, REQPARSE_OP_GET_AVAILABLE_SEATS, __REQPARSE_ARG_NONE },
+	{ "GetAvailableRanges", 18, REQPARSE_OP_GET_AVAILABLE_RANGES, __REQPARSE_ARG_NONE },
+	{ "GetVersionedSeats", 17, REQPARSE_OP_GET_VERSIONED_SEATS, __REQPARSE_ARG_NONE },
+	{ "BookSeats", 9, REQPARSE_OP_BOOK_SEATS, __REQPARSE_ARG_LIST },
+	{ "BookBatch", 9, REQPARSE_OP_BOOK_BATCH, __REQPARSE_ARG_GROUPS },
+	{ "BookBest", 8, REQPARSE_OP_BOOK_BEST, __REQPARSE_ARG_LIST },
+	{ "RevokeBooking", 13, REQPARSE_OP_REVOKE_BOOKING, __REQPARSE_ARG_NUMBER },
+	{ "Stats", 5, REQPARSE_OP_STATS, __REQPARSE_ARG_NONE }
+};
+
+static __reqparse_classify_fpt __reqparse_classify;
+static const char* __reqparse_impl_name = "none";
+
+#define __reqparse_is_digit(c) ((unsigned char) ((c) - '0') <= 9)
+#define __reqparse_is_letter(c) ((unsigned char) (((c) | 0x20) - 'a') <= 'z' - 'a')
+
+static unsigned __reqparse_classify_tail(const char* p, unsigned n, unsigned* digit) {
+	unsigned delim = 0;
+	*digit = 0;
+
+	for(unsigned i = 0; i < n; ++i) {
+		if(p[i] == ',' || p[i] == ';' || p[i] == '\r')
+			delim |= 1u << i;
+		else if(__reqparse_is_digit(p[i]))
+			*digit |= 1u << i;
+	}
+
+	return delim;
+}
+
+static void __reqparse_classify_scalar(const char* p, unsigned* delim, unsigned* digit) {
+	*delim = __reqparse_classify_tail(p, REQPARSE_BLOCK, digit);
+}
+
+__attribute__((target("avx2")))
+static void __reqparse_classify_avx2(const char* p, unsigned* delim, unsigned* digit) {
+	__m256i v = _mm256_loadu_si256((const __m256i*) p);
+	__m256i comma = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','));
+	__m256i semi = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';'));
+	__m256i cr = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'));
+
+	//c - '0' <= 9 as unsigned bytes
+	__m256i off = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+	__m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(off, _mm256_set1_epi8(9)), off);
+
+	*delim = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(comma, semi), cr));
+	*digit = (unsigned) _mm256_movemask_epi8(is_digit);
+}
+
+static void __reqparse_push(reqparse* rp, unsigned v) {
+	if(rp->n_values < rp->max_values) {
+		if(rp->n_values == rp->values_cap) {
+			unsigned cap = rp->values_cap << 1;
+			if(cap > rp->max_values)
+				cap = rp->max_values;
+
+			if(rp->values == rp->inline_values) {
+				rp->values = (unsigned*) malloc(sizeof(unsigned) * cap);
+				malloc_check_exit_on_error(rp->values);
+				memcpy(rp->values, rp->inline_values, sizeof(unsigned) * rp->n_values);
+			} else {
+				rp->values = (unsigned*) realloc(rp->values, sizeof(unsigned) * cap);
+				malloc_check_exit_on_error(rp->values);
+			}
+
+			rp->values_cap = cap;
+		}
+
+		rp->values[rp->n_values] = v;
+	}
+
+	++rp->n_values;
+}
+
+static void __reqparse_end_token(reqparse* rp) {
+	if(rp->num_len == 0 && !rp->num_bad)
+		return; //empty token: ",," or leading/trailing ','
+
+	unsigned v = (unsigned) rp->num;
+	if(rp->num_bad || rp->num > UINT_MAX) {
+		v = 0;
+		if(rp->arg_kind == __REQPARSE_ARG_NUMBER && rp->error == REQPARSE_ERR_NONE)
+			rp->error = REQPARSE_ERR_NUMBER;
+	}
+
+	if(rp->n_values < rp->values_cap)
+		rp->values[rp->n_values++] = v;
+	else
+		__reqparse_push(rp, v);
+
+	rp->num = 0;
+	rp->num_len = 0;
+	rp->num_bad = 0;
+}
+
+/* BookBatch: a slot for the length of the group, filled when it ends */
+static void __reqparse_begin_group(reqparse* rp) {
+	rp->group_start = rp->n_values;
+	__reqparse_push(rp, 0);
+}
+
+static void __reqparse_end_group(reqparse* rp) {
+	if(rp->group_start < rp->max_values)
+		rp->values[rp->group_start] = rp->n_values - rp->group_start - 1;
+}
+
+/* 
+ * argument bytes up to and including '\r', returns how many were consumed.
+ * Each step takes a whole token: the bytes up to the next delimiter in the
+ * block's masks, either all digits or spoiled
+ */
+static unsigned __reqparse_arg(reqparse* rp, const char* p, unsigned n) {
+	unsigned pos = 0;
+
+	while(pos < n) {
+		unsigned blk = n - pos < REQPARSE_BLOCK ? n - pos : REQPARSE_BLOCK;
+		const char* b = p + pos;
+		unsigned delim;
+		unsigned digit;
+
+		if(blk == REQPARSE_BLOCK)
+			__reqparse_classify(b, &delim, &digit);
+		else
+			delim = __reqparse_classify_tail(b, blk, &digit);
+
+		unsigned i = 0;
+		while(i < blk) {
+			unsigned stop = delim & (~0u << i);
+			unsigned end = stop ? (unsigned) __builtin_ctz(stop) : blk;
+
+			if(end > i) {
+				unsigned len = end - i;
+				unsigned span = (len == REQPARSE_BLOCK ? ~0u : (1u << len) - 1) << i;
+
+				if((digit & span) != span)
+					rp->num_bad = 1;
+				else {
+					//saturates above UINT_MAX, leading zeros stay harmless
+					unsigned long long num = rp->num;
+					for(unsigned j = i; j < end && num <= UINT_MAX; ++j)
+						num = num * 10 + (unsigned) (b[j] - '0');
+					rp->num = num;
+					rp->num_len += len;
+				}
+
+				rp->arg_len += len;
+			}
+
+			if(end == blk)
+				break;
+
+			++rp->arg_len;
+			i = end + 1;
+
+			if(b[end] == ',') {
+				if(rp->arg_kind == __REQPARSE_ARG_NUMBER)
+					rp->num_bad = 1;
+				else
+					__reqparse_end_token(rp);
+			} else if(b[end] == ';') {
+				//only a separator for BookBatch, elsewhere it spoils the token
+				if(rp->arg_kind != __REQPARSE_ARG_GROUPS)
+					rp->num_bad = 1;
+				else {
+					__reqparse_end_token(rp);
+					__reqparse_end_group(rp);
+					__reqparse_begin_group(rp);
+				}
+			} else {
+				__reqparse_end_token(rp);
+				if(rp->arg_kind == __REQPARSE_ARG_GROUPS) {
+					//"x,y;\r": a trailing ';' opens no group, one reply per group sent
+					if(rp->group_start > 0 && rp->n_values == rp->group_start + 1)
+						rp->n_values = rp->group_start;
+					else
+						__reqparse_end_group(rp);
+				}
+
+				--rp->arg_len; //'\r' is not part of the argument
+
+				if(rp->arg_len == 0 && rp->error == REQPARSE_ERR_NONE)
+					rp->error = REQPARSE_ERR_INVALID;
+
+				rp->stage = __REQPARSE_STAGE_SKIP_CR;
+				return pos + i;
+			}
+		}
+
+		pos += blk;
+	}
+
+	return pos;
+}
+
+static int __reqparse_match_name(reqparse* rp) {
+	for(unsigned i = 0; i < sizeof(__reqparse_ops) / sizeof(__reqparse_op); ++i) {
+		const __reqparse_op* o = &__reqparse_ops[i];
+		if(o->len == rp->name_len && !memcmp(o->name, rp->name, o->len)) {
+			rp->op = o->op;
+			rp->arg_kind = o->arg_kind;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void __reqparse_v2_header(reqparse* rp) {
+	memcpy(&rp->v2, rp->partial, PROTO2_HEADER_SIZE);
+	rp->v2.status = le16toh(rp->v2.status);
+	rp->v2.show_id = le32toh(rp->v2.show_id);
+	rp->v2.request_id = le32toh(rp->v2.request_id);
+	rp->v2.payload_len = le32toh(rp->v2.payload_len);
+	rp->partial_len = 0;
+}
+
+static void __reqparse_v2_word(reqparse* rp, const void* p) {
+	unsigned w;
+	memcpy(&w, p, sizeof(unsigned));
+	__reqparse_push(rp, le32toh(w));
+}
+
+/* exposed */
+void reqparse_init(reqparse* rp, unsigned max_values, unsigned long max_request) {
+	if(__reqparse_classify == NULL) {
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2")) {
+			__reqparse_classify = __reqparse_classify_avx2;
+			__reqparse_impl_name = "avx2";
+		} else {
+			__reqparse_classify = __reqparse_classify_scalar;
+			__reqparse_impl_name = "scalar";
+		}
+	}
+
+	memset(rp, 0, sizeof(reqparse));
+	rp->values = rp->inline_values;
+	rp->values_cap = REQPARSE_INLINE_VALUES;
+	rp->max_values = max_values;
+	rp->max_request = max_request;
+}
+
+void reqparse_finish(reqparse* rp) {
+	if(rp->values != rp->inline_values)
+		malloc_free(rp->values);
+
+	rp->values = rp->inline_values;
+	rp->values_cap = REQPARSE_INLINE_VALUES;
+}
+
+void reqparse_trim(reqparse* rp, unsigned long keep_max) {
+	if(sizeof(unsigned) * (unsigned long) rp->values_cap > keep_max)
+		reqparse_finish(rp);
+}
+
+void reqparse_next(reqparse* rp) {
+	rp->proto = REQPARSE_PROTO_TEXT;
+	rp->error = REQPARSE_ERR_NONE;
+	rp->op = REQPARSE_OP_NONE;
+	rp->show_id = 0;
+	rp->has_show = 0;
+	rp->n_values = 0;
+	rp->arg_len = 0;
+
+	rp->stage = __REQPARSE_STAGE_START;
+	rp->arg_kind = __REQPARSE_ARG_NONE;
+	rp->req_bytes = 0;
+	rp->name_len = 0;
+	rp->num = 0;
+	rp->num_len = 0;
+	rp->num_bad = 0;
+	rp->group_start = 0;
+	rp->partial_len = 0;
+	rp->payload_left = 0;
+}
+
+int reqparse_feed(reqparse* rp, const char* data, unsigned len, unsigned* consumed) {
+	unsigned pos = 0;
+	int done = 0;
+
+	while(pos < len && !done) {
+		unsigned start = pos;
+		char c = data[pos];
+
+		switch(rp->stage) {
+			case __REQPARSE_STAGE_START:
+				if(c == 0) {
+					//padding between requests
+					++pos;
+					continue;
+				}
+
+				if((unsigned char) c == PROTO2_MAGIC) {
+					rp->proto = REQPARSE_PROTO_V2;
+					rp->stage = __REQPARSE_STAGE_V2_HEADER;
+				} else if(c == '@') {
+					rp->has_show = 1;
+					rp->stage = __REQPARSE_STAGE_SHOW;
+					++pos;
+				} else
+					rp->stage = __REQPARSE_STAGE_NAME;
+				break;
+
+			case __REQPARSE_STAGE_SHOW:
+				if(__reqparse_is_digit(c)) {
+					rp->num = rp->num * 10 + (unsigned) (c - '0');
+					++pos;
+
+					if(++rp->num_len > 10 || rp->num > UINT_MAX) {
+						rp->error = REQPARSE_ERR_INVALID;
+						rp->stage = __REQPARSE_STAGE_SKIP;
+					}
+				} else if(c == ':' && rp->num_len) {
+					rp->show_id = (unsigned) rp->num;
+					rp->num = 0;
+					rp->num_len = 0;
+					rp->stage = __REQPARSE_STAGE_NAME;
+					++pos;
+				} else {
+					rp->error = REQPARSE_ERR_INVALID;
+					rp->stage = __REQPARSE_STAGE_SKIP;
+				}
+				break;
+
+			case __REQPARSE_STAGE_NAME:
+				if(!__reqparse_is_letter(c) || rp->name_len == REQPARSE_NAME_MAX) {
+					rp->error = REQPARSE_ERR_INVALID;
+					rp->stage = __REQPARSE_STAGE_SKIP;
+					break;
+				}
+
+				rp->name[rp->name_len++] = c;
+				++pos;
+
+				//no name is a prefix of another: the first match is the command
+				if(__reqparse_match_name(rp)) {
+					rp->stage = rp->arg_kind == __REQPARSE_ARG_NONE ?
+						__REQPARSE_STAGE_SKIP : __REQPARSE_STAGE_ARG;
+
+					if(rp->arg_kind == __REQPARSE_ARG_GROUPS)
+						__reqparse_begin_group(rp);
+				}
+				break;
+
+			case __REQPARSE_STAGE_ARG:
+				pos += __reqparse_arg(rp, data + pos, len - pos);
+				break;
+
+			case __REQPARSE_STAGE_SKIP: {
+				const char* cr = (const char*) memchr(data + pos, '\r', len - pos);
+				if(cr == NULL)
+					pos = len;
+				else {
+					pos = (unsigned) (cr - data) + 1;
+					rp->stage = __REQPARSE_STAGE_SKIP_CR;
+				}
+				break;
+			}
+
+			case __REQPARSE_STAGE_SKIP_CR:
+				if(c == '\n')
+					done = 1;
+				else if(c != '\r') {
+					//stray '\r' inside an argument
+					if(rp->arg_kind != __REQPARSE_ARG_NONE && rp->error == REQPARSE_ERR_NONE)
+						rp->error = REQPARSE_ERR_INVALID;
+					rp->stage = __REQPARSE_STAGE_SKIP;
+					continue;
+				}
+
+				++pos;
+				break;
+
+			case __REQPARSE_STAGE_V2_HEADER: {
+				unsigned n = PROTO2_HEADER_SIZE - rp->partial_len;
+				if(n > len - pos)
+					n = len - pos;
+
+				memcpy(rp->partial + rp->partial_len, data + pos, n);
+				rp->partial_len += n;
+				pos += n;
+
+				if(rp->partial_len < PROTO2_HEADER_SIZE)
+					break;
+
+				__reqparse_v2_header(rp);
+
+				if(rp->v2.payload_len > rp->max_request - PROTO2_HEADER_SIZE) {
+					rp->error = REQPARSE_ERR_TOOLONG;
+					done = 1;
+					break;
+				}
+
+				rp->payload_left = rp->v2.payload_len;
+				if(rp->payload_left == 0)
+					done = 1;
+				else if((rp->v2.opcode == PROTO2_OP_BOOK_SEATS ||
+						rp->v2.opcode == PROTO2_OP_REVOKE_BOOKING) &&
+						rp->payload_left % sizeof(unsigned) == 0)
+					rp->stage = __REQPARSE_STAGE_V2_WORDS;
+				else
+					rp->stage = __REQPARSE_STAGE_V2_SKIP;
+				break;
+			}
+
+			case __REQPARSE_STAGE_V2_WORDS:
+				while(pos < len && rp->payload_left) {
+					if(rp->partial_len == 0 && len - pos >= sizeof(unsigned)) {
+						__reqparse_v2_word(rp, data + pos);
+						pos += sizeof(unsigned);
+						rp->payload_left -= sizeof(unsigned);
+					} else {
+						rp->partial[rp->partial_len++] = (unsigned char) data[pos++];
+						--rp->payload_left;
+
+						if(rp->partial_len == sizeof(unsigned)) {
+							__reqparse_v2_word(rp, rp->partial);
+							rp->partial_len = 0;
+						}
+					}
+				}
+
+				done = rp->payload_left == 0;
+				break;
+
+			case __REQPARSE_STAGE_V2_SKIP: {
+				unsigned n = len - pos < rp->payload_left ? len - pos : rp->payload_left;
+				pos += n;
+				rp->payload_left -= n;
+				done = rp->payload_left == 0;
+				break;
+			}
+		}
+
+		if(rp->proto == REQPARSE_PROTO_TEXT) {
+			rp->req_bytes += pos - start;
+			if(rp->req_bytes > rp->max_request) {
+				rp->error = REQPARSE_ERR_TOOLONG;
+				done = 1;
+			}
+		}
+	}
+
+	*consumed = pos;
+	return done ? REQPARSE_DONE : REQPARSE_NEED_MORE;
+}
+
+const char* reqparse_simd_name() {
+	return __reqparse_impl_name;
+}
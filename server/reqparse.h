@@ -0,0 +1,132 @@
+#ifndef REQPARSE_H
+#define REQPARSE_H
+
+#include "proto2.h"
+
+#define REQPARSE_NEED_MORE 0
+#define REQPARSE_DONE 1
+
+#define REQPARSE_PROTO_TEXT 0
+#define REQPARSE_PROTO_V2 1
+
+//comandi testuali
+#define REQPARSE_OP_NONE 0
+#define REQPARSE_OP_GET_AVAILABLE_SEATS 1
+#define REQPARSE_OP_GET_AVAILABLE_RANGES 2
+#define REQPARSE_OP_GET_VERSIONED_SEATS 3
+#define REQPARSE_OP_BOOK_SEATS 4
+#define REQPARSE_OP_REVOKE_BOOKING 5
+#define REQPARSE_OP_STATS 6
+#define REQPARSE_OP_BOOK_BATCH 7
+#define REQPARSE_OP_BOOK_BEST 8
+#define REQPARSE_NOPS 9
+
+#define REQPARSE_ERR_NONE 0
+#define REQPARSE_ERR_INVALID 1 //sintassi non valida, la connessione resta aperta
+#define REQPARSE_ERR_TOOLONG 2 //oltre max_request bytes, da chiudere dopo la risposta
+#define REQPARSE_ERR_NUMBER 3 //argomento di RevokeBooking non numerico o oltre 32 bit
+
+#define REQPARSE_NAME_MAX 24
+#define REQPARSE_INLINE_VALUES 32
+
+/*
+ * stato del parser di una connessione: i dati possono arrivare a pezzi
+ * qualsiasi, ogni byte ricevuto è esaminato una volta sola e non deve
+ * restare nel buffer di ricezione. Gli argomenti numerici sono decodificati
+ * man mano (fino a max_values, oltre sono solo contati).
+ *
+ * A richiesta completa:
+ *		proto, error
+ *		testo: op, show_id/has_show ("@id:"), values (BookSeats: x,y,x,y,...,
+ *			un token non numerico o oltre 32 bit vale 0; RevokeBooking: il codice;
+ *			BookBatch: per ogni lista separata da ';' il numero dei suoi valori
+ *			seguito dai valori, n,x,y,...,n,x,y,..., un ';' finale non apre
+ *			un'altra lista; BookBest: n e, se presente, la riga preferita)
+ *		v2: v2 (header decodificato), values (payload come uint32, solo
+ *			BOOK_SEATS e REVOKE_BOOKING con payload multiplo di 4)
+ *		values[i] è valido per i < min(n_values, max_values).
+ *
+ * values può puntare dentro la struttura stessa: non va copiata.
+ */
+typedef struct {
+	int proto;
+	int error;
+	unsigned op;
+	unsigned show_id;
+	int has_show;
+	proto2_header v2;
+	unsigned* values;
+	unsigned n_values; //decodificati, anche oltre max_values
+	unsigned long arg_len; //bytes dell'argomento testuale
+
+	//stato interno
+	unsigned stage;
+	unsigned arg_kind;
+	unsigned long req_bytes;
+	char name[REQPARSE_NAME_MAX];
+	unsigned name_len;
+	unsigned long long num;
+	unsigned num_len;
+	int num_bad;
+	unsigned group_start;
+	unsigned char partial[PROTO2_HEADER_SIZE]; //header v2 o parola del payload
+	unsigned partial_len;
+	unsigned payload_left;
+	unsigned values_cap;
+	unsigned max_values;
+	unsigned long max_request;
+	unsigned inline_values[REQPARSE_INLINE_VALUES];
+} reqparse;
+
+/*
+ * reqparse_init
+ *		parser pronto per la prima richiesta di una connessione, nessuna
+ *		allocazione finché una richiesta non supera REQPARSE_INLINE_VALUES
+ *		numeri. max_values limita i numeri memorizzati, max_request la
+ *		lunghezza di una richiesta testuale e del payload v2 (header incluso)
+ */
+void reqparse_init(reqparse* rp, unsigned max_values, unsigned long max_request);
+
+/*
+ * reqparse_finish
+ *		libera la memoria dei valori, se allocata
+ */
+void reqparse_finish(reqparse* rp);
+
+/*
+ * reqparse_trim
+ *		come reqparse_finish, ma solo se la memoria dei valori supera
+ *		keep_max bytes: tra una connessione e l'altra resta quella
+ *		cresciuta per le richieste precedenti
+ */
+void reqparse_trim(reqparse* rp, unsigned long keep_max);
+
+/*
+ * reqparse_feed
+ *
+ * DESCRIZIONE:
+ *		esamina i len bytes di data, si ferma alla fine della prima richiesta
+ *		completa. In *consumed i bytes esaminati, possono essere scartati
+ *		anche se la richiesta non è completa.
+ *
+ * RITORNA:
+ *		* REQPARSE_DONE se una richiesta è completa, il risultato è nei campi
+ *		  esposti fino a reqparse_next
+ *		* REQPARSE_NEED_MORE se servono altri dati
+ */
+int reqparse_feed(reqparse* rp, const char* data, unsigned len, unsigned* consumed);
+
+/*
+ * reqparse_next
+ *		prepara il parser alla richiesta successiva, la memoria dei valori
+ *		è mantenuta
+ */
+void reqparse_next(reqparse* rp);
+
+/*
+ * reqparse_simd_name
+ *		implementazione usata per classificare i bytes degli argomenti
+ */
+const char* reqparse_simd_name();
+
+#endif
@@ -0,0 +1,386 @@
+/* seatmap.c - seat storage and availability bitmap
+	ITA: ogni riga della sala ha una bitmap di disponibilità allineata
+		a una linea di cache (due righe non condividono mai una linea,
+		nemmeno se prenotate da thread diversi). Le scansioni (conteggi, 
+		elenco dei posti liberi o prenotati, ricerca di n posti liberi
+		consecutivi) lavorano a parole intere: 
+		blocchi da 256 bit con AVX2 (blocchi vuoti saltati con un solo
+		test, popcount con lookup a nibble), parole da 64 bit con 
+		ctz/popcount nella versione scalare.
+
+	Le letture consistenti usano un seqlock a due contatori invece di
+	uno solo perché gli scrittori non sono serializzati tra loro (lock
+	per riga): un contatore dispari non basterebbe a dire quanti sono
+	in corso.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "malloc_utils.h"
+#include "seatmap.h"
+
+#define SEATMAP_ALIGN 64
+
+typedef unsigned long long __seatmap_word;
+
+typedef unsigned (*__seatmap_list_fpt)(const __seatmap_word*, unsigned, unsigned, int, unsigned*);
+typedef unsigned long (*__seatmap_count_fpt)(const __seatmap_word*, unsigned long);
+
+typedef struct {
+	unsigned first;
+	unsigned dist;
+} __seatmap_best_run;
+
+/* NOT exposed */
+static __seatmap_list_fpt __seatmap_list;
+static __seatmap_count_fpt __seatmap_count;
+static const char* __seatmap_impl_name = "none";
+
+#define __seatmap_valid_mask(w, pols) \
+	(((w) + 1) * SEATMAP_WORD_BITS <= (pols) ? ~0ULL : \
+	 ((w) * SEATMAP_WORD_BITS >= (pols) ? 0ULL : \
+	  (1ULL << ((pols) % SEATMAP_WORD_BITS)) - 1))
+
+#define __seatmap_emit_bits(x, base, out, n) \
+{ \
+	while(x) { \
+		out[n++] = (base) + __builtin_ctzll(x); \
+		x &= x - 1; \
+	} \
+}
+
+static unsigned __seatmap_list_scalar(const __seatmap_word* row, unsigned n_words,
+		unsigned pols, int booked, unsigned* out) {
+	unsigned n = 0;
+
+	for(unsigned w = 0; w < n_words; ++w) {
+		__seatmap_word x = booked ? ~row[w] & __seatmap_valid_mask(w, pols) : row[w];
+		__seatmap_emit_bits(x, w * SEATMAP_WORD_BITS, out, n);
+	}
+
+	return n;
+}
+
+static unsigned long __seatmap_count_scalar(const __seatmap_word* words, unsigned long n_words) {
+	unsigned long n = 0;
+
+	for(unsigned long i = 0; i < n_words; ++i)
+		n += __builtin_popcountll(words[i]);
+
+	return n;
+}
+
+__attribute__((target("avx2,bmi,popcnt")))
+static unsigned __seatmap_list_avx2(const __seatmap_word* row, unsigned n_words,
+		unsigned pols, int booked, unsigned* out) {
+	unsigned n = 0;
+	const __m256i ones = _mm256_set1_epi64x(-1);
+
+	for(unsigned w = 0; w < n_words; w += SEATMAP_BLOCK_WORDS) {
+		__m256i v = _mm256_load_si256((const __m256i*) (row + w));
+		int full_block = (w + SEATMAP_BLOCK_WORDS) * SEATMAP_WORD_BITS <= pols;
+
+		if(booked) {
+			//nothing booked in a full block of ones
+			if(full_block && _mm256_testc_si256(v, ones))
+				continue;
+		} else if(_mm256_testz_si256(v, v))
+			continue;
+
+		for(unsigned k = w; k < w + SEATMAP_BLOCK_WORDS; ++k) {
+			__seatmap_word x = booked ? ~row[k] & __seatmap_valid_mask(k, pols) : row[k];
+			__seatmap_emit_bits(x, k * SEATMAP_WORD_BITS, out, n);
+		}
+	}
+
+	return n;
+}
+
+__attribute__((target("avx2")))
+static unsigned long __seatmap_count_avx2(const __seatmap_word* words, unsigned long n_words) {
+	const __m256i lookup = _mm256_setr_epi8(
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+	__m256i acc = _mm256_setzero_si256();
+
+	unsigned long i = 0;
+	for(; i + SEATMAP_BLOCK_WORDS <= n_words; i += SEATMAP_BLOCK_WORDS) {
+		__m256i v = _mm256_load_si256((const __m256i*) (words + i));
+		__m256i lo = _mm256_and_si256(v, low_nibble);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble);
+		__m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+	}
+
+	unsigned long n = (unsigned long) _mm256_extract_epi64(acc, 0) +
+		(unsigned long) _mm256_extract_epi64(acc, 1) +
+		(unsigned long) _mm256_extract_epi64(acc, 2) +
+		(unsigned long) _mm256_extract_epi64(acc, 3);
+
+	for(; i < n_words; ++i)
+		n += __builtin_popcountll(words[i]);
+
+	return n;
+}
+
+/* bit i set if the n bits from i are all set, runs crossing the top of x are not seen */
+static __seatmap_word __seatmap_run_starts(__seatmap_word x, unsigned n) {
+	for(unsigned covered = 1; covered < n && x; ) {
+		unsigned shift = covered < n - covered ? covered : n - covered;
+		x &= x >> shift;
+		covered += shift;
+	}
+
+	return x;
+}
+
+/* free run [first, end), at least n seats long, runs come by increasing first; 
+ * returns != 0 when no later run can be closer to target 
+ */
+static int __seatmap_best_run_add(__seatmap_best_run* best, unsigned first, unsigned end, 
+		unsigned n, unsigned target) {
+	if(first > target && first - target >= best->dist)
+		return 1;
+
+	//the start closest to target inside [first, end - n]
+	unsigned start = target < first ? first : (target > end - n ? end - n : target);
+	unsigned dist = start > target ? start - target : target - start;
+
+	if(dist < best->dist) {
+		best->first = start;
+		best->dist = dist;
+	}
+
+	return dist == 0;
+}
+
+/* exposed */
+int seatmap_init(seatmap* sm, unsigned rows, unsigned pols) {
+	if(rows == 0 || pols == 0)
+		return SEATMAP_INIT_INVAL;
+
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") &&
+			__builtin_cpu_supports("popcnt")) {
+		__seatmap_list = __seatmap_list_avx2;
+		__seatmap_count = __seatmap_count_avx2;
+		__seatmap_impl_name = "avx2";
+	} else {
+		__seatmap_list = __seatmap_list_scalar;
+		__seatmap_count = __seatmap_count_scalar;
+		__seatmap_impl_name = "scalar";
+	}
+
+	unsigned words = (pols + SEATMAP_WORD_BITS - 1) / SEATMAP_WORD_BITS;
+	words = (words + SEATMAP_ROW_ALIGN - 1) / SEATMAP_ROW_ALIGN * SEATMAP_ROW_ALIGN;
+
+	sm->rows = rows;
+	sm->pols = pols;
+	sm->words_per_row = words;
+	sm->free_bits = NULL;
+	sm->external = 0;
+	sm->seq.begun = 0;
+	sm->seq.ended = 0;
+
+	if((sm->seats = (seat*) calloc((unsigned long) rows * pols, sizeof(seat))) == NULL)
+		return SEATMAP_INIT_MALLOC_FAILURE;
+
+	unsigned long bitmap_size = (unsigned long) rows * words * sizeof(__seatmap_word);
+	if(posix_memalign((void**) &sm->free_bits, SEATMAP_ALIGN, bitmap_size) != 0) {
+		sm->free_bits = NULL;
+		malloc_free(sm->seats);
+		return SEATMAP_INIT_MALLOC_FAILURE;
+	}
+
+	for(unsigned r = 0; r < rows; ++r) {
+		__seatmap_word* row = sm->free_bits + (unsigned long) r * words;
+		for(unsigned w = 0; w < words; ++w)
+			row[w] = __seatmap_valid_mask(w, pols);
+	}
+
+	return SEATMAP_OK;
+}
+
+void seatmap_finish(seatmap* sm) {
+	if(sm->external)
+		return;
+
+	malloc_free(sm->seats);
+	malloc_free(sm->free_bits);
+}
+
+unsigned long seatmap_seats_size(const seatmap* sm) {
+	return (unsigned long) sm->rows * sm->pols * sizeof(seat);
+}
+
+unsigned long seatmap_bits_size(const seatmap* sm) {
+	return (unsigned long) sm->rows * sm->words_per_row * sizeof(__seatmap_word);
+}
+
+void seatmap_adopt(seatmap* sm, seat* seats, unsigned long long* free_bits) {
+	seatmap_finish(sm);
+
+	sm->seats = seats;
+	sm->free_bits = free_bits;
+	sm->external = 1;
+}
+
+unsigned long seatmap_count_free(const seatmap* sm) {
+	return __seatmap_count(sm->free_bits, (unsigned long) sm->rows * sm->words_per_row);
+}
+
+unsigned seatmap_row_count_free(const seatmap* sm, unsigned r) {
+	return (unsigned) __seatmap_count(sm->free_bits + (unsigned long) r * sm->words_per_row,
+			sm->words_per_row);
+}
+
+unsigned seatmap_row_free_list(const seatmap* sm, unsigned r, unsigned* out_cols) {
+	return __seatmap_list(sm->free_bits + (unsigned long) r * sm->words_per_row,
+			sm->words_per_row, sm->pols, 0, out_cols);
+}
+
+unsigned seatmap_row_booked_list(const seatmap* sm, unsigned r, unsigned* out_cols) {
+	return __seatmap_list(sm->free_bits + (unsigned long) r * sm->words_per_row,
+			sm->words_per_row, sm->pols, 1, out_cols);
+}
+
+unsigned seatmap_row_free_ranges(const seatmap* sm, unsigned r, unsigned* out_ranges) {
+	const __seatmap_word* row = sm->free_bits + (unsigned long) r * sm->words_per_row;
+	unsigned n_words = sm->words_per_row;
+	unsigned n = 0;
+	unsigned w = 0;
+	__seatmap_word x = row[0]; //free seats not yet visited
+
+	for(;;) {
+		while(x == 0) {
+			if(++w == n_words)
+				return n;
+			x = row[w];
+		}
+
+		unsigned first = __builtin_ctzll(x);
+		__seatmap_word y = ~x & (~0ULL << first); //booked (or padding) seats after first
+		out_ranges[n << 1] = w * SEATMAP_WORD_BITS + first;
+
+		while(y == 0) {
+			if(++w == n_words) {
+				out_ranges[(n << 1) + 1] = n_words * SEATMAP_WORD_BITS - 1;
+				return n + 1;
+			}
+			y = ~row[w];
+		}
+
+		unsigned end = __builtin_ctzll(y);
+		out_ranges[(n << 1) + 1] = w * SEATMAP_WORD_BITS + end - 1;
+		++n;
+
+		x = row[w] & (~0ULL << end);
+	}
+}
+
+unsigned seatmap_row_best_run(const seatmap* sm, unsigned r, unsigned n, unsigned target) {
+	const __seatmap_word* row = sm->free_bits + (unsigned long) r * sm->words_per_row;
+	__seatmap_best_run best = { SEATMAP_NO_RUN, ~0U };
+	unsigned carry_first = 0;
+	unsigned carry_len = 0; //free run reaching the top of the previous word
+
+	for(unsigned w = 0; w < sm->words_per_row; ++w) {
+		__seatmap_word x = row[w];
+		unsigned base = w * SEATMAP_WORD_BITS;
+
+		if(x == ~0ULL) {
+			if(carry_len == 0)
+				carry_first = base;
+			carry_len += SEATMAP_WORD_BITS;
+			continue;
+		}
+
+		//the carried run ends in this word
+		unsigned low = __builtin_ctzll(~x);
+		if(carry_len + low >= n && __seatmap_best_run_add(&best, carry_len ? carry_first : base, base + low, n, target))
+			return best.first;
+
+		//runs inside the word, neither at its bottom nor at its top
+		unsigned high = __builtin_clzll(~x);
+		__seatmap_word inner = x & (~0ULL << low) & (high ? ~(~0ULL << (SEATMAP_WORD_BITS - high)) : ~0ULL);
+		__seatmap_word starts = n <= SEATMAP_WORD_BITS ? __seatmap_run_starts(inner, n) : 0;
+
+		//a word left of target: its last run is closer than the others
+		if(starts && base + SEATMAP_WORD_BITS - 1 <= target) {
+			__seatmap_word zeros = ~inner & ((1ULL << (SEATMAP_WORD_BITS - 1 - __builtin_clzll(starts))) - 1);
+			starts = 1ULL << (zeros ? SEATMAP_WORD_BITS - __builtin_clzll(zeros) : 0);
+		}
+
+		while(starts) {
+			unsigned first = __builtin_ctzll(starts);
+			unsigned end = first + __builtin_ctzll(~(inner >> first));
+
+			if(__seatmap_best_run_add(&best, base + first, base + end, n, target))
+				return best.first;
+
+			starts &= ~0ULL << end;
+		}
+
+		carry_first = base + SEATMAP_WORD_BITS - high;
+		carry_len = high;
+	}
+
+	if(carry_len >= n)
+		__seatmap_best_run_add(&best, carry_first, carry_first + carry_len, n, target);
+
+	return best.first;
+}
+
+void seatmap_write_begin(seatmap* sm) {
+	__atomic_fetch_add(&sm->seq.begun, 1, __ATOMIC_SEQ_CST);
+	//seat stores must not move above the counter
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void seatmap_write_end(seatmap* sm) {
+	__atomic_fetch_add(&sm->seq.ended, 1, __ATOMIC_RELEASE);
+}
+
+unsigned long seatmap_read_begin(const seatmap* sm) {
+	for(;;) {
+		//ended first: begun == ended then means no writer at all in between
+		unsigned long ended = __atomic_load_n(&sm->seq.ended, __ATOMIC_ACQUIRE);
+		unsigned long begun = __atomic_load_n(&sm->seq.begun, __ATOMIC_ACQUIRE);
+
+		if(begun == ended)
+			return ended;
+
+		_mm_pause();
+	}
+}
+
+int seatmap_read_retry(const seatmap* sm, unsigned long version) {
+	//seat loads must not move below the counter
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&sm->seq.begun, __ATOMIC_RELAXED) != version;
+}
+
+const char* seatmap_simd_name() {
+	return __seatmap_impl_name;
+}
+
+void seatmap_strerror(int error, char* dst, int dst_max_size) {
+	int current_errno = errno;
+	memset(dst, 0, dst_max_size);
+	switch(error) {
+		case SEATMAP_INIT_INVAL:
+			memcpy(dst, "seatmap_init: Invalid argument", sizeof("seatmap_init: Invalid argument"));
+			break;
+		case SEATMAP_INIT_MALLOC_FAILURE:
+			snprintf(dst, dst_max_size, "seatmap_init:malloc: %s", strerror(current_errno));
+			break;
+
+		default:
+			snprintf(dst, dst_max_size, "seatmap: Success");
+	}
+}
@@ -0,0 +1,181 @@
+#ifndef SEATMAP_H
+#define SEATMAP_H
+
+#define SEATMAP_OK 0
+
+#define SEATMAP_INIT_INVAL 4
+#define SEATMAP_INIT_MALLOC_FAILURE 5
+
+#define SEATMAP_WORD_BITS 64
+#define SEATMAP_BLOCK_WORDS 4 //words in a 256 bit block
+#define SEATMAP_ROW_ALIGN 8 //words, a row always spans whole 64 byte cache lines
+
+typedef struct {
+	unsigned char booked;
+	unsigned int unique_code;
+} seat;
+
+/*
+ * contatori delle scritture: iniziate e terminate. Sono uguali quando 
+ * nessuna scrittura è in corso, ended è la versione della sala.
+ */
+typedef struct {
+	unsigned long begun;
+	unsigned long ended;
+} __attribute__((aligned(64))) seatmap_seqcount;
+
+/*
+ * stato dei posti di una sala: l'array dei posti e, accanto, una bitmap
+ * di disponibilità (bit a 1 = posto libero), una riga occupa words_per_row
+ * parole da 64 bit, i bit oltre pols sono sempre a 0.
+ */
+typedef struct {
+	unsigned rows;
+	unsigned pols;
+	unsigned words_per_row;
+	seat* seats;
+	unsigned long long* free_bits;
+	int external; //seats e free_bits non sono di seatmap (seatmap_adopt)
+	seatmap_seqcount seq;
+} seatmap;
+
+#define seatmap_index(sm, r, c) ((unsigned long) (r) * (sm)->pols + (c))
+#define seatmap_seat(sm, r, c) (&(sm)->seats[seatmap_index(sm, r, c)])
+#define seatmap_word(sm, r, c) \
+	(&(sm)->free_bits[(unsigned long) (r) * (sm)->words_per_row + (c) / SEATMAP_WORD_BITS])
+#define seatmap_bit(c) (1ULL << ((c) % SEATMAP_WORD_BITS))
+
+#define seatmap_is_free(sm, r, c) ((*seatmap_word(sm, r, c) & seatmap_bit(c)) != 0)
+
+#define seatmap_book(sm, r, c, code) \
+{ \
+	seat* __s = seatmap_seat(sm, r, c); \
+	__s->unique_code = (code); \
+	__s->booked = 1; \
+	*seatmap_word(sm, r, c) &= ~seatmap_bit(c); \
+}
+
+#define seatmap_release(sm, r, c) \
+{ \
+	seatmap_seat(sm, r, c)->booked = 0; \
+	*seatmap_word(sm, r, c) |= seatmap_bit(c); \
+}
+
+/*
+ * seatmap_init
+ *
+ * DESCRIZIONE:
+ *		alloca posti e bitmap per rows * pols posti, tutti liberi.
+ *		Sceglie una volta sola l'implementazione delle scansioni 
+ *		(AVX2 se la CPU la supporta, scalare altrimenti)
+ *
+ * RITORNA:
+ *		* SEATMAP_OK se tutto è andato a buon fine
+ *		* uno degli errori della classe SEATMAP_INIT_* altrimenti
+ */
+int seatmap_init(seatmap* sm, unsigned rows, unsigned pols);
+
+/*
+ * seatmap_finish
+ *		libera le risorse
+ */
+void seatmap_finish(seatmap* sm);
+
+/*
+ * seatmap_seats_size, seatmap_bits_size
+ *		bytes dell'array dei posti e della bitmap
+ */
+unsigned long seatmap_seats_size(const seatmap* sm);
+unsigned long seatmap_bits_size(const seatmap* sm);
+
+/*
+ * seatmap_adopt
+ *		sostituisce posti e bitmap con quelli di un'altra area di memoria
+ *		(seatmap_seats_size e seatmap_bits_size bytes, bitmap allineata a
+ *		64 bytes), ad esempio un file mappato. seatmap_finish non la
+ *		libera. Dentro una sezione seatmap_write_begin/end
+ */
+void seatmap_adopt(seatmap* sm, seat* seats, unsigned long long* free_bits);
+
+/*
+ * seatmap_count_free
+ *		numero di posti liberi nella sala (popcount sulla bitmap)
+ */
+unsigned long seatmap_count_free(const seatmap* sm);
+
+/*
+ * seatmap_row_count_free
+ *		numero di posti liberi nella riga r
+ */
+unsigned seatmap_row_count_free(const seatmap* sm, unsigned r);
+
+/*
+ * seatmap_row_free_list
+ *		scrive in out_cols (almeno pols elementi) le colonne libere della 
+ *		riga r in ordine crescente, ritorna quante sono
+ */
+unsigned seatmap_row_free_list(const seatmap* sm, unsigned r, unsigned* out_cols);
+
+/*
+ * seatmap_row_booked_list
+ *		come seatmap_row_free_list, ma per i posti prenotati
+ */
+unsigned seatmap_row_booked_list(const seatmap* sm, unsigned r, unsigned* out_cols);
+
+/*
+ * seatmap_row_free_ranges
+ *		scrive in out_ranges (almeno pols + 1 elementi) le sequenze di posti
+ *		liberi consecutivi della riga r come coppie (prima, ultima colonna),
+ *		ritorna il numero di coppie. Le parole vuote o piene sono saltate
+ *		intere: il costo dipende dal numero di sequenze, non di posti.
+ */
+unsigned seatmap_row_free_ranges(const seatmap* sm, unsigned r, unsigned* out_ranges);
+
+#define SEATMAP_NO_RUN (~0U)
+
+/*
+ * seatmap_row_best_run
+ *		prima colonna di n (> 0) posti liberi consecutivi della riga r,
+ *		scelti in modo che la prima colonna sia il più vicino possibile a
+ *		target (a parità di distanza quelli a sinistra). SEATMAP_NO_RUN
+ *		se la riga non ha n posti liberi consecutivi. Scansione a parole:
+ *		le sequenze interne a una parola sono trovate con shift e and
+ *		(log n passi), solo quelle tra due parole sono seguite bit per
+ *		bit; le sequenze più corte di n non costano nulla. Si ferma
+ *		appena nessuna sequenza successiva può essere più vicina
+ */
+unsigned seatmap_row_best_run(const seatmap* sm, unsigned r, unsigned n, unsigned target);
+
+/*
+ * seatmap_write_begin, seatmap_write_end
+ *		racchiudono ogni modifica ai posti. Più scritture (su righe diverse,
+ *		serializzate dal chiamante per riga) possono essere in corso insieme.
+ */
+void seatmap_write_begin(seatmap* sm);
+void seatmap_write_end(seatmap* sm);
+
+/*
+ * seatmap_read_begin, seatmap_read_retry
+ *		lettura consistente senza lock:
+ *
+ *			do {
+ *				v = seatmap_read_begin(sm);
+ *				... lettura ...
+ *			} while(seatmap_read_retry(sm, v));
+ *
+ *		read_begin attende che non vi siano scritture in corso e ritorna la
+ *		versione, read_retry != 0 se una scrittura è iniziata nel frattempo:
+ *		la lettura va ripetuta. Al termine v è la versione letta.
+ */
+unsigned long seatmap_read_begin(const seatmap* sm);
+int seatmap_read_retry(const seatmap* sm, unsigned long version);
+
+/*
+ * seatmap_simd_name
+ *		implementazione delle scansioni in uso
+ */
+const char* seatmap_simd_name();
+
+void seatmap_strerror(int error, char* dst, int dst_size);
+
+#endif
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE //pthread_attr_setaffinity_np
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -11,14 +13,26 @@
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <pthread.h>
+#include <endian.h>
+#include <stddef.h>
 
 #include "thrmgmt.h"
+#include "evloop.h"
+#include "uring.h"
+#include "proto2.h"
+#include "reqparse.h"
+#include "shows.h"
+#include "ops.h"
+#include "logger.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "arena.h"
+#include "numfmt.h"
+#include "alloccount.h"
+#include "timerwheel.h"
 #include "malloc_utils.h"
 
-#ifndef DATETIME_FORMAT
-#define DATETIME_FORMAT "%Y/%m/%d %H:%M:%S"
-#endif
-
 #ifndef DEFAULT_PORT
 #define DEFAULT_PORT 8123
 #endif
@@ -27,10 +41,64 @@
 #define DEFAULT_THREADS 1024
 #endif
 
+#ifndef DEFAULT_QUEUE
+#define DEFAULT_QUEUE 4096
+#endif
+
 #ifndef DEFAULT_RCVTO
 #define DEFAULT_RCVTO 3
 #endif
 
+#ifndef DEFAULT_IDLETO
+#define DEFAULT_IDLETO 15
+#endif
+
+#ifndef DEFAULT_SNDTO
+#define DEFAULT_SNDTO 10 //seconds to send the replies of one recv
+#endif
+
+#ifndef DEFAULT_ACCEPTORS
+#define DEFAULT_ACCEPTORS 1
+#endif
+
+#ifndef DEFAULT_BACKLOG
+#define DEFAULT_BACKLOG 4096 //capped by net.core.somaxconn
+#endif
+
+#ifndef DEFAULT_BOOKINGS
+#define DEFAULT_BOOKINGS 1024 //initial capacity of the booking index
+#endif
+
+#ifndef DEFAULT_KEEPALIVE_REQUESTS
+#define DEFAULT_KEEPALIVE_REQUESTS 1000
+#endif
+
+#ifndef WORKER_KEEP_BUFFER
+#define WORKER_KEEP_BUFFER (1 << 20) //memory each worker keeps between requests
+#endif
+
+#ifndef DEFAULT_CHECKPOINT_INTERVAL
+#define DEFAULT_CHECKPOINT_INTERVAL 60 //seconds, 0 = only at shutdown
+#endif
+
+#ifndef DEFAULT_STATS_INTERVAL
+#define DEFAULT_STATS_INTERVAL 0 //seconds between two reports in the log, 0 = never
+#endif
+
+#ifndef DEFAULT_COMMIT_WINDOW
+#define DEFAULT_COMMIT_WINDOW 1000 //microseconds a batched fdatasync waits for more bookings
+#endif
+
+#define INPUT_BUFFER 4096 //receive buffer of a connection, requests are parsed as they arrive
+
+#define SHOW_PREFIX_MAX 12 //"@4294967295:", text requests for a show other than the default
+
+#define DEADLINE_TICK_MS 250 //thread pool timeouts resolution
+
+#define CONN_PHASE_READ 0 //rcvtos
+#define CONN_PHASE_IDLE 1 //idletos
+#define CONN_PHASE_WRITE 2 //sndtos
+
 #define thrmgmt_strerror_loge_exit(r) \
 { \
 	if(r != THRMGMT_OK) { \
@@ -41,6 +109,66 @@
 	} \
 }
 
+#define uring_strerror_loge_exit(r) \
+{ \
+	if(r != URING_OK) { \
+		char buf[256]; \
+		uring_strerror(r, buf, 256); \
+		loge(buf); \
+		exit(EXIT_FAILURE); \
+	} \
+}
+
+#define shows_strerror_loge_exit(r) \
+{ \
+	if(r != SHOWS_OK) { \
+		char buf[256]; \
+		shows_strerror(r, buf, 256); \
+		loge(buf); \
+		exit(EXIT_FAILURE); \
+	} \
+}
+
+#define journal_strerror_loge_exit(r) \
+{ \
+	if(r != JOURNAL_OK) { \
+		char buf[256]; \
+		journal_strerror(r, buf, 256); \
+		loge(buf); \
+		exit(EXIT_FAILURE); \
+	} \
+}
+
+#define snapshot_strerror_loge_exit(r) \
+{ \
+	if(r != SNAPSHOT_OK) { \
+		char buf[256]; \
+		snapshot_strerror(r, buf, 256); \
+		loge(buf); \
+		exit(EXIT_FAILURE); \
+	} \
+}
+
+#define stats_strerror_loge_exit(r) \
+{ \
+	if(r != STATS_OK) { \
+		char buf[256]; \
+		stats_strerror(r, buf, 256); \
+		loge(buf); \
+		exit(EXIT_FAILURE); \
+	} \
+}
+
+#define evloop_strerror_loge_exit(r) \
+{ \
+	if(r != EVLOOP_OK) { \
+		char buf[256]; \
+		evloop_strerror(r, buf, 256); \
+		loge(buf); \
+		exit(EXIT_FAILURE); \
+	} \
+}
+
 #define strerror_log(msg) \
 { \
 	char buf[256] = { 0 }; \
@@ -77,9 +205,9 @@
 
 #define arg(a, s, l) (strcmp(a, s) == 0 || strcmp(a, l) == 0)
 
-#define log(msg) (basic_log("LOG", msg))
-#define loge(msg) (basic_log("ERROR", msg))
-#define VERBOSE if(conf(__verbose__))
+#define log(msg) (logger_log(LOGGER_INFO, msg))
+#define loge(msg) (logger_log(LOGGER_ERROR, msg))
+#define VERBOSE if(logger_enabled(LOGGER_VERBOSE))
 
 #define conf(prop) (g_conf.prop)
 
@@ -91,157 +219,347 @@ typedef unsigned int uint32;
 typedef unsigned char ubyte;
 typedef unsigned short ushort16;
 typedef long long int64;
-typedef char* (*svcop_handler_fpt)(const char*, const char*);
 
-typedef struct {
-	char* name;
-	ubyte has_arg;
-	svcop_handler_fpt handler;
-	uint32 len;
-} svcop;
-
-typedef struct {
-	ubyte booked;
-	uint32 unique_code;
-} seat;
+#define IO_BACKEND_THREADS 0
+#define IO_BACKEND_EVLOOP 1
+#define IO_BACKEND_URING 2
 
 typedef struct {
-	ubyte __verbose__;
+	int log_level; //LOGGER_*
+	ubyte io_backend;
+	uint32 n_loops;
 	uint32 rows;
 	uint32 pols;
-	uint32 n_total_seats;
 	uint32 n_threads; //default threads
+	uint32 queue_size; //default pending connections
 	uint32 rcvtos; //default rcvtos
-	uint32 rcvmaxbuf;
+	uint32 idletos; //default idletos
+	uint32 sndtos; //default sndtos
+	uint32 max_requests; //per connection, 0 = unlimited
+	uint32 n_acceptors; //listening sockets, SO_REUSEPORT if more than one
+	uint32 backlog;
+	uint32 rcvmaxbuf; //longest request, text or v2
 	uint32 sndavailseatbuf;
-	int listen_sd;
+	int* listen_sds; //n_acceptors elements
+	const char* journal_path; //NULL = bookings are not persisted
+	int durability; //JOURNAL_SYNC_*
+	uint32 commit_window; //microseconds
+	const char* snapshot_path; //NULL = the journal is replayed from the start
+	uint32 checkpoint_interval; //seconds
+	uint32 stats_interval; //seconds
 } program_instance_config;
 
+/* ITA: scadenza della connessione servita da un worker del pool, nella
+ *  timerwheel comune (g_deadlines). Il worker resta bloccato in recv() o
+ *  send() finché il watchdog non fa shutdown() del socket
+ */
+typedef struct {
+	timerwheel_timer timer; //first member: deadline_expired casts it back
+	int sd;
+	int expired; //guarded by g_deadlines_mtx
+	int phase; //CONN_PHASE_*
+	uint32 phase_served; //requests served when the phase began
+} conn_deadline;
+
+/* ITA: memoria riutilizzata da tutte le richieste servite dallo stesso 
+ *  worker (thread del pool, event loop o ring), liberata alla sua uscita
+ */
+typedef struct {
+	arena scratch; //risposta della richiesta in corso
+	reqparse parser; //pool di thread: stato della connessione servita
+	char request[INPUT_BUFFER]; //pool di thread: buffer di ricezione
+	char* replies; //pool di thread: risposte di una recv
+	uint32 replies_cap;
+	conn_deadline deadline; //pool di thread
+} worker_buffers;
+
 void request_handler(void*);
-char* op_get_available_seats(const char*, const char*);
-char* op_book_seats(const char*, const char*);
-char* op_revoke_booking(const char*, const char*);
+int request_execute(void*, char*, uint32, const char**, uint32*, uint32*);
+void request_state_init(void*);
+void request_state_finish(void*);
+int request_execute_v2(const reqparse*, arena*, const char**, uint32*, uint32*);
 
 //global variables
-system_mutex g_booking_mtx;
-
-seat** g_seats = NULL;
+show_table g_shows;
+journal g_journal;
+snapshot g_snapshot;
 
 program_instance_config g_conf = 
-{ 0, 0, 0, 0, DEFAULT_THREADS, DEFAULT_RCVTO, 0, 0, 0 };
+{ LOGGER_INFO, 0, 0, 0, 0, DEFAULT_THREADS, DEFAULT_QUEUE, DEFAULT_RCVTO, DEFAULT_IDLETO, DEFAULT_SNDTO, 1, 
+	DEFAULT_ACCEPTORS, DEFAULT_BACKLOG, 0, 0, NULL, NULL, JOURNAL_SYNC_REQUEST, DEFAULT_COMMIT_WINDOW,
+	NULL, DEFAULT_CHECKPOINT_INTERVAL, DEFAULT_STATS_INTERVAL };
 
-#define NOPS 3
-const svcop g_op_listing[NOPS] = 
-{
-	{ "GetAvailableSeats", 0, op_get_available_seats, 17 },
-	{ "BookSeats", 1, op_book_seats, 9 },
-	{ "RevokeBooking", 1, op_revoke_booking, 13 }
-};
+volatile sig_atomic_t g_exiting = 0;
 
-// program aux functions
+pthread_t* g_acceptors = NULL; //joined before the pool is finished
+uint32 g_n_acceptors = 0; //started so far
 
-int dgt(uint32 j) {
-	int i = 0;
+pthread_key_t g_worker_key;
+__thread worker_buffers* t_worker = NULL;
 
-	while (j) {
-		j /= 10;
-		i++;
-	}
+timerwheel g_deadlines;
+pthread_mutex_t g_deadlines_mtx = PTHREAD_MUTEX_INITIALIZER;
+pthread_t g_watchdog;
+int g_watchdog_running = 0;
 
-	return i;
-}
+//indexed by REQPARSE_OP_*, command names are matched by the parser
+const ops_handler_fpt g_op_listing[REQPARSE_NOPS] = 
+{
+	NULL,
+	op_get_available_seats,
+	op_get_available_ranges,
+	op_get_versioned_seats,
+	op_book_seats,
+	op_revoke_booking,
+	op_stats,
+	op_book_batch,
+	op_book_best
+};
 
-int itos(uint32 n, char* out) {
-	int slen = dgt(n);
-	for (int i = slen - 1; n; --i) {
-		out[i] = (n % 10) + 48;
-		n /= 10;
-	}
+//names in the Stats report, REQPARSE_OP_NONE counts invalid requests
+const char* const g_op_names[REQPARSE_NOPS] =
+{
+	"Invalid",
+	"GetAvailableSeats",
+	"GetAvailableRanges",
+	"GetVersionedSeats",
+	"BookSeats",
+	"RevokeBooking",
+	"Stats",
+	"BookBatch",
+	"BookBest"
+};
 
-	return slen;
-}
+// program aux functions
 
 //int stoull(__in const char*, __out ulong64*);
 // returns 0 on success, 1 on failure
 int stoull(const char* s, ulong64* res) {
 	char* end = NULL;
+	errno = 0;
 	*res = strtoull(s, &end, 10);
 	return *end != 0 || errno;
 }
 
-void basic_log(const char* type, const char* msg) {
-	char timebuf[256] = { 0 };
-	time_t t = time(NULL);
-	struct tm *tm = localtime(&t);
+/* ITA: valori istantanei del report di Stats, dipendono dal backend */
+unsigned stats_gauges(char* dst, unsigned cap) {
+	int n;
+	if(conf(io_backend) == IO_BACKEND_THREADS) {
+		unsigned busy, queued;
+		thrmgmt_pool_status(&busy, &queued);
+		n = snprintf(dst, cap, "workers=%u busy=%u queued=%u log_dropped=%lu", 
+				conf(n_threads), busy, queued, logger_dropped());
+	} else
+		n = snprintf(dst, cap, "loops=%u log_dropped=%lu", conf(n_loops), logger_dropped());
+
+	return n < 0 ? 0 : ((unsigned) n < cap ? (unsigned) n : cap - 1);
+}
 
-	if(tm == NULL) {
-		snprintf(timebuf, 256, "localtime: %s", strerror(errno));
-	} else {
-		if(strftime(timebuf, sizeof(timebuf), DATETIME_FORMAT, tm) == 0)
-			snprintf(timebuf, 256, "strftime: %s", strerror(errno));
+void worker_buffers_free(void* _wb) {
+	worker_buffers* wb = (worker_buffers*) _wb;
+
+	arena_finish(&wb->scratch);
+	reqparse_finish(&wb->parser);
+	malloc_free(wb->replies);
+	free(wb);
+}
+
+worker_buffers* worker_local() {
+	if(t_worker == NULL) {
+		t_worker = (worker_buffers*) calloc(1, sizeof(worker_buffers));
+		malloc_check_exit_on_error(t_worker);
+		arena_init(&t_worker->scratch, WORKER_KEEP_BUFFER);
+		request_state_init(&t_worker->parser);
+		pthread_setspecific(g_worker_key, t_worker);
 	}
 
-	FILE* out;
-	if(strcmp(type, "ERROR") == 0) {
-		out = stderr;
-	} else if(strcmp(type, "LOG") == 0) {
-		out = stdout;
-	} else {
-		fprintf(stderr, "DEBUG -- INVALID LOG TYPE: %s\nDEBUG -- Exiting...\n",type);
-		exit(EXIT_FAILURE);
+	return t_worker;
+}
+
+/* ITA: scadenze del pool di thread. Programmare o cancellare una
+ *  scadenza costa O(1) sotto g_deadlines_mtx, nessuna chiamata di sistema
+ *  per connessione; il watchdog avanza la ruota ogni DEADLINE_TICK_MS
+ */
+void deadline_expired(timerwheel_timer* t, void* ctx) {
+	((void)ctx);
+	conn_deadline* d = (conn_deadline*) t;
+
+	//the worker wakes up from recv()/send() and closes the socket
+	__atomic_store_n(&d->expired, 1, __ATOMIC_RELAXED);
+	shutdown(d->sd, SHUT_RDWR);
+}
+
+void* watchdog_routine(void* unused) {
+	((void)unused);
+	struct timespec tick = { 0, DEADLINE_TICK_MS * 1000000L };
+
+	while(__atomic_load_n(&g_watchdog_running, __ATOMIC_RELAXED)) {
+		nanosleep(&tick, NULL);
+
+		pthread_mutex_lock(&g_deadlines_mtx);
+		timerwheel_advance(&g_deadlines, timerwheel_clock_ms(), deadline_expired, NULL);
+		pthread_mutex_unlock(&g_deadlines_mtx);
 	}
 
-	char* msgln = strtok((char*) msg, "\n");
-	while(msgln) {
-		fprintf(out, "%s [%s]: %s\n", type, timebuf, msgln);
-		msgln = strtok(NULL, "\n");
+	return NULL;
+}
+
+void watchdog_start() {
+	timerwheel_init(&g_deadlines, DEADLINE_TICK_MS, timerwheel_clock_ms());
+	g_watchdog_running = 1;
+
+	int err = pthread_create(&g_watchdog, NULL, watchdog_routine, NULL);
+	if(err != 0) {
+		errno = err;
+		strerror_log("pthread_create(watchdog)");
+		exit(EXIT_FAILURE);
 	}
 }
 
+void watchdog_stop() {
+	if(__atomic_exchange_n(&g_watchdog_running, 0, __ATOMIC_RELAXED))
+		pthread_join(g_watchdog, NULL);
+}
+
+/* a new deadline only when a phase or a request begins: bytes trickling in don't extend it */
+void deadline_set(conn_deadline* d, int phase, uint32 served) {
+	if(phase == d->phase && served == d->phase_served)
+		return;
+
+	uint32 timeout = phase == CONN_PHASE_READ ? conf(rcvtos) :
+		(phase == CONN_PHASE_IDLE ? conf(idletos) : conf(sndtos));
+
+	d->phase = phase;
+	d->phase_served = served;
+
+	pthread_mutex_lock(&g_deadlines_mtx);
+	timerwheel_schedule(&g_deadlines, &d->timer, timerwheel_clock_ms() + timeout * 1000ULL);
+	pthread_mutex_unlock(&g_deadlines_mtx);
+}
+
+/* returns != 0 if the deadline had expired, the socket can be closed afterwards */
+int deadline_clear(conn_deadline* d) {
+	pthread_mutex_lock(&g_deadlines_mtx);
+	timerwheel_cancel(&d->timer);
+	int expired = d->expired;
+	pthread_mutex_unlock(&g_deadlines_mtx);
+
+	return expired;
+}
+
 void cleanup_exit(int res) {
+	g_exiting = 1;
+
 	VERBOSE log("cleaning up...");
 	
-	close(conf(listen_sd));
+	/* ITA: shutdown() sveglia gli acceptor bloccati in accept(), nessuno
+	 *  sottomette più connessioni al pool quando viene chiuso
+	 */
+	if(conf(listen_sds)) {
+		for(uint32 i = 0; i < conf(n_acceptors); ++i) {
+			if(conf(listen_sds)[i] >= 0)
+				shutdown(conf(listen_sds)[i], SHUT_RDWR);
+		}
+	}
 
-	VERBOSE log("giving every thread chance to terminate gracefully...");
+	if(g_acceptors) {
+		for(uint32 i = 0; i < g_n_acceptors; ++i)
+			pthread_join(g_acceptors[i], NULL);
 
-	int semv;
-	thrmgmt_waitall(&semv);
-	if((uint32) semv < conf(n_threads)) {
-		conf(rcvtos) <<= 1;
-		char buf[256] = { 0 };
-		snprintf(buf, 256, "waiting %d seconds before ending cleanup procedure...", conf(rcvtos));
-		log(buf);
-		sleep(conf(rcvtos));
+		malloc_free(g_acceptors);
 	}
 
-	thrmgmt_finish();
+	if(conf(listen_sds)) {
+		for(uint32 i = 0; i < conf(n_acceptors); ++i) {
+			if(conf(listen_sds)[i] >= 0)
+				close(conf(listen_sds)[i]);
+		}
+
+		malloc_free(conf(listen_sds));
+	}
 
-	thrmgmt_mutex_destroy(&g_booking_mtx);
+	VERBOSE log("giving every worker chance to terminate gracefully...");
 
-	for(unsigned i = 0; i < conf(rows); ++i) {
-		malloc_free(g_seats[i]);
+	stats_stop();
+
+	if(conf(io_backend) == IO_BACKEND_EVLOOP)
+		evloop_finish();
+	else if(conf(io_backend) == IO_BACKEND_URING)
+		uring_finish();
+	else {
+		//workers still blocked in recv() are woken up by their deadline
+		thrmgmt_pool_finish();
+		watchdog_stop();
 	}
 
-	malloc_free(g_seats);
+	//no request is running: a last checkpoint leaves nothing to replay
+	if(conf(snapshot_path)) {
+		snapshot_stop(&g_snapshot);
+
+		int ckpt_res = snapshot_checkpoint(&g_snapshot, &g_journal);
+		if(ckpt_res != SNAPSHOT_OK) {
+			char buf[256];
+			snapshot_strerror(ckpt_res, buf, 256);
+			loge(buf);
+		}
+	}
+
+	//whatever is still buffered gets flushed
+	if(conf(journal_path))
+		journal_close(&g_journal);
+
+	shows_finish(&g_shows);
+
+	if(conf(snapshot_path))
+		snapshot_close(&g_snapshot);
+
+#ifdef COUNT_ALLOCS
+	{
+		char buf[256] = { 0 };
+		snprintf(buf, 256, "allocator calls: %lu", alloccount_get());
+		log(buf);
+	}
+#endif
 
 	VERBOSE log("bye");
 	exit(res);
 }
 
 void print_usage_exit(const char* first) {
-	fprintf(stderr, "usage: %s [-v | --verbose] [-t th | --nthreads th] [-o to | --recvto to]"
-			" [-l po| --port po] [-r nr | --rows nr] [-p np | --pols np]\n", first);
+	fprintf(stderr, "usage: %s [-v | --verbose] [-L error|info|verbose | --log-level error|info|verbose] [-t th | --nthreads th] [-q qs | --queue qs] [-o to | --recvto to]"
+			" [-T wt | --write-timeout wt]"
+			" [-e | --event-loop] [-u | --io-uring] [-n nl | --loops nl]"
+			" [-k | --keep-alive] [-m mr | --max-requests mr] [-i it | --idle-timeout it]"
+			" [-a na | --acceptors na] [-b bl | --backlog bl]"
+			" [-l po| --port po] [-r nr | --rows nr] [-p np | --pols np] [-s sf | --shows sf]"
+			" [-j jf | --journal jf] [-d request|batch|async | --durability request|batch|async]"
+			" [-w us | --commit-window us] [-c cf | --snapshot cf] [-x s | --checkpoint-interval s]"
+			" [-S s | --stats-interval s]\n", first);
 	exit(EXIT_FAILURE);
 }
 
-int get_new_listening_socket(ushort16 port) {
+/* ITA: reuseport != 0 se il socket fa parte di un gruppo SO_REUSEPORT,
+ *  il kernel distribuisce le nuove connessioni tra i socket del gruppo
+ */
+int get_new_listening_socket(ushort16 port, uint32 backlog, int reuseport) {
 	int sd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 	if(sd < 0) {
 		VERBOSE strerror_log("socket");
 		return -1;
 	}
 
+	//must be set before bind() to have any effect
+	int val = 1;
+	if(setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, (void*)&val, sizeof(int)) < 0) {
+		VERBOSE strerror_log("setsockopt(SO_REUSEADDR)");
+		goto listening_socket_failure;
+	}
+
+	if(reuseport && setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, (void*)&val, sizeof(int)) < 0) {
+		VERBOSE strerror_log("setsockopt(SO_REUSEPORT)");
+		goto listening_socket_failure;
+	}
+
 	struct sockaddr_in addr = { 0 };
 	addr.sin_family = AF_INET;
 	addr.sin_addr.s_addr = INADDR_ANY;
@@ -250,57 +568,49 @@ int get_new_listening_socket(ushort16 port) {
 	int ret = bind(sd, (struct sockaddr*) &addr, sizeof(struct sockaddr_in));
 	if(ret < 0) {
 		VERBOSE strerror_log("bind");
-		return -1;
-	}
-
-	int val = 1;
-	if(setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, (void*)&val, sizeof(int)) < 0) {
-		VERBOSE strerror_log("setsockopt");
-		return -1;
+		goto listening_socket_failure;
 	}
 
-	if(listen(sd, 0) < 0) {
+	if(listen(sd, (int) backlog) < 0) {
 		VERBOSE strerror_log("listen");
-		return -1;
+		goto listening_socket_failure;
 	}
 
 	return sd;
-}
 
-void sigrcv(int sig) {
-	((void)sig);
-	cleanup_exit(EXIT_SUCCESS);
+listening_socket_failure:
+	close(sd);
+	return -1;
 }
 
 //end program aux functions
 
-int handle_connections() {
+int handle_connections(int listen_sd) {
 	struct sockaddr_in addr = { 0 };
 	socklen_t len = sizeof(struct sockaddr_in);
 
 	int client_sd;
-	while((client_sd = accept(conf(listen_sd), (struct sockaddr*) &addr, &len)) > 0) {
+	while((client_sd = accept(listen_sd, (struct sockaddr*) &addr, &len)) >= 0) {
 		VERBOSE {
+			char ip[INET_ADDRSTRLEN] = { 0 };
 			char buf[256] = { 0 };
-			snprintf(buf, 256, "accepted connection from %s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+			inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+			snprintf(buf, 256, "accepted connection from %s:%d", ip, ntohs(addr.sin_port));
 			log(buf);
 		}
 
-		struct timeval tv;
-		tv.tv_sec = conf(rcvtos);
-		tv.tv_usec = 0;
-
-		if(setsockopt(client_sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(struct timeval)) == 0) {
-			int rv;
-			while((rv = thrmgmt_dispatch_work(request_handler, (void*) client_sd)) == THRMGMT_DISPATCH_WORK_RETRY) {
-				log("failed to dispatch \"work\", retrying");
-			}
-
-			thrmgmt_strerror_loge_exit(rv);
+		int rv = thrmgmt_pool_submit((void*) client_sd);
+		if(rv == THRMGMT_POOL_SUBMIT_FULL) {
+			VERBOSE log("work queue full, dropping connection");
+			close(client_sd);
 		} else
-			strerror_log("setsockopt(SO_RCVTIMEO)");
+			thrmgmt_strerror_loge_exit(rv);
 	}
 
+	//shutdown() by cleanup_exit
+	if(g_exiting)
+		return EXIT_SUCCESS;
+
 	if(client_sd < 0) {
 		VERBOSE strerror_log("accept");
 		loge("error on accepting connections");
@@ -311,8 +621,55 @@ int handle_connections() {
 	return EXIT_SUCCESS;
 }
 
+/* ITA: un thread per socket in ascolto, le connessioni accettate vanno
+ *  nella coda comune del pool. Se accept() fallisce il processo termina
+ *  come con SIGTERM, cleanup_exit gira solo nel thread principale e
+ *  attende la fine di ogni acceptor
+ */
+void* acceptor_routine(void* _sd) {
+	handle_connections((int) _sd);
+
+	if(!g_exiting)
+		kill(getpid(), SIGTERM);
+
+	return NULL;
+}
+
+/* ITA: acceptor i sul core i % ncpu, se ce n'è più di uno */
+void start_acceptors() {
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	g_acceptors = (pthread_t*) malloc(sizeof(pthread_t) * conf(n_acceptors));
+	malloc_check_exit_on_error(g_acceptors);
+
+	for(uint32 i = 0; i < conf(n_acceptors); ++i) {
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+
+		if(conf(n_acceptors) > 1 && ncpu > 0) {
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(i % ncpu, &cpus);
+			if(pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpus) != 0)
+				VERBOSE log("unable to pin acceptor, leaving it unpinned");
+		}
+
+		int err = pthread_create(&g_acceptors[i], &attr, acceptor_routine, (void*) conf(listen_sds)[i]);
+		pthread_attr_destroy(&attr);
+
+		if(err != 0) {
+			errno = err;
+			strerror_log("pthread_create(acceptor)");
+			cleanup_exit(EXIT_FAILURE);
+		}
+
+		++g_n_acceptors;
+	}
+}
+
 int main(int argc, char** argv) {
 	ushort16 use_port = DEFAULT_PORT;
+	const char* shows_path = NULL;
 
 	for(int i = 0; i < argc; ++i) {
 		if(arg(argv[i], "--rows", "-r")) {
@@ -335,14 +692,110 @@ int main(int argc, char** argv) {
 			get_ullong_value_for_option(argv, &o, i);
 			conf(rcvtos) = (uint32) o;
 
+		} else if(arg(argv[i], "--write-timeout", "-T")) {
+			ulong64 wt;
+			get_ullong_value_for_option(argv, &wt, i);
+			conf(sndtos) = (uint32) wt;
+
 		} else if(arg(argv[i], "--verbose", "-v")) {
-			conf(__verbose__) = 1;
+			conf(log_level) = LOGGER_VERBOSE;
+
+		} else if(arg(argv[i], "--log-level", "-L")) {
+			int next_idx;
+			value_check(next_idx, i, argv[i]);
+			if((conf(log_level) = logger_parse_level(argv[next_idx])) < 0) {
+				printf("%s: expected error, info or verbose\n", argv[next_idx]);
+				print_usage_exit(argv[0]);
+			}
+			i = next_idx;
 
 		} else if(arg(argv[i], "--nthreads", "-t")) {
 			ulong64 t;
 			get_ullong_value_for_option(argv, &t, i);
 			conf(n_threads) = (uint32) t;
 
+		} else if(arg(argv[i], "--event-loop", "-e")) {
+			conf(io_backend) = IO_BACKEND_EVLOOP;
+
+		} else if(arg(argv[i], "--io-uring", "-u")) {
+			conf(io_backend) = IO_BACKEND_URING;
+
+		} else if(arg(argv[i], "--loops", "-n")) {
+			ulong64 n;
+			get_ullong_value_for_option(argv, &n, i);
+			conf(n_loops) = (uint32) n;
+
+		} else if(arg(argv[i], "--keep-alive", "-k")) {
+			if(conf(max_requests) == 1)
+				conf(max_requests) = DEFAULT_KEEPALIVE_REQUESTS;
+
+		} else if(arg(argv[i], "--max-requests", "-m")) {
+			ulong64 m;
+			get_ullong_value_for_option(argv, &m, i);
+			conf(max_requests) = (uint32) m;
+
+		} else if(arg(argv[i], "--idle-timeout", "-i")) {
+			ulong64 it;
+			get_ullong_value_for_option(argv, &it, i);
+			conf(idletos) = (uint32) it;
+
+		} else if(arg(argv[i], "--queue", "-q")) {
+			ulong64 q;
+			get_ullong_value_for_option(argv, &q, i);
+			conf(queue_size) = (uint32) q;
+
+		} else if(arg(argv[i], "--acceptors", "-a")) {
+			ulong64 a;
+			get_ullong_value_for_option(argv, &a, i);
+			conf(n_acceptors) = (uint32) a;
+
+		} else if(arg(argv[i], "--backlog", "-b")) {
+			ulong64 b;
+			get_ullong_value_for_option(argv, &b, i);
+			conf(backlog) = b > INT_MAX ? INT_MAX : (uint32) b;
+
+		} else if(arg(argv[i], "--shows", "-s")) {
+			int next_idx;
+			value_check(next_idx, i, argv[i]);
+			shows_path = argv[next_idx];
+			i = next_idx;
+
+		} else if(arg(argv[i], "--journal", "-j")) {
+			int next_idx;
+			value_check(next_idx, i, argv[i]);
+			conf(journal_path) = argv[next_idx];
+			i = next_idx;
+
+		} else if(arg(argv[i], "--durability", "-d")) {
+			int next_idx;
+			value_check(next_idx, i, argv[i]);
+			if((conf(durability) = journal_parse_mode(argv[next_idx])) < 0) {
+				printf("%s: expected request, batch or async\n", argv[next_idx]);
+				print_usage_exit(argv[0]);
+			}
+			i = next_idx;
+
+		} else if(arg(argv[i], "--snapshot", "-c")) {
+			int next_idx;
+			value_check(next_idx, i, argv[i]);
+			conf(snapshot_path) = argv[next_idx];
+			i = next_idx;
+
+		} else if(arg(argv[i], "--checkpoint-interval", "-x")) {
+			ulong64 x;
+			get_ullong_value_for_option(argv, &x, i);
+			conf(checkpoint_interval) = x > UINT_MAX ? UINT_MAX : (uint32) x;
+
+		} else if(arg(argv[i], "--stats-interval", "-S")) {
+			ulong64 s;
+			get_ullong_value_for_option(argv, &s, i);
+			conf(stats_interval) = s > UINT_MAX ? UINT_MAX : (uint32) s;
+
+		} else if(arg(argv[i], "--commit-window", "-w")) {
+			ulong64 w;
+			get_ullong_value_for_option(argv, &w, i);
+			conf(commit_window) = w > UINT_MAX ? UINT_MAX : (uint32) w;
+
 		} else {
 			if(i > 0)
 				printf("ignoring unrecognized option: %s\n", argv[i]);
@@ -350,10 +803,14 @@ int main(int argc, char** argv) {
 		}
 	}
 
-	if(conf(rows) == 0 || conf(pols) == 0 || conf(rcvtos) == 0 || conf(n_threads) == 0) {
+	if((shows_path == NULL && (conf(rows) == 0 || conf(pols) == 0)) || conf(rcvtos) == 0 || conf(n_threads) == 0 ||
+			conf(queue_size) == 0 || conf(idletos) == 0 || conf(sndtos) == 0 || conf(n_acceptors) == 0 || conf(backlog) == 0 ||
+			(conf(snapshot_path) && conf(journal_path) == NULL)) {
 		print_usage_exit(argv[0]);
 	}
 
+	logger_set_level(conf(log_level));
+
 #ifdef PRINT_VALUES
 	VERBOSE { 
 		char buf[256] = { 0 };
@@ -374,354 +831,398 @@ int main(int argc, char** argv) {
 
 	VERBOSE log("blocked signals");
 
-	conf(listen_sd) = get_new_listening_socket(use_port);
-	if(conf(listen_sd) < 0) {
-		loge("unable to create new listening socket");
+	/* ITA: da qui i messaggi passano dal thread del logger, anche quelli
+	 *  dei worker: nessuna richiesta attende stdout/stderr
+	 */
+	int lg_init_res = logger_init();
+	if(lg_init_res != LOGGER_OK) {
+		char buf[256];
+		logger_strerror(lg_init_res, buf, 256);
+		loge(buf);
 		exit(EXIT_FAILURE);
 	}
 
-	g_seats = (seat**) calloc(conf(rows), sizeof(seat*));
-	malloc_check_exit_on_error(g_seats);
+	if(conf(io_backend) != IO_BACKEND_THREADS) {
+		if(conf(n_loops) == 0) {
+			long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+			conf(n_loops) = ncpu > 0 ? (uint32) ncpu : 1;
+		}
 
-	for(unsigned i = 0; i < conf(rows); ++i) {
-		g_seats[i] = (seat*) calloc(conf(pols), sizeof(seat));
-		malloc_check_exit_on_error(g_seats[i]);
+		//each loop polls one socket, a socket without loops would never be served
+		if(conf(n_acceptors) > conf(n_loops))
+			conf(n_acceptors) = conf(n_loops);
 	}
 
-	int thr_init_res = thrmgmt_init(conf(n_threads));
-	thrmgmt_strerror_loge_exit(thr_init_res);
+	conf(listen_sds) = (int*) malloc(sizeof(int) * conf(n_acceptors));
+	malloc_check_exit_on_error(conf(listen_sds));
 
-	thrmgmt_mutex_init(&g_booking_mtx);
-
-	VERBOSE log("thrmgmt initialization done");
+	for(uint32 i = 0; i < conf(n_acceptors); ++i) {
+		conf(listen_sds)[i] = get_new_listening_socket(use_port, conf(backlog), conf(n_acceptors) > 1);
+		if(conf(listen_sds)[i] < 0) {
+			loge("unable to create new listening socket");
+			exit(EXIT_FAILURE);
+		}
+	}
 
-	signal(SIGINT, cleanup_exit);
-	signal(SIGTERM, cleanup_exit);
+	int shw_init_res = shows_path ? 
+		shows_load(&g_shows, shows_path, DEFAULT_BOOKINGS) :
+		shows_single(&g_shows, 0, conf(rows), conf(pols), DEFAULT_BOOKINGS);
+	shows_strerror_loge_exit(shw_init_res);
 
-	if(sigprocmask(SIG_UNBLOCK, &blocked_signals, NULL) < 0) {
-		strerror_log("sigprocmask(SIG_UNBLOCK)");
-		exit(EXIT_FAILURE);
+	VERBOSE {
+		char buf[256] = { 0 };
+		snprintf(buf, 256, "%u show(s), default show id: %u", g_shows.n_shows, g_shows.default_show->id);
+		log(buf);
 	}
 
-	VERBOSE log("unblocked signals");
-
-
-	/* ITA: buffer più grandi
-	 * (recv) BookSeatsx1,x2,y1,y2,z1,z2,...,k1,k2\r\n
-	 * (send) x1,x2,y1,y2,z1,z2,...,k1,k2\0
-	 * 
-	 * rcvmaxbuf:
-	 *  9 = len("BookSeats")
-	 *  2 = len("\r\n")
-	 *  20 * n_total_seats = 2 * 10 * n_total_seats = 2 * len(32_bit_integer) * n_total_seats
-	 *  n_total_seats * 2 - 1 = # di virgole necessarie
-	 *
-	 * sndavailseatbuf:
-	 *    rcvmaxbuf - 10 = non abbiamo 9 + 2: len("BookSeats") + len("\r\n"), ma dobbiamo inviare
-	 *    il terminatore '\0', è quindi equivalente a rcvmaxbuf - 11 + 1
-	 *  
-	 *  E' conveniente fare cosi perchè il buffer è fisso, niente realloc(s), una sola recv.
-	 *  E' inverosimile che una sala cinema abbia talmente tanti posti tali da ottenere buffer
-	 *  enormi.
+	/* ITA: lo snapshot diventa la memoria delle sale, il giornale 
+	 *  riparte dal suo LSN. Il replay avviene prima di servire qualsiasi
+	 *  richiesta, i thread di scrittura e dei checkpoint nascono con tutti
+	 *  i segnali bloccati.
+	 *  Con gli event loop (-e, -u) l'attesa del disco blocca il loop:
+	 *  batch/async limitano il tempo perso per ogni prenotazione
 	 */
+	if(conf(snapshot_path)) {
+		int sn_open_res = snapshot_open(&g_snapshot, conf(snapshot_path), &g_shows);
+		snapshot_strerror_loge_exit(sn_open_res);
 
-	conf(n_total_seats) = conf(rows) * conf(pols);
-	conf(rcvmaxbuf) = 11 + (20 * conf(n_total_seats)) + ((conf(n_total_seats) << 1) - 1);
-	conf(sndavailseatbuf) = conf(rcvmaxbuf) - 10;
+		VERBOSE {
+			char buf[256] = { 0 };
+			snprintf(buf, 256, "snapshot %s: %u show(s) mapped, journal from lsn %lu",
+					conf(snapshot_path), g_snapshot.n_mapped, g_snapshot.lsn);
+			log(buf);
+		}
+	}
+
+	if(conf(journal_path)) {
+		int jr_open_res = journal_open(&g_journal, conf(journal_path), g_snapshot.lsn, conf(durability), 
+				conf(commit_window), shows_replay_record, &g_shows);
+		journal_strerror_loge_exit(jr_open_res);
+
+		shows_attach_journal(&g_shows, &g_journal);
+
+		VERBOSE {
+			char buf[256] = { 0 };
+			snprintf(buf, 256, "journal %s: %lu record(s) replayed, %lu byte(s) of a torn record dropped",
+					conf(journal_path), g_journal.replayed, g_journal.truncated);
+			log(buf);
+		}
+	}
+
+	if(conf(snapshot_path)) {
+		int sn_start_res = snapshot_start(&g_snapshot, &g_journal, conf(checkpoint_interval));
+		snapshot_strerror_loge_exit(sn_start_res);
+	}
 
 	VERBOSE {
 		char buf[256] = { 0 };
-		snprintf(buf, 256, 
-				"max receive buffer size: %dB\n"
-				"max command GetAvailableSeats send buffer size: %dB\n"
-				"receive timeout: %ds\n"
-				"listening on port %d\n"
-				"setup done, waiting for connections...", 
-				conf(rcvmaxbuf), conf(sndavailseatbuf), conf(rcvtos), use_port);
+		snprintf(buf, 256, "seatmap scans: %s, request parsing: %s", 
+				seatmap_simd_name(), reqparse_simd_name());
 		log(buf);
 	}
 
-	//cleanup_exit will never be reached at this point, unless accept() fails
-	cleanup_exit(handle_connections()); 
-}
+	/* ITA: ogni spettacolo ha i propri limiti (vedi shows.c), una richiesta
+	 *  può essere lunga quanto la più grande tra tutti gli spettacoli, 
+	 *  preceduta da "@id:". Il buffer di ricezione invece è costante: 
+	 *  il parser consuma i dati man mano che arrivano
+	 */
+	conf(rcvmaxbuf) = g_shows.max_request + SHOW_PREFIX_MAX;
+	conf(sndavailseatbuf) = g_shows.max_reply;
+
+	int key_err = pthread_key_create(&g_worker_key, worker_buffers_free);
+	if(key_err != 0) {
+		errno = key_err;
+		strerror_log("pthread_key_create");
+		exit(EXIT_FAILURE);
+	}
+
+	int st_init_res = stats_init(g_op_names, REQPARSE_NOPS, stats_gauges);
+	stats_strerror_loge_exit(st_init_res);
+
+	evloop_params evl_params;
+	evl_params.max_input = INPUT_BUFFER;
+	evl_params.read_timeout = conf(rcvtos);
+	evl_params.idle_timeout = conf(idletos);
+	evl_params.write_timeout = conf(sndtos);
+	evl_params.max_requests = conf(max_requests);
+	evl_params.handler = request_execute;
+	evl_params.state_size = sizeof(reqparse);
+	evl_params.state_init = request_state_init;
+	evl_params.state_finish = request_state_finish;
+
+	if(conf(io_backend) == IO_BACKEND_URING) {
+		int url_init_res = uring_init(conf(listen_sds), conf(n_acceptors), conf(n_loops), &evl_params);
+		uring_strerror_loge_exit(url_init_res);
+
+		VERBOSE log("uring initialization done");
+	} else if(conf(io_backend) == IO_BACKEND_EVLOOP) {
+		int evl_init_res = evloop_init(conf(listen_sds), conf(n_acceptors), conf(n_loops), &evl_params);
+		evloop_strerror_loge_exit(evl_init_res);
+
+		VERBOSE log("evloop initialization done");
+	} else {
+		int thr_init_res = thrmgmt_pool_init(conf(n_threads), conf(queue_size), request_handler);
+		thrmgmt_strerror_loge_exit(thr_init_res);
 
-#define NOT_FOUND -1
+		VERBOSE log("thrmgmt initialization done");
 
-int64 detect_request_termination(const char* req, uint32 len) {
-	for(uint32 i = 0; i < len - 1; ++i) {
-		uint32 i_plus_one = i + 1;
-		if(req[i] == '\r' && req[i_plus_one] == '\n')
-			return i_plus_one; //found terminator
+		//created with every signal blocked, only this thread handles them
+		watchdog_start();
+		start_acceptors();
 	}
 
-	return NOT_FOUND;
-}
+	int st_start_res = stats_start(conf(stats_interval));
+	stats_strerror_loge_exit(st_start_res);
 
-svcop_handler_fpt request_parsereq(const char* reqstr, uint32 end, char **out_argstrt_ptr) {
-	*out_argstrt_ptr = NULL;
+	VERBOSE {
+		char buf[512] = { 0 };
+		snprintf(buf, 512, 
+				"max request size: %dB, receive buffer size: %dB\n"
+				"max command GetAvailableSeats send buffer size: %dB\n"
+				"receive timeout: %ds, idle timeout: %ds, send timeout: %ds, requests per connection: %d\n"
+				"%s: %d, work queue: %d\n"
+				"listening on port %d, %d socket(s), backlog %d\n"
+				"setup done, waiting for connections...", 
+				conf(rcvmaxbuf), INPUT_BUFFER, conf(sndavailseatbuf), conf(rcvtos), conf(idletos), conf(sndtos), conf(max_requests),
+				conf(io_backend) ? "event loops" : "workers",
+				conf(io_backend) ? conf(n_loops) : conf(n_threads), conf(queue_size), use_port,
+				conf(n_acceptors), conf(backlog));
+		log(buf);
+	}
 
-	for(int i = 0; i < NOPS; ++i) {
-		if(strncmp(reqstr, g_op_listing[i].name, g_op_listing[i].len) == 0) {
-			if(g_op_listing[i].has_arg) {
-				if(end == g_op_listing[i].len + 1)
-					return NULL; //no argument, but argument is required
+	/* ITA: loop o acceptor fanno tutto il lavoro. SIGINT/SIGTERM restano
+	 *  bloccati in ogni thread e vengono raccolti qui con sigwait():
+	 *  cleanup_exit gira come codice normale del thread principale, non
+	 *  in un signal handler
+	 */
+	sigset_t exit_signals;
+	sigemptyset(&exit_signals);
+	sigaddset(&exit_signals, SIGINT);
+	sigaddset(&exit_signals, SIGTERM);
 
-				*out_argstrt_ptr = (char*) reqstr + g_op_listing[i].len;
-			}
+	int sig;
+	while(sigwait(&exit_signals, &sig) != 0)
+		;
 
-			return g_op_listing[i].handler; //OK
-		}
+	VERBOSE {
+		char buf[64] = { 0 };
+		snprintf(buf, 64, "received %s", sig == SIGINT ? "SIGINT" : "SIGTERM");
+		log(buf);
 	}
 
-	return NULL; //NOT FOUND
+	cleanup_exit(EXIT_SUCCESS);
 }
 
-void request_handler(void* _sd) {
-	int sd = (int) _sd;
+/* ITA: stato del parser di una connessione, per tutti i backend di I/O.
+ *  Nessun numero oltre quelli della sala più grande viene memorizzato
+ *  (una coppia in più basta a rispondere Fail:toomuch)
+ */
+void request_state_init(void* state) {
+	reqparse_init((reqparse*) state, (g_shows.max_seats + 1) << 1, conf(rcvmaxbuf));
+}
 
-	char *request = (char*) calloc(conf(rcvmaxbuf), sizeof(char));
-	malloc_check_exit_on_error(request);
+void request_state_finish(void* state) {
+	reqparse_finish((reqparse*) state);
+}
 
-	int termpos = NOT_FOUND;
+/* ITA: passa al parser della connessione (state) i len bytes ricevuti, 
+ *  tutti consumati; se con questi una richiesta è completa la esegue. 
+ *  Comune a tutti i backend di I/O.
+ */
+int request_execute(void* state, char* request, uint32 len, const char** out_ans, uint32* out_len, uint32* consumed) {
+	reqparse* rp = (reqparse*) state;
+
+	//the previous reply has already been copied by the I/O backend
+	worker_buffers* wb = worker_local();
+	arena* scratch = &wb->scratch;
+	arena_reset(scratch);
+
+	if(reqparse_feed(rp, request, len, consumed) == REQPARSE_NEED_MORE)
+		return EVLOOP_REQUEST_NEED_MORE;
+
+	//latency: from the complete request to the reply, durability wait included
+	unsigned long started = stats_now();
+	uint32 op = REQPARSE_OP_NONE;
+
+	int rv = EVLOOP_REQUEST_REPLY;
+	if(rp->proto == REQPARSE_PROTO_V2) {
+		rv = request_execute_v2(rp, scratch, out_ans, out_len, &op);
+	} else if(rp->error == REQPARSE_ERR_TOOLONG) {
+		*out_ans = fail_reply(INVALID_REQUEST_REPLY, STATS_RESULT_INVALID, out_len);
+		rv = EVLOOP_REQUEST_CLOSE;
+	} else if(rp->error == REQPARSE_ERR_INVALID) {
+		*out_ans = fail_reply(INVALID_REQUEST_REPLY, STATS_RESULT_INVALID, out_len);
+	} else {
+		//"@id:" selects the show, without it the request goes to the default one
+		show* target_show = rp->has_show ? shows_find(&g_shows, rp->show_id) : g_shows.default_show;
 
-/* --- recv --- */
-	int err = 0;
-intr_retry:
-	err = recv(sd, request, conf(rcvmaxbuf), 0);
-	if(err < 0) {
-		if(errno == EINTR)
-			goto intr_retry;
-		else if(errno) {
-			if(errno != EWOULDBLOCK)
-				strerror_log("recv");
-			goto request_finish;
-		}
-	} else if(err == 0) {
-		VERBOSE log("client suddenly closed connection");
-		goto request_finish;
+		op = rp->op;
+		if(target_show == NULL)
+			*out_ans = fail_reply("Fail:noshow", STATS_RESULT_NOSHOW, out_len);
+		else
+			*out_ans = g_op_listing[op](target_show, scratch, rp, out_len);
 	}
-/* --- recv --- */
 
-	termpos = detect_request_termination(request, err);
-	if(termpos == NOT_FOUND) {
+	stats_record(op, ops_result_take(), stats_now() - started);
 
-/* --- send --- */	
-intr1_retry:
-		if(send(sd, "Op:invalid\r\n\0", sizeof("Op:invalid\r\n"), MSG_NOSIGNAL) < 0) {
-			if (errno == EINTR)
-				goto intr1_retry;
-			else
-				strerror_log("send");
-		}
-/* --- send --- */
-		
-		goto request_finish;
+	if(op == REQPARSE_OP_BOOK_SEATS || op == REQPARSE_OP_REVOKE_BOOKING || 
+			op == REQPARSE_OP_BOOK_BATCH || op == REQPARSE_OP_BOOK_BEST) {
+		unsigned long waits, wait_ns;
+		booking_lock_waits(&waits, &wait_ns);
+		stats_lock_waits(waits, wait_ns);
 	}
 
-	char* arg_starts_from_ptr = NULL;
-	svcop_handler_fpt target_op = request_parsereq(request, termpos, &arg_starts_from_ptr);
-	
-	if(target_op == NULL) {
-		
-/* --- send --- */	
-intr2_retry:
-		if(send(sd, "Op:invalid\r\n\0", sizeof("Op:invalid\r\n"), MSG_NOSIGNAL) < 0) {
-			if (errno == EINTR)
-				goto intr2_retry;
-			else
-				strerror_log("send");
-		}
-/* --- send --- */
-		
-		goto request_finish;
-	}
+	reqparse_next(rp);
+	return rv;
+}
 
-	char* endpos = request + termpos;
-	*(endpos - 1) = 0;
+void request_handler(void* _sd) {
+	int sd = (int) _sd;
 
-	char* ans = target_op(arg_starts_from_ptr, endpos);
-/* --- send --- */
-intr3_retry:
-	if(send(sd, ans, strlen(ans) + 1, MSG_NOSIGNAL) < 0) {
-		if (errno == EINTR)
-			goto intr3_retry;
-		else
-			strerror_log("send");
-	}
-/* --- send --- */
+	//kept by the worker across connections
+	worker_buffers* wb = worker_local();
+	reqparse_next(&wb->parser);
 
-	malloc_free(ans);
-	
-request_finish: 
-	close(sd);
-	malloc_free(request);
-}
+	uint32 in_len = 0;
+	uint32 served = 0;
+	int closing = 0;
+	int pending = 0; //incomplete request already consumed by the parser
 
-char* op_get_available_seats(const char* __unused_1__, const char* __unused_2__) {
-	(void)__unused_1__;
-	(void)__unused_2__;
+	conn_deadline* dl = &wb->deadline;
+	dl->sd = sd;
+	dl->expired = 0;
+	dl->phase = -1;
 
-	const char comma = ',';
+	while(!closing) {
+		deadline_set(dl, (served > 0 && in_len == 0 && !pending) ? CONN_PHASE_IDLE : CONN_PHASE_READ, served);
 
-	char* res = (char*) calloc(conf(sndavailseatbuf), sizeof(char));
-	malloc_check_exit_on_error(res);
+/* --- recv --- */
+		char* request = wb->request;
 
-	uint32 len = 0;
+		int err = 0;
+intr_retry:
+		err = recv(sd, request + in_len, INPUT_BUFFER - in_len, 0);
+		if(err < 0) {
+			if(errno == EINTR)
+				goto intr_retry;
+			else if(errno) {
+				if(!__atomic_load_n(&dl->expired, __ATOMIC_RELAXED))
+					strerror_log("recv");
+				goto request_finish;
+			}
+		} else if(err == 0) {
+			VERBOSE if(served == 0 && !__atomic_load_n(&dl->expired, __ATOMIC_RELAXED)) 
+				log("client suddenly closed connection");
+			goto request_finish;
+		}
+/* --- recv --- */
 
-	for(uint32 i = 0; i < conf(rows); ++i) {
-		char sip1[11] = { 0 };
-		int sip1_len = itos(i + 1, sip1);
+		in_len += err;
 
-		for(uint32 j = 0; j < conf(pols); ++j) {
-			ubyte is_booked = g_seats[i][j].booked;
+		uint32 pos = 0;
+		uint32 replies_len = 0;
 
-			if(is_booked == 0) {
-				char sjp1[11] = { 0 };
-				int sjp1_len = itos(j + 1, sjp1);
+		while(pos < in_len && !closing) {
+			const char* ans = NULL;
+			uint32 ans_len = 0;
+			uint32 consumed = 0;
 
-				strncat(res, sip1, sip1_len);
-				strncat(res, &comma, 1);
-				strncat(res, sjp1, sjp1_len);
-				strncat(res, &comma, 1);
+			int rv = request_execute(&wb->parser, request + pos, in_len - pos, &ans, &ans_len, &consumed);
+			pos += consumed;
 
-				len += 2 + sip1_len + sjp1_len;
+			if(rv == EVLOOP_REQUEST_NEED_MORE) {
+				if(consumed > 0)
+					pending = 1;
+				break;
 			}
-		}
-	}
 
-	if(len > 0)
-		res[len - 1] = 0;
+			pending = 0;
 
-	return res;
-}
+			if(replies_len + ans_len > wb->replies_cap) {
+				wb->replies_cap = (replies_len + ans_len) << 1;
+				wb->replies = (char*) realloc(wb->replies, wb->replies_cap);
+				malloc_check_exit_on_error(wb->replies);
+			}
 
-#define book_seats_error(msg, msglen) \
-{ \
-		malloc_free(to_book); \
-		char* err = (char*) malloc(sizeof(char) * msglen); \
-		malloc_check_exit_on_error(err); \
-		memcpy(err, msg, msglen); \
-		return err; \
-} 
-
-#define __locked__() \
-	(thrmgmt_strerror_loge_exit(thrmgmt_mutex_lock(&g_booking_mtx)))
-
-#define __unlocked__() \
-	(thrmgmt_strerror_loge_exit(thrmgmt_mutex_unlock(&g_booking_mtx)))
-
-char* op_book_seats(const char* arg, const char* endat) {
-	uint32 n_compo = 0;
-
-	uint32 n_bookings = 0;
-	seat** to_book = (seat**) malloc(sizeof(seat*) * 1);
-	malloc_check_exit_on_error(to_book);
-
-	char* tok = strtok((char*)arg, ",");
-	while(tok && tok < endat) {
-		++n_compo;
-
-		if(n_compo % 2 == 1) {
-			char* prevtok = tok;
-			tok = strtok(NULL, ",");
-			
-			if(tok == NULL)
-				book_seats_error("Fail:noteven", 13);
-
-			uint32 x;
-			uint32 y;
-			
-			int res1, res2;
-			if((res1 = stoull(prevtok, (ulong64*) &x)) || (res2 = stoull(tok, (ulong64*) &y)) || 
-					x == 0 || y == 0 || x > conf(rows) || y > conf(pols))
-				book_seats_error("Fail:exceed", 12);
-
-			if(n_bookings + 1 > conf(n_total_seats))
-				book_seats_error("Fail:toomuch", 13);
-
-			to_book[n_bookings] = &g_seats[x - 1][y - 1];
-			++n_bookings;
-			
-			to_book = (seat**) realloc(to_book, sizeof(seat*) * (n_bookings + 1));
-			malloc_check_exit_on_error(to_book);
+			memcpy(wb->replies + replies_len, ans, ans_len);
+			replies_len += ans_len;
+
+			++served;
+			if(rv == EVLOOP_REQUEST_CLOSE || served == conf(max_requests))
+				closing = 1;
 		}
 
-		tok = strtok(NULL, ",");
-	}
+		memmove(request, request + pos, in_len - pos);
+		in_len -= pos;
 
-	if(n_bookings == 0)
-		book_seats_error("Fail:wholeempty", 16);
+		if(replies_len == 0)
+			continue;
 
-	__locked__();
-	
-	for(uint32 i = 0; i < n_bookings; ++i) {
-		ubyte is_booked = to_book[i]->booked;
+/* --- send --- */
+		deadline_set(dl, CONN_PHASE_WRITE, served);
 
-		if(is_booked == 1) {
-			__unlocked__();
-			book_seats_error("Fail:notavail", 14);
+intr1_retry:
+		if(send(sd, wb->replies, replies_len, MSG_NOSIGNAL) < 0) {
+			if (errno == EINTR)
+				goto intr1_retry;
+			else {
+				if(!__atomic_load_n(&dl->expired, __ATOMIC_RELAXED))
+					strerror_log("send");
+				goto request_finish;
+			}
 		}
-	}
-
-	uint32 unique = (uint32) time(NULL);
-
-	for(uint32 i = 0; i < n_bookings; ++i) {
-		to_book[i]->unique_code = unique;
-		to_book[i]->booked = 1;
+/* --- send --- */
 	}
 	
-	__unlocked__();
-
-	malloc_free(to_book);
-
-	char code[11] = { 0 };
-	uint32 code_len = itos(unique, code);
-
-	int len = code_len + 9;
-	char* res = (char*) malloc(sizeof(char) * len);
-	malloc_check_exit_on_error(res);
-	memcpy(res, "Success:", 8);
-	memcpy(res + 8, code, code_len);
-	res[len - 1] = 0;
+request_finish: 
+	//the watchdog must not shutdown() a descriptor that may be reused
+	if(deadline_clear(dl))
+		VERBOSE log("connection timed out");
 
-	return res;
-}
+	close(sd);
 
-#undef book_seats_error
-#undef __locked__
-#undef __unlocked__
+	//don't let one huge request pin its memory to the worker
+	reqparse_trim(&wb->parser, WORKER_KEEP_BUFFER);
 
-#define revoke_booking_result(msg, len) \
-{ \
-	char* err = (char*) malloc(sizeof(char) * len); \
-	memcpy(err, msg, len); \
-	return err; \
+	if(wb->replies_cap > WORKER_KEEP_BUFFER) {
+		malloc_free(wb->replies);
+		wb->replies_cap = 0;
+	}
 }
 
-char* op_revoke_booking(const char* arg, const char* __unused_1__) {
-	((void)__unused_1__);
-
-	uint32 unique;
-	if(stoull(arg, (ulong64*) &unique))
-		revoke_booking_result("Fail:nan\0", 9);
+/* ITA: in *op la richiesta testuale equivalente, per Stats */
+int request_execute_v2(const reqparse* rp, arena* scratch, const char** out_ans, uint32* out_len, uint32* op) {
+	const proto2_header* h = &rp->v2;
+	const uint32* payload = rp->values;
 
-	int unique_code_found = 0;
-	for(uint32 i = 0; i < conf(rows); ++i) {
-		for(uint32 j = 0; j < conf(pols); ++j) {
-			ubyte is_booked = g_seats[i][j].booked;
+	if(rp->error == REQPARSE_ERR_TOOLONG) {
+		//framing can't be trusted anymore
+		*out_ans = op2_reply(scratch, h, PROTO2_STATUS_INVALID, 0, out_len);
+		return EVLOOP_REQUEST_CLOSE;
+	}
 
-			if(is_booked && g_seats[i][j].unique_code == unique) {
-				unique_code_found = 1;
+	show* sh = shows_find(&g_shows, h->show_id);
+	if(sh == NULL) {
+		*out_ans = op2_reply(scratch, h, PROTO2_STATUS_NOSHOW, 0, out_len);
+		return EVLOOP_REQUEST_REPLY;
+	}
 
-				g_seats[i][j].booked = 0;
-			}
-		}
+	switch(h->opcode) {
+		case PROTO2_OP_GET_AVAILABLE_SEATS:
+			*op = REQPARSE_OP_GET_AVAILABLE_SEATS;
+			*out_ans = op2_get_available_seats(sh, scratch, h, payload, out_len);
+			break;
+		case PROTO2_OP_BOOK_SEATS:
+			*op = REQPARSE_OP_BOOK_SEATS;
+			*out_ans = op2_book_seats(sh, scratch, h, payload, out_len);
+			break;
+		case PROTO2_OP_REVOKE_BOOKING:
+			*op = REQPARSE_OP_REVOKE_BOOKING;
+			*out_ans = op2_revoke_booking(sh, scratch, h, payload, out_len);
+			break;
+		default:
+			*out_ans = op2_reply(scratch, h, PROTO2_STATUS_INVALID, 0, out_len);
 	}
-	
-	if(unique_code_found == 0)
-		revoke_booking_result("Fail:nounique\0", 14);
 
-	revoke_booking_result("Success:ok\0", 11);
+	return EVLOOP_REQUEST_REPLY;
 }
-
-#undef revoke_booking_error
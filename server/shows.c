@@ -0,0 +1,303 @@
+/* shows.c - show table
+	ITA: ogni spettacolo ha la propria sala (booking_engine: posti,
+		cache, indice dei codici e lock), la tabella è ordinata per id
+		e viene cercata per bisezione. Nessuno stato è condiviso tra
+		spettacoli diversi.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "malloc_utils.h"
+#include "shows.h"
+
+#define SHOWS_LINE_MAX 256
+
+//BookSeats + "\r\n" + "x,y," per ogni posto, 10 cifre per coordinata
+#define SHOWS_MAX_SEATS ((UINT_MAX - 11) / 22)
+
+typedef struct {
+	unsigned id;
+	unsigned rows;
+	unsigned pols;
+	unsigned line;
+} __shows_decl;
+
+/* NOT exposed */
+static unsigned __shows_error_line;
+
+static int __shows_cmp_decl(const void* a, const void* b) {
+	unsigned x = ((const __shows_decl*) a)->id;
+	unsigned y = ((const __shows_decl*) b)->id;
+	return (x > y) - (x < y);
+}
+
+/* returns 0 on success */
+static int __shows_parse_uint(char** s, unsigned* out) {
+	while(isspace((unsigned char) **s))
+		++*s;
+
+	if(!isdigit((unsigned char) **s))
+		return 1;
+
+	char* end = NULL;
+	errno = 0;
+	unsigned long v = strtoul(*s, &end, 10);
+	if(errno || v > UINT_MAX)
+		return 1;
+
+	*s = end;
+	*out = (unsigned) v;
+	return 0;
+}
+
+static int __shows_build(show_table* st, __shows_decl* decls, unsigned n, unsigned bookings) {
+	unsigned first_id = decls[0].id;
+
+	qsort(decls, n, sizeof(__shows_decl), __shows_cmp_decl);
+
+	for(unsigned i = 1; i < n; ++i) {
+		if(decls[i].id == decls[i - 1].id) {
+			__shows_error_line = decls[i].line;
+			return SHOWS_LOAD_DUPLICATE;
+		}
+	}
+
+	if((st->shows = (show*) calloc(n, sizeof(show))) == NULL)
+		return SHOWS_LOAD_MALLOC_FAILURE;
+
+	for(unsigned i = 0; i < n; ++i) {
+		show* s = &st->shows[i];
+		s->id = decls[i].id;
+		s->rows = decls[i].rows;
+		s->pols = decls[i].pols;
+		s->n_total_seats = s->rows * s->pols;
+
+		/* ITA: buffer più grandi
+		 * (recv) BookSeatsx1,x2,y1,y2,z1,z2,...,k1,k2\r\n
+		 * (send) x1,x2,y1,y2,z1,z2,...,k1,k2\0
+		 * 
+		 * max_request:
+		 *  9 = len("BookSeats")
+		 *  2 = len("\r\n")
+		 *  20 * n_total_seats = 2 * 10 * n_total_seats = 2 * len(32_bit_integer) * n_total_seats
+		 *  n_total_seats * 2 - 1 = # di virgole necessarie
+		 *
+		 * max_reply:
+		 *    max_request - 10 = non abbiamo 9 + 2: len("BookSeats") + len("\r\n"), ma dobbiamo inviare
+		 *    il terminatore '\0', è quindi equivalente a max_request - 11 + 1
+		 */
+		s->max_request = 11 + (20 * s->n_total_seats) + ((s->n_total_seats << 1) - 1);
+		s->max_reply = s->max_request - 10;
+
+		if(booking_init(&s->engine, s->rows, s->pols, bookings) != BOOKING_OK) {
+			__shows_error_line = decls[i].line;
+			st->n_shows = i;
+			shows_finish(st);
+			return SHOWS_LOAD_BOOKING_FAILURE;
+		}
+
+		st->n_shows = i + 1;
+
+		if(s->max_request > st->max_request)
+			st->max_request = s->max_request;
+		if(s->max_reply > st->max_reply)
+			st->max_reply = s->max_reply;
+		if(s->n_total_seats > st->max_seats)
+			st->max_seats = s->n_total_seats;
+	}
+
+	st->default_show = shows_find(st, first_id);
+	return SHOWS_OK;
+}
+
+/* exposed */
+int shows_load(show_table* st, const char* path, unsigned bookings) {
+	memset(st, 0, sizeof(show_table));
+	__shows_error_line = 0;
+
+	if(path == NULL || bookings == 0)
+		return SHOWS_LOAD_INVAL;
+
+	FILE* f = fopen(path, "r");
+	if(f == NULL)
+		return SHOWS_LOAD_OPEN_FAILURE;
+
+	__shows_decl* decls = NULL;
+	unsigned n = 0;
+	unsigned cap = 0;
+	unsigned line_no = 0;
+	int err = SHOWS_OK;
+
+	char line[SHOWS_LINE_MAX];
+	while(fgets(line, SHOWS_LINE_MAX, f)) {
+		++line_no;
+
+		char* p = line;
+		while(isspace((unsigned char) *p))
+			++p;
+
+		if(*p == 0 || *p == '#')
+			continue;
+
+		__shows_decl d;
+		d.line = line_no;
+
+		if(__shows_parse_uint(&p, &d.id) || __shows_parse_uint(&p, &d.rows) ||
+				__shows_parse_uint(&p, &d.pols)) {
+			err = SHOWS_LOAD_SYNTAX;
+			break;
+		}
+
+		while(isspace((unsigned char) *p))
+			++p;
+
+		if((*p != 0 && *p != '#') || d.rows == 0 || d.pols == 0 ||
+				(unsigned long long) d.rows * d.pols > SHOWS_MAX_SEATS) {
+			err = SHOWS_LOAD_SYNTAX;
+			break;
+		}
+
+		if(n == cap) {
+			cap = cap ? cap << 1 : 8;
+			__shows_decl* grown = (__shows_decl*) realloc(decls, sizeof(__shows_decl) * cap);
+			if(grown == NULL) {
+				err = SHOWS_LOAD_MALLOC_FAILURE;
+				break;
+			}
+
+			decls = grown;
+		}
+
+		decls[n++] = d;
+	}
+
+	fclose(f);
+
+	if(err == SHOWS_LOAD_SYNTAX)
+		__shows_error_line = line_no;
+	else if(err == SHOWS_OK && n == 0)
+		err = SHOWS_LOAD_EMPTY;
+
+	if(err == SHOWS_OK)
+		err = __shows_build(st, decls, n, bookings);
+
+	malloc_free(decls);
+	return err;
+}
+
+int shows_single(show_table* st, unsigned id, unsigned rows, unsigned pols, unsigned bookings) {
+	memset(st, 0, sizeof(show_table));
+	__shows_error_line = 0;
+
+	if(rows == 0 || pols == 0 || bookings == 0 ||
+			(unsigned long long) rows * pols > SHOWS_MAX_SEATS)
+		return SHOWS_LOAD_INVAL;
+
+	__shows_decl d = { id, rows, pols, 0 };
+	return __shows_build(st, &d, 1, bookings);
+}
+
+show* shows_find(const show_table* st, unsigned id) {
+	unsigned lo = 0;
+	unsigned hi = st->n_shows;
+
+	while(lo < hi) {
+		unsigned mid = lo + ((hi - lo) >> 1);
+		unsigned mid_id = st->shows[mid].id;
+
+		if(mid_id == id)
+			return &st->shows[mid];
+		else if(mid_id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+int shows_replay_record(void* ctx, const journal_record* rec) {
+	show* s = shows_find((const show_table*) ctx, rec->show_id);
+	if(s == NULL)
+		return 1;
+
+	switch(rec->type) {
+		case JOURNAL_REC_KEY:
+			if(rec->n_values != BOOKIDX_KEY_WORDS)
+				return 1;
+
+			bookidx_set_key(&s->engine.bi, rec->values);
+			s->key_journaled = 1;
+			return 0;
+		case JOURNAL_REC_BOOK:
+		case JOURNAL_REC_REVOKE:
+			//codes written before the key would not decode to their counter
+			return !s->key_journaled || booking_redo(&s->engine, rec->code, rec->values, rec->n_values,
+					rec->type == JOURNAL_REC_BOOK) != BOOKING_OK;
+	}
+
+	return 1;
+}
+
+void shows_attach_journal(show_table* st, journal* jr) {
+	for(unsigned i = 0; i < st->n_shows; ++i) {
+		show* s = &st->shows[i];
+
+		if(!s->key_journaled) {
+			journal_append(jr, JOURNAL_REC_KEY, s->id, 0, s->engine.bi.key, BOOKIDX_KEY_WORDS);
+			s->key_journaled = 1;
+		}
+
+		booking_rebuild_index(&s->engine);
+		booking_attach_journal(&s->engine, jr, s->id);
+	}
+
+	journal_sync(jr);
+}
+
+void shows_finish(show_table* st) {
+	for(unsigned i = 0; i < st->n_shows; ++i)
+		booking_finish(&st->shows[i].engine);
+
+	malloc_free(st->shows);
+	st->n_shows = 0;
+	st->default_show = NULL;
+}
+
+void shows_strerror(int error, char* dst, int dst_max_size) {
+	int current_errno = errno;
+	memset(dst, 0, dst_max_size);
+	switch(error) {
+		case SHOWS_LOAD_INVAL:
+			memcpy(dst, "shows_load: Invalid argument", sizeof("shows_load: Invalid argument"));
+			break;
+		case SHOWS_LOAD_OPEN_FAILURE:
+			snprintf(dst, dst_max_size, "shows_load:fopen: %s", strerror(current_errno));
+			break;
+		case SHOWS_LOAD_SYNTAX:
+			snprintf(dst, dst_max_size, "shows_load: line %u: expected \"<id> <rows> <pols>\""
+					" (rows, pols > 0)", __shows_error_line);
+			break;
+		case SHOWS_LOAD_DUPLICATE:
+			snprintf(dst, dst_max_size, "shows_load: line %u: duplicate show id", __shows_error_line);
+			break;
+		case SHOWS_LOAD_EMPTY:
+			memcpy(dst, "shows_load: no shows defined", sizeof("shows_load: no shows defined"));
+			break;
+		case SHOWS_LOAD_MALLOC_FAILURE:
+			snprintf(dst, dst_max_size, "shows_load:malloc: %s", strerror(current_errno));
+			break;
+		case SHOWS_LOAD_BOOKING_FAILURE:
+			snprintf(dst, dst_max_size, "shows_load: line %u: booking_init: %s",
+					__shows_error_line, strerror(current_errno));
+			break;
+
+		default:
+			snprintf(dst, dst_max_size, "shows: Success");
+	}
+}
@@ -0,0 +1,102 @@
+#ifndef SHOWS_H
+#define SHOWS_H
+
+#include "booking.h"
+
+#define SHOWS_OK 0
+
+#define SHOWS_LOAD_INVAL 4
+#define SHOWS_LOAD_OPEN_FAILURE 5
+#define SHOWS_LOAD_SYNTAX 6
+#define SHOWS_LOAD_DUPLICATE 7
+#define SHOWS_LOAD_EMPTY 8
+#define SHOWS_LOAD_MALLOC_FAILURE 9
+#define SHOWS_LOAD_BOOKING_FAILURE 10
+
+/*
+ * uno spettacolo: la sua sala e i limiti che ne derivano
+ */
+typedef struct {
+	unsigned id;
+	unsigned rows;
+	unsigned pols;
+	unsigned n_total_seats;
+	unsigned max_request; //BookSeats con tutti i posti della sala, "\r\n" incluso
+	unsigned max_reply; //GetAvailableSeats con tutti i posti liberi, '\0' incluso
+	int key_journaled; //la chiave dei codici è già nel giornale o nello snapshot
+	booking_engine engine;
+} show;
+
+/*
+ * tabella degli spettacoli, ordinata per id. Ogni spettacolo ha i propri
+ * lock: richieste per spettacoli diversi non condividono nulla.
+ * Gli elementi non vengono mai spostati dopo il caricamento.
+ */
+typedef struct {
+	show* shows;
+	unsigned n_shows;
+	show* default_show; //per le richieste senza id: il primo del file
+	unsigned max_request; //il massimo tra gli spettacoli
+	unsigned max_reply; //il massimo tra gli spettacoli
+	unsigned max_seats; //la sala più grande, n_total_seats
+} show_table;
+
+/*
+ * shows_load
+ *
+ * DESCRIZIONE:
+ *		carica la tabella dal file path, una riga per spettacolo:
+ *
+ *			# commento
+ *			<id> <righe> <colonne>
+ *
+ *		righe vuote e commenti sono ignorati, id distinti.
+ *		bookings è la capacità iniziale dell'indice delle prenotazioni
+ *		di ogni spettacolo.
+ *
+ * RITORNA:
+ *		* SHOWS_OK se tutto è andato a buon fine
+ *		* uno degli errori della classe SHOWS_LOAD_* altrimenti,
+ *		  shows_strerror riporta la riga del file che lo ha causato
+ */
+int shows_load(show_table* st, const char* path, unsigned bookings);
+
+/*
+ * shows_single
+ *		come shows_load, ma la tabella contiene un solo spettacolo,
+ *		(id, rows, pols): il server lanciato con --rows/--pols
+ */
+int shows_single(show_table* st, unsigned id, unsigned rows, unsigned pols, unsigned bookings);
+
+/*
+ * shows_find
+ *		lo spettacolo con l'id richiesto, NULL se non esiste
+ */
+show* shows_find(const show_table* st, unsigned id);
+
+/*
+ * shows_replay_record
+ *		journal_replay_fpt, ctx è la show_table: applica un record del
+ *		giornale ai posti dello spettacolo show_id (booking_redo).
+ *		Fallisce (ritorna != 0) se lo spettacolo non esiste o il record
+ *		non è applicabile alla sua sala
+ */
+int shows_replay_record(void* ctx, const journal_record* rec);
+
+/*
+ * shows_attach_journal
+ *		dopo il replay: ricostruisce gli indici dei codici, scrive la 
+ *		chiave dei codici degli spettacoli che non l'hanno ancora salvata
+ *		e collega al giornale tutte le sale
+ */
+void shows_attach_journal(show_table* st, journal* jr);
+
+/*
+ * shows_finish
+ *		libera tutti gli spettacoli
+ */
+void shows_finish(show_table* st);
+
+void shows_strerror(int error, char* dst, int dst_size);
+
+#endif
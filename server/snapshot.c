@@ -0,0 +1,400 @@
+/* snapshot.c - memory-mapped seat-state snapshots and checkpoints
+	ITA: un checkpoint fissa prima l'LSN del giornale, poi copia ogni
+		riga sotto il suo lock in un file nuovo mappato MAP_SHARED.
+		La copia non è una fotografia di un solo istante: contiene
+		tutto ciò che precede l'LSN e forse parte di ciò che segue.
+		I record del giornale impostano i posti al loro valore finale
+		(booking_redo), quindi il replay da quell'LSN porta comunque
+		allo stato giusto. Prima di pubblicare il file con rename si
+		attende che il giornale sia durevole: lo snapshot non contiene
+		mai una modifica che il giornale potrebbe perdere.
+
+		All'avvio il file è mappato MAP_PRIVATE e le sale puntano
+		dentro la mappa: il tempo di avvio non dipende dalla sala, solo
+		l'indice dei codici (booking_rebuild_index) dipende dai posti
+		prenotati. Il checkpoint successivo sostituisce il file con
+		rename, la mappa resta sul vecchio inode finché il processo vive.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "malloc_utils.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "TKTS"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_PAGE 4096
+
+#define __snapshot_round(n) (((n) + SNAPSHOT_PAGE - 1) & ~((unsigned long) SNAPSHOT_PAGE - 1))
+
+typedef struct {
+	char magic[4];
+	unsigned version;
+	unsigned n_shows;
+	unsigned seat_size;
+	unsigned long lsn;
+} __snapshot_header;
+
+typedef struct {
+	unsigned id;
+	unsigned rows;
+	unsigned pols;
+	unsigned words_per_row;
+	unsigned key[BOOKIDX_KEY_WORDS];
+	unsigned counter;
+	unsigned reserved;
+	unsigned long seats_off;
+	unsigned long bits_off;
+} __snapshot_show;
+
+/* NOT exposed */
+static unsigned __snapshot_error_show;
+
+static __snapshot_show* __snapshot_shows(char* map) {
+	return (__snapshot_show*) (map + sizeof(__snapshot_header));
+}
+
+/* a new file is durable only once its directory entry is */
+static void __snapshot_sync_dir(const char* path) {
+	char* copy = strdup(path);
+	if(copy == NULL)
+		return;
+
+	int dfd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+	if(dfd >= 0) {
+		fsync(dfd);
+		close(dfd);
+	}
+
+	free(copy);
+}
+
+/* fills the geometry and offsets of every show, returns the file size */
+static unsigned long __snapshot_layout(const show_table* st, __snapshot_show* out) {
+	unsigned long off = __snapshot_round(sizeof(__snapshot_header) + sizeof(__snapshot_show) * st->n_shows);
+
+	for(unsigned i = 0; i < st->n_shows; ++i) {
+		const seatmap* sm = &st->shows[i].engine.sm;
+
+		memset(&out[i], 0, sizeof(__snapshot_show));
+		out[i].id = st->shows[i].id;
+		out[i].rows = sm->rows;
+		out[i].pols = sm->pols;
+		out[i].words_per_row = sm->words_per_row;
+
+		out[i].seats_off = off;
+		off = __snapshot_round(off + seatmap_seats_size(sm));
+		out[i].bits_off = off;
+		off = __snapshot_round(off + seatmap_bits_size(sm));
+	}
+
+	return off;
+}
+
+/* returns 0 on success */
+static int __snapshot_write(snapshot* sn, unsigned long lsn, const char* tmp) {
+	show_table* st = sn->st;
+	__snapshot_show* layout = (__snapshot_show*) malloc(sizeof(__snapshot_show) * st->n_shows);
+	if(layout == NULL)
+		return 1;
+
+	unsigned long size = __snapshot_layout(st, layout);
+	char* map = MAP_FAILED;
+	int err = 0;
+
+	int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0 || ftruncate(fd, (off_t) size) < 0 ||
+			(map = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		err = 1;
+		goto out;
+	}
+
+	__snapshot_header hdr;
+	memcpy(hdr.magic, SNAPSHOT_MAGIC, 4);
+	hdr.version = SNAPSHOT_VERSION;
+	hdr.n_shows = st->n_shows;
+	hdr.seat_size = sizeof(seat);
+	hdr.lsn = lsn;
+	memcpy(map, &hdr, sizeof(hdr));
+
+	for(unsigned i = 0; i < st->n_shows; ++i) {
+		booking_engine* be = &st->shows[i].engine;
+
+		//read after lsn: codes it does not cover are in records after lsn
+		memcpy(layout[i].key, be->bi.key, sizeof(layout[i].key));
+		layout[i].counter = bookidx_get_counter(&be->bi);
+
+		booking_copy(be, (seat*) (map + layout[i].seats_off), (unsigned long long*) (map + layout[i].bits_off));
+	}
+
+	memcpy(__snapshot_shows(map), layout, sizeof(__snapshot_show) * st->n_shows);
+
+	if(msync(map, size, MS_SYNC) < 0 || fsync(fd) < 0)
+		err = 1;
+
+out:
+	if(err)
+		err = errno;
+	if(map != MAP_FAILED)
+		munmap(map, size);
+	if(fd >= 0)
+		close(fd);
+
+	free(layout);
+	errno = err;
+	return err != 0;
+}
+
+static void* __snapshot_routine(void* arg) {
+	snapshot* sn = (snapshot*) arg;
+
+	pthread_mutex_lock(&sn->mtx);
+
+	while(sn->running) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += sn->interval;
+
+		while(sn->running && pthread_cond_timedwait(&sn->cv, &sn->mtx, &deadline) == 0)
+			;
+
+		if(!sn->running)
+			break;
+
+		pthread_mutex_unlock(&sn->mtx);
+
+		if(journal_position(sn->jr) != sn->lsn) {
+			int res = snapshot_checkpoint(sn, sn->jr);
+			if(res != SNAPSHOT_OK) {
+				char buf[256];
+				snapshot_strerror(res, buf, 256);
+				fprintf(stderr, "%s\n", buf);
+			}
+		}
+
+		pthread_mutex_lock(&sn->mtx);
+	}
+
+	pthread_mutex_unlock(&sn->mtx);
+	return NULL;
+}
+
+/* exposed */
+int snapshot_open(snapshot* sn, const char* path, show_table* st) {
+	memset(sn, 0, sizeof(snapshot));
+	__snapshot_error_show = 0;
+
+	if(path == NULL || st == NULL)
+		return SNAPSHOT_OPEN_INVAL;
+
+	sn->st = st;
+	if((sn->path = strdup(path)) == NULL)
+		return SNAPSHOT_OPEN_MALLOC_FAILURE;
+
+	pthread_mutex_init(&sn->ckpt_mtx, NULL);
+	pthread_mutex_init(&sn->mtx, NULL);
+	pthread_cond_init(&sn->cv, NULL);
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return errno == ENOENT ? SNAPSHOT_OK : SNAPSHOT_OPEN_FAILURE;
+
+	struct stat fs;
+	if(fstat(fd, &fs) < 0) {
+		close(fd);
+		return SNAPSHOT_OPEN_FAILURE;
+	}
+
+	unsigned long size = (unsigned long) fs.st_size;
+	if(size < sizeof(__snapshot_header)) {
+		close(fd);
+		return SNAPSHOT_OPEN_FORMAT;
+	}
+
+	//private: the halls write here, the file only changes through checkpoints
+	char* map = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return SNAPSHOT_OPEN_FAILURE;
+
+	__snapshot_header hdr;
+	memcpy(&hdr, map, sizeof(hdr));
+
+	if(memcmp(hdr.magic, SNAPSHOT_MAGIC, 4) != 0 || hdr.version != SNAPSHOT_VERSION ||
+			hdr.seat_size != sizeof(seat) ||
+			hdr.n_shows > (size - sizeof(hdr)) / sizeof(__snapshot_show)) {
+		munmap(map, size);
+		return SNAPSHOT_OPEN_FORMAT;
+	}
+
+	__snapshot_show* descs = __snapshot_shows(map);
+
+	//everything is checked before the first hall is touched
+	for(unsigned i = 0; i < hdr.n_shows; ++i) {
+		show* s = shows_find(st, descs[i].id);
+
+		if(s == NULL || s->rows != descs[i].rows || s->pols != descs[i].pols ||
+				s->engine.sm.words_per_row != descs[i].words_per_row) {
+			__snapshot_error_show = descs[i].id;
+			munmap(map, size);
+			return SNAPSHOT_OPEN_MISMATCH;
+		}
+
+		if(descs[i].seats_off % SNAPSHOT_PAGE || descs[i].bits_off % SNAPSHOT_PAGE ||
+				descs[i].seats_off > size || size - descs[i].seats_off < seatmap_seats_size(&s->engine.sm) ||
+				descs[i].bits_off > size || size - descs[i].bits_off < seatmap_bits_size(&s->engine.sm)) {
+			munmap(map, size);
+			return SNAPSHOT_OPEN_FORMAT;
+		}
+	}
+
+	//pages are read ahead in the background, the first requests do not wait for all of them
+	madvise(map, size, MADV_WILLNEED);
+
+	for(unsigned i = 0; i < hdr.n_shows; ++i) {
+		show* s = shows_find(st, descs[i].id);
+
+		booking_adopt(&s->engine, (seat*) (map + descs[i].seats_off),
+				(unsigned long long*) (map + descs[i].bits_off));
+		bookidx_set_key(&s->engine.bi, descs[i].key);
+		bookidx_set_counter(&s->engine.bi, descs[i].counter);
+		s->key_journaled = 1;
+	}
+
+	sn->map = map;
+	sn->map_size = size;
+	sn->lsn = hdr.lsn;
+	sn->n_mapped = hdr.n_shows;
+	return SNAPSHOT_OK;
+}
+
+int snapshot_checkpoint(snapshot* sn, journal* jr) {
+	pthread_mutex_lock(&sn->ckpt_mtx);
+
+	//every change before lsn is already in the halls
+	unsigned long lsn = journal_position(jr);
+
+	unsigned long path_len = strlen(sn->path);
+	char* tmp = (char*) malloc(path_len + sizeof(".tmp"));
+	if(tmp == NULL) {
+		pthread_mutex_unlock(&sn->ckpt_mtx);
+		return SNAPSHOT_CHECKPOINT_FAILURE;
+	}
+
+	memcpy(tmp, sn->path, path_len);
+	memcpy(tmp + path_len, ".tmp", sizeof(".tmp"));
+
+	if(__snapshot_write(sn, lsn, tmp)) {
+		int err = errno;
+		unlink(tmp);
+		free(tmp);
+		pthread_mutex_unlock(&sn->ckpt_mtx);
+		errno = err;
+		return SNAPSHOT_CHECKPOINT_FAILURE;
+	}
+
+	//changes copied after lsn must not outlive their records
+	journal_sync(jr);
+
+	if(rename(tmp, sn->path) < 0) {
+		int err = errno;
+		unlink(tmp);
+		free(tmp);
+		pthread_mutex_unlock(&sn->ckpt_mtx);
+		errno = err;
+		return SNAPSHOT_CHECKPOINT_FAILURE;
+	}
+
+	__snapshot_sync_dir(sn->path);
+	free(tmp);
+
+	sn->lsn = lsn;
+	++sn->checkpoints;
+
+	int res = journal_truncate(jr, lsn) == JOURNAL_OK ? SNAPSHOT_OK : SNAPSHOT_CHECKPOINT_TRUNCATE_FAILURE;
+
+	pthread_mutex_unlock(&sn->ckpt_mtx);
+	return res;
+}
+
+int snapshot_start(snapshot* sn, journal* jr, unsigned interval) {
+	sn->jr = jr;
+	sn->interval = interval;
+
+	if(interval == 0)
+		return SNAPSHOT_OK;
+
+	sn->running = 1;
+	int err = pthread_create(&sn->thr, NULL, __snapshot_routine, sn);
+	if(err != 0) {
+		sn->running = 0;
+		errno = err;
+		return SNAPSHOT_START_THREAD_FAILURE;
+	}
+
+	return SNAPSHOT_OK;
+}
+
+void snapshot_stop(snapshot* sn) {
+	pthread_mutex_lock(&sn->mtx);
+	int was_running = sn->running;
+	sn->running = 0;
+	pthread_cond_signal(&sn->cv);
+	pthread_mutex_unlock(&sn->mtx);
+
+	if(was_running)
+		pthread_join(sn->thr, NULL);
+}
+
+void snapshot_close(snapshot* sn) {
+	if(sn->map) {
+		munmap(sn->map, sn->map_size);
+		sn->map = NULL;
+	}
+
+	malloc_free(sn->path);
+}
+
+void snapshot_strerror(int error, char* dst, int dst_max_size) {
+	int current_errno = errno;
+	memset(dst, 0, dst_max_size);
+	switch(error) {
+		case SNAPSHOT_OPEN_INVAL:
+			memcpy(dst, "snapshot_open: Invalid argument", sizeof("snapshot_open: Invalid argument"));
+			break;
+		case SNAPSHOT_OPEN_FAILURE:
+			snprintf(dst, dst_max_size, "snapshot_open: %s", strerror(current_errno));
+			break;
+		case SNAPSHOT_OPEN_FORMAT:
+			memcpy(dst, "snapshot_open: not a snapshot file", sizeof("snapshot_open: not a snapshot file"));
+			break;
+		case SNAPSHOT_OPEN_MISMATCH:
+			snprintf(dst, dst_max_size, "snapshot_open: show %u is not defined or has a different hall",
+					__snapshot_error_show);
+			break;
+		case SNAPSHOT_OPEN_MALLOC_FAILURE:
+			snprintf(dst, dst_max_size, "snapshot_open:malloc: %s", strerror(current_errno));
+			break;
+		case SNAPSHOT_CHECKPOINT_FAILURE:
+			snprintf(dst, dst_max_size, "snapshot_checkpoint: %s", strerror(current_errno));
+			break;
+		case SNAPSHOT_CHECKPOINT_TRUNCATE_FAILURE:
+			snprintf(dst, dst_max_size, "snapshot_checkpoint:journal_truncate: %s", strerror(current_errno));
+			break;
+		case SNAPSHOT_START_THREAD_FAILURE:
+			snprintf(dst, dst_max_size, "snapshot_start:pthread_create: %s", strerror(current_errno));
+			break;
+
+		default:
+			snprintf(dst, dst_max_size, "snapshot: Success");
+	}
+}
@@ -0,0 +1,113 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <pthread.h>
+
+#include "shows.h"
+#include "journal.h"
+
+#define SNAPSHOT_OK 0
+
+#define SNAPSHOT_OPEN_INVAL 4
+#define SNAPSHOT_OPEN_FAILURE 5
+#define SNAPSHOT_OPEN_FORMAT 6
+#define SNAPSHOT_OPEN_MISMATCH 7
+#define SNAPSHOT_OPEN_MALLOC_FAILURE 8
+
+#define SNAPSHOT_CHECKPOINT_FAILURE 12
+#define SNAPSHOT_CHECKPOINT_TRUNCATE_FAILURE 13
+
+#define SNAPSHOT_START_THREAD_FAILURE 16
+
+/*
+ * stato dei posti di tutte le sale su file: un'intestazione (versione,
+ * LSN del giornale fino a cui lo snapshot è completo, geometria, chiave
+ * e contatore dei codici di ogni spettacolo) seguita da posti e bitmap
+ * di ogni sala, allineati alla pagina, nello stesso formato della memoria.
+ * All'avvio il file è mappato (MAP_PRIVATE) e usato direttamente come
+ * memoria delle sale: nessuna lettura o ricostruzione, le pagine sono
+ * caricate quando servono e le modifiche non tornano sul file.
+ * Un checkpoint scrive un nuovo file e lo sostituisce con rename.
+ */
+typedef struct {
+	char* path;
+	char* map; //snapshot caricato all'avvio, NULL se non c'era
+	unsigned long map_size;
+	unsigned long lsn; //ultimo checkpoint
+	unsigned long checkpoints;
+	unsigned n_mapped; //spettacoli presi dallo snapshot
+	show_table* st;
+	journal* jr;
+	unsigned interval; //secondi tra due checkpoint
+	int running;
+	pthread_mutex_t ckpt_mtx; //un checkpoint alla volta
+	pthread_mutex_t mtx; //stato del thread
+	pthread_cond_t cv;
+	pthread_t thr;
+} snapshot;
+
+/*
+ * snapshot_open
+ *
+ * DESCRIZIONE:
+ *		se path esiste le sale di st usano i posti dello snapshot, che
+ *		riprendono anche la chiave e il contatore dei codici; in sn->lsn
+ *		il punto del giornale da cui riprendere il replay (0 se path non
+ *		esiste). Gli spettacoli assenti dallo snapshot restano vuoti.
+ *
+ * NOTA BENE:
+ *		prima del replay del giornale e di servire richieste
+ *
+ * RITORNA:
+ *		* SNAPSHOT_OK se tutto è andato a buon fine
+ *		* uno degli errori della classe SNAPSHOT_OPEN_* altrimenti,
+ *		  nessuna sala è stata modificata
+ */
+int snapshot_open(snapshot* sn, const char* path, show_table* st);
+
+/*
+ * snapshot_checkpoint
+ *
+ * DESCRIZIONE:
+ *		scrive lo stato attuale delle sale (una riga alla volta, senza
+ *		fermare le prenotazioni), attende che il giornale sia durevole,
+ *		sostituisce lo snapshot e tronca il giornale. Le modifiche
+ *		arrivate durante la copia sono nel giornale dopo sn->lsn: il loro
+ *		replay le riapplica anche se la copia le contiene già.
+ *		Thread safe
+ *
+ * RITORNA:
+ *		* SNAPSHOT_OK se tutto è andato a buon fine
+ *		* SNAPSHOT_CHECKPOINT_FAILURE se lo snapshot non è stato scritto
+ *		* SNAPSHOT_CHECKPOINT_TRUNCATE_FAILURE se lo snapshot è valido ma
+ *		  il giornale non è stato troncato (lo sarà al prossimo)
+ */
+int snapshot_checkpoint(snapshot* sn, journal* jr);
+
+/*
+ * snapshot_start
+ *		avvia un thread che esegue un checkpoint ogni interval secondi,
+ *		se il giornale è avanzato. interval == 0: nessun thread
+ *
+ * RITORNA:
+ *		* SNAPSHOT_OK se tutto è andato a buon fine
+ *		* SNAPSHOT_START_THREAD_FAILURE altrimenti
+ */
+int snapshot_start(snapshot* sn, journal* jr, unsigned interval);
+
+/*
+ * snapshot_stop
+ *		termina il thread dei checkpoint, attende quello in corso
+ */
+void snapshot_stop(snapshot* sn);
+
+/*
+ * snapshot_close
+ *		rilascia lo snapshot caricato, dopo shows_finish: è la memoria
+ *		delle sale
+ */
+void snapshot_close(snapshot* sn);
+
+void snapshot_strerror(int error, char* dst, int dst_size);
+
+#endif
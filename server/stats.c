@@ -0,0 +1,342 @@
+/* stats.c - per-thread request counters and latency histograms
+	ITA: ogni thread che registra una richiesta riceve un blocco di
+		contatori tutto suo, aggiunto in testa (CAS) a una lista da cui
+		non si toglie mai: i totali dei thread terminati restano nel
+		report. Il proprietario aggiorna i contatori con load/store
+		relaxed (nessun lock, nessuna istruzione atomica con lock), chi
+		legge il report li somma con load relaxed: un report non è una
+		fotografia esatta, ma ogni contatore è coerente.
+
+		Istogramma log-lineare (come HdrHistogram): un valore v < 16 ha
+		un intervallo tutto suo, altrimenti l'intervallo è dato dalla
+		posizione del bit più alto e dai 4 bit successivi, errore
+		relativo massimo 1/16. I percentili sono il centro dell'intervallo.
+		L'istogramma di una op è allocato alla prima richiesta del
+		thread per quella op: con il pool di thread i worker sono molti
+		e ognuno vede poche op.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "logger.h"
+#include "stats.h"
+
+#define STATS_SUB_BITS 4
+#define STATS_SUB (1UL << STATS_SUB_BITS)
+#define STATS_MAX_BITS 34 //2^34 ns ~ 17s, beyond is counted as 17s
+#define STATS_BUCKETS ((STATS_MAX_BITS - STATS_SUB_BITS + 1) * STATS_SUB)
+
+typedef struct __stats_block_s {
+	unsigned long results[STATS_MAX_OPS][STATS_NRESULTS];
+	unsigned long* hist[STATS_MAX_OPS]; //STATS_BUCKETS elements, NULL until used
+	unsigned long sum_ns[STATS_MAX_OPS];
+	unsigned long max_ns[STATS_MAX_OPS];
+	unsigned long lock_waits;
+	unsigned long lock_wait_ns;
+	struct __stats_block_s* next;
+} __stats_block;
+
+//owner only: no lock prefix, readers still see whole values
+#define __stats_add(p, n) (__atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED))
+#define __stats_load(p) (__atomic_load_n(p, __ATOMIC_RELAXED))
+
+/* NOT exposed */
+static const char* const __stats_result_names[STATS_NRESULTS] = {
+	"ok", "invalid", "exceed", "toomuch", "wholeempty", "notavail", "nounique", "noshow", "noteven", "nan"
+};
+
+static __stats_block* __stats_blocks = NULL;
+static __thread __stats_block* __stats_local = NULL;
+static const char* const* __stats_op_names;
+static unsigned __stats_n_ops;
+static stats_gauges_fpt __stats_gauges;
+static unsigned long __stats_started;
+
+static unsigned __stats_interval;
+static int __stats_running = 0;
+static pthread_mutex_t __stats_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t __stats_cv = PTHREAD_COND_INITIALIZER;
+static pthread_t __stats_thread;
+
+static unsigned __stats_bucket(unsigned long v) {
+	if(v >= (1UL << STATS_MAX_BITS))
+		v = (1UL << STATS_MAX_BITS) - 1;
+
+	if(v < STATS_SUB)
+		return (unsigned) v;
+
+	unsigned shift = (63 - __builtin_clzl(v)) - STATS_SUB_BITS;
+	return (shift + 1) * STATS_SUB + ((v >> shift) & (STATS_SUB - 1));
+}
+
+/* middle of the bucket, in ns */
+static double __stats_bucket_value(unsigned b) {
+	if(b < STATS_SUB)
+		return b;
+
+	unsigned shift = b / STATS_SUB - 1;
+	unsigned long low = (STATS_SUB + b % STATS_SUB) << shift;
+	return low + ((1UL << shift) - 1) / 2.0;
+}
+
+static __stats_block* __stats_get_local() {
+	if(__stats_local)
+		return __stats_local;
+
+	__stats_block* b = (__stats_block*) calloc(1, sizeof(__stats_block));
+	if(b == NULL)
+		return NULL;
+
+	b->next = __atomic_load_n(&__stats_blocks, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&__stats_blocks, &b->next, b, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	__stats_local = b;
+	return b;
+}
+
+/* ns at quantile q of hist (total values), never above the largest value seen */
+static double __stats_quantile(const unsigned long* hist, unsigned long total, double q, unsigned long max) {
+	unsigned long rank = (unsigned long) (q * total);
+	if(rank >= total)
+		rank = total - 1;
+
+	unsigned long seen = 0;
+	unsigned b;
+	for(b = 0; b < STATS_BUCKETS; ++b) {
+		seen += hist[b];
+		if(seen > rank)
+			break;
+	}
+
+	double v = __stats_bucket_value(b < STATS_BUCKETS ? b : STATS_BUCKETS - 1);
+	return v < max ? v : max;
+}
+
+#define __stats_append(dst, cap, len, ...) \
+{ \
+	if(len < cap) { \
+		int __n = snprintf(dst + len, cap - len, __VA_ARGS__); \
+		len = __n < 0 ? len : (len + __n < cap ? len + __n : cap - 1); \
+	} \
+}
+
+static void* __stats_routine(void* arg) {
+	(void) arg;
+	char report[STATS_REPORT_MAX];
+
+	pthread_mutex_lock(&__stats_mtx);
+
+	while(__stats_running) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += __stats_interval;
+
+		while(__stats_running && pthread_cond_timedwait(&__stats_cv, &__stats_mtx, &deadline) == 0)
+			;
+
+		if(!__stats_running)
+			break;
+
+		pthread_mutex_unlock(&__stats_mtx);
+
+		//one message per line: the whole report is longer than a log message
+		char* save = NULL;
+		stats_report(report, STATS_REPORT_MAX);
+		for(char* line = strtok_r(report, "\n", &save); line; line = strtok_r(NULL, "\n", &save))
+			logger_log(LOGGER_INFO, line);
+
+		pthread_mutex_lock(&__stats_mtx);
+	}
+
+	pthread_mutex_unlock(&__stats_mtx);
+	return NULL;
+}
+
+/* exposed */
+int stats_init(const char* const* op_names, unsigned n_ops, stats_gauges_fpt gauges) {
+	if(n_ops == 0 || n_ops > STATS_MAX_OPS || op_names == NULL)
+		return STATS_INIT_INVAL;
+
+	__stats_op_names = op_names;
+	__stats_n_ops = n_ops;
+	__stats_gauges = gauges;
+	__stats_started = stats_now();
+
+	return STATS_OK;
+}
+
+unsigned long stats_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void stats_record(unsigned op, unsigned result, unsigned long ns) {
+	__stats_block* b = __stats_get_local();
+	if(b == NULL || op >= STATS_MAX_OPS || result >= STATS_NRESULTS)
+		return;
+
+	unsigned long* hist = b->hist[op];
+	if(hist == NULL) {
+		if((hist = (unsigned long*) calloc(STATS_BUCKETS, sizeof(unsigned long))) == NULL)
+			return;
+
+		__atomic_store_n(&b->hist[op], hist, __ATOMIC_RELEASE);
+	}
+
+	__stats_add(&b->results[op][result], 1);
+	__stats_add(&hist[__stats_bucket(ns)], 1);
+	__stats_add(&b->sum_ns[op], ns);
+
+	if(ns > b->max_ns[op])
+		__atomic_store_n(&b->max_ns[op], ns, __ATOMIC_RELAXED);
+}
+
+void stats_lock_waits(unsigned long waits, unsigned long wait_ns) {
+	__stats_block* b = __stats_get_local();
+	if(b == NULL)
+		return;
+
+	__atomic_store_n(&b->lock_waits, waits, __ATOMIC_RELAXED);
+	__atomic_store_n(&b->lock_wait_ns, wait_ns, __ATOMIC_RELAXED);
+}
+
+void stats_collect(int op, stats_summary* out) {
+	unsigned long hist[STATS_BUCKETS] = { 0 };
+	unsigned long sum_ns = 0, max_ns = 0, hist_total = 0;
+	unsigned first_op = op < 0 ? 0 : (unsigned) op;
+	unsigned last_op = op < 0 ? __stats_n_ops : (unsigned) op + 1;
+
+	memset(out, 0, sizeof(stats_summary));
+
+	for(__stats_block* b = __atomic_load_n(&__stats_blocks, __ATOMIC_ACQUIRE); b; b = b->next) {
+		for(unsigned o = first_op; o < last_op && o < STATS_MAX_OPS; ++o) {
+			for(unsigned r = 0; r < STATS_NRESULTS; ++r)
+				out->results[r] += __stats_load(&b->results[o][r]);
+
+			sum_ns += __stats_load(&b->sum_ns[o]);
+			unsigned long m = __stats_load(&b->max_ns[o]);
+			max_ns = m > max_ns ? m : max_ns;
+
+			//read later than the results, the histogram may count a few more requests
+			const unsigned long* block_hist = __atomic_load_n(&b->hist[o], __ATOMIC_ACQUIRE);
+			if(block_hist == NULL)
+				continue;
+
+			for(unsigned i = 0; i < STATS_BUCKETS; ++i) {
+				unsigned long c = __stats_load(&block_hist[i]);
+				hist[i] += c;
+				hist_total += c;
+			}
+		}
+	}
+
+	for(unsigned r = 0; r < STATS_NRESULTS; ++r)
+		out->requests += out->results[r];
+
+	if(out->requests == 0 || hist_total == 0)
+		return;
+
+	out->mean_us = sum_ns / 1e3 / out->requests;
+	out->p50_us = __stats_quantile(hist, hist_total, 0.5, max_ns) / 1e3;
+	out->p99_us = __stats_quantile(hist, hist_total, 0.99, max_ns) / 1e3;
+	out->p999_us = __stats_quantile(hist, hist_total, 0.999, max_ns) / 1e3;
+	out->max_us = max_ns / 1e3;
+}
+
+const char* stats_result_name(unsigned result) {
+	return result < STATS_NRESULTS ? __stats_result_names[result] : "unknown";
+}
+
+unsigned stats_report(char* dst, unsigned cap) {
+	stats_summary all;
+	unsigned long lock_waits = 0, lock_wait_ns = 0;
+
+	for(__stats_block* b = __atomic_load_n(&__stats_blocks, __ATOMIC_ACQUIRE); b; b = b->next) {
+		lock_waits += __stats_load(&b->lock_waits);
+		lock_wait_ns += __stats_load(&b->lock_wait_ns);
+	}
+
+	unsigned len = 0;
+	if(cap == 0)
+		return 0;
+	dst[0] = 0;
+
+	stats_collect(STATS_ALL_OPS, &all);
+	__stats_append(dst, cap, len, "uptime_s=%lu requests=%lu lock_waits=%lu lock_wait_us=%.1f",
+			(stats_now() - __stats_started) / 1000000000UL, all.requests, lock_waits, lock_wait_ns / 1e3);
+
+	if(__stats_gauges && len + 1 < cap) {
+		dst[len++] = ' ';
+		len += __stats_gauges(dst + len, cap - len);
+	}
+
+	for(unsigned op = 0; op < __stats_n_ops; ++op) {
+		stats_summary sm;
+		stats_collect(op, &sm);
+
+		__stats_append(dst, cap, len, "\n%s requests=%lu", __stats_op_names[op], sm.requests);
+		if(sm.requests == 0)
+			continue;
+
+		for(unsigned r = 0; r < STATS_NRESULTS; ++r) {
+			if(sm.results[r])
+				__stats_append(dst, cap, len, " %s=%lu", __stats_result_names[r], sm.results[r]);
+		}
+
+		__stats_append(dst, cap, len, " mean_us=%.2f p50_us=%.2f p99_us=%.2f p999_us=%.2f max_us=%.2f",
+				sm.mean_us, sm.p50_us, sm.p99_us, sm.p999_us, sm.max_us);
+	}
+
+	return len;
+}
+
+int stats_start(unsigned interval) {
+	__stats_interval = interval;
+
+	if(interval == 0)
+		return STATS_OK;
+
+	__stats_running = 1;
+	int err = pthread_create(&__stats_thread, NULL, __stats_routine, NULL);
+	if(err != 0) {
+		__stats_running = 0;
+		errno = err;
+		return STATS_START_THREAD_FAILURE;
+	}
+
+	return STATS_OK;
+}
+
+void stats_stop() {
+	pthread_mutex_lock(&__stats_mtx);
+	int was_running = __stats_running;
+	__stats_running = 0;
+	pthread_cond_signal(&__stats_cv);
+	pthread_mutex_unlock(&__stats_mtx);
+
+	if(was_running)
+		pthread_join(__stats_thread, NULL);
+}
+
+void stats_strerror(int error, char* dst, int dst_max_size) {
+	int current_errno = errno;
+	memset(dst, 0, dst_max_size);
+	switch(error) {
+		case STATS_INIT_INVAL:
+			memcpy(dst, "stats_init: Invalid argument", sizeof("stats_init: Invalid argument"));
+			break;
+		case STATS_START_THREAD_FAILURE:
+			snprintf(dst, dst_max_size, "stats_start:pthread_create: %s", strerror(current_errno));
+			break;
+
+		default:
+			snprintf(dst, dst_max_size, "stats: Success");
+	}
+}
@@ -0,0 +1,133 @@
+#ifndef STATS_H
+#define STATS_H
+
+#define STATS_OK 0
+
+#define STATS_INIT_INVAL 4
+
+#define STATS_START_THREAD_FAILURE 8
+
+#define STATS_MAX_OPS 16
+#define STATS_REPORT_MAX 4096
+
+//esito di una richiesta, 0-7 coincidono con PROTO2_STATUS_*
+#define STATS_RESULT_OK 0
+#define STATS_RESULT_INVALID 1 //Op:invalid
+#define STATS_RESULT_EXCEED 2 //Fail:exceed
+#define STATS_RESULT_TOOMUCH 3 //Fail:toomuch
+#define STATS_RESULT_EMPTY 4 //Fail:wholeempty
+#define STATS_RESULT_NOTAVAIL 5 //Fail:notavail
+#define STATS_RESULT_NOUNIQUE 6 //Fail:nounique
+#define STATS_RESULT_NOSHOW 7 //Fail:noshow
+#define STATS_RESULT_NOTEVEN 8 //Fail:noteven
+#define STATS_RESULT_NAN 9 //Fail:nan
+#define STATS_NRESULTS 10
+
+#define STATS_ALL_OPS -1
+
+/*
+ * riepilogo di una op (o di tutte), vedi stats_collect
+ */
+typedef struct {
+	unsigned long requests;
+	unsigned long results[STATS_NRESULTS];
+	double mean_us;
+	double p50_us;
+	double p99_us;
+	double p999_us;
+	double max_us;
+} stats_summary;
+
+/*
+ * stats_gauges_fpt
+ *		scrive in dst (al più cap bytes, terminatore incluso) valori
+ *		istantanei del chiamante da aggiungere al report, ritorna la
+ *		lunghezza scritta
+ */
+typedef unsigned (*stats_gauges_fpt)(char* dst, unsigned cap);
+
+/*
+ * stats_init
+ *
+ * DESCRIZIONE:
+ *		contatori per op (0 .. n_ops - 1, op_names[op] nel report) ed
+ *		esito, istogrammi delle latenze con precisione relativa costante
+ *		(16 sottointervalli per potenza di 2, da 1ns a 17s). Ogni thread
+ *		scrive solo nel proprio blocco, allocato alla prima richiesta che
+ *		registra: nessun lock e nessuna istruzione atomica con lock.
+ *		Il report somma i blocchi di tutti i thread
+ *
+ * NOTA BENE:
+ *		prima di qualsiasi stats_record, op_names deve restare valido
+ *
+ * RITORNA:
+ *		* STATS_OK se tutto è andato a buon fine
+ *		* STATS_INIT_INVAL se n_ops è 0 o maggiore di STATS_MAX_OPS
+ */
+int stats_init(const char* const* op_names, unsigned n_ops, stats_gauges_fpt gauges);
+
+/*
+ * stats_now
+ *		orologio monotono in nanosecondi, per misurare le latenze
+ */
+unsigned long stats_now();
+
+/*
+ * stats_record
+ *		una richiesta op terminata con result in ns nanosecondi
+ */
+void stats_record(unsigned op, unsigned result, unsigned long ns);
+
+/*
+ * stats_lock_waits
+ *		totali del thread chiamante delle attese sui lock
+ *		(vedi booking_lock_waits)
+ */
+void stats_lock_waits(unsigned long waits, unsigned long wait_ns);
+
+/*
+ * stats_collect
+ *		somma i blocchi di tutti i thread per op (STATS_ALL_OPS: tutte
+ *		le op insieme) in *out, latenze a 0 senza richieste. Thread safe
+ */
+void stats_collect(int op, stats_summary* out);
+
+/*
+ * stats_result_name
+ *		nome dell'esito result nel report ("ok", "notavail", ...)
+ */
+const char* stats_result_name(unsigned result);
+
+/*
+ * stats_report
+ *		scrive in dst (al più cap bytes, terminatore incluso) una riga
+ *		generale e una riga per op:
+ *
+ *			uptime_s=.. requests=.. lock_waits=.. lock_wait_us=.. <gauges>
+ *			<op> requests=.. <esito>=.. ... mean_us=.. p50_us=.. p99_us=.. p999_us=.. max_us=..
+ *
+ *		solo gli esiti con almeno una richiesta. Ritorna la lunghezza
+ *		scritta. Thread safe, i contatori sono letti senza fermare nessuno
+ */
+unsigned stats_report(char* dst, unsigned cap);
+
+/*
+ * stats_start
+ *		avvia un thread che scrive il report con il logger ogni interval
+ *		secondi. interval == 0: nessun thread
+ *
+ * RITORNA:
+ *		* STATS_OK se tutto è andato a buon fine
+ *		* STATS_START_THREAD_FAILURE altrimenti
+ */
+int stats_start(unsigned interval);
+
+/*
+ * stats_stop
+ *		termina il thread del report periodico
+ */
+void stats_stop();
+
+void stats_strerror(int error, char* dst, int dst_size);
+
+#endif
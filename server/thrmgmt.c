@@ -7,6 +7,10 @@
 	In caso di risorse esaurite, la chiamata di richiesta di dispatch
 	blocca il thread chiamante, finchè almeno una delle risorse non
 	viene rilasciata.
+
+	ITA: thrmgmt_pool_* invece mantiene un insieme di worker persistenti
+		alimentati da una coda MPMC limitata (Vyukov), il dispatch costa
+		un enqueue e una sem_post, nessuna creazione di thread.
 */
 
 #define _GNU_SOURCE //pthread_tryjoin_np
@@ -17,10 +21,13 @@
 #include <string.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <sched.h>
 
 #include "malloc_utils.h"
 #include "thrmgmt.h"
 
+#define CACHELINE 64
+
 typedef struct {
 	work_routine_fpt perform_work;
 	void* user_args;
@@ -42,6 +49,99 @@ static void* __thrmgmt_internal_routine(void* _args) {
 }
 
 
+/* pool - NOT exposed */
+typedef struct {
+	unsigned long seq;
+	void* data;
+} __thrmgmt_cell;
+
+static __thrmgmt_cell* pool_queue;
+static unsigned long pool_mask;
+static unsigned long pool_enqueue_pos __attribute__((aligned(CACHELINE)));
+static unsigned long pool_dequeue_pos __attribute__((aligned(CACHELINE)));
+
+static pthread_t* pool_worker;
+static unsigned pool_n_workers;
+static sem_t sem_pool_items;
+static work_routine_fpt pool_routine;
+static volatile int pool_stopping;
+static unsigned pool_busy; //workers inside routine
+
+static int __thrmgmt_pool_enqueue(void* data) {
+	__thrmgmt_cell* cell;
+	unsigned long pos = __atomic_load_n(&pool_enqueue_pos, __ATOMIC_RELAXED);
+
+	for(;;) {
+		cell = &pool_queue[pos & pool_mask];
+		unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		long diff = (long) seq - (long) pos;
+
+		if(diff == 0) {
+			if(__atomic_compare_exchange_n(&pool_enqueue_pos, &pos, pos + 1, 1,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if(diff < 0)
+			return 0; //full
+		else
+			pos = __atomic_load_n(&pool_enqueue_pos, __ATOMIC_RELAXED);
+	}
+
+	cell->data = data;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static int __thrmgmt_pool_dequeue(void** data) {
+	__thrmgmt_cell* cell;
+	unsigned long pos = __atomic_load_n(&pool_dequeue_pos, __ATOMIC_RELAXED);
+
+	for(;;) {
+		cell = &pool_queue[pos & pool_mask];
+		unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		long diff = (long) seq - (long) (pos + 1);
+
+		if(diff == 0) {
+			if(__atomic_compare_exchange_n(&pool_dequeue_pos, &pos, pos + 1, 1,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if(diff < 0)
+			return 0; //empty
+		else
+			pos = __atomic_load_n(&pool_dequeue_pos, __ATOMIC_RELAXED);
+	}
+
+	*data = cell->data;
+	__atomic_store_n(&cell->seq, pos + pool_mask + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static void* __thrmgmt_pool_routine(void* __unused_1__) {
+	((void)__unused_1__);
+
+	for(;;) {
+		if(sem_wait(&sem_pool_items) < 0)
+			continue; //EINTR
+
+		/* a token stands for an item already published, but the head of
+		 * the queue may be a cell claimed by another producer and not yet
+		 * written: wait for it, dropping the token would strand an item.
+		 * Only a stop token finds nothing claimed at all
+		 */
+		void* data;
+		while(!__thrmgmt_pool_dequeue(&data)) {
+			if(pool_stopping && __atomic_load_n(&pool_dequeue_pos, __ATOMIC_ACQUIRE) ==
+					__atomic_load_n(&pool_enqueue_pos, __ATOMIC_ACQUIRE))
+				return NULL;
+
+			sched_yield();
+		}
+
+		__atomic_add_fetch(&pool_busy, 1, __ATOMIC_RELAXED);
+		pool_routine(data);
+		__atomic_sub_fetch(&pool_busy, 1, __ATOMIC_RELAXED);
+	}
+}
+
 /* exposed */
 int thrmgmt_init(unsigned max_running_threads) {
 	if(max_running_threads == 0)
@@ -115,6 +215,83 @@ void thrmgmt_finish() {
 	sem_destroy(&sem_running_threads);
 }
 
+int thrmgmt_pool_init(unsigned n_workers, unsigned queue_capacity, work_routine_fpt routine) {
+	if(n_workers == 0 || queue_capacity == 0 || routine == NULL)
+		return THRMGMT_POOL_INIT_INVAL;
+
+	unsigned long capacity = 1;
+	while(capacity < queue_capacity)
+		capacity <<= 1;
+
+	if((pool_queue = (__thrmgmt_cell*) calloc(capacity, sizeof(__thrmgmt_cell))) == NULL)
+		return THRMGMT_POOL_INIT_MALLOC_FAILURE;
+
+	for(unsigned long i = 0; i < capacity; ++i)
+		pool_queue[i].seq = i;
+
+	pool_mask = capacity - 1;
+	pool_enqueue_pos = 0;
+	pool_dequeue_pos = 0;
+	pool_routine = routine;
+	pool_stopping = 0;
+	pool_busy = 0;
+
+	if((pool_worker = (pthread_t*) calloc(n_workers, sizeof(pthread_t))) == NULL) {
+		malloc_free(pool_queue);
+		return THRMGMT_POOL_INIT_MALLOC_FAILURE;
+	}
+
+	if(sem_init(&sem_pool_items, 0, 0) < 0) {
+		malloc_free(pool_queue);
+		malloc_free(pool_worker);
+		return THRMGMT_POOL_INIT_SEMINIT_FAILURE;
+	}
+
+	for(pool_n_workers = 0; pool_n_workers < n_workers; ++pool_n_workers) {
+		if(pthread_create(&pool_worker[pool_n_workers], NULL, __thrmgmt_pool_routine, NULL) != 0) {
+			thrmgmt_pool_finish();
+			return THRMGMT_POOL_INIT_CREATE_FAILURE;
+		}
+	}
+
+	return THRMGMT_OK;
+}
+
+int thrmgmt_pool_submit(void* args) {
+	if(!__thrmgmt_pool_enqueue(args))
+		return THRMGMT_POOL_SUBMIT_FULL;
+
+	if(sem_post(&sem_pool_items) < 0)
+		return THRMGMT_POOL_SUBMIT_SEMPOST_FAILURE;
+
+	return THRMGMT_OK;
+}
+
+void thrmgmt_pool_status(unsigned* busy, unsigned* queued) {
+	int items = 0;
+	sem_getvalue(&sem_pool_items, &items);
+
+	*busy = __atomic_load_n(&pool_busy, __ATOMIC_RELAXED);
+	*queued = items > 0 ? (unsigned) items : 0;
+}
+
+//errors ignored
+void thrmgmt_pool_finish() {
+	pool_stopping = 1;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	for(unsigned i = 0; i < pool_n_workers; ++i)
+		sem_post(&sem_pool_items);
+
+	for(unsigned i = 0; i < pool_n_workers; ++i)
+		pthread_join(pool_worker[i], NULL);
+
+	pool_n_workers = 0;
+	malloc_free(pool_worker);
+	malloc_free(pool_queue);
+	sem_destroy(&sem_pool_items);
+}
+
 int thrmgmt_mutex_init(thrmgmt_system_mutex mtx) {
 	if(pthread_mutex_init((pthread_mutex_t*)mtx, NULL) < 0)
 		return THRMGMT_MUTEX_INIT_FAILURE;
@@ -197,6 +374,25 @@ void thrmgmt_strerror(int error, char* dst, int dst_max_size) {
 			snprintf(dst, dst_max_size, "thrmgmt_mutex_destroy:pthread_mutex_destroy: %s",strerror(current_errno));
 			break;
 
+		case THRMGMT_POOL_INIT_INVAL:
+			memcpy(dst, "thrmgmt_pool_init: Invalid argument", sizeof("thrmgmt_pool_init: Invalid argument"));
+			break;
+		case THRMGMT_POOL_INIT_MALLOC_FAILURE:
+			snprintf(dst, dst_max_size, "thrmgmt_pool_init:malloc: %s", strerror(current_errno));
+			break;
+		case THRMGMT_POOL_INIT_SEMINIT_FAILURE:
+			snprintf(dst, dst_max_size, "thrmgmt_pool_init:sem_init: %s", strerror(current_errno));
+			break;
+		case THRMGMT_POOL_INIT_CREATE_FAILURE:
+			snprintf(dst, dst_max_size, "thrmgmt_pool_init:pthread_create: %s", strerror(current_errno));
+			break;
+		case THRMGMT_POOL_SUBMIT_FULL:
+			memcpy(dst, "thrmgmt_pool_submit: queue full", sizeof("thrmgmt_pool_submit: queue full"));
+			break;
+		case THRMGMT_POOL_SUBMIT_SEMPOST_FAILURE:
+			snprintf(dst, dst_max_size, "thrmgmt_pool_submit:sem_post: %s", strerror(current_errno));
+			break;
+
 		default:
 			snprintf(dst, dst_max_size, "thrmgmt: Success");
 	}
@@ -22,6 +22,14 @@
 #define THRMGMT_MUTEX_UNLOCK_FAILURE 24
 #define THRMGMT_MUTEX_DESTROY_FAILURE 25
 
+#define THRMGMT_POOL_INIT_INVAL 26
+#define THRMGMT_POOL_INIT_MALLOC_FAILURE 27
+#define THRMGMT_POOL_INIT_SEMINIT_FAILURE 28
+#define THRMGMT_POOL_INIT_CREATE_FAILURE 29
+
+#define THRMGMT_POOL_SUBMIT_FULL 30
+#define THRMGMT_POOL_SUBMIT_SEMPOST_FAILURE 31
+
 typedef void(*work_routine_fpt)(void*);
 
 typedef void* thrmgmt_system_mutex;
@@ -98,6 +106,53 @@ int thrmgmt_mutex_unlock(thrmgmt_system_mutex mtx);
  */
 int thrmgmt_mutex_destroy(thrmgmt_system_mutex mtx);
 
+/*
+ * thrmgmt_pool_init
+ *
+ * DESCRIZIONE:
+ *		avvia n_workers thread persistenti che eseguono routine su ogni elemento
+ *		accodato con thrmgmt_pool_submit. La coda è una MPMC limitata, la sua
+ *		capacità viene arrotondata alla potenza di 2 successiva.
+ *		Indipendente da thrmgmt_init, le due API possono coesistere.
+ *
+ * NOTA BENE:
+ *		n_workers > 0, queue_capacity > 0
+ *
+ * RITORNA:
+ *		* THRMGMT_OK se tutto è andato a buon fine
+ *		* uno degli errori della classe THRMGMT_POOL_INIT_* altrimenti
+ */
+int thrmgmt_pool_init(unsigned n_workers, unsigned queue_capacity, work_routine_fpt routine);
+
+/*
+ * thrmgmt_pool_submit
+ *
+ * DESCRIZIONE:
+ *		accoda args, sarà consegnato al primo worker libero. Non blocca mai
+ *		il thread chiamante: se la coda è piena la chiamata fallisce subito.
+ *
+ * RITORNA:
+ *		* THRMGMT_OK se tutto è andato a buon fine
+ *		* THRMGMT_POOL_SUBMIT_FULL se la coda è piena, args non è stato accodato
+ *		* THRMGMT_POOL_SUBMIT_SEMPOST_FAILURE altrimenti
+ */
+int thrmgmt_pool_submit(void* args);
+
+/*
+ * thrmgmt_pool_status
+ *		worker occupati a eseguire routine ed elementi in coda, letti
+ *		senza sincronizzazione: una fotografia approssimata. Solo tra
+ *		thrmgmt_pool_init e thrmgmt_pool_finish
+ */
+void thrmgmt_pool_status(unsigned* busy, unsigned* queued);
+
+/*
+ * thrmgmt_pool_finish
+ *		i worker smaltiscono la coda e terminano, attende la loro terminazione
+ *		e libera le risorse, ogni errore è ignorato
+ */
+void thrmgmt_pool_finish();
+
 void thrmgmt_strerror(int error, char* dst, int dst_size);
 
 #endif
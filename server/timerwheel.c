@@ -0,0 +1,133 @@
+/* timerwheel.c - hierarchical timer wheel
+	ITA: un timer con scadenza a delta tick da ora va nel livello l
+		più basso con delta < 64^(l + 1), nella lista indicizzata dai
+		6 bit della scadenza di quel livello. Ogni tick svuota una lista
+		del livello 0; quando l'indice del livello 0 torna a 0 la lista
+		corrente del livello 1 è ridistribuita nei livelli inferiori (e
+		così via verso l'alto): inserimento e cancellazione sono O(1),
+		ogni timer è spostato al più TIMERWHEEL_LEVELS - 1 volte.
+
+		Le liste sono circolari con una sentinella per posizione: un
+		timer si toglie senza sapere in quale lista si trova.
+*/
+
+#include <stddef.h>
+#include <time.h>
+
+#include "timerwheel.h"
+
+#define __TIMERWHEEL_MASK (TIMERWHEEL_SLOTS - 1)
+#define __TIMERWHEEL_MAX_DELTA ((1ULL << (TIMERWHEEL_LEVELS * TIMERWHEEL_SLOT_BITS)) - 1)
+
+/* NOT exposed */
+static void __timerwheel_list_init(timerwheel_timer* head) {
+	head->prev = head->next = head;
+}
+
+static void __timerwheel_unlink(timerwheel_timer* t) {
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->prev = t->next = NULL;
+}
+
+static void __timerwheel_link(timerwheel_timer* head, timerwheel_timer* t) {
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+}
+
+static void __timerwheel_place(timerwheel* tw, timerwheel_timer* t) {
+	unsigned long long delta = t->expires - tw->now;
+
+	int level = 0;
+	while(level < TIMERWHEEL_LEVELS - 1 && delta >> ((level + 1) * TIMERWHEEL_SLOT_BITS))
+		++level;
+
+	unsigned slot = (unsigned) (t->expires >> (level * TIMERWHEEL_SLOT_BITS)) & __TIMERWHEEL_MASK;
+	__timerwheel_link(&tw->slots[level][slot], t);
+}
+
+/* moves the current list of level to the lower levels, returns its index */
+static unsigned __timerwheel_cascade(timerwheel* tw, int level) {
+	unsigned slot = (unsigned) (tw->now >> (level * TIMERWHEEL_SLOT_BITS)) & __TIMERWHEEL_MASK;
+	timerwheel_timer* head = &tw->slots[level][slot];
+
+	while(head->next != head) {
+		timerwheel_timer* t = head->next;
+		__timerwheel_unlink(t);
+		__timerwheel_place(tw, t);
+	}
+
+	return slot;
+}
+
+/* exposed */
+void timerwheel_init(timerwheel* tw, unsigned tick_ms, unsigned long long now_ms) {
+	for(int l = 0; l < TIMERWHEEL_LEVELS; ++l)
+		for(int s = 0; s < TIMERWHEEL_SLOTS; ++s)
+			__timerwheel_list_init(&tw->slots[l][s]);
+
+	tw->tick_ms = tick_ms;
+	tw->now = now_ms / tick_ms;
+}
+
+void timerwheel_timer_init(timerwheel_timer* t) {
+	t->prev = t->next = NULL;
+	t->expires = 0;
+}
+
+void timerwheel_schedule(timerwheel* tw, timerwheel_timer* t, unsigned long long deadline_ms) {
+	if(t->next)
+		__timerwheel_unlink(t);
+
+	//rounded up: never before deadline_ms
+	unsigned long long expires = (deadline_ms + tw->tick_ms - 1) / tw->tick_ms;
+	if(expires <= tw->now)
+		expires = tw->now + 1;
+	else if(expires - tw->now > __TIMERWHEEL_MAX_DELTA)
+		expires = tw->now + __TIMERWHEEL_MAX_DELTA;
+
+	t->expires = expires;
+	__timerwheel_place(tw, t);
+}
+
+void timerwheel_cancel(timerwheel_timer* t) {
+	if(t->next)
+		__timerwheel_unlink(t);
+}
+
+int timerwheel_pending(const timerwheel_timer* t) {
+	return t->next != NULL;
+}
+
+unsigned timerwheel_advance(timerwheel* tw, unsigned long long now_ms, timerwheel_expire_fpt expire, void* ctx) {
+	unsigned long long target = now_ms / tw->tick_ms;
+	unsigned n = 0;
+
+	while(tw->now < target) {
+		++tw->now;
+
+		//the levels below l wrapped: bring the current block of l down
+		for(int l = 1; l < TIMERWHEEL_LEVELS; ++l)
+			if((tw->now & ((1ULL << (l * TIMERWHEEL_SLOT_BITS)) - 1)) || __timerwheel_cascade(tw, l) != 0)
+				break;
+
+		//expire() may cancel or schedule other timers: one at a time from the head
+		timerwheel_timer* head = &tw->slots[0][tw->now & __TIMERWHEEL_MASK];
+		while(head->next != head) {
+			timerwheel_timer* t = head->next;
+			__timerwheel_unlink(t);
+			expire(t, ctx);
+			++n;
+		}
+	}
+
+	return n;
+}
+
+unsigned long long timerwheel_clock_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,81 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#define TIMERWHEEL_LEVELS 4
+#define TIMERWHEEL_SLOT_BITS 6
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_SLOT_BITS)
+
+/*
+ * un timer, da includere nella struttura a cui si riferisce (la
+ * connessione): nessuna allocazione per inserirlo o rimuoverlo.
+ * Azzerato (o con timerwheel_timer_init) non è in nessuna ruota
+ */
+typedef struct timerwheel_timer_s {
+	struct timerwheel_timer_s* prev;
+	struct timerwheel_timer_s* next; //NULL: non programmato
+	unsigned long long expires; //tick
+} timerwheel_timer;
+
+/*
+ * ruota gerarchica: TIMERWHEEL_LEVELS livelli di TIMERWHEEL_SLOTS
+ * liste, il livello l copre scadenze entro 64^(l + 1) tick. Un timer
+ * scende di livello quando la sua scadenza si avvicina, al più
+ * TIMERWHEEL_LEVELS - 1 volte. Non thread safe
+ */
+typedef struct {
+	timerwheel_timer slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS]; //sentinelle
+	unsigned long long now; //ultimo tick elaborato
+	unsigned tick_ms;
+} timerwheel;
+
+/*
+ * timerwheel_expire_fpt
+ *		invocata per ogni timer scaduto, già rimosso dalla ruota: può
+ *		liberarlo, riprogrammarlo o cancellare altri timer
+ */
+typedef void (*timerwheel_expire_fpt)(timerwheel_timer* t, void* ctx);
+
+/*
+ * timerwheel_init
+ *		ruota vuota con risoluzione tick_ms (> 0), now_ms è l'istante
+ *		attuale (timerwheel_clock_ms)
+ */
+void timerwheel_init(timerwheel* tw, unsigned tick_ms, unsigned long long now_ms);
+
+void timerwheel_timer_init(timerwheel_timer* t);
+
+/*
+ * timerwheel_schedule
+ *		programma t (togliendolo dalla ruota se vi era già) perché
+ *		scada all'istante deadline_ms o al più un tick dopo, mai prima.
+ *		Scadenze oltre 64^TIMERWHEEL_LEVELS tick sono anticipate a quel
+ *		limite. O(1)
+ */
+void timerwheel_schedule(timerwheel* tw, timerwheel_timer* t, unsigned long long deadline_ms);
+
+/*
+ * timerwheel_cancel
+ *		toglie t dalla ruota, se programmato. O(1)
+ */
+void timerwheel_cancel(timerwheel_timer* t);
+
+/*
+ * timerwheel_pending
+ *		!= 0 se t è programmato
+ */
+int timerwheel_pending(const timerwheel_timer* t);
+
+/*
+ * timerwheel_advance
+ *		elabora i tick fino a now_ms, invocando expire(timer, ctx) per
+ *		ogni timer scaduto. Ritorna quanti timer sono scaduti
+ */
+unsigned timerwheel_advance(timerwheel* tw, unsigned long long now_ms, timerwheel_expire_fpt expire, void* ctx);
+
+/*
+ * timerwheel_clock_ms
+ *		orologio monotono in millisecondi
+ */
+unsigned long long timerwheel_clock_ms();
+
+#endif
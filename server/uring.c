@@ -0,0 +1,739 @@
+/* uring.c - io_uring I/O backend
+	ITA: stesso modello di evloop (un thread per ring, handler comune)
+		ma ogni operazione di I/O è una SQE, sottomessa a lotti con una
+		sola io_uring_enter per iterazione:
+
+		accept (multishot, una SQE per molte connessioni)
+		recv (buffer scelto dal kernel)
+		send -> recv (collegate, connessioni persistenti)
+		send, poi close al suo completamento (ultima risposta)
+
+	Le scadenze sono quelle di evloop: una timerwheel per ring, un timer
+	per connessione fissato all'inizio di ogni fase (lettura, attesa,
+	invio), avanzata dopo ogni lotto di completamenti; un timeout
+	periodico (IORING_OP_TIMEOUT) sveglia il ring anche senza traffico.
+	Alla scadenza le SQE in corso della connessione sono cancellate
+	(IORING_OP_ASYNC_CANCEL) e il socket è chiuso al loro completamento.
+	Nessuna close è sottomessa finché il timer è programmato: la
+	cancellazione per descrittore non può colpire un socket riusato.
+
+	Nessuna dipendenza da liburing, le poche primitive necessarie
+	sono implementate qui sopra le syscall.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+#include "malloc_utils.h"
+#include "timerwheel.h"
+#include "uring.h"
+
+#define URING_ENTRIES 1024
+#define URING_BUFFERS 512 //power of 2
+#define URING_BUFFER_SIZE 4096
+#define URING_BGID 0
+#define URING_TICK_MS 250 //timeouts resolution
+
+#define URING_PHASE_READ 0 //read_timeout
+#define URING_PHASE_IDLE 1 //idle_timeout
+#define URING_PHASE_WRITE 2 //write_timeout
+
+#define URING_OP_RECV 0
+#define URING_OP_SEND 1
+#define URING_OP_CLOSE 2
+#define URING_OP_ACCEPT 3
+#define URING_OP_STOP 4
+#define URING_OP_TIMEOUT 5 //timerwheel tick
+#define URING_OP_CANCEL 6
+#define URING_OP_MASK 7
+
+#define uring_data(ptr, op) (((unsigned long long) (unsigned long) (ptr)) | (op))
+#define uring_data_ptr(d) ((void*) (unsigned long) ((d) & ~((unsigned long long) URING_OP_MASK)))
+#define uring_data_op(d) ((int) ((d) & URING_OP_MASK))
+
+typedef struct __uring_conn {
+	int sd;
+	char* in;
+	unsigned in_len;
+	unsigned in_cap;
+	char* out;
+	unsigned out_len;
+	unsigned out_cap;
+	unsigned served;
+	int closing;
+	int writing; //send in corso
+	int expired; //SQE in corso cancellate, si chiude al loro completamento
+	int pending; //richiesta incompleta consumata dall'handler
+	int phase;
+	unsigned phase_served; //served all'inizio della fase
+	timerwheel_timer timer;
+	struct __uring_conn* prev;
+	struct __uring_conn* next;
+	//params.state_size bytes of handler state follow
+} __uring_conn;
+
+typedef struct {
+	pthread_t thread;
+	int fd;
+	int listen_fd;
+
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned sq_entries;
+	unsigned sqe_tail;
+	unsigned to_submit;
+	struct io_uring_sqe* sqes;
+
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+
+	void* sq_ptr;
+	size_t sq_size;
+	void* cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+
+	struct io_uring_buf_ring* br;
+	size_t br_size;
+	unsigned short br_tail;
+	char* bufs;
+
+	struct __kernel_timespec tick;
+	unsigned long long stop_val;
+
+	__uring_conn* conns;
+	timerwheel tw;
+} __uring_ring;
+
+/* NOT exposed */
+static __uring_ring* rings;
+static unsigned n_running_rings;
+static int stop_fd = -1;
+static evloop_params params;
+
+static void* __uring_state(__uring_conn* c) {
+	return (char*) c + sizeof(__uring_conn);
+}
+
+static int __uring_enter(__uring_ring* r, unsigned wait_nr) {
+	__atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+
+	int ret;
+	do {
+		ret = syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait_nr,
+				wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while(ret < 0 && errno == EINTR);
+
+	if(ret > 0)
+		r->to_submit -= ret;
+
+	return ret;
+}
+
+static struct io_uring_sqe* __uring_get_sqe(__uring_ring* r) {
+	while(r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) == r->sq_entries) {
+		if(__uring_enter(r, 0) < 0)
+			return NULL;
+	}
+
+	unsigned idx = r->sqe_tail & *r->sq_mask;
+	struct io_uring_sqe* sqe = &r->sqes[idx];
+	r->sq_array[idx] = idx;
+	++r->sqe_tail;
+	++r->to_submit;
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	return sqe;
+}
+
+static void __uring_buf_recycle(__uring_ring* r, unsigned short bid) {
+	struct io_uring_buf* buf = &r->br->bufs[r->br_tail & (URING_BUFFERS - 1)];
+	buf->addr = (unsigned long) (r->bufs + (unsigned long) bid * URING_BUFFER_SIZE);
+	buf->len = URING_BUFFER_SIZE;
+	buf->bid = bid;
+
+	++r->br_tail;
+	__atomic_store_n(&r->br->tail, r->br_tail, __ATOMIC_RELEASE);
+}
+
+static void __uring_prep_accept(__uring_ring* r) {
+	struct io_uring_sqe* sqe = __uring_get_sqe(r);
+	if(sqe == NULL)
+		return;
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = r->listen_fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->user_data = uring_data(NULL, URING_OP_ACCEPT);
+}
+
+static void __uring_prep_stop(__uring_ring* r) {
+	struct io_uring_sqe* sqe = __uring_get_sqe(r);
+	if(sqe == NULL)
+		return;
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = stop_fd;
+	sqe->addr = (unsigned long) &r->stop_val;
+	sqe->len = sizeof(r->stop_val);
+	sqe->user_data = uring_data(NULL, URING_OP_STOP);
+}
+
+static void __uring_prep_close(__uring_ring* r, __uring_conn* c) {
+	struct io_uring_sqe* sqe = __uring_get_sqe(r);
+	if(sqe == NULL)
+		return;
+
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = c->sd;
+	sqe->user_data = uring_data(c, URING_OP_CLOSE);
+}
+
+static void __uring_prep_recv(__uring_ring* r, __uring_conn* c) {
+	unsigned room = params.max_input - c->in_len;
+
+	struct io_uring_sqe* sqe = __uring_get_sqe(r);
+	if(sqe == NULL)
+		return;
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = c->sd;
+	sqe->len = room < URING_BUFFER_SIZE ? room : URING_BUFFER_SIZE;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = uring_data(c, URING_OP_RECV);
+}
+
+/* send linked to the next recv, the last one is followed by a close once completed */
+static void __uring_prep_send(__uring_ring* r, __uring_conn* c) {
+	struct io_uring_sqe* sqe = __uring_get_sqe(r);
+	if(sqe == NULL)
+		return;
+
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = c->sd;
+	sqe->addr = (unsigned long) c->out;
+	sqe->len = c->out_len;
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+	sqe->flags = c->closing ? 0 : IOSQE_IO_LINK;
+	sqe->user_data = uring_data(c, URING_OP_SEND);
+
+	c->writing = 1;
+
+	if(!c->closing)
+		__uring_prep_recv(r, c);
+}
+
+static void __uring_prep_tick(__uring_ring* r) {
+	struct io_uring_sqe* sqe = __uring_get_sqe(r);
+	if(sqe == NULL)
+		return;
+
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (unsigned long) &r->tick;
+	sqe->len = 1;
+	sqe->user_data = uring_data(NULL, URING_OP_TIMEOUT);
+}
+
+/* every request in flight on the socket: a recv, or a send and the recv linked to it */
+static void __uring_prep_cancel(__uring_ring* r, __uring_conn* c) {
+	struct io_uring_sqe* sqe = __uring_get_sqe(r);
+	if(sqe == NULL)
+		return;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = c->sd;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	sqe->user_data = uring_data(NULL, URING_OP_CANCEL);
+}
+
+static void __uring_schedule(__uring_ring* r, __uring_conn* c, int phase) {
+	unsigned timeout = phase == URING_PHASE_READ ? params.read_timeout :
+		(phase == URING_PHASE_IDLE ? params.idle_timeout : params.write_timeout);
+
+	c->phase = phase;
+	c->phase_served = c->served;
+	timerwheel_schedule(&r->tw, &c->timer, timerwheel_clock_ms() + timeout * 1000ULL);
+}
+
+/* a new deadline only when a phase or a request begins */
+static void __uring_touch(__uring_ring* r, __uring_conn* c) {
+	int phase = c->writing ? URING_PHASE_WRITE :
+		((c->served > 0 && c->in_len == 0 && !c->pending) ? URING_PHASE_IDLE : URING_PHASE_READ);
+
+	if(phase != c->phase || c->served != c->phase_served)
+		__uring_schedule(r, c, phase);
+}
+
+/* nothing else is in flight: the deadline goes with the socket */
+static void __uring_conn_close(__uring_ring* r, __uring_conn* c) {
+	timerwheel_cancel(&c->timer);
+	__uring_prep_close(r, c);
+}
+
+static void __uring_conn_free(__uring_ring* r, __uring_conn* c) {
+	if(c->prev)
+		c->prev->next = c->next;
+	else
+		r->conns = c->next;
+
+	if(c->next)
+		c->next->prev = c->prev;
+
+	timerwheel_cancel(&c->timer);
+	if(params.state_finish)
+		params.state_finish(__uring_state(c));
+	malloc_free(c->in);
+	malloc_free(c->out);
+	free(c);
+}
+
+static void __uring_on_accept(__uring_ring* r, struct io_uring_cqe* cqe) {
+	if(!(cqe->flags & IORING_CQE_F_MORE))
+		__uring_prep_accept(r); //multishot terminated, rearm
+
+	if(cqe->res < 0)
+		return;
+
+	__uring_conn* c = (__uring_conn*) calloc(1, sizeof(__uring_conn) + params.state_size);
+	if(c == NULL) {
+		close(cqe->res);
+		return;
+	}
+
+	if(params.state_init)
+		params.state_init(__uring_state(c));
+
+	c->sd = cqe->res;
+	c->next = r->conns;
+	if(r->conns)
+		r->conns->prev = c;
+	r->conns = c;
+
+	__uring_schedule(r, c, URING_PHASE_READ);
+	__uring_prep_recv(r, c);
+}
+
+/* returns 0 if the connection must be closed */
+static int __uring_append(__uring_conn* c, const char* data, unsigned len) {
+	if(len == 0)
+		return 1;
+
+	if(c->in_len + len > c->in_cap) {
+		unsigned cap = c->in_cap ? c->in_cap : URING_BUFFER_SIZE;
+		while(cap < c->in_len + len)
+			cap <<= 1;
+		if(cap > params.max_input)
+			cap = params.max_input;
+
+		char* in = (char*) realloc(c->in, cap);
+		if(in == NULL)
+			return 0;
+
+		c->in = in;
+		c->in_cap = cap;
+	}
+
+	memcpy(c->in + c->in_len, data, len);
+	c->in_len += len;
+	return 1;
+}
+
+/* returns 0 on allocation failure */
+static int __uring_queue_reply(__uring_conn* c, const char* ans, unsigned ans_len) {
+	if(c->out_len + ans_len > c->out_cap) {
+		unsigned cap = c->out_cap ? c->out_cap : URING_BUFFER_SIZE;
+		while(cap < c->out_len + ans_len)
+			cap <<= 1;
+
+		char* out = (char*) realloc(c->out, cap);
+		if(out == NULL)
+			return 0;
+
+		c->out = out;
+		c->out_cap = cap;
+	}
+
+	memcpy(c->out + c->out_len, ans, ans_len);
+	c->out_len += ans_len;
+	return 1;
+}
+
+/* runs every complete request in base, returns the bytes consumed or -1 on failure */
+static long __uring_process(__uring_conn* c, char* base, unsigned len) {
+	unsigned pos = 0;
+
+	while(pos < len && !c->closing) {
+		const char* ans = NULL;
+		unsigned ans_len = 0;
+		unsigned consumed = 0;
+
+		int rv = params.handler(__uring_state(c), base + pos, len - pos, &ans, &ans_len, &consumed);
+		pos += consumed;
+
+		if(rv == EVLOOP_REQUEST_NEED_MORE) {
+			if(consumed > 0)
+				c->pending = 1;
+			break;
+		}
+
+		c->pending = 0;
+
+		if(!__uring_queue_reply(c, ans, ans_len))
+			return -1;
+
+		++c->served;
+		if(rv == EVLOOP_REQUEST_CLOSE || c->served == params.max_requests)
+			c->closing = 1;
+	}
+
+	return c->closing ? len : pos;
+}
+
+static void __uring_on_recv(__uring_ring* r, __uring_conn* c, struct io_uring_cqe* cqe) {
+	if(c->expired) {
+		//cancelled, or completed before the cancellation
+		if(cqe->flags & IORING_CQE_F_BUFFER)
+			__uring_buf_recycle(r, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+		__uring_conn_close(r, c);
+		return;
+	}
+
+	if(cqe->res == -ENOBUFS) {
+		__uring_prep_recv(r, c); //every buffer in flight, retry
+		return;
+	}
+
+	if(cqe->res <= 0 || !(cqe->flags & IORING_CQE_F_BUFFER)) {
+		__uring_conn_close(r, c); //eof, error or linked send failed
+		return;
+	}
+
+	unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	char* data = r->bufs + (unsigned long) bid * URING_BUFFER_SIZE;
+	unsigned len = cqe->res;
+	int ok = 1;
+
+	c->out_len = 0; //the previous send, if any, is done
+
+	if(c->in_len == 0) {
+		//fast path: requests parsed in the kernel-provided buffer, only leftovers are copied
+		long pos = __uring_process(c, data, len);
+		ok = pos >= 0 && __uring_append(c, data + pos, len - pos);
+	} else {
+		ok = __uring_append(c, data, len);
+		if(ok) {
+			long pos = __uring_process(c, c->in, c->in_len);
+			if(pos < 0)
+				ok = 0;
+			else {
+				memmove(c->in, c->in + pos, c->in_len - pos);
+				c->in_len -= pos;
+			}
+		}
+	}
+
+	__uring_buf_recycle(r, bid);
+
+	if(!ok)
+		__uring_conn_close(r, c);
+	else if(c->in_len == params.max_input && c->out_len == 0)
+		__uring_conn_close(r, c); //full and not consumed by the handler
+	else {
+		if(c->out_len > 0)
+			__uring_prep_send(r, c);
+		else
+			__uring_prep_recv(r, c);
+
+		__uring_touch(r, c);
+	}
+}
+
+/* a failed or cancelled send fails the linked recv too, that one closes the connection */
+static void __uring_on_send(__uring_ring* r, __uring_conn* c, struct io_uring_cqe* cqe) {
+	c->writing = 0;
+
+	if(c->closing)
+		__uring_conn_close(r, c); //the last reply, nothing linked to it
+	else if(cqe->res >= 0 && !c->expired)
+		__uring_touch(r, c);
+}
+
+static void __uring_on_close(__uring_ring* r, __uring_conn* c) {
+	__uring_conn_free(r, c);
+}
+
+/* the linked recv of a send not yet completed might not be issued: shutdown() makes it return at once */
+static void __uring_expired(timerwheel_timer* t, void* _ring) {
+	__uring_conn* c = (__uring_conn*) ((char*) t - offsetof(__uring_conn, timer));
+
+	c->expired = 1;
+	shutdown(c->sd, SHUT_RDWR);
+	__uring_prep_cancel((__uring_ring*) _ring, c);
+}
+
+static void* __uring_routine(void* _ring) {
+	__uring_ring* r = (__uring_ring*) _ring;
+	int running = 1;
+
+	__uring_prep_stop(r);
+	__uring_prep_accept(r);
+	__uring_prep_tick(r);
+
+	while(running) {
+		if(__uring_enter(r, 1) < 0)
+			break;
+
+		unsigned head = *r->cq_head;
+		unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+		for(; head != tail; ++head) {
+			struct io_uring_cqe* cqe = &r->cqes[head & *r->cq_mask];
+			__uring_conn* c = (__uring_conn*) uring_data_ptr(cqe->user_data);
+
+			switch(uring_data_op(cqe->user_data)) {
+				case URING_OP_ACCEPT:
+					__uring_on_accept(r, cqe);
+					break;
+				case URING_OP_RECV:
+					__uring_on_recv(r, c, cqe);
+					break;
+				case URING_OP_SEND:
+					__uring_on_send(r, c, cqe);
+					break;
+				case URING_OP_CLOSE:
+					__uring_on_close(r, c);
+					break;
+				case URING_OP_TIMEOUT:
+					__uring_prep_tick(r);
+					break;
+				case URING_OP_STOP:
+					running = 0;
+					break;
+				default: //cancellations, the cancelled requests do the job
+					break;
+			}
+		}
+
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+		timerwheel_advance(&r->tw, timerwheel_clock_ms(), __uring_expired, r);
+	}
+
+	return NULL;
+}
+
+static int __uring_setup(__uring_ring* r) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = URING_ENTRIES << 2;
+
+	if((r->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0)
+		return URING_INIT_SETUP_FAILURE;
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(r->cq_size > r->sq_size)
+			r->sq_size = r->cq_size;
+		r->cq_size = 0;
+	}
+
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if(r->sq_ptr == MAP_FAILED)
+		return URING_INIT_MMAP_FAILURE;
+
+	if(r->cq_size) {
+		r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if(r->cq_ptr == MAP_FAILED)
+			return URING_INIT_MMAP_FAILURE;
+	} else
+		r->cq_ptr = r->sq_ptr;
+
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = (struct io_uring_sqe*) mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if(r->sqes == MAP_FAILED)
+		return URING_INIT_MMAP_FAILURE;
+
+	char* sq = (char*) r->sq_ptr;
+	r->sq_head = (unsigned*) (sq + p.sq_off.head);
+	r->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+	r->sq_mask = (unsigned*) (sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned*) (sq + p.sq_off.array);
+	r->sq_entries = p.sq_entries;
+	r->sqe_tail = *r->sq_tail;
+
+	char* cq = (char*) r->cq_ptr;
+	r->cq_head = (unsigned*) (cq + p.cq_off.head);
+	r->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+	r->cq_mask = (unsigned*) (cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+
+	/* provided buffer ring */
+	r->br_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+	r->br = (struct io_uring_buf_ring*) mmap(NULL, r->br_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(r->br == MAP_FAILED) {
+		r->br = NULL;
+		return URING_INIT_MMAP_FAILURE;
+	}
+
+	if((r->bufs = (char*) malloc((unsigned long) URING_BUFFERS * URING_BUFFER_SIZE)) == NULL)
+		return URING_INIT_MALLOC_FAILURE;
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long) r->br;
+	reg.ring_entries = URING_BUFFERS;
+	reg.bgid = URING_BGID;
+
+	if(syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		return URING_INIT_PBUF_FAILURE;
+
+	r->br_tail = 0;
+	for(unsigned short i = 0; i < URING_BUFFERS; ++i)
+		__uring_buf_recycle(r, i);
+
+	r->tick.tv_sec = 0;
+	r->tick.tv_nsec = URING_TICK_MS * 1000000L;
+	timerwheel_init(&r->tw, URING_TICK_MS, timerwheel_clock_ms());
+
+	return URING_OK;
+}
+
+static void __uring_teardown(__uring_ring* r) {
+	if(r->fd > 0)
+		close(r->fd);
+
+	if(r->sqes && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_size);
+
+	if(r->cq_size && r->cq_ptr && r->cq_ptr != MAP_FAILED)
+		munmap(r->cq_ptr, r->cq_size);
+
+	if(r->sq_ptr && r->sq_ptr != MAP_FAILED)
+		munmap(r->sq_ptr, r->sq_size);
+
+	if(r->br)
+		munmap(r->br, r->br_size);
+
+	malloc_free(r->bufs);
+
+	while(r->conns) {
+		close(r->conns->sd);
+		__uring_conn_free(r, r->conns);
+	}
+}
+
+/* exposed */
+int uring_init(const int* listen_sds, unsigned n_listen, unsigned n_rings, const evloop_params* p) {
+	if(n_rings == 0 || n_listen == 0 || n_listen > n_rings || p->max_input == 0 || 
+			p->read_timeout == 0 || p->idle_timeout == 0 || p->write_timeout == 0 || p->handler == NULL)
+		return URING_INIT_INVAL;
+
+	params = *p;
+
+	if((rings = (__uring_ring*) calloc(n_rings, sizeof(__uring_ring))) == NULL)
+		return URING_INIT_MALLOC_FAILURE;
+
+	if((stop_fd = eventfd(0, EFD_SEMAPHORE)) < 0) {
+		malloc_free(rings);
+		return URING_INIT_EVENTFD_FAILURE;
+	}
+
+	for(n_running_rings = 0; n_running_rings < n_rings; ++n_running_rings) {
+		__uring_ring* r = &rings[n_running_rings];
+		r->listen_fd = listen_sds[n_running_rings % n_listen];
+
+		int rv = __uring_setup(r);
+		if(rv != URING_OK) {
+			__uring_teardown(r);
+			uring_finish();
+			return rv;
+		}
+
+		if(pthread_create(&r->thread, NULL, __uring_routine, (void*) r) != 0) {
+			__uring_teardown(r);
+			uring_finish();
+			return URING_INIT_CREATE_FAILURE;
+		}
+	}
+
+	return URING_OK;
+}
+
+//errors ignored
+void uring_finish() {
+	if(stop_fd >= 0) {
+		unsigned long long n = n_running_rings;
+		ssize_t r = write(stop_fd, &n, sizeof(n));
+		((void)r);
+	}
+
+	for(unsigned i = 0; i < n_running_rings; ++i) {
+		pthread_join(rings[i].thread, NULL);
+		__uring_teardown(&rings[i]);
+	}
+
+	n_running_rings = 0;
+
+	if(stop_fd >= 0) {
+		close(stop_fd);
+		stop_fd = -1;
+	}
+
+	malloc_free(rings);
+}
+
+void uring_strerror(int error, char* dst, int dst_max_size) {
+	int current_errno = errno;
+	memset(dst, 0, dst_max_size);
+	switch(error) {
+		case URING_INIT_INVAL:
+			memcpy(dst, "uring_init: Invalid argument", sizeof("uring_init: Invalid argument"));
+			break;
+		case URING_INIT_MALLOC_FAILURE:
+			snprintf(dst, dst_max_size, "uring_init:malloc: %s", strerror(current_errno));
+			break;
+		case URING_INIT_SETUP_FAILURE:
+			snprintf(dst, dst_max_size, "uring_init:io_uring_setup: %s", strerror(current_errno));
+			break;
+		case URING_INIT_MMAP_FAILURE:
+			snprintf(dst, dst_max_size, "uring_init:mmap: %s", strerror(current_errno));
+			break;
+		case URING_INIT_PBUF_FAILURE:
+			snprintf(dst, dst_max_size, "uring_init:io_uring_register(PBUF_RING): %s", strerror(current_errno));
+			break;
+		case URING_INIT_EVENTFD_FAILURE:
+			snprintf(dst, dst_max_size, "uring_init:eventfd: %s", strerror(current_errno));
+			break;
+		case URING_INIT_CREATE_FAILURE:
+			snprintf(dst, dst_max_size, "uring_init:pthread_create: %s", strerror(current_errno));
+			break;
+
+		default:
+			snprintf(dst, dst_max_size, "uring: Success");
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef URING_H
+#define URING_H
+
+#include "evloop.h" //evloop_params, EVLOOP_REQUEST_*
+
+#define URING_OK 0
+
+#define URING_INIT_INVAL 4
+#define URING_INIT_MALLOC_FAILURE 5
+#define URING_INIT_SETUP_FAILURE 6
+#define URING_INIT_MMAP_FAILURE 7
+#define URING_INIT_PBUF_FAILURE 8
+#define URING_INIT_EVENTFD_FAILURE 9
+#define URING_INIT_CREATE_FAILURE 10
+
+/*
+ * uring_init
+ *
+ * DESCRIZIONE:
+ *		backend io_uring, alternativo a evloop: avvia n_rings thread, ognuno con
+ *		il proprio ring. Accept multishot su uno degli n_listen socket 
+ *		(il ring i usa listen_sds[i % n_listen]), recv su buffer forniti
+ *		dal kernel (provided buffer ring), send collegata alla close o alla recv
+ *		successiva (IOSQE_IO_LINK). Scadenze in una timerwheel per ring,
+ *		come evloop: alla scadenza le SQE della connessione sono cancellate.
+ *		params ha la stessa semantica di evloop.
+ *
+ * NOTA BENE:
+ *		0 < n_listen <= n_rings, params->max_input > 0, timeout > 0
+ *		richiede kernel >= 5.19
+ *
+ * RITORNA:
+ *		* URING_OK se tutto è andato a buon fine
+ *		* uno degli errori della classe URING_INIT_* altrimenti
+ */
+int uring_init(const int* listen_sds, unsigned n_listen, unsigned n_rings, const evloop_params* params);
+
+/*
+ * uring_finish
+ *		ferma tutti i ring, chiude le connessioni aperte e libera le risorse,
+ *		ogni errore è ignorato
+ */
+void uring_finish();
+
+void uring_strerror(int error, char* dst, int dst_size);
+
+#endif
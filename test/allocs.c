@@ -0,0 +1,164 @@
+/* allocs.c - steady state allocation check
+	ITA: un worker che ha già servito qualche giro di richieste non deve
+		più allocare memoria. Ogni giro passa dal parser e dagli handler
+		di ops.c su una sala 100 x 100: GetAvailableSeats, BookSeats da
+		1, 10 e 100 posti (oltre i buffer sullo stack di booking.c e i
+		posti nello slot di bookidx), BookBatch con una lista da 70 posti,
+		BookBest e di nuovo GetAvailableSeats, da riserializzare; infine
+		RevokeBooking di ogni codice ottenuto, la sala torna com'era.
+		Dopo TEST_WARMUP giri il contatore di alloccount (compilato con
+		-DCOUNT_ALLOCS) non deve crescere in TEST_ROUNDS giri.
+		Termina con EXIT_FAILURE altrimenti.
+
+	usage: test/allocs
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../server/ops.h"
+#include "../server/stats.h"
+#include "../server/alloccount.h"
+
+#define TEST_ROWS 100
+#define TEST_POLS 100
+#define TEST_WARMUP 8
+#define TEST_ROUNDS 64
+#define TEST_MAX_CODES 16
+#define TEST_REQUEST_MAX 4096
+#define TEST_KEEP_ARENA (1 << 20)
+
+/* NOT exposed */
+static const ops_handler_fpt __test_ops[REQPARSE_NOPS] = {
+	NULL,
+	op_get_available_seats,
+	op_get_available_ranges,
+	op_get_versioned_seats,
+	op_book_seats,
+	op_revoke_booking,
+	op_stats,
+	op_book_batch,
+	op_book_best
+};
+
+static show_table __test_st;
+static arena __test_scratch;
+static reqparse __test_rp;
+
+static unsigned __test_codes[TEST_MAX_CODES];
+static unsigned __test_n_codes;
+static unsigned __test_failures;
+
+/* the request as a worker would run it, codes of "Success:" parts are kept */
+static void __test_request(const char* request) {
+	arena_reset(&__test_scratch);
+	reqparse_next(&__test_rp);
+
+	unsigned len = (unsigned) strlen(request);
+	unsigned consumed = 0;
+	if(reqparse_feed(&__test_rp, request, len, &consumed) != REQPARSE_DONE ||
+			__test_rp.error != REQPARSE_ERR_NONE) {
+		printf("FAIL %.*s: not parsed\n", len - 2, request);
+		exit(EXIT_FAILURE);
+	}
+
+	unsigned reply_len;
+	const char* reply = __test_ops[__test_rp.op](__test_st.default_show, &__test_scratch, &__test_rp, &reply_len);
+	ops_result_take();
+
+	for(const char* p = strstr(reply, "Success:"); p; p = strstr(p, "Success:")) {
+		p += 8;
+		if(__test_n_codes < TEST_MAX_CODES)
+			__test_codes[__test_n_codes++] = (unsigned) strtoul(p, NULL, 10);
+	}
+}
+
+/* x,y of count seats of row, from column first on */
+static unsigned __test_seats(char* dst, unsigned row, unsigned first, unsigned count) {
+	unsigned len = 0;
+	for(unsigned i = 0; i < count; ++i)
+		len += (unsigned) sprintf(dst + len, "%s%u,%u", i ? "," : "", row, first + i);
+
+	return len;
+}
+
+static void __test_round() {
+	char request[TEST_REQUEST_MAX];
+	unsigned len;
+
+	__test_n_codes = 0;
+
+	__test_request("GetAvailableSeats\r\n");
+
+	len = (unsigned) sprintf(request, "BookSeats");
+	len += __test_seats(request + len, 1, 1, 1);
+	strcpy(request + len, "\r\n");
+	__test_request(request);
+
+	len = (unsigned) sprintf(request, "BookSeats");
+	len += __test_seats(request + len, 2, 1, 10);
+	strcpy(request + len, "\r\n");
+	__test_request(request);
+
+	len = (unsigned) sprintf(request, "BookSeats");
+	len += __test_seats(request + len, 3, 1, TEST_POLS);
+	strcpy(request + len, "\r\n");
+	__test_request(request);
+
+	len = (unsigned) sprintf(request, "BookBatch");
+	len += __test_seats(request + len, 4, 1, 2);
+	request[len++] = ';';
+	len += __test_seats(request + len, 5, 1, 70);
+	request[len++] = ';';
+	len += __test_seats(request + len, 6, 1, 8);
+	strcpy(request + len, "\r\n");
+	__test_request(request);
+
+	__test_request("BookBest5\r\n");
+	__test_request("GetAvailableSeats\r\n");
+
+	unsigned n_codes = __test_n_codes;
+	if(n_codes != 7) {
+		printf("FAIL round: %u booking(s), expected 7\n", n_codes);
+		++__test_failures;
+	}
+
+	unsigned codes[TEST_MAX_CODES];
+	memcpy(codes, __test_codes, sizeof(unsigned) * n_codes);
+
+	for(unsigned i = 0; i < n_codes; ++i) {
+		sprintf(request, "RevokeBooking%u\r\n", codes[i]);
+		__test_request(request);
+	}
+}
+
+int main() {
+	if(shows_single(&__test_st, 1, TEST_ROWS, TEST_POLS, 16) != SHOWS_OK)
+		exit(EXIT_FAILURE);
+
+	arena_init(&__test_scratch, TEST_KEEP_ARENA);
+	reqparse_init(&__test_rp, (TEST_ROWS * TEST_POLS + 1) << 1, TEST_REQUEST_MAX);
+
+	for(unsigned i = 0; i < TEST_WARMUP; ++i)
+		__test_round();
+
+	unsigned long allocs0 = alloccount_get();
+
+	for(unsigned i = 0; i < TEST_ROUNDS; ++i)
+		__test_round();
+
+	unsigned long allocs = alloccount_get() - allocs0;
+
+	reqparse_finish(&__test_rp);
+	arena_finish(&__test_scratch);
+	shows_finish(&__test_st);
+
+	if(allocs0 == 0) {
+		printf("allocs: allocations not counted, build with -DCOUNT_ALLOCS\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("allocs: %lu allocation(s) in %u warm round(s)\n", allocs, TEST_ROUNDS);
+	return (allocs || __test_failures) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
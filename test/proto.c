@@ -0,0 +1,184 @@
+/* proto.c - text command checks
+	ITA: ogni richiesta passa dal parser (intera e un byte alla volta,
+		come la può ricevere il server) e dall'handler del comando su una
+		sala 10 x 10 nuova; la risposta è confrontata con quella attesa,
+		una parte per ogni prenotazione separata da ';'. "S" sta per
+		"Success:<codice>", ogni altra parte deve coincidere.
+		Un caso può avere una richiesta preliminare (setup) sulla stessa
+		sala, dopo la quale la risposta di GetAvailableSeats è già pronta:
+		con untouched la richiesta non deve cambiare la versione della
+		sala né alcuna riga della cache, con clean_row (x, da 1) almeno
+		quella riga deve restare valida.
+		Termina con EXIT_FAILURE se una risposta è diversa.
+
+	usage: test/proto
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../server/ops.h"
+#include "../server/stats.h"
+
+#define TEST_ROWS 10
+#define TEST_POLS 10
+
+typedef struct {
+	const char* request;
+	const char* expected;
+	const char* setup; //NULL: nessuna
+	int untouched;
+	unsigned clean_row; //0: nessuna
+} __test_case;
+
+/* NOT exposed */
+static const __test_case __test_cases[] = {
+	{ "BookBatch1,1;2,2\r\n", "S;S", NULL, 0, 0 },
+	{ "BookBatch1,1;2,2;\r\n", "S;S", NULL, 0, 0 }, //a trailing ';' opens no booking
+	{ "BookBatch1,1;;2,2\r\n", "S;Fail:wholeempty;S", NULL, 0, 0 },
+	{ "BookBatch;\r\n", "Fail:wholeempty", NULL, 0, 0 },
+	{ "BookBatch1,1;1,1\r\n", "S;Fail:notavail", NULL, 0, 0 },
+	{ "BookBatch1,1;11,1;1,2,3\r\n", "S;Fail:exceed;Fail:noteven", NULL, 0, 0 },
+	//every booking conflicts: neither readers nor the cache notice
+	{ "BookBatch1,1;1,2;2,1,2,2\r\n", "Fail:notavail;Fail:notavail;Fail:notavail",
+		"BookSeats1,1,1,2,2,2\r\n", 1, 1 },
+	{ "BookBatch1,1;3,3\r\n", "Fail:notavail;S", "BookSeats1,1\r\n", 0, 1 },
+	{ "BookSeats1,1,2,2\r\n", "S", NULL, 0, 0 },
+	{ "BookBest3\r\n", "S", NULL, 0, 0 },
+	{ "BookBest11\r\n", "Fail:toomuch", NULL, 0, 0 }
+};
+
+static const ops_handler_fpt __test_ops[REQPARSE_NOPS] = {
+	NULL,
+	op_get_available_seats,
+	op_get_available_ranges,
+	op_get_versioned_seats,
+	op_book_seats,
+	op_revoke_booking,
+	op_stats,
+	op_book_batch,
+	op_book_best
+};
+
+/* reply parts against "S;Fail:x;...", 0 if they match */
+static int __test_match(const char* reply, const char* expected) {
+	for(;;) {
+		const char* r_end = strchr(reply, ';');
+		const char* e_end = strchr(expected, ';');
+		unsigned r_len = r_end ? (unsigned) (r_end - reply) : (unsigned) strlen(reply);
+		unsigned e_len = e_end ? (unsigned) (e_end - expected) : (unsigned) strlen(expected);
+
+		if(e_len == 1 && expected[0] == 'S') {
+			if(r_len <= 8 || strncmp(reply, "Success:", 8) != 0)
+				return 1;
+		} else if(r_len != e_len || strncmp(reply, expected, e_len) != 0)
+			return 1;
+
+		if((r_end == NULL) != (e_end == NULL))
+			return 1;
+
+		if(r_end == NULL)
+			return 0;
+
+		reply = r_end + 1;
+		expected = e_end + 1;
+	}
+}
+
+/* request through the parser and its handler, the reply lives in scratch */
+static const char* __test_exec(show* sh, arena* scratch, reqparse* rp, const char* request, int bytewise) {
+	reqparse_next(rp);
+
+	unsigned len = (unsigned) strlen(request);
+	unsigned pos = 0;
+	int done = REQPARSE_NEED_MORE;
+
+	while(pos < len && done == REQPARSE_NEED_MORE) {
+		unsigned consumed = 0;
+		done = reqparse_feed(rp, request + pos, bytewise ? 1 : len - pos, &consumed);
+		pos += consumed;
+	}
+
+	const char* reply = "(incomplete)";
+	unsigned reply_len;
+	if(done == REQPARSE_DONE) {
+		if(rp->error != REQPARSE_ERR_NONE || rp->op == REQPARSE_OP_NONE)
+			reply = INVALID_REQUEST_REPLY;
+		else
+			reply = __test_ops[rp->op](sh, scratch, rp, &reply_len);
+	}
+
+	ops_result_take();
+	return reply;
+}
+
+/* != 0 if some row of the cache must be serialized again */
+static int __test_dirty_rows(const availcache* ac, unsigned rows) {
+	for(unsigned r = 0; r < rows; ++r)
+		if(ac->rows[r].dirty)
+			return 1;
+
+	return 0;
+}
+
+static int __test_run(const __test_case* tc, int bytewise) {
+	show_table st;
+	if(shows_single(&st, 1, TEST_ROWS, TEST_POLS, 16) != SHOWS_OK)
+		exit(EXIT_FAILURE);
+
+	show* sh = st.default_show;
+	booking_engine* be = &sh->engine;
+
+	arena scratch;
+	arena_init(&scratch, 4096);
+
+	reqparse rp;
+	reqparse_init(&rp, (TEST_ROWS * TEST_POLS + 1) << 1, 4096);
+
+	if(tc->setup) {
+		__test_exec(sh, &scratch, &rp, tc->setup, 0);
+		__test_exec(sh, &scratch, &rp, "GetAvailableSeats\r\n", 0);
+	}
+
+	unsigned long version = be->sm.seq.ended;
+	unsigned len = (unsigned) strlen(tc->request);
+	const char* reply = __test_exec(sh, &scratch, &rp, tc->request, bytewise);
+
+	int failed = __test_match(reply, tc->expected);
+	if(failed) {
+		printf("FAIL %.*s (%s): got \"%s\", expected \"%s\"\n", len - 2, tc->request,
+				bytewise ? "byte by byte" : "whole", reply, tc->expected);
+	}
+
+	if(tc->untouched && (be->sm.seq.ended != version || __test_dirty_rows(&be->ac, TEST_ROWS))) {
+		printf("FAIL %.*s (%s): seats or cache changed\n", len - 2, tc->request,
+				bytewise ? "byte by byte" : "whole");
+		failed = 1;
+	}
+
+	if(tc->clean_row && be->ac.rows[tc->clean_row - 1].dirty) {
+		printf("FAIL %.*s (%s): row %u marked dirty\n", len - 2, tc->request,
+				bytewise ? "byte by byte" : "whole", tc->clean_row);
+		failed = 1;
+	}
+
+	reqparse_finish(&rp);
+	arena_finish(&scratch);
+	shows_finish(&st);
+
+	return failed;
+}
+
+int main() {
+	unsigned n = sizeof(__test_cases) / sizeof(__test_case);
+	unsigned failed = 0;
+
+	for(unsigned i = 0; i < n; ++i) {
+		failed += __test_run(&__test_cases[i], 0);
+		failed += __test_run(&__test_cases[i], 1);
+	}
+
+	printf("proto: %u/%u passed\n", 2 * n - failed, 2 * n);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
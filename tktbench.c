@@ -0,0 +1,588 @@
+/* tktbench.c - load generator for tktsrv
+	ITA: threads thread inviano GetAvailableSeats, BookSeats e
+		RevokeBooking nelle proporzioni di --mix per --duration secondi.
+		Ciclo chiuso (default): ogni thread invia la richiesta successiva
+		appena riceve la risposta. Ciclo aperto (--rate): le richieste
+		partono a intervalli fissi qualunque sia la risposta del server,
+		la latenza è misurata dall'istante previsto per l'invio, così il
+		ritardo accumulato da un server lento non sparisce dalle misure.
+
+		I posti di BookSeats sono scelti uniformemente o, con --zipf s,
+		con probabilità proporzionale a 1/k^s (k = 1 per il primo posto
+		della prima fila): pochi posti molto richiesti come all'apertura
+		delle vendite. RevokeBooking revoca una prenotazione ottenuta dallo
+		stesso thread, senza prenotazioni da revocare invia BookSeats.
+
+		Latenze ed esiti (Fail:* per motivo) sono raccolti per thread con
+		gli istogrammi del server (server/stats.c), gli errori di rete a
+		parte. Con --csv una riga per op e una per il totale sono aggiunte
+		al file, con l'intestazione se è vuoto.
+
+	usage: tktbench -r rows -c pols [-h host] [-p port] [-s show] [-t threads] [-d seconds]
+		[-m get:book:revoke] [-n seats] [-z s] [-a rate] [-k] [-o file.csv] [-L label]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "clientproto.h"
+#include "server/stats.h"
+
+#ifndef DEFAULT_PORT
+#define DEFAULT_PORT 8123
+#endif
+
+#define DEFAULT_THREADS 8
+#define DEFAULT_DURATION 10
+#define DEFAULT_MIX "80:15:5"
+#define REPLY_TIMEOUT 5 //seconds, then the request is an I/O error
+
+#define BENCH_OP_GET 0
+#define BENCH_OP_BOOK 1
+#define BENCH_OP_REVOKE 2
+#define BENCH_NOPS 3
+
+#define BENCH_ARG_MAX 256
+#define BENCH_MAX_SEATS 16 //per booking, "x,y," each
+
+#define stoull_exit(a, s) \
+{ \
+	int err; \
+	if((err = stoull(a, s))) { \
+		printf("%s: not a valid integer or of/uf occoured\n", \
+				a); \
+		exit(EXIT_FAILURE); \
+	} \
+}
+
+#define value_check(target_idx, cur_idx, opt) \
+{ \
+	target_idx = cur_idx + 1; \
+	if(target_idx == argc) { \
+		printf("%s: missing value\n", opt); \
+		print_usage_exit(argv[0]); \
+	} \
+}
+
+#define get_ullong_value_for_option(arg_array, out_value_ptr, arg_cur_idx) \
+{ \
+	int next_idx; \
+	value_check(next_idx, i, arg_array[i]); \
+	stoull_exit(arg_array[next_idx], out_value_ptr); \
+	++arg_cur_idx; \
+}
+
+#define arg(a, l, s) (strcmp(a, l) == 0 || strcmp(a, s) == 0)
+
+typedef unsigned int uint32;
+typedef unsigned long long ulong64;
+typedef unsigned short ushort16;
+
+typedef struct {
+	struct sockaddr_in addr;
+	uint32 threads;
+	uint32 duration;
+	uint32 rows;
+	uint32 pols;
+	uint32 seats; //per booking
+	uint32 mix[BENCH_NOPS]; //weights
+	uint32 mix_total;
+	double zipf; //0 = uniform
+	double rate; //requests/s of all threads, 0 = closed loop
+	int keepalive;
+	const char* csv_path;
+	const char* label;
+} bench_config;
+
+typedef struct {
+	uint32 id;
+	pthread_t tid;
+	ulong64 rng;
+	int sd;
+	char* reply;
+	unsigned reply_cap;
+	uint32* codes; //own bookings not revoked yet
+	uint32 n_codes;
+	uint32 codes_cap;
+	unsigned long io_errors[BENCH_NOPS];
+} bench_worker;
+
+const char* const g_op_names[BENCH_NOPS] = { "GetAvailableSeats", "BookSeats", "RevokeBooking" };
+
+bench_config g_conf = { { 0 }, DEFAULT_THREADS, DEFAULT_DURATION, 0, 0, 1, { 0 }, 0, 0.0, 0.0, 0, NULL, "" };
+double* g_zipf_cdf = NULL; //rows * pols elements
+pthread_barrier_t g_start_barrier;
+ulong64 g_start_ns;
+
+void print_usage_exit(const char* fa) {
+	printf("usage: %s --rows nr | -r nr --pols np | -c np [ --host ht | -h ht ] [ --port pt | -p pt ]"
+			" [ --show id | -s id ] [ --threads th | -t th ] [ --duration s | -d s ]"
+			" [ --mix g:b:r | -m g:b:r ] [ --seats n | -n n ] [ --zipf s | -z s ]"
+			" [ --rate rps | -a rps ] [ --keep-alive | -k ] [ --csv file | -o file ] [ --label lb | -L lb ]\n", fa);
+	exit(EXIT_FAILURE);
+}
+
+//int stoull(__in const char*, __out ulong64*);
+// returns 0 on success, 1 on failure
+int stoull(const char* s, ulong64* res) {
+	char* end = NULL;
+	*res = strtoull(s, &end, 10);
+	return *end != 0;
+}
+
+ulong64 now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//xorshift64*, one state per thread
+ulong64 next_random(ulong64* s) {
+	*s ^= *s >> 12;
+	*s ^= *s << 25;
+	*s ^= *s >> 27;
+	return *s * 2685821657736338717ULL;
+}
+
+double next_uniform(ulong64* s) {
+	return (next_random(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* ITA: probabilità cumulate di 1/k^s, k = 1 .. n_seats */
+void zipf_init(uint32 n_seats, double s) {
+	g_zipf_cdf = (double*) malloc(sizeof(double) * n_seats);
+	if(g_zipf_cdf == NULL)
+		exit(EXIT_FAILURE);
+
+	double sum = 0;
+	for(uint32 k = 0; k < n_seats; ++k) {
+		sum += 1.0 / pow(k + 1, s);
+		g_zipf_cdf[k] = sum;
+	}
+
+	for(uint32 k = 0; k < n_seats; ++k)
+		g_zipf_cdf[k] /= sum;
+}
+
+uint32 next_seat(bench_worker* w) {
+	uint32 n_seats = g_conf.rows * g_conf.pols;
+	if(g_zipf_cdf == NULL)
+		return (uint32) (next_random(&w->rng) % n_seats);
+
+	//first seat whose cumulative probability reaches u
+	double u = next_uniform(&w->rng);
+	uint32 lo = 0, hi = n_seats - 1;
+	while(lo < hi) {
+		uint32 mid = lo + ((hi - lo) >> 1);
+		if(g_zipf_cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* "x,y,x,y...", seats distinct, 1-based coordinates */
+int booking_arg(bench_worker* w, char* arg) {
+	uint32 seats[BENCH_MAX_SEATS];
+	int len = 0;
+
+	for(uint32 i = 0; i < g_conf.seats; ++i) {
+		uint32 s;
+		int dup;
+		do {
+			s = next_seat(w);
+			dup = 0;
+			for(uint32 j = 0; j < i; ++j)
+				dup |= seats[j] == s;
+		} while(dup);
+
+		seats[i] = s;
+		len += snprintf(arg + len, BENCH_ARG_MAX - len, "%s%u,%u", i ? "," : "",
+				s / g_conf.pols + 1, s % g_conf.pols + 1);
+	}
+
+	return len;
+}
+
+/* ITA: STATS_RESULT_* della risposta, in *code il codice di "Success:code" */
+uint32 classify_reply(const char* reply, uint32* code) {
+	*code = 0;
+
+	if(strncmp(reply, "Success:", 8) == 0) {
+		*code = (uint32) strtoul(reply + 8, NULL, 10);
+		return STATS_RESULT_OK;
+	}
+
+	if(strncmp(reply, "Fail:", 5) == 0) {
+		for(uint32 r = 1; r < STATS_NRESULTS; ++r)
+			if(strcmp(reply + 5, stats_result_name(r)) == 0)
+				return r;
+	}
+
+	if(strncmp(reply, "Fail:", 5) == 0 || strncmp(reply, "Op:", 3) == 0)
+		return STATS_RESULT_INVALID;
+
+	//GetAvailableSeats: the seat list itself
+	return STATS_RESULT_OK;
+}
+
+/* ITA: invia req e attende la risposta in w->reply. Una connessione
+ *  tenuta aperta (--keep-alive) che il server ha chiuso o resettato è
+ *  riaperta una volta. Ritorna la lunghezza della risposta, -1 per errori di rete
+ */
+int roundtrip(bench_worker* w, const char* req, int req_len) {
+	for(int attempt = 0; attempt < 2; ++attempt) {
+		int reused = w->sd >= 0;
+
+		if(w->sd < 0) {
+			if((w->sd = get_connected_socket(&g_conf.addr)) < 0) {
+				w->sd = -1;
+				return -1;
+			}
+
+			struct timeval tv = { REPLY_TIMEOUT, 0 };
+			setsockopt(w->sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(struct timeval));
+		}
+
+		int n = -1;
+		if(send(w->sd, req, req_len, MSG_NOSIGNAL) == req_len)
+			n = recv_reply(w->sd, &w->reply, &w->reply_cap);
+
+		if(n > 0 && g_conf.keepalive)
+			return n;
+
+		close(w->sd);
+		w->sd = -1;
+
+		if(n > 0)
+			return n;
+		else if(!reused)
+			return -1;
+	}
+
+	return -1;
+}
+
+void push_code(bench_worker* w, uint32 code) {
+	if(w->n_codes == w->codes_cap) {
+		w->codes_cap = w->codes_cap ? w->codes_cap << 1 : 64;
+		if((w->codes = (uint32*) realloc(w->codes, sizeof(uint32) * w->codes_cap)) == NULL)
+			exit(EXIT_FAILURE);
+	}
+
+	w->codes[w->n_codes++] = code;
+}
+
+/* one request of the mix, latency measured from started */
+void run_request(bench_worker* w, ulong64 started) {
+	uint32 r = (uint32) (next_random(&w->rng) % g_conf.mix_total);
+	uint32 op = r < g_conf.mix[BENCH_OP_GET] ? BENCH_OP_GET :
+		(r < g_conf.mix[BENCH_OP_GET] + g_conf.mix[BENCH_OP_BOOK] ? BENCH_OP_BOOK : BENCH_OP_REVOKE);
+
+	if(op == BENCH_OP_REVOKE && w->n_codes == 0)
+		op = BENCH_OP_BOOK;
+
+	char arg[BENCH_ARG_MAX];
+	int arg_len = 0;
+	uint32 revoked = 0;
+
+	if(op == BENCH_OP_BOOK)
+		arg_len = booking_arg(w, arg);
+	else if(op == BENCH_OP_REVOKE) {
+		uint32 i = (uint32) (next_random(&w->rng) % w->n_codes);
+		revoked = w->codes[i];
+		w->codes[i] = w->codes[--w->n_codes];
+		arg_len = snprintf(arg, BENCH_ARG_MAX, "%u", revoked);
+	}
+
+	int req_len;
+	char* req = make_request(g_op_names[op], arg, arg_len, &req_len);
+
+	int n = roundtrip(w, req, req_len);
+	ulong64 done = now_ns();
+	free(req);
+
+	if(n < 0) {
+		++w->io_errors[op];
+		return;
+	}
+
+	uint32 code;
+	uint32 result = classify_reply(w->reply, &code);
+	stats_record(op, result, done - started);
+
+	if(op == BENCH_OP_BOOK && result == STATS_RESULT_OK)
+		push_code(w, code);
+}
+
+void* bench_routine(void* _w) {
+	bench_worker* w = (bench_worker*) _w;
+
+	pthread_barrier_wait(&g_start_barrier);
+
+	ulong64 deadline = g_start_ns + g_conf.duration * 1000000000ULL;
+
+	if(g_conf.rate == 0) {
+		while(now_ns() < deadline)
+			run_request(w, now_ns());
+	} else {
+		//each thread has its share of the rate, starts staggered
+		double interval = g_conf.threads * 1e9 / g_conf.rate;
+		ulong64 k = 0;
+
+		for(;;) {
+			ulong64 next = g_start_ns + (ulong64) ((k + (double) w->id / g_conf.threads) * interval);
+			if(next >= deadline)
+				break;
+
+			struct timespec ts = { (time_t) (next / 1000000000ULL), (long) (next % 1000000000ULL) };
+			while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+				;
+
+			run_request(w, next);
+			++k;
+		}
+	}
+
+	if(w->sd >= 0)
+		close(w->sd);
+
+	return NULL;
+}
+
+void print_results(double secs, const unsigned long* io_errors) {
+	printf("%u thread(s), %s, %.2f s, mix %u:%u:%u, %u seat(s) per booking, %s over %u x %u seats%s\n",
+			g_conf.threads, g_conf.rate ? "open loop" : "closed loop", secs,
+			g_conf.mix[BENCH_OP_GET], g_conf.mix[BENCH_OP_BOOK], g_conf.mix[BENCH_OP_REVOKE], g_conf.seats,
+			g_conf.zipf ? "zipf" : "uniform", g_conf.rows, g_conf.pols, g_conf.keepalive ? ", keep-alive" : "");
+	if(g_conf.rate)
+		printf("target rate %.0f req/s\n", g_conf.rate);
+
+	unsigned long all_io = 0;
+	for(int op = STATS_ALL_OPS; op < BENCH_NOPS; ++op) {
+		stats_summary sm;
+		stats_collect(op, &sm);
+		unsigned long io = op < 0 ? 0 : io_errors[op];
+		if(op < 0) {
+			for(uint32 i = 0; i < BENCH_NOPS; ++i)
+				io += io_errors[i];
+			all_io = io;
+		}
+
+		printf("\n%-18s %10lu req %12.1f req/s   mean %9.1f  p50 %9.1f  p99 %9.1f  p999 %9.1f  max %9.1f us\n",
+				op < 0 ? "all" : g_op_names[op], sm.requests, sm.requests / secs,
+				sm.mean_us, sm.p50_us, sm.p99_us, sm.p999_us, sm.max_us);
+
+		printf("%-18s", "");
+		for(uint32 r = 0; r < STATS_NRESULTS; ++r) {
+			if(sm.results[r])
+				printf(" %s=%lu", stats_result_name(r), sm.results[r]);
+		}
+		if(io)
+			printf(" io_error=%lu", io);
+		printf("\n");
+	}
+
+	if(all_io)
+		printf("\n%lu request(s) without a reply (connection refused, reset or %d s timeout)\n",
+				all_io, REPLY_TIMEOUT);
+}
+
+void write_csv(double secs, const unsigned long* io_errors) {
+	FILE* f = fopen(g_conf.csv_path, "a");
+	if(f == NULL) {
+		perror(g_conf.csv_path);
+		return;
+	}
+
+	if(ftell(f) == 0) {
+		fprintf(f, "label,mode,threads,target_rps,duration_s,mix,seats,zipf,keepalive,op,requests,rps");
+		for(uint32 r = 0; r < STATS_NRESULTS; ++r)
+			fprintf(f, ",%s", stats_result_name(r));
+		fprintf(f, ",io_error,mean_us,p50_us,p99_us,p999_us,max_us\n");
+	}
+
+	for(int op = STATS_ALL_OPS; op < BENCH_NOPS; ++op) {
+		stats_summary sm;
+		stats_collect(op, &sm);
+
+		unsigned long io = 0;
+		for(uint32 i = 0; i < BENCH_NOPS; ++i)
+			io += (op < 0 || (uint32) op == i) ? io_errors[i] : 0;
+
+		fprintf(f, "%s,%s,%u,%.0f,%.3f,%u:%u:%u,%u,%.3f,%d,%s,%lu,%.1f", g_conf.label,
+				g_conf.rate ? "open" : "closed", g_conf.threads, g_conf.rate, secs,
+				g_conf.mix[BENCH_OP_GET], g_conf.mix[BENCH_OP_BOOK], g_conf.mix[BENCH_OP_REVOKE],
+				g_conf.seats, g_conf.zipf, g_conf.keepalive, op < 0 ? "all" : g_op_names[op],
+				sm.requests, sm.requests / secs);
+		for(uint32 r = 0; r < STATS_NRESULTS; ++r)
+			fprintf(f, ",%lu", sm.results[r]);
+		fprintf(f, ",%lu,%.2f,%.2f,%.2f,%.2f,%.2f\n", io, sm.mean_us, sm.p50_us, sm.p99_us, sm.p999_us, sm.max_us);
+	}
+
+	fclose(f);
+}
+
+int main(int argc, char** argv) {
+	ushort16 port = DEFAULT_PORT;
+	char* host = "127.0.0.1";
+	const char* mix = DEFAULT_MIX;
+
+	for(int i = 0; i < argc; ++i) {
+		if(arg(argv[i], "--host", "-h")) {
+			int i_plus_one;
+			value_check(i_plus_one, i, argv[i]);
+			i = i_plus_one;
+			host = argv[i_plus_one];
+
+		} else if(arg(argv[i], "--port", "-p")) {
+			ulong64 r;
+			get_ullong_value_for_option(argv, &r, i);
+			port = (ushort16) r;
+
+		} else if(arg(argv[i], "--show", "-s")) {
+			ulong64 r;
+			get_ullong_value_for_option(argv, &r, i);
+			select_show((uint32) r);
+
+		} else if(arg(argv[i], "--threads", "-t")) {
+			ulong64 r;
+			get_ullong_value_for_option(argv, &r, i);
+			g_conf.threads = (uint32) r;
+
+		} else if(arg(argv[i], "--duration", "-d")) {
+			ulong64 r;
+			get_ullong_value_for_option(argv, &r, i);
+			g_conf.duration = (uint32) r;
+
+		} else if(arg(argv[i], "--rows", "-r")) {
+			ulong64 r;
+			get_ullong_value_for_option(argv, &r, i);
+			g_conf.rows = (uint32) r;
+
+		} else if(arg(argv[i], "--pols", "-c")) {
+			ulong64 r;
+			get_ullong_value_for_option(argv, &r, i);
+			g_conf.pols = (uint32) r;
+
+		} else if(arg(argv[i], "--seats", "-n")) {
+			ulong64 r;
+			get_ullong_value_for_option(argv, &r, i);
+			g_conf.seats = (uint32) r;
+
+		} else if(arg(argv[i], "--mix", "-m")) {
+			int i_plus_one;
+			value_check(i_plus_one, i, argv[i]);
+			i = i_plus_one;
+			mix = argv[i_plus_one];
+
+		} else if(arg(argv[i], "--zipf", "-z")) {
+			int i_plus_one;
+			value_check(i_plus_one, i, argv[i]);
+			i = i_plus_one;
+			g_conf.zipf = strtod(argv[i_plus_one], NULL);
+
+		} else if(arg(argv[i], "--rate", "-a")) {
+			int i_plus_one;
+			value_check(i_plus_one, i, argv[i]);
+			i = i_plus_one;
+			g_conf.rate = strtod(argv[i_plus_one], NULL);
+
+		} else if(arg(argv[i], "--keep-alive", "-k")) {
+			g_conf.keepalive = 1;
+
+		} else if(arg(argv[i], "--csv", "-o")) {
+			int i_plus_one;
+			value_check(i_plus_one, i, argv[i]);
+			i = i_plus_one;
+			g_conf.csv_path = argv[i_plus_one];
+
+		} else if(arg(argv[i], "--label", "-L")) {
+			int i_plus_one;
+			value_check(i_plus_one, i, argv[i]);
+			i = i_plus_one;
+			g_conf.label = argv[i_plus_one];
+
+		} else {
+			if(i > 0)
+				printf("ignoring unrecognized option: %s\n", argv[i]);
+
+		}
+	}
+
+	if(sscanf(mix, "%u:%u:%u", &g_conf.mix[BENCH_OP_GET], &g_conf.mix[BENCH_OP_BOOK],
+				&g_conf.mix[BENCH_OP_REVOKE]) != 3) {
+		printf("%s: expected get:book:revoke weights\n", mix);
+		print_usage_exit(argv[0]);
+	}
+
+	g_conf.mix_total = g_conf.mix[BENCH_OP_GET] + g_conf.mix[BENCH_OP_BOOK] + g_conf.mix[BENCH_OP_REVOKE];
+
+	if(g_conf.rows == 0 || g_conf.pols == 0 || g_conf.threads == 0 || g_conf.duration == 0 ||
+			g_conf.mix_total == 0 || g_conf.seats == 0 || g_conf.seats > BENCH_MAX_SEATS ||
+			g_conf.seats > g_conf.rows * g_conf.pols || g_conf.zipf < 0 || g_conf.rate < 0)
+		print_usage_exit(argv[0]);
+
+	g_conf.addr = host_lookup(host, port);
+	if(g_conf.addr.sin_family == 0) {
+		printf("unable to resolve \"%s\"\n", host);
+		return EXIT_FAILURE;
+	}
+
+	if(g_conf.zipf > 0)
+		zipf_init(g_conf.rows * g_conf.pols, g_conf.zipf);
+
+	stats_init(g_op_names, BENCH_NOPS, NULL);
+
+	bench_worker* ws = (bench_worker*) calloc(g_conf.threads, sizeof(bench_worker));
+	if(ws == NULL)
+		exit(EXIT_FAILURE);
+
+	pthread_barrier_init(&g_start_barrier, NULL, g_conf.threads + 1);
+
+	for(uint32 i = 0; i < g_conf.threads; ++i) {
+		ws[i].id = i;
+		ws[i].sd = -1;
+		ws[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1) ^ (ulong64) time(NULL);
+		if(pthread_create(&ws[i].tid, NULL, bench_routine, &ws[i]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	g_start_ns = now_ns();
+	pthread_barrier_wait(&g_start_barrier);
+
+	unsigned long io_errors[BENCH_NOPS] = { 0 };
+	for(uint32 i = 0; i < g_conf.threads; ++i) {
+		pthread_join(ws[i].tid, NULL);
+
+		for(uint32 op = 0; op < BENCH_NOPS; ++op)
+			io_errors[op] += ws[i].io_errors[op];
+
+		free(ws[i].reply);
+		free(ws[i].codes);
+	}
+
+	double secs = (now_ns() - g_start_ns) / 1e9;
+
+	print_results(secs, io_errors);
+	if(g_conf.csv_path)
+		write_csv(secs, io_errors);
+
+	free(ws);
+	free(g_zipf_cdf);
+	pthread_barrier_destroy(&g_start_barrier);
+
+	return EXIT_SUCCESS;
+}